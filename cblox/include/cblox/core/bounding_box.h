@@ -0,0 +1,87 @@
+#ifndef CBLOX_CORE_BOUNDING_BOX_H_
+#define CBLOX_CORE_BOUNDING_BOX_H_
+
+#include <limits>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// An axis aligned bounding box. Default constructed boxes are empty.
+struct BoundingBox {
+  BoundingBox()
+      : min_corner(
+            Point::Constant(std::numeric_limits<FloatingPoint>::max())),
+        max_corner(
+            Point::Constant(std::numeric_limits<FloatingPoint>::lowest())) {}
+  BoundingBox(const Point& min_corner_in, const Point& max_corner_in)
+      : min_corner(min_corner_in), max_corner(max_corner_in) {}
+
+  bool isEmpty() const {
+    return (min_corner.array() > max_corner.array()).any();
+  }
+
+  // Growing the box to include a point or another box
+  void extend(const Point& point) {
+    min_corner = min_corner.cwiseMin(point);
+    max_corner = max_corner.cwiseMax(point);
+  }
+  void extend(const BoundingBox& other) {
+    if (!other.isEmpty()) {
+      extend(other.min_corner);
+      extend(other.max_corner);
+    }
+  }
+
+  bool contains(const Point& point) const {
+    return (point.array() >= min_corner.array()).all() &&
+           (point.array() <= max_corner.array()).all();
+  }
+  bool overlaps(const BoundingBox& other) const {
+    return !isEmpty() && !other.isEmpty() &&
+           (min_corner.array() <= other.max_corner.array()).all() &&
+           (other.min_corner.array() <= max_corner.array()).all();
+  }
+
+  // The distance from the point to the box (zero inside)
+  FloatingPoint distanceTo(const Point& point) const {
+    if (isEmpty()) {
+      return std::numeric_limits<FloatingPoint>::max();
+    }
+    return (point.cwiseMax(min_corner).cwiseMin(max_corner) - point).norm();
+  }
+
+  // The volume of the box (zero when empty)
+  FloatingPoint volume() const {
+    return isEmpty() ? 0.0 : (max_corner - min_corner).prod();
+  }
+  // The (possibly empty) box shared by both boxes
+  BoundingBox intersection(const BoundingBox& other) const {
+    return BoundingBox(min_corner.cwiseMax(other.min_corner),
+                       max_corner.cwiseMin(other.max_corner));
+  }
+
+  // The box enclosing this box after it has been transformed from frame A
+  // into frame B.
+  BoundingBox transformed(const Transformation& T_B_A) const {
+    BoundingBox box_B;
+    if (isEmpty()) {
+      return box_B;
+    }
+    for (int corner_index = 0; corner_index < 8; corner_index++) {
+      const Point corner_A(
+          (corner_index & 1) ? max_corner.x() : min_corner.x(),
+          (corner_index & 2) ? max_corner.y() : min_corner.y(),
+          (corner_index & 4) ? max_corner.z() : min_corner.z());
+      box_B.extend(T_B_A * corner_A);
+    }
+    return box_B;
+  }
+
+  Point min_corner;
+  Point max_corner;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_BOUNDING_BOX_H_
@@ -36,6 +36,10 @@ using AlignedDeque = std::deque<Type, Eigen::aligned_allocator<Type>>;
 
 // Containers of transforms
 typedef AlignedVector<Transformation> TransformationVector;
+typedef std::map<SubmapID, Transformation, std::less<SubmapID>,
+                 Eigen::aligned_allocator<
+                     std::pair<const SubmapID, Transformation>>>
+    SubmapPoseMap;
 
 // Taking some voxblox datatypes
 using voxblox::Pointcloud;
@@ -48,6 +52,13 @@ using voxblox::Layer;
 using voxblox::Block;
 using voxblox::TsdfVoxel;
 
+// A scan in the sensor frame (C), and the pose of the sensor.
+struct PosedScan {
+  Transformation T_G_C;
+  Pointcloud points_C;
+  Colors colors;
+};
+
 // Taking timing from voxblox
 namespace timing {
  using namespace voxblox::timing;
@@ -1,26 +1,148 @@
 #ifndef CBLOX_CORE_SUBMAP_COLLECTION_H_
 #define CBLOX_CORE_SUBMAP_COLLECTION_H_
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "./TsdfSubmapCollection.pb.h"
+#include "cblox/core/bounding_box.h"
 #include "cblox/core/common.h"
+#include "cblox/core/submap_pose_table.h"
+#include "cblox/core/submap_spatial_index.h"
+#include "cblox/core/submap_storage.h"
+#include "cblox/core/submap_traits.h"
+#include "cblox/core/tsdf_block_pool.h"
 #include "cblox/core/tsdf_esdf_submap.h"
+#include "cblox/utils/parallel_for.h"
+#include "cblox/utils/reader_writer_mutex.h"
 
 namespace cblox {
 
+// The side length of the spatial index cells, in blocks.
+constexpr FloatingPoint kSpatialIndexCellSizeBlocks = 8.0;
+
+// Paging of (finished) submaps to disk, to bound the memory used by the
+// collection. The least recently used submaps are paged out first.
+// Independently, finished submaps may be compressed in memory (see
+// TsdfSubmap::compress()), which fits several times more submaps in the budget.
+struct SubmapPagingConfig {
+  SubmapPagingConfig()
+      : enable_paging(false),
+        max_resident_memory_mb(4096.0),
+        page_directory("/tmp"),
+        compress_finished_submaps(false) {}
+  bool enable_paging;
+  // The memory budget for the blocks of the submaps in memory
+  double max_resident_memory_mb;
+  // Where the page files are written
+  std::string page_directory;
+  // Compression of the finished submaps, which are paged out compressed
+  bool compress_finished_submaps;
+  TsdfBlockEncodingConfig encoding_config;
+};
+
+struct SubmapPagingStats {
+  size_t num_resident_submaps = 0;
+  size_t num_compressed_submaps = 0;
+  size_t num_paged_out_submaps = 0;
+  size_t resident_memory_bytes = 0;
+  // Accesses to the submaps in memory (hits) and to paged out submaps, which
+  // are paged in (misses).
+  size_t num_hits = 0;
+  size_t num_page_ins = 0;
+  size_t num_page_outs = 0;
+  // Accesses to compressed submaps, which are decompressed
+  size_t num_decompressions = 0;
+};
+
+// Statistics of a call to SubmapCollection::fuseSubmapGroups()
+struct SubmapFusionStats {
+  size_t num_groups = 0;
+  // The submaps fused into the roots of their groups (and removed)
+  size_t num_fused_submaps = 0;
+  size_t num_fused_blocks = 0;
+  double duration_s = 0.0;
+  // The summed (single group) times, and the slowest group
+  double total_group_duration_s = 0.0;
+  double max_group_duration_s = 0.0;
+};
+
+// A collection of submaps.
+// NOTE: Concurrency model. The set of submaps (and which one is active) is
+//       guarded by a reader/writer lock, held only for the duration of each
+//       call. The submaps are handed out as shared pointers, which act as
+//       snapshot handles: a submap removed (e.g. fused) from the collection
+//       stays valid while handles to it exist. Each submap guards its own TSDF,
+//       such that background readers (meshing, saving, planning) run
+//       concurrently with integration into the active submap. Inactive submaps
+//       are frozen and read without locks (see
+//       TsdfSubmap::getTsdfReaderLock()), except those made writable for
+//       revisit integration (see getWritableSubMapPtr()).
 template <typename SubmapType>
 class SubmapCollection {
  public:
   typedef std::shared_ptr<SubmapCollection> Ptr;
   typedef std::shared_ptr<const SubmapCollection> ConstPtr;
+  typedef std::function<void(const typename SubmapType::Ptr &)>
+      SubmapFinishedCallback;
+  typedef SubmapStorage<typename SubmapType::Ptr> Storage;
+
+  // A read-only view of the submaps, in ID order, which holds the collection
+  // (reader) lock for its lifetime. Iterating it doesn't allocate.
+  // NOTE: Keep views short lived, and don't call functions of the collection
+  //       while holding one (see ReaderWriterMutex). Hold on to the submap
+  //       pointers instead for longer work.
+  class ConstSubmapView {
+   public:
+    class const_iterator {
+     public:
+      explicit const_iterator(const typename Storage::const_iterator &it)
+          : it_(it) {}
+      const SubmapType &operator*() const { return *(it_->second); }
+      const SubmapType *operator->() const { return it_->second.get(); }
+      SubmapID getID() const { return it_->first; }
+      typename SubmapType::ConstPtr getPtr() const { return it_->second; }
+      const_iterator &operator++() {
+        ++it_;
+        return *this;
+      }
+      bool operator==(const const_iterator &other) const {
+        return it_ == other.it_;
+      }
+      bool operator!=(const const_iterator &other) const {
+        return it_ != other.it_;
+      }
+
+     private:
+      typename Storage::const_iterator it_;
+    };
+
+    ConstSubmapView(ReaderLock &&lock, const Storage &storage)
+        : lock_(std::move(lock)), storage_(&storage) {}
+
+    const_iterator begin() const { return const_iterator(storage_->begin()); }
+    const_iterator end() const { return const_iterator(storage_->end()); }
+    size_t size() const { return storage_->size(); }
+    bool empty() const { return storage_->empty(); }
+
+   private:
+    ReaderLock lock_;
+    const Storage *storage_;
+  };
 
   // Constructor. Constructs an empty submap collection map
   explicit SubmapCollection(const typename SubmapType::Config &submap_config)
-      : submap_config_(submap_config) {}
+      : submap_config_(submap_config),
+        active_submap_id_(0),
+        spatial_index_(getSpatialIndexCellSize(submap_config)),
+        block_pool_(createBlockPool(submap_config)) {}
 
   // Constructor. Constructs a submap collection from a list of submaps
   SubmapCollection(const typename SubmapType::Config &submap_config,
@@ -28,6 +150,7 @@ class SubmapCollection {
 
   // Gets a vector of the linked IDs
   std::vector<SubmapID> getIDs() const;
+  void getIDs(std::vector<SubmapID> *submap_ids) const;
   bool exists(const SubmapID submap_id) const;
 
   // Creates a new submap on the top of the collection
@@ -37,7 +160,23 @@ class SubmapCollection {
   void createNewSubMap(const Transformation &T_G_S, const SubmapID submap_id);
   SubmapID createNewSubMap(const Transformation &T_G_S);
 
-  // Create a new submap which duplicates an existing source submap
+  // Adds existing submaps (e.g. loaded from file), without activating them.
+  // Returns false, adding none of them, if any of their IDs is taken.
+  // NOTE: Adding submaps doesn't call the finished callbacks, and leaves the
+  //       active submap as it is.
+  bool addSubMap(const typename SubmapType::Ptr &submap_ptr);
+  bool addSubMaps(const std::vector<typename SubmapType::Ptr> &submap_ptrs);
+  // Adds the submaps, replacing those with the same IDs, and removes submaps
+  // by ID (e.g. to mirror another collection). Returns the number removed.
+  // NOTE: As for fusion, readers holding a pointer to a replaced or removed
+  //       submap may keep reading it.
+  void replaceSubMaps(
+      const std::vector<typename SubmapType::Ptr> &submap_ptrs);
+  size_t removeSubMaps(const std::vector<SubmapID> &submap_ids);
+
+  // Create a new submap which duplicates an existing source submap. The
+  // duplicate is frozen, and shares the layers derived from the TSDF (see
+  // SubmapTraits::shareDerivedLayers()).
   bool duplicateSubMap(const SubmapID source_submap_id,
                        const SubmapID new_submap_id);
 
@@ -45,19 +184,30 @@ class SubmapCollection {
   // NOTE(alexmillane): This function hard fails when the submap doesn't
   // exist... This puts the onus on the caller to call exists() first. I don't
   // like this but I can't see a solution.
+  // NOTE: The reference is only valid while the submap is part of the
+  //       collection. Concurrent code should use the pointer versions below.
   const SubmapType &getSubMap(const SubmapID submap_id) const;
   // Note(alexmillane): Unlike the above this function returns a nullptr when
   // the map doesn't exist. No hard crash.
   typename SubmapType::ConstPtr getSubMapConstPtrById(
       const SubmapID submap_id) const;
   // A list of the submaps
+  // NOTE: The versions taking an output vector reuse its memory, so don't
+  //       allocate when called repeatedly (e.g. per frame) with the same
+  //       vector.
   const std::vector<typename SubmapType::Ptr> getSubMapPtrs() const;
   const std::vector<typename SubmapType::ConstPtr> getSubMapConstPtrs() const;
+  void getSubMapConstPtrs(
+      std::vector<typename SubmapType::ConstPtr> *submap_ptrs) const;
+  // Allocation free iteration over the submaps (see ConstSubmapView)
+  ConstSubmapView getSubMapView() const;
 
   // Interactions with the active submap
+  // NOTE: The collection keeps a handle to the active submap, so these don't
+  //       search the storage.
   const SubmapType &getActiveSubMap() const;
   typename SubmapType::Ptr getActiveSubMapPtr();
-  const Transformation &getActiveSubMapPose() const;
+  Transformation getActiveSubMapPose() const;
   const SubmapID getActiveSubMapID() const;
 
   // Access the tsdf_map member of the active submap
@@ -66,22 +216,117 @@ class SubmapCollection {
 
   // Activate a submap
   // NOTE(alexmillane): Note that creating a new submap automatically activates it.
+  // NOTE: The previously active submap is frozen. Activating a frozen submap
+  //       replaces it with a writable copy.
   void activateSubMap(const SubmapID submap_id);
 
+  // Writable access to a submap other than the active one (e.g. to integrate
+  // into a revisited submap). Returns nullptr if the submap doesn't exist.
+  // NOTE: As for activateSubMap(), a frozen submap is replaced by a writable
+  //       copy. The caller flags its changes with markSubmapModified(), and
+  //       hands the submap back with finishWritableSubMap(), which freezes it
+  //       again and calls the finished callbacks.
+  typename SubmapType::Ptr getWritableSubMapPtr(const SubmapID submap_id);
+  void finishWritableSubMap(const typename SubmapType::Ptr &submap_ptr);
+
+  // Paging of submaps to disk. Once enabled, the memory budget is enforced
+  // each time a submap is finished.
+  void setPagingConfig(const SubmapPagingConfig &paging_config);
+  // Compresses the finished submaps (if enabled), then pages out the least
+  // recently used submaps until the collection fits its memory budget.
+  // Submaps currently held (e.g. being read) elsewhere are skipped.
+  // NOTE: The submaps are encoded (compressed) and their page files written
+  //       without the collection lock, which is only taken to select them and
+  //       then again to drop their blocks.
+  void enforceMemoryBudget();
+  SubmapPagingStats getPagingStats() const;
+
+  // Recycling of blocks. The blocks freed by submaps (destroyed, paged out or
+  // compressed) are kept, up to max_pooled_blocks, and reused for the blocks
+  // the collection allocates (decompression, copies of frozen submaps and
+  // fusion). Off (zero) by default.
+  // NOTE: The pooled blocks don't count towards the memory budget of the
+  //       paging.
+  // NOTE: Not (yet) the blocks allocated by integration, which is where most
+  //       blocks are allocated. The voxblox integrators allocate their blocks
+  //       internally, so integration would need its own integrators to draw
+  //       from the pool. Until then the pool only pays off with paging or
+  //       compression cycling submaps in and out.
+  void setBlockPoolCapacity(const size_t max_pooled_blocks);
+  TsdfBlockPoolStats getBlockPoolStats() const;
+
+  // Registers a function called with each submap which is finished, i.e. stops
+  // being the active submap (through createNewSubMap() or activateSubMap()).
+  // NOTE: Called outside of the collection lock, on the thread changing the
+  //       active submap, so should be quick (e.g. to queue background work).
+  // Returns an ID with which the callback is removed again, which owners of
+  // callbacks referring to them should do before the collection outlives them.
+  // NOTE: A call already in flight on another thread may still complete after
+  //       the removal.
+  size_t addSubmapFinishedCallback(const SubmapFinishedCallback &callback);
+  void removeSubmapFinishedCallback(const size_t callback_id);
+
   // Interacting with the submap poses
+  // NOTE: The collection keeps a table of the poses (see SubmapPoseTable),
+  //       which the getters read, so they don't lock the submaps.
+  //       setSubMapPoses() expects the poses in ascending ID order, prefer
+  //       updatePoses().
   bool setSubMapPose(const SubmapID submap_id, const Transformation &pose);
   void setSubMapPoses(const TransformationVector &transforms);
   bool getSubMapPose(const SubmapID submap_id, Transformation *pose_ptr) const;
   void getSubMapPoses(TransformationVector* submap_poses) const;
 
+  // Sets the poses of many submaps (e.g. after a pose graph optimization) at
+  // once. Readers of the pose table see either all or none of the new poses.
+  // Returns the number of submaps found.
+  size_t updatePoses(const SubmapPoseMap &T_G_S_map);
+
+  // A consistent snapshot of the poses (and inverse poses) of all submaps,
+  // taken without locking the collection or the submaps.
+  SubmapPoseTable::ConstPtr getPoseTable() const;
+
+  // Spatial queries, using the bounding boxes of the allocated blocks of the
+  // submaps in the global frame (G). The IDs are returned in ascending order.
+  // NOTE: The index is brought up to date lazily, at query time. Changes made
+  //       through the collection, and integration into the active submap, are
+  //       picked up automatically. Code that modifies the TSDF of other submaps
+  //       through a pointer has to call markSubmapModified() afterwards.
+  void getSubmapsOverlapping(const BoundingBox &box_G,
+                             std::vector<SubmapID> *submap_ids) const;
+  void getSubmapsContaining(const Point &point_G,
+                            std::vector<SubmapID> *submap_ids) const;
+  void markSubmapModified(const SubmapID submap_id) const;
+
+  // Batched distance queries in the global frame (G). The ESDFs of all submaps
+  // containing a point are fused, weighted by the submaps' TSDF weights.
+  // observed[i] is false where no submap has data for the i-th point.
+  // NOTE: Only available for submap types with an ESDF layer (see
+  //       SubmapTraits). Only submaps with a generated ESDF (isEsdfReady())
+  //       take part, which normally excludes the active submap.
+  void getDistancesAtPositions(const Pointcloud &points_G,
+                               const bool interpolate,
+                               std::vector<FloatingPoint> *distances,
+                               std::vector<bool> *observed) const;
+  void getDistancesAndGradientsAtPositions(
+      const Pointcloud &points_G, const bool interpolate,
+      std::vector<FloatingPoint> *distances, Pointcloud *gradients_G,
+      std::vector<bool> *observed) const;
+
   // Clears the collection, leaving an empty map
-  void clear() { id_to_submap_.clear(); }
+  void clear();
 
   // Size information
-  bool empty() const { return id_to_submap_.empty(); }
-  size_t size() const { return id_to_submap_.size(); }
-  size_t num_patches() const { return id_to_submap_.size(); }
+  bool empty() const {
+    const ReaderLock collection_lock(&collection_mutex_);
+    return id_to_submap_.empty();
+  }
+  size_t size() const {
+    const ReaderLock collection_lock(&collection_mutex_);
+    return id_to_submap_.size();
+  }
+  size_t num_patches() const { return size(); }
   FloatingPoint block_size() const {
+    const ReaderLock collection_lock(&collection_mutex_);
     return (id_to_submap_.begin()->second)->block_size();
   }
   size_t getNumberAllocatedBlocks() const;
@@ -91,27 +336,120 @@ class SubmapCollection {
     return submap_config_;
   }
 
-  // Save the collection to file
-  bool saveToFile(const std::string &file_path) const;
+  // Save the collection to file, in the indexed format (see io/submap_file.h)
+  // NOTE: The submaps are serialized over num_threads, while being written to
+  //       file.
+  bool saveToFile(const std::string &file_path,
+                  const size_t num_threads = getDefaultNumThreads()) const;
   void getProto(TsdfSubmapCollectionProto *proto) const;
 
   // Fusing the submap pairs
   void fuseSubmapPair(const SubmapIdPair &submap_id_pair);
+  // Fuses the groups of submaps connected by the pairs (e.g. chains or
+  // triangles of loop closures), each into a single (root) submap. The root is
+  // the active submap if part of the group, otherwise the submap with the
+  // lowest ID. The groups are fused in parallel, and the blocks within each
+  // group over the remaining threads. The collection is only locked to find
+  // the submaps and to swap in the results, not while fusing.
+  SubmapFusionStats fuseSubmapGroups(
+      const std::vector<SubmapIdPair> &submap_id_pairs,
+      const size_t num_threads = getDefaultNumThreads());
 
   // Flattens the collection map down to a normal TSDF map
   TsdfMap::Ptr getProjectedMap() const;
 
  private:
-  // TODO(alexmillane): Get some concurrency guards
+  // Adds a submap and makes it active. Call with the writer lock held.
+  // Returns the submap which was finished by this (if any).
+  typename SubmapType::Ptr addNewSubMap(const Transformation &T_G_S,
+                                        const SubmapID submap_id);
+  // Freezes the active submap and returns it (if any). Call with the writer
+  // lock held.
+  typename SubmapType::Ptr deactivateActiveSubMap();
+  // Calls the submap finished callbacks and enforces the memory budget. Call
+  // without the lock held.
+  void notifySubmapFinished(
+      const typename SubmapType::Ptr &finished_submap_ptr);
+  // Points the active submap handle at the entry of the active ID (or at
+  // nothing). Call with the writer lock held, after changing the storage or
+  // the active ID.
+  void updateActiveSubMapHandle();
+  // Rebuilds the pose table from the submaps. Call with the writer lock held,
+  // after adding or removing submaps.
+  void updatePoseTable();
+  // Creates a (not frozen) copy of a submap, with a new ID
+  typename SubmapType::Ptr copySubMap(const SubmapType &source_submap,
+                                      const SubmapID new_submap_id) const;
+
+  // The pool of the blocks of the submaps of this collection
+  static TsdfBlockPool::Ptr createBlockPool(
+      const typename SubmapType::Config &submap_config) {
+    constexpr size_t kMaxPooledBlocks = 0;
+    return std::make_shared<TsdfBlockPool>(submap_config.tsdf_voxel_size,
+                                           submap_config.tsdf_voxels_per_side,
+                                           kMaxPooledBlocks);
+  }
+  // Hands the pool to a submap created elsewhere (if it has none)
+  void shareBlockPool(SubmapType *submap_ptr) const;
+
+  // Spatial index functions
+  static FloatingPoint getSpatialIndexCellSize(
+      const typename SubmapType::Config &submap_config) {
+    return submap_config.tsdf_voxel_size * submap_config.tsdf_voxels_per_side *
+           kSpatialIndexCellSizeBlocks;
+  }
+  // Re-indexes the submaps flagged as modified. Call with the collection
+  // (reader) lock and the index mutex held.
+  void updateSpatialIndex() const;
+
+  // Implements the distance queries. The gradients are optional (nullptr).
+  void fuseDistancesAtPositions(const Pointcloud &points_G,
+                                const bool interpolate,
+                                std::vector<FloatingPoint> *distances,
+                                Pointcloud *gradients_G,
+                                std::vector<bool> *observed) const;
 
   // The config used for the patches
   typename SubmapType::Config submap_config_;
 
-  // The active SubmapID
+  // The active SubmapID, and the active submap (if it exists)
   SubmapID active_submap_id_;
+  typename SubmapType::Ptr active_submap_ptr_;
 
   // Submap storage and access
-  std::map<SubmapID, typename SubmapType::Ptr> id_to_submap_;
+  Storage id_to_submap_;
+
+  // Guards the submap storage and the active submap
+  mutable ReaderWriterMutex collection_mutex_;
+
+  // Serializes fuseSubmapGroups(), which fuses without the collection lock
+  std::mutex fusion_mutex_;
+
+  // Called when submaps are finished
+  mutable std::mutex submap_finished_callbacks_mutex_;
+  std::vector<std::pair<size_t, SubmapFinishedCallback>>
+      submap_finished_callbacks_;
+  size_t next_submap_finished_callback_id_ = 0;
+
+  // Paging (guarded by the collection lock)
+  std::string getPageFilePath(const SubmapID submap_id) const;
+  SubmapPagingConfig paging_config_;
+  size_t num_page_outs_ = 0;
+
+  // The spatial index over the submap bounding boxes, the submaps which (may)
+  // have changed since they were last indexed, and the submap stamps (TSDF,
+  // pose) at which they were indexed.
+  mutable std::mutex spatial_index_mutex_;
+  mutable SubmapSpatialIndex spatial_index_;
+  mutable std::set<SubmapID> spatial_index_dirty_ids_;
+  mutable std::map<SubmapID, std::pair<size_t, size_t>>
+      spatial_index_versions_;
+
+  // The poses of the submaps (internally synchronized)
+  SubmapPoseTableBuffer pose_table_;
+
+  // Recycles the blocks of the submaps (internally synchronized)
+  const TsdfBlockPool::Ptr block_pool_;
 };
 
 }  // namespace cblox
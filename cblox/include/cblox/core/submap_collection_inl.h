@@ -1,15 +1,26 @@
 #ifndef CBLOX_CORE_SUBMAP_COLLECTION_INL_H_
 #define CBLOX_CORE_SUBMAP_COLLECTION_INL_H_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <glog/logging.h>
+#include <unistd.h>
 
 #include <voxblox/integrator/merge_integration.h>
+#include <voxblox/interpolator/interpolator.h>
 #include <voxblox/utils/protobuf_utils.h>
 #include "cblox/core/tsdf_submap.h"
+#include "cblox/integrator/tsdf_layer_fusion.h"
+#include "cblox/io/serialize_submaps.h"
+#include "cblox/io/submap_file.h"
+#include "cblox/utils/bounding_box_protobuf_utils.h"
+#include "cblox/utils/union_find.h"
 
 namespace cblox {
 
@@ -17,28 +28,45 @@ template <typename SubmapType>
 SubmapCollection<SubmapType>::SubmapCollection(
     const typename SubmapType::Config& submap_config,
     const std::vector<typename SubmapType::Ptr>& tsdf_sub_maps)
-    : submap_config_(submap_config) {
+    : submap_config_(submap_config),
+      active_submap_id_(0),
+      spatial_index_(getSpatialIndexCellSize(submap_config)),
+      block_pool_(createBlockPool(submap_config)) {
   // Constructing from a list of existing submaps
   // NOTE(alexmillane): assigning arbitrary SubmapIDs
   SubmapID submap_id = 0;
   for (const auto& tsdf_submap_ptr : tsdf_sub_maps) {
+    shareBlockPool(tsdf_submap_ptr.get());
     id_to_submap_[submap_id] = tsdf_submap_ptr;
+    markSubmapModified(submap_id);
     submap_id++;
   }
+  updateActiveSubMapHandle();
+  updatePoseTable();
 }
 
 template <typename SubmapType>
 std::vector<SubmapID> SubmapCollection<SubmapType>::getIDs() const {
   std::vector<SubmapID> submap_ids;
-  submap_ids.reserve(id_to_submap_.size());
+  getIDs(&submap_ids);
+  return submap_ids;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getIDs(
+    std::vector<SubmapID>* submap_ids) const {
+  CHECK_NOTNULL(submap_ids);
+  const ReaderLock collection_lock(&collection_mutex_);
+  submap_ids->clear();
+  submap_ids->reserve(id_to_submap_.size());
   for (const auto& id_submap_pair : id_to_submap_) {
-    submap_ids.emplace_back(id_submap_pair.first);
+    submap_ids->push_back(id_submap_pair.first);
   }
-  return submap_ids;
 }
 
 template <typename SubmapType>
 bool SubmapCollection<SubmapType>::exists(const SubmapID submap_id) const {
+  const ReaderLock collection_lock(&collection_mutex_);
   // Searching for the passed submap ID
   const auto it = id_to_submap_.find(submap_id);
   return (it != id_to_submap_.end());
@@ -47,6 +75,102 @@ bool SubmapCollection<SubmapType>::exists(const SubmapID submap_id) const {
 template <typename SubmapType>
 void SubmapCollection<SubmapType>::createNewSubMap(const Transformation& T_G_S,
                                                    const SubmapID submap_id) {
+  typename SubmapType::Ptr finished_submap_ptr;
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    finished_submap_ptr = addNewSubMap(T_G_S, submap_id);
+  }
+  notifySubmapFinished(finished_submap_ptr);
+}
+
+template <typename SubmapType>
+bool SubmapCollection<SubmapType>::addSubMap(
+    const typename SubmapType::Ptr& submap_ptr) {
+  return addSubMaps(std::vector<typename SubmapType::Ptr>(1, submap_ptr));
+}
+
+template <typename SubmapType>
+bool SubmapCollection<SubmapType>::addSubMaps(
+    const std::vector<typename SubmapType::Ptr>& submap_ptrs) {
+  const WriterLock collection_lock(collection_mutex_);
+  // Checking all IDs first, such that either all submaps are added or none
+  std::set<SubmapID> new_submap_ids;
+  for (const typename SubmapType::Ptr& submap_ptr : submap_ptrs) {
+    CHECK(submap_ptr);
+    const SubmapID submap_id = submap_ptr->getID();
+    if (id_to_submap_.count(submap_id) > 0 ||
+        !new_submap_ids.insert(submap_id).second) {
+      LOG(ERROR) << "Could not add the submaps. A submap with ID "
+                 << submap_id << " already exists.";
+      return false;
+    }
+  }
+  for (const typename SubmapType::Ptr& submap_ptr : submap_ptrs) {
+    const SubmapID submap_id = submap_ptr->getID();
+    shareBlockPool(submap_ptr.get());
+    id_to_submap_.emplace(submap_id, submap_ptr);
+    markSubmapModified(submap_id);
+  }
+  // NOTE: The active submap (if any) stays as it is. The added submaps can't
+  //       replace it, as their IDs are new.
+  updatePoseTable();
+  return true;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::replaceSubMaps(
+    const std::vector<typename SubmapType::Ptr>& submap_ptrs) {
+  const WriterLock collection_lock(collection_mutex_);
+  for (const typename SubmapType::Ptr& submap_ptr : submap_ptrs) {
+    CHECK(submap_ptr);
+    const SubmapID submap_id = submap_ptr->getID();
+    shareBlockPool(submap_ptr.get());
+    id_to_submap_[submap_id] = submap_ptr;
+    markSubmapModified(submap_id);
+  }
+  updateActiveSubMapHandle();
+  updatePoseTable();
+}
+
+template <typename SubmapType>
+size_t SubmapCollection<SubmapType>::removeSubMaps(
+    const std::vector<SubmapID>& submap_ids) {
+  const WriterLock collection_lock(collection_mutex_);
+  size_t num_removed = 0;
+  for (const SubmapID submap_id : submap_ids) {
+    if (id_to_submap_.erase(submap_id) > 0) {
+      markSubmapModified(submap_id);
+      num_removed++;
+    }
+  }
+  if (num_removed > 0) {
+    updateActiveSubMapHandle();
+    updatePoseTable();
+  }
+  return num_removed;
+}
+
+template <typename SubmapType>
+SubmapID SubmapCollection<SubmapType>::createNewSubMap(
+    const Transformation& T_G_S) {
+  typename SubmapType::Ptr finished_submap_ptr;
+  SubmapID new_ID = 0;
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    // Creating a submap with a generated SubmapID
+    // NOTE(alexmillane): rbegin() returns the pair with the highest key.
+    if (!id_to_submap_.empty()) {
+      new_ID = id_to_submap_.rbegin()->first + 1;
+    }
+    finished_submap_ptr = addNewSubMap(T_G_S, new_ID);
+  }
+  notifySubmapFinished(finished_submap_ptr);
+  return new_ID;
+}
+
+template <typename SubmapType>
+typename SubmapType::Ptr SubmapCollection<SubmapType>::addNewSubMap(
+    const Transformation& T_G_S, const SubmapID submap_id) {
   // Checking if the submap already exists
   // NOTE(alexmillane): This hard fails the program if the submap already
   // exists. This is fairly brittle behaviour and we may want to change it at a
@@ -57,44 +181,355 @@ void SubmapCollection<SubmapType>::createNewSubMap(const Transformation& T_G_S,
   // Creating the new submap and adding it to the list
   typename SubmapType::Ptr tsdf_sub_map(
       new SubmapType(T_G_S, submap_id, submap_config_));
-  id_to_submap_.emplace(submap_id, std::move(tsdf_sub_map));
+  tsdf_sub_map->setBlockPool(block_pool_);
+  // The currently active submap is finished
+  typename SubmapType::Ptr finished_submap_ptr = deactivateActiveSubMap();
+  id_to_submap_.emplace(submap_id, tsdf_sub_map);
+  markSubmapModified(submap_id);
+  // New submaps usually have the highest ID, so go at the end of the table
+  if (id_to_submap_.rbegin()->first == submap_id) {
+    pose_table_.update([&T_G_S, submap_id](SubmapPoseTable* pose_table) {
+      pose_table->append(submap_id, T_G_S);
+    });
+  } else {
+    updatePoseTable();
+  }
   // Updating the active submap
   active_submap_id_ = submap_id;
+  active_submap_ptr_ = std::move(tsdf_sub_map);
+  return finished_submap_ptr;
 }
 
 template <typename SubmapType>
-SubmapID SubmapCollection<SubmapType>::createNewSubMap(
-    const Transformation& T_G_S) {
-  // Creating a submap with a generated SubmapID
-  // NOTE(alexmillane): rbegin() returns the pair with the highest key.
-  SubmapID new_ID = 0;
-  if (!id_to_submap_.empty()) {
-    new_ID = id_to_submap_.rbegin()->first + 1;
+typename SubmapType::Ptr
+SubmapCollection<SubmapType>::deactivateActiveSubMap() {
+  if (!active_submap_ptr_) {
+    return typename SubmapType::Ptr();
   }
-  createNewSubMap(T_G_S, new_ID);
-  return new_ID;
+  active_submap_ptr_->freeze();
+  // No longer re-checked by the spatial index automatically
+  markSubmapModified(active_submap_id_);
+  return active_submap_ptr_;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::updateActiveSubMapHandle() {
+  const auto it = id_to_submap_.find(active_submap_id_);
+  if (it == id_to_submap_.end()) {
+    active_submap_ptr_.reset();
+  } else {
+    active_submap_ptr_ = it->second;
+  }
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::updatePoseTable() {
+  pose_table_.update([this](SubmapPoseTable* pose_table) {
+    pose_table->clear();
+    pose_table->reserve(id_to_submap_.size());
+    for (const auto& id_submap_pair : id_to_submap_) {
+      pose_table->append(id_submap_pair.first,
+                         id_submap_pair.second->getPose());
+    }
+  });
+}
+
+template <typename SubmapType>
+size_t SubmapCollection<SubmapType>::addSubmapFinishedCallback(
+    const SubmapFinishedCallback& callback) {
+  std::lock_guard<std::mutex> callbacks_lock(submap_finished_callbacks_mutex_);
+  const size_t callback_id = next_submap_finished_callback_id_++;
+  submap_finished_callbacks_.emplace_back(callback_id, callback);
+  return callback_id;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::removeSubmapFinishedCallback(
+    const size_t callback_id) {
+  std::lock_guard<std::mutex> callbacks_lock(submap_finished_callbacks_mutex_);
+  submap_finished_callbacks_.erase(
+      std::remove_if(
+          submap_finished_callbacks_.begin(), submap_finished_callbacks_.end(),
+          [callback_id](
+              const std::pair<size_t, SubmapFinishedCallback>& id_callback) {
+            return id_callback.first == callback_id;
+          }),
+      submap_finished_callbacks_.end());
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::notifySubmapFinished(
+    const typename SubmapType::Ptr& finished_submap_ptr) {
+  if (!finished_submap_ptr) {
+    return;
+  }
+  std::vector<std::pair<size_t, SubmapFinishedCallback>> callbacks;
+  {
+    std::lock_guard<std::mutex> callbacks_lock(
+        submap_finished_callbacks_mutex_);
+    callbacks = submap_finished_callbacks_;
+  }
+  for (const auto& id_callback : callbacks) {
+    id_callback.second(finished_submap_ptr);
+  }
+  // The collection grew by a finished submap
+  enforceMemoryBudget();
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::setPagingConfig(
+    const SubmapPagingConfig& paging_config) {
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    paging_config_ = paging_config;
+  }
+  enforceMemoryBudget();
+}
+
+template <typename SubmapType>
+std::string SubmapCollection<SubmapType>::getPageFilePath(
+    const SubmapID submap_id) const {
+  // NOTE: Made unique over processes and collections, such that several mappers
+  //       may share a page directory.
+  static std::atomic<size_t> page_file_count(0);
+  return paging_config_.page_directory + "/cblox_page_" +
+         std::to_string(::getpid()) + "_" + std::to_string(page_file_count++) +
+         "_submap_" + std::to_string(submap_id) + ".tsdf";
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::enforceMemoryBudget() {
+  // The submaps to page out, and the (not yet written) files they go to
+  struct PageOutCandidate {
+    SubmapID submap_id;
+    std::weak_ptr<SubmapType> submap_weak_ptr;
+    std::string page_file_path;
+  };
+  std::vector<PageOutCandidate> candidates;
+  size_t max_resident_memory_bytes = 0;
+  size_t resident_memory_bytes = 0;
+  // Compressing. As for paging, the blocks are encoded without the lock,
+  // which is then only taken to swap the encodings in.
+  // NOTE: Submaps decompressed by an access since the last call are compressed
+  //       again.
+  std::vector<std::weak_ptr<SubmapType>> compression_candidates;
+  TsdfBlockEncodingConfig encoding_config;
+  {
+    const ReaderLock collection_lock(&collection_mutex_);
+    if (paging_config_.compress_finished_submaps) {
+      encoding_config = paging_config_.encoding_config;
+      for (const auto& id_submap_pair : id_to_submap_) {
+        const typename SubmapType::Ptr& submap_ptr = id_submap_pair.second;
+        if (id_submap_pair.first != active_submap_id_ &&
+            submap_ptr->isFrozen() && !submap_ptr->isPagedOut() &&
+            !submap_ptr->isCompressed()) {
+          compression_candidates.push_back(submap_ptr);
+        }
+      }
+    }
+  }
+  std::vector<
+      std::pair<typename SubmapType::Ptr, typename SubmapType::EncodedTsdf>>
+      encoded_submaps;
+  for (const std::weak_ptr<SubmapType>& candidate : compression_candidates) {
+    typename SubmapType::Ptr submap_ptr = candidate.lock();
+    typename SubmapType::EncodedTsdf encoded_tsdf;
+    if (submap_ptr && submap_ptr->encodeTsdf(encoding_config, &encoded_tsdf)) {
+      encoded_submaps.emplace_back(std::move(submap_ptr),
+                                   std::move(encoded_tsdf));
+    }
+  }
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    for (auto& submap_encoded_pair : encoded_submaps) {
+      const SubmapID submap_id = submap_encoded_pair.first->getID();
+      const auto it = id_to_submap_.find(submap_id);
+      // NOTE: Only submaps which are still in the collection, and which no one
+      //       but the collection (and us) holds, such that none are being read.
+      if (it == id_to_submap_.end() || submap_id == active_submap_id_ ||
+          it->second != submap_encoded_pair.first ||
+          submap_encoded_pair.first.use_count() > 2) {
+        continue;
+      }
+      it->second->compress(&submap_encoded_pair.second);
+    }
+    encoded_submaps.clear();
+    if (!paging_config_.enable_paging) {
+      return;
+    }
+    max_resident_memory_bytes = static_cast<size_t>(
+        paging_config_.max_resident_memory_mb * 1024.0 * 1024.0);
+    // Finding the memory used and the submaps which may be paged out
+    std::vector<std::pair<size_t, SubmapID>> access_stamp_id_pairs;
+    for (const auto& id_submap_pair : id_to_submap_) {
+      const SubmapType& submap = *(id_submap_pair.second);
+      resident_memory_bytes += submap.getResidentMemoryBytes();
+      if (id_submap_pair.first != active_submap_id_ && submap.isFrozen() &&
+          !submap.isPagedOut()) {
+        access_stamp_id_pairs.emplace_back(submap.getLastAccessStamp(),
+                                           id_submap_pair.first);
+      }
+    }
+    if (resident_memory_bytes <= max_resident_memory_bytes) {
+      return;
+    }
+    // Selecting the submaps to page out, least recently used first
+    std::sort(access_stamp_id_pairs.begin(), access_stamp_id_pairs.end());
+    size_t selected_memory_bytes = 0;
+    for (const std::pair<size_t, SubmapID>& access_stamp_id_pair :
+         access_stamp_id_pairs) {
+      if (resident_memory_bytes - selected_memory_bytes <=
+          max_resident_memory_bytes) {
+        break;
+      }
+      const typename SubmapType::Ptr& submap_ptr =
+          id_to_submap_.at(access_stamp_id_pair.second);
+      if (submap_ptr.use_count() > 1) {
+        continue;
+      }
+      selected_memory_bytes += submap_ptr->getResidentMemoryBytes();
+      candidates.push_back({submap_ptr->getID(), submap_ptr,
+                            getPageFilePath(submap_ptr->getID())});
+    }
+  }
+  // Writing the page files without the lock. Frozen submaps aren't modified,
+  // so this is safe while they are being read.
+  std::vector<PageOutCandidate> written_candidates;
+  written_candidates.reserve(candidates.size());
+  for (const PageOutCandidate& candidate : candidates) {
+    const typename SubmapType::Ptr submap_ptr =
+        candidate.submap_weak_ptr.lock();
+    if (submap_ptr && submap_ptr->writePageFile(candidate.page_file_path)) {
+      written_candidates.push_back(candidate);
+    }
+  }
+  // Dropping the blocks of the written submaps, which only takes a short lock
+  const WriterLock collection_lock(collection_mutex_);
+  for (const PageOutCandidate& candidate : written_candidates) {
+    const auto it = id_to_submap_.find(candidate.submap_id);
+    // NOTE: The submap may have been removed, or replaced (e.g. by a writable
+    //       copy), since it was selected. Owner-based comparison, as the weak
+    //       pointer may have expired.
+    if (it == id_to_submap_.end() ||
+        it->second.owner_before(candidate.submap_weak_ptr) ||
+        candidate.submap_weak_ptr.owner_before(it->second)) {
+      continue;
+    }
+    const typename SubmapType::Ptr& submap_ptr = it->second;
+    // NOTE: Frozen submaps are read without locks. As new pointers can't be
+    //       handed out while we hold the writer lock, a submap referenced only
+    //       by the collection is not being read.
+    if (submap_ptr.use_count() > 1 || submap_ptr->isPagedOut()) {
+      continue;
+    }
+    const size_t submap_memory_bytes = submap_ptr->getResidentMemoryBytes();
+    // The page file is current, so this only drops the blocks
+    if (submap_ptr->pageOut(candidate.page_file_path)) {
+      resident_memory_bytes -= std::min(resident_memory_bytes,
+                                        submap_memory_bytes);
+      num_page_outs_++;
+    }
+  }
+  if (resident_memory_bytes > max_resident_memory_bytes) {
+    LOG(WARNING) << "Submap collection exceeds its memory budget after paging: "
+                 << resident_memory_bytes / (1024 * 1024) << "MB of "
+                 << paging_config_.max_resident_memory_mb << "MB.";
+  }
+}
+
+template <typename SubmapType>
+SubmapPagingStats SubmapCollection<SubmapType>::getPagingStats() const {
+  const ReaderLock collection_lock(&collection_mutex_);
+  SubmapPagingStats paging_stats;
+  for (const auto& id_submap_pair : id_to_submap_) {
+    const SubmapType& submap = *(id_submap_pair.second);
+    if (submap.isPagedOut()) {
+      paging_stats.num_paged_out_submaps++;
+    } else {
+      paging_stats.num_resident_submaps++;
+    }
+    if (submap.isCompressed()) {
+      paging_stats.num_compressed_submaps++;
+    }
+    paging_stats.resident_memory_bytes += submap.getResidentMemoryBytes();
+    paging_stats.num_hits += submap.getNumAccesses() - submap.getNumPageIns();
+    paging_stats.num_page_ins += submap.getNumPageIns();
+    paging_stats.num_decompressions += submap.getNumDecompressions();
+  }
+  paging_stats.num_page_outs = num_page_outs_;
+  return paging_stats;
+}
+
+template <typename SubmapType>
+typename SubmapType::Ptr SubmapCollection<SubmapType>::copySubMap(
+    const SubmapType& source_submap, const SubmapID new_submap_id) const {
+  typename SubmapType::Ptr new_submap(
+      new SubmapType(source_submap.getPose(), new_submap_id, submap_config_));
+  new_submap->setBlockPool(block_pool_);
+  const ReaderLock source_tsdf_lock = source_submap.getTsdfReaderLock();
+  // Copying block by block, such that the copy reuses pooled blocks
+  const Layer<TsdfVoxel>& source_tsdf_layer =
+      source_submap.getTsdfMap().getTsdfLayer();
+  Layer<TsdfVoxel>* new_tsdf_layer_ptr =
+      new_submap->getTsdfMapPtr()->getTsdfLayerPtr();
+  voxblox::BlockIndexList block_indices;
+  source_tsdf_layer.getAllAllocatedBlocks(&block_indices);
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    const Block<TsdfVoxel>& source_block =
+        source_tsdf_layer.getBlockByIndex(block_index);
+    Block<TsdfVoxel>::Ptr block_ptr =
+        block_pool_->allocateBlockPtrByIndex(block_index, new_tsdf_layer_ptr);
+    for (size_t linear_index = 0; linear_index < source_block.num_voxels();
+         linear_index++) {
+      block_ptr->getVoxelByLinearIndex(linear_index) =
+          source_block.getVoxelByLinearIndex(linear_index);
+    }
+    block_ptr->set_has_data(source_block.has_data());
+  }
+  return new_submap;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::shareBlockPool(
+    SubmapType* submap_ptr) const {
+  CHECK_NOTNULL(submap_ptr);
+  if (!submap_ptr->getBlockPool()) {
+    submap_ptr->setBlockPool(block_pool_);
+  }
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::setBlockPoolCapacity(
+    const size_t max_pooled_blocks) {
+  block_pool_->setMaxPooledBlocks(max_pooled_blocks);
+}
+
+template <typename SubmapType>
+TsdfBlockPoolStats SubmapCollection<SubmapType>::getBlockPoolStats() const {
+  return block_pool_->getStats();
 }
 
 template <typename SubmapType>
 bool SubmapCollection<SubmapType>::duplicateSubMap(
     const SubmapID source_submap_id, const SubmapID new_submap_id) {
+  const WriterLock collection_lock(collection_mutex_);
   // Get pointer to the source submap
   const auto src_submap_ptr_it = id_to_submap_.find(source_submap_id);
   if (src_submap_ptr_it != id_to_submap_.end()) {
-    typename SubmapType::Ptr src_submap_ptr = src_submap_ptr_it->second;
-    // Create a new submap with the same pose and get its pointer
-    const Transformation T_G_S = src_submap_ptr->getPose();
-    // Creating the new submap and adding it to the list
-    typename SubmapType::Ptr new_tsdf_sub_map(
-        new SubmapType(T_G_S, new_submap_id, submap_config_));
-    // Reset the TsdfMap based on a copy of the source submap's TSDF layer
-    // TODO(victorr): Find a better way to do this, however with .reset(...) as
-    // below the new submap appears empty
-    // new_tsdf_sub_map->getTsdfMapPtr().reset(new
-    // TsdfMap(src_submap_ptr->getTsdfMap().getTsdfLayer()));
-    *(new_tsdf_sub_map->getTsdfMapPtr()) =
-        *(new TsdfMap(src_submap_ptr->getTsdfMap().getTsdfLayer()));
-    id_to_submap_.emplace(new_submap_id, new_tsdf_sub_map);
+    // Copying the TSDF block by block (reusing pooled blocks). As the TSDFs
+    // are identical, the copy takes over the layers derived from it (e.g. the
+    // ESDF) rather than copying them.
+    const SubmapType& src_submap = *(src_submap_ptr_it->second);
+    typename SubmapType::Ptr new_submap_ptr =
+        copySubMap(src_submap, new_submap_id);
+    SubmapTraits<SubmapType>::shareDerivedLayers(src_submap,
+                                                 new_submap_ptr.get());
+    // Only the active submap is written to
+    new_submap_ptr->freeze();
+    id_to_submap_.emplace(new_submap_id, std::move(new_submap_ptr));
+    markSubmapModified(new_submap_id);
+    updateActiveSubMapHandle();
+    updatePoseTable();
     return true;
   }
   return false;
@@ -103,6 +538,7 @@ bool SubmapCollection<SubmapType>::duplicateSubMap(
 template <typename SubmapType>
 const SubmapType& SubmapCollection<SubmapType>::getSubMap(
     const SubmapID submap_id) const {
+  const ReaderLock collection_lock(&collection_mutex_);
   const auto it = id_to_submap_.find(submap_id);
   CHECK(it != id_to_submap_.end());
   return *it->second;
@@ -111,7 +547,9 @@ const SubmapType& SubmapCollection<SubmapType>::getSubMap(
 template <typename SubmapType>
 const std::vector<typename SubmapType::Ptr>
 SubmapCollection<SubmapType>::getSubMapPtrs() const {
+  const ReaderLock collection_lock(&collection_mutex_);
   std::vector<typename SubmapType::Ptr> submap_ptrs;
+  submap_ptrs.reserve(id_to_submap_.size());
   for (const auto& id_submap_pair : id_to_submap_) {
     submap_ptrs.emplace_back(id_submap_pair.second);
   }
@@ -122,55 +560,127 @@ template <typename SubmapType>
 const std::vector<typename SubmapType::ConstPtr>
 SubmapCollection<SubmapType>::getSubMapConstPtrs() const {
   std::vector<typename SubmapType::ConstPtr> submap_ptrs;
+  getSubMapConstPtrs(&submap_ptrs);
+  return submap_ptrs;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getSubMapConstPtrs(
+    std::vector<typename SubmapType::ConstPtr>* submap_ptrs) const {
+  CHECK_NOTNULL(submap_ptrs);
+  const ReaderLock collection_lock(&collection_mutex_);
+  submap_ptrs->clear();
+  submap_ptrs->reserve(id_to_submap_.size());
   for (const auto& id_submap_pair : id_to_submap_) {
-    submap_ptrs.emplace_back(id_submap_pair.second);
+    submap_ptrs->push_back(id_submap_pair.second);
   }
-  return submap_ptrs;
+}
+
+template <typename SubmapType>
+typename SubmapCollection<SubmapType>::ConstSubmapView
+SubmapCollection<SubmapType>::getSubMapView() const {
+  return ConstSubmapView(ReaderLock(&collection_mutex_), id_to_submap_);
 }
 
 template <typename SubmapType>
 TsdfMap::Ptr SubmapCollection<SubmapType>::getActiveTsdfMapPtr() {
-  const auto it = id_to_submap_.find(active_submap_id_);
-  CHECK(it != id_to_submap_.end());
-  return (it->second)->getTsdfMapPtr();
+  const ReaderLock collection_lock(&collection_mutex_);
+  CHECK(active_submap_ptr_);
+  return active_submap_ptr_->getTsdfMapPtr();
 }
 template <typename SubmapType>
 const TsdfMap& SubmapCollection<SubmapType>::getActiveTsdfMap() const {
-  const auto it = id_to_submap_.find(active_submap_id_);
-  CHECK(it != id_to_submap_.end());
-  return (it->second)->getTsdfMap();
+  const ReaderLock collection_lock(&collection_mutex_);
+  CHECK(active_submap_ptr_);
+  return active_submap_ptr_->getTsdfMap();
 }
 
 template <typename SubmapType>
 const SubmapType& SubmapCollection<SubmapType>::getActiveSubMap() const {
-  const auto it = id_to_submap_.find(active_submap_id_);
-  CHECK(it != id_to_submap_.end());
-  return *(it->second);
+  const ReaderLock collection_lock(&collection_mutex_);
+  CHECK(active_submap_ptr_);
+  return *active_submap_ptr_;
 }
 
 // Gets a pointer to the active submap
 template <typename SubmapType>
 typename SubmapType::Ptr SubmapCollection<SubmapType>::getActiveSubMapPtr() {
-  const auto it = id_to_submap_.find(active_submap_id_);
-  CHECK(it != id_to_submap_.end());
-  return it->second;
+  const ReaderLock collection_lock(&collection_mutex_);
+  CHECK(active_submap_ptr_);
+  return active_submap_ptr_;
 }
 
 template <typename SubmapType>
-const Transformation& SubmapCollection<SubmapType>::getActiveSubMapPose()
-    const {
-  return getActiveSubMap().getPose();
+Transformation SubmapCollection<SubmapType>::getActiveSubMapPose() const {
+  const ReaderLock collection_lock(&collection_mutex_);
+  CHECK(active_submap_ptr_);
+  return active_submap_ptr_->getPose();
 }
 template <typename SubmapType>
 const SubmapID SubmapCollection<SubmapType>::getActiveSubMapID() const {
+  const ReaderLock collection_lock(&collection_mutex_);
   return active_submap_id_;
 }
 
 template <typename SubmapType>
 void SubmapCollection<SubmapType>::activateSubMap(const SubmapID submap_id) {
+  typename SubmapType::Ptr finished_submap_ptr;
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    const auto it = id_to_submap_.find(submap_id);
+    CHECK(it != id_to_submap_.end());
+    // NOTE: Submaps added through addSubMap() may have the (default) active ID
+    //       without being the active submap.
+    if (it->second == active_submap_ptr_ && !it->second->isFrozen()) {
+      return;
+    }
+    finished_submap_ptr = deactivateActiveSubMap();
+    // NOTE: Frozen submaps may still be being read without locks, so the submap
+    //       is replaced by a (writable) copy rather than being unfrozen.
+    if (it->second->isFrozen()) {
+      it->second = copySubMap(*(it->second), submap_id);
+      markSubmapModified(submap_id);
+    }
+    active_submap_id_ = submap_id;
+    active_submap_ptr_ = it->second;
+  }
+  notifySubmapFinished(finished_submap_ptr);
+}
+
+template <typename SubmapType>
+typename SubmapType::Ptr SubmapCollection<SubmapType>::getWritableSubMapPtr(
+    const SubmapID submap_id) {
+  const WriterLock collection_lock(collection_mutex_);
   const auto it = id_to_submap_.find(submap_id);
-  CHECK(it != id_to_submap_.end());
-  active_submap_id_ = submap_id;
+  if (it == id_to_submap_.end()) {
+    return typename SubmapType::Ptr();
+  }
+  if (it->second->isFrozen()) {
+    it->second = copySubMap(*(it->second), submap_id);
+    markSubmapModified(submap_id);
+    updateActiveSubMapHandle();
+  }
+  return it->second;
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::finishWritableSubMap(
+    const typename SubmapType::Ptr& submap_ptr) {
+  CHECK(submap_ptr);
+  {
+    const WriterLock collection_lock(collection_mutex_);
+    // NOTE: Submaps which have since been removed (e.g. fused), or replaced, or
+    //       which became the active submap, are left alone.
+    const SubmapID submap_id = submap_ptr->getID();
+    const auto it = id_to_submap_.find(submap_id);
+    if (it == id_to_submap_.end() || it->second != submap_ptr ||
+        submap_id == active_submap_id_ || submap_ptr->isFrozen()) {
+      return;
+    }
+    submap_ptr->freeze();
+    markSubmapModified(submap_id);
+  }
+  notifySubmapFinished(submap_ptr);
 }
 
 template <typename SubmapType>
@@ -181,10 +691,12 @@ TsdfMap::Ptr SubmapCollection<SubmapType>::getProjectedMap() const {
   Layer<TsdfVoxel>* combined_tsdf_layer_ptr =
       projected_tsdf_map_ptr->getTsdfLayerPtr();
   // Looping over the current submaps
-  for (const auto& id_submap_pair : id_to_submap_) {
+  for (const typename SubmapType::ConstPtr& submap_ptr :
+       getSubMapConstPtrs()) {
     // Getting the tsdf submap and its pose
-    const TsdfMap& tsdf_map = (id_submap_pair.second)->getTsdfMap();
-    const Transformation& T_G_S = (id_submap_pair.second)->getPose();
+    const ReaderLock tsdf_lock = submap_ptr->getTsdfReaderLock();
+    const TsdfMap& tsdf_map = submap_ptr->getTsdfMap();
+    const Transformation T_G_S = submap_ptr->getPose();
     // Merging layers the submap into the global layer
     mergeLayerAintoLayerB(tsdf_map.getTsdfLayer(), T_G_S,
                           combined_tsdf_layer_ptr);
@@ -196,64 +708,88 @@ TsdfMap::Ptr SubmapCollection<SubmapType>::getProjectedMap() const {
 template <typename SubmapType>
 bool SubmapCollection<SubmapType>::setSubMapPose(const SubmapID submap_id,
                                                  const Transformation& pose) {
-  // Looking for the submap
-  const auto tsdf_submap_ptr_it = id_to_submap_.find(submap_id);
-  if (tsdf_submap_ptr_it != id_to_submap_.end()) {
-    typename SubmapType::Ptr submap_ptr = (*tsdf_submap_ptr_it).second;
-    submap_ptr->setPose(pose);
-    return true;
-  } else {
+  SubmapPoseMap T_G_S_map;
+  T_G_S_map.emplace(submap_id, pose);
+  if (updatePoses(T_G_S_map) == 0) {
     LOG(WARNING) << "Tried to set the pose of the submap with submap_id: "
                  << submap_id << " and could not find the linked submap.";
     return false;
   }
+  return true;
 }
 
 template <typename SubmapType>
 void SubmapCollection<SubmapType>::setSubMapPoses(
     const TransformationVector& transforms) {
+  const ReaderLock collection_lock(&collection_mutex_);
   CHECK_EQ(transforms.size(), id_to_submap_.size());
   // NOTE(alexmillane): This assumes that the order of transforms matches the
   //                    submap order.
-  // NOTE(alexmillane): Should really be passing a map of ids to transforms.
-  size_t sub_map_index = 0;
-  for (const auto& id_submap_pair : id_to_submap_) {
-    (id_submap_pair.second)->setPose(transforms[sub_map_index]);
-    sub_map_index++;
-  }
+  pose_table_.update([this, &transforms](SubmapPoseTable* pose_table) {
+    size_t sub_map_index = 0;
+    for (const auto& id_submap_pair : id_to_submap_) {
+      (id_submap_pair.second)->setPose(transforms[sub_map_index]);
+      CHECK(pose_table->setPose(id_submap_pair.first,
+                                transforms[sub_map_index]));
+      markSubmapModified(id_submap_pair.first);
+      sub_map_index++;
+    }
+  });
+}
+
+template <typename SubmapType>
+size_t SubmapCollection<SubmapType>::updatePoses(
+    const SubmapPoseMap& T_G_S_map) {
+  // NOTE: The poses have their own locks, so changing them doesn't require
+  //       exclusive access to the collection. The submaps get their new poses
+  //       one by one, the table all at once.
+  const ReaderLock collection_lock(&collection_mutex_);
+  size_t num_updated = 0;
+  pose_table_.update(
+      [this, &T_G_S_map, &num_updated](SubmapPoseTable* pose_table) {
+        for (const auto& id_pose_pair : T_G_S_map) {
+          const auto submap_it = id_to_submap_.find(id_pose_pair.first);
+          if (submap_it == id_to_submap_.end()) {
+            continue;
+          }
+          submap_it->second->setPose(id_pose_pair.second);
+          CHECK(pose_table->setPose(id_pose_pair.first, id_pose_pair.second));
+          markSubmapModified(id_pose_pair.first);
+          num_updated++;
+        }
+      });
+  return num_updated;
+}
+
+template <typename SubmapType>
+SubmapPoseTable::ConstPtr SubmapCollection<SubmapType>::getPoseTable() const {
+  return pose_table_.getSnapshot();
 }
 
 template <typename SubmapType>
 bool SubmapCollection<SubmapType>::getSubMapPose(
     const SubmapID submap_id, Transformation* pose_ptr) const {
-  // Looking for the submap
-  const auto tsdf_submap_ptr_it = id_to_submap_.find(submap_id);
-  if (tsdf_submap_ptr_it != id_to_submap_.end()) {
-    typename SubmapType::Ptr submap_ptr = (*tsdf_submap_ptr_it).second;
-    *pose_ptr = submap_ptr->getPose();
-    return true;
-  } else {
+  CHECK_NOTNULL(pose_ptr);
+  if (!pose_table_.getSnapshot()->getPose(submap_id, pose_ptr)) {
     LOG(INFO) << "Tried to get the pose of the submap with submap_id: "
               << submap_id << " and could not find the linked submap.";
     return false;
   }
+  return true;
 }
 
 template <typename SubmapType>
 void SubmapCollection<SubmapType>::getSubMapPoses(
     AlignedVector<Transformation>* submap_poses_ptr) const {
   CHECK_NOTNULL(submap_poses_ptr);
-  // Extracting transforms
-  submap_poses_ptr->clear();
-  submap_poses_ptr->reserve(id_to_submap_.size());
-  for (const auto& id_submap_pair : id_to_submap_) {
-    submap_poses_ptr->push_back((id_submap_pair.second)->getPose());
-  }
+  // NOTE: Assigning reuses the memory of the output.
+  *submap_poses_ptr = pose_table_.getSnapshot()->getPoses();
 }
 
 template <typename SubmapType>
 typename SubmapType::ConstPtr SubmapCollection<
     SubmapType>::getSubMapConstPtrById(const SubmapID submap_id) const {
+  const ReaderLock collection_lock(&collection_mutex_);
   const auto tsdf_submap_ptr_it = id_to_submap_.find(submap_id);
   if (tsdf_submap_ptr_it != id_to_submap_.end()) {
     return tsdf_submap_ptr_it->second;
@@ -263,34 +799,92 @@ typename SubmapType::ConstPtr SubmapCollection<
 }
 
 template <typename SubmapType>
-bool SubmapCollection<SubmapType>::saveToFile(
-    const std::string& file_path) const {
+bool SubmapCollection<SubmapType>::saveToFile(const std::string& file_path,
+                                              const size_t num_threads) const {
   // Opening the file (if we can)
+  // NOTE: The collection is written to a temporary file which then replaces the
+  //       target. Submaps (lazily) loaded from the target hold it open, so keep
+  //       reading the original.
   CHECK(!file_path.empty());
+  const std::string tmp_file_path = file_path + ".tmp";
   std::fstream outfile;
-  outfile.open(file_path, std::fstream::out | std::fstream::binary);
+  outfile.open(tmp_file_path, std::fstream::out | std::fstream::binary |
+                                  std::fstream::trunc);
   if (!outfile.is_open()) {
-    LOG(ERROR) << "Could not open file for writing: " << file_path;
+    LOG(ERROR) << "Could not open file for writing: " << tmp_file_path;
     return false;
   }
+  const auto discard_file = [&outfile, &tmp_file_path]() {
+    outfile.close();
+    std::remove(tmp_file_path.c_str());
+  };
+  // Taking a snapshot of the collection, such that integration may continue
+  // while saving.
+  const std::vector<typename SubmapType::ConstPtr> submap_ptrs =
+      getSubMapConstPtrs();
+  const size_t num_submaps = submap_ptrs.size();
   // Saving the submap collection header object
   TsdfSubmapCollectionProto tsdf_submap_collection_proto;
-  getProto(&tsdf_submap_collection_proto);
+  tsdf_submap_collection_proto.set_num_submaps(num_submaps);
+  tsdf_submap_collection_proto.set_format_version(
+      io::kCollectionFileFormatVersion);
   // Write out the layer header.
   if (!voxblox::utils::writeProtoMsgToStream(tsdf_submap_collection_proto,
                                              &outfile)) {
     LOG(ERROR) << "Could not write submap collection header message.";
-    outfile.close();
+    discard_file();
     return false;
   }
-  // Saving the tsdf submaps
-  for (const auto& id_submap_pair : id_to_submap_) {
-    LOG(INFO) << "Saving tsdf_submap with ID: " << id_submap_pair.first;
-    // Saving the submap
-    (id_submap_pair.second)->saveToStream(&outfile);
+  // Writing the tsdf submaps (serialized in parallel), and indexing where
+  // they went
+  TsdfSubmapCollectionIndexProto index_proto;
+  const auto write_submap = [&](const size_t submap_index,
+                                const std::string& bytes,
+                                const TsdfSubmapProto& tsdf_sub_map_proto) {
+    const typename SubmapType::ConstPtr& submap_ptr = submap_ptrs[submap_index];
+    VLOG(2) << "Saving tsdf_submap with ID: " << submap_ptr->getID();
+    const uint64_t byte_offset = outfile.tellp();
+    if (!outfile.write(bytes.data(), bytes.size())) {
+      return false;
+    }
+    TsdfSubmapIndexEntryProto* index_entry_proto = index_proto.add_submaps();
+    index_entry_proto->set_id(tsdf_sub_map_proto.id());
+    index_entry_proto->set_byte_offset(byte_offset);
+    index_entry_proto->set_num_bytes(bytes.size());
+    index_entry_proto->set_num_blocks(tsdf_sub_map_proto.num_blocks());
+    *index_entry_proto->mutable_transform() = tsdf_sub_map_proto.transform();
+    // NOTE: The box is taken after serializing, such that blocks added in the
+    //       meantime (to the active submap) only make it larger than required.
+    conversions::boundingBoxToProto(submap_ptr->getSubmapFrameBoundingBox(),
+                                    index_entry_proto->mutable_bounding_box());
+    VLOG_EVERY_N(1, 100) << "Saved " << (submap_index + 1) << " of "
+                         << num_submaps << " submaps.";
+    return true;
+  };
+  if (!io::SerializeSubmapsInOrder(submap_ptrs, num_threads, write_submap)) {
+    LOG(ERROR) << "Could not save the tsdf submaps.";
+    discard_file();
+    return false;
   }
-  // Closing the file
+  // Saving the index
+  if (!io::WriteCollectionIndex(index_proto, &outfile)) {
+    LOG(ERROR) << "Could not write the submap collection index.";
+    discard_file();
+    return false;
+  }
+  // Closing the file, syncing it (once) and moving it into place
   outfile.close();
+  if (outfile.fail() || !io::SyncFileToDisk(tmp_file_path)) {
+    LOG(ERROR) << "Could not write file: " << tmp_file_path;
+    std::remove(tmp_file_path.c_str());
+    return false;
+  }
+  if (std::rename(tmp_file_path.c_str(), file_path.c_str()) != 0) {
+    LOG(ERROR) << "Could not move " << tmp_file_path << " to " << file_path;
+    std::remove(tmp_file_path.c_str());
+    return false;
+  }
+  LOG(INFO) << "Saved " << num_submaps << " submaps to: " << file_path;
   return true;
 }
 
@@ -305,6 +899,7 @@ void SubmapCollection<SubmapType>::getProto(
 template <typename SubmapType>
 void SubmapCollection<SubmapType>::fuseSubmapPair(
     const SubmapIdPair& submap_id_pair) {
+  const WriterLock collection_lock(collection_mutex_);
   // Extracting the submap IDs
   SubmapID submap_id_1 = submap_id_pair.first;
   SubmapID submap_id_2 = submap_id_pair.second;
@@ -329,12 +924,31 @@ void SubmapCollection<SubmapType>::fuseSubmapPair(
     const Transformation& T_G_S2 = submap_ptr_2->getPose();
     const Transformation T_S1_S2 = T_G_S1.inverse() * T_G_S2;
     // Merging the submap layers
-    mergeLayerAintoLayerB(submap_ptr_2->getTsdfMap().getTsdfLayer(), T_S1_S2,
-                          submap_ptr_1->getTsdfMapPtr()->getTsdfLayerPtr());
+    // NOTE: Frozen submaps are fused into a copy, which then replaces the
+    //       original, such that readers of the original are not disturbed.
+    const bool fuse_into_copy = submap_ptr_1->isFrozen();
+    if (fuse_into_copy) {
+      submap_ptr_1 = copySubMap(*submap_ptr_1, submap_id_1);
+    }
+    {
+      const WriterLock tsdf_lock_1 = submap_ptr_1->getTsdfWriterLock();
+      const ReaderLock tsdf_lock_2 = submap_ptr_2->getTsdfReaderLock();
+      mergeLayerAintoLayerB(submap_ptr_2->getTsdfMap().getTsdfLayer(),
+                            T_S1_S2,
+                            submap_ptr_1->getTsdfMapPtr()->getTsdfLayerPtr());
+    }
+    if (fuse_into_copy) {
+      submap_ptr_1->freeze();
+      id_submap_pair_1_it->second = submap_ptr_1;
+    }
 
     // Deleting Submap #2
     const size_t num_erased = id_to_submap_.erase(submap_id_2);
     CHECK_EQ(num_erased, 1);
+    updateActiveSubMapHandle();
+    updatePoseTable();
+    markSubmapModified(submap_id_1);
+    markSubmapModified(submap_id_2);
     LOG(INFO) << "Erased the submap: " << submap_ptr_2->getID()
               << " from the submap collection";
 
@@ -343,8 +957,174 @@ void SubmapCollection<SubmapType>::fuseSubmapPair(
   }
 }
 
+template <typename SubmapType>
+SubmapFusionStats SubmapCollection<SubmapType>::fuseSubmapGroups(
+    const std::vector<SubmapIdPair>& submap_id_pairs,
+    const size_t num_threads) {
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  SubmapFusionStats stats;
+  // NOTE: The groups are fused without the collection lock, which is only
+  //       taken to find the submaps, and to swap in the results.
+  std::lock_guard<std::mutex> fusion_lock(fusion_mutex_);
+  struct FusionGroup {
+    SubmapID root_id;
+    std::vector<SubmapID> member_ids;
+    // The submaps as found in the collection
+    typename SubmapType::Ptr root_ptr;
+    std::vector<typename SubmapType::Ptr> member_ptrs;
+    typename SubmapType::Ptr fused_submap_ptr;
+    size_t num_fused_blocks;
+    double duration_s;
+  };
+  std::vector<FusionGroup> groups;
+  {
+    const ReaderLock collection_lock(&collection_mutex_);
+    // Grouping the submaps connected by the pairs
+    UnionFind<SubmapID> submap_groups;
+    for (const SubmapIdPair& submap_id_pair : submap_id_pairs) {
+      if ((id_to_submap_.count(submap_id_pair.first) == 0) ||
+          (id_to_submap_.count(submap_id_pair.second) == 0)) {
+        LOG(WARNING) << "Could not find the requested submap pair ("
+                     << submap_id_pair.first << ", " << submap_id_pair.second
+                     << ") during fusion.";
+        continue;
+      }
+      submap_groups.unite(submap_id_pair.first, submap_id_pair.second);
+    }
+    for (const auto& representative_ids_pair : submap_groups.getSets()) {
+      const std::vector<SubmapID>& ids = representative_ids_pair.second;
+      if (ids.size() < 2) {
+        continue;
+      }
+      FusionGroup group;
+      // NOTE: The active submap keeps being integrated into, so survives the
+      //       fusion. The IDs are sorted.
+      const bool contains_active = std::find(ids.begin(), ids.end(),
+                                             active_submap_id_) != ids.end();
+      group.root_id = contains_active ? active_submap_id_ : ids.front();
+      group.root_ptr = id_to_submap_.at(group.root_id);
+      for (const SubmapID submap_id : ids) {
+        if (submap_id != group.root_id) {
+          group.member_ids.push_back(submap_id);
+          group.member_ptrs.push_back(id_to_submap_.at(submap_id));
+        }
+      }
+      group.num_fused_blocks = 0;
+      group.duration_s = 0.0;
+      groups.push_back(group);
+    }
+  }
+  if (groups.empty()) {
+    return stats;
+  }
+  // Fusing the groups in parallel. The threads only touch the submaps found
+  // above, of which each group holds its own.
+  const size_t num_group_threads = std::min(num_threads, groups.size());
+  const size_t num_block_threads = std::max(
+      num_threads / std::max(num_group_threads, static_cast<size_t>(1)),
+      static_cast<size_t>(1));
+  parallelFor(groups.size(), num_group_threads, [&](const size_t group_index) {
+    const std::chrono::steady_clock::time_point group_start_time =
+        std::chrono::steady_clock::now();
+    FusionGroup& group = groups[group_index];
+    // NOTE: As in fuseSubmapPair(), frozen roots are fused into a copy, such
+    //       that readers of the original are not disturbed. Others (e.g. the
+    //       active submap) are fused in place, under their TSDF lock.
+    typename SubmapType::Ptr root_ptr = group.root_ptr;
+    if (root_ptr->isFrozen()) {
+      root_ptr = copySubMap(*root_ptr, group.root_id);
+    }
+    const Transformation T_G_R = root_ptr->getPose();
+    std::vector<ReaderLock> member_locks;
+    std::vector<const Layer<TsdfVoxel>*> member_layers;
+    TransformationVector T_R_M_vector;
+    for (const typename SubmapType::Ptr& member_ptr : group.member_ptrs) {
+      member_locks.push_back(member_ptr->getTsdfReaderLock());
+      member_layers.push_back(&(member_ptr->getTsdfMap().getTsdfLayer()));
+      T_R_M_vector.push_back(T_G_R.inverse() * member_ptr->getPose());
+    }
+    {
+      const WriterLock tsdf_lock = root_ptr->getTsdfWriterLock();
+      group.num_fused_blocks = fuseTsdfLayersIntoLayer(
+          member_layers, T_R_M_vector, num_block_threads,
+          root_ptr->getTsdfMapPtr()->getTsdfLayerPtr(), block_pool_.get());
+    }
+    root_ptr->markTsdfModified();
+    group.fused_submap_ptr = root_ptr;
+    group.duration_s = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - group_start_time)
+                           .count();
+  });
+  // Replacing the roots, and removing the fused submaps
+  const WriterLock collection_lock(collection_mutex_);
+  for (const FusionGroup& group : groups) {
+    const bool fused_in_place = (group.fused_submap_ptr == group.root_ptr);
+    // NOTE: Submaps may have been removed or replaced (e.g. by a writable
+    //       copy) while fusing. A group fused into a copy is then dropped. In
+    //       place, the fusion has already happened, so only the members which
+    //       are unchanged are removed.
+    const auto root_it = id_to_submap_.find(group.root_id);
+    bool group_unchanged =
+        (root_it != id_to_submap_.end()) && (root_it->second == group.root_ptr);
+    std::vector<bool> members_unchanged(group.member_ids.size());
+    for (size_t member_index = 0; member_index < group.member_ids.size();
+         member_index++) {
+      const auto member_it = id_to_submap_.find(group.member_ids[member_index]);
+      members_unchanged[member_index] =
+          (member_it != id_to_submap_.end()) &&
+          (member_it->second == group.member_ptrs[member_index]);
+      group_unchanged = group_unchanged && members_unchanged[member_index];
+    }
+    if (!group_unchanged) {
+      LOG(WARNING) << "The submaps fused into submap " << group.root_id
+                   << " changed during fusion.";
+      if (!fused_in_place) {
+        continue;
+      }
+    }
+    if (!fused_in_place) {
+      group.fused_submap_ptr->freeze();
+      root_it->second = group.fused_submap_ptr;
+    }
+    markSubmapModified(group.root_id);
+    for (size_t member_index = 0; member_index < group.member_ids.size();
+         member_index++) {
+      if (!members_unchanged[member_index]) {
+        continue;
+      }
+      const SubmapID member_id = group.member_ids[member_index];
+      const size_t num_erased = id_to_submap_.erase(member_id);
+      CHECK_EQ(num_erased, 1);
+      markSubmapModified(member_id);
+      stats.num_fused_submaps++;
+    }
+    stats.num_fused_blocks += group.num_fused_blocks;
+    stats.total_group_duration_s += group.duration_s;
+    stats.max_group_duration_s =
+        std::max(stats.max_group_duration_s, group.duration_s);
+  }
+  updateActiveSubMapHandle();
+  updatePoseTable();
+  stats.num_groups = groups.size();
+  stats.duration_s = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+  LOG(INFO) << "Fused " << stats.num_fused_submaps << " submaps in "
+            << stats.num_groups << " groups in " << stats.duration_s
+            << "s ("
+            << 1000.0 * stats.duration_s /
+                   std::max(stats.num_fused_submaps, static_cast<size_t>(1))
+            << "ms per submap, "
+            << stats.num_fused_blocks / std::max(stats.duration_s, 1e-9)
+            << " blocks/s). The slowest group took "
+            << stats.max_group_duration_s << "s.";
+  return stats;
+}
+
 template <typename SubmapType>
 size_t SubmapCollection<SubmapType>::getNumberAllocatedBlocks() const {
+  const ReaderLock collection_lock(&collection_mutex_);
   // Looping over the submaps totalling the sizes
   size_t total_blocks = 0;
   for (const auto& id_submap_pair : id_to_submap_) {
@@ -353,6 +1133,238 @@ size_t SubmapCollection<SubmapType>::getNumberAllocatedBlocks() const {
   return total_blocks;
 }
 
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::clear() {
+  const WriterLock collection_lock(collection_mutex_);
+  id_to_submap_.clear();
+  active_submap_ptr_.reset();
+  updatePoseTable();
+  std::lock_guard<std::mutex> spatial_index_lock(spatial_index_mutex_);
+  spatial_index_.clear();
+  spatial_index_dirty_ids_.clear();
+  spatial_index_versions_.clear();
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::markSubmapModified(
+    const SubmapID submap_id) const {
+  std::lock_guard<std::mutex> spatial_index_lock(spatial_index_mutex_);
+  spatial_index_dirty_ids_.insert(submap_id);
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::updateSpatialIndex() const {
+  // The active submap is being integrated into, so is always checked.
+  if (!id_to_submap_.empty()) {
+    spatial_index_dirty_ids_.insert(active_submap_id_);
+  }
+  for (const SubmapID submap_id : spatial_index_dirty_ids_) {
+    const auto submap_it = id_to_submap_.find(submap_id);
+    // Submaps which have been removed
+    if (submap_it == id_to_submap_.end()) {
+      spatial_index_.remove(submap_id);
+      spatial_index_versions_.erase(submap_id);
+      continue;
+    }
+    // Only re-indexing if the submap actually changed
+    const std::pair<size_t, size_t> versions(
+        submap_it->second->getTsdfVersion(),
+        submap_it->second->getPoseVersion());
+    const auto version_it = spatial_index_versions_.find(submap_id);
+    if (version_it != spatial_index_versions_.end() &&
+        version_it->second == versions) {
+      continue;
+    }
+    spatial_index_.insertOrUpdate(
+        submap_id, submap_it->second->getGlobalFrameBoundingBox());
+    spatial_index_versions_[submap_id] = versions;
+  }
+  spatial_index_dirty_ids_.clear();
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getSubmapsOverlapping(
+    const BoundingBox& box_G, std::vector<SubmapID>* submap_ids) const {
+  CHECK_NOTNULL(submap_ids);
+  const ReaderLock collection_lock(&collection_mutex_);
+  std::lock_guard<std::mutex> spatial_index_lock(spatial_index_mutex_);
+  updateSpatialIndex();
+  spatial_index_.getSubmapsOverlapping(box_G, submap_ids);
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getSubmapsContaining(
+    const Point& point_G, std::vector<SubmapID>* submap_ids) const {
+  CHECK_NOTNULL(submap_ids);
+  const ReaderLock collection_lock(&collection_mutex_);
+  std::lock_guard<std::mutex> spatial_index_lock(spatial_index_mutex_);
+  updateSpatialIndex();
+  spatial_index_.getSubmapsContaining(point_G, submap_ids);
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getDistancesAtPositions(
+    const Pointcloud& points_G, const bool interpolate,
+    std::vector<FloatingPoint>* distances, std::vector<bool>* observed) const {
+  fuseDistancesAtPositions(points_G, interpolate, distances, nullptr,
+                           observed);
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::getDistancesAndGradientsAtPositions(
+    const Pointcloud& points_G, const bool interpolate,
+    std::vector<FloatingPoint>* distances, Pointcloud* gradients_G,
+    std::vector<bool>* observed) const {
+  CHECK_NOTNULL(gradients_G);
+  fuseDistancesAtPositions(points_G, interpolate, distances, gradients_G,
+                           observed);
+}
+
+template <typename SubmapType>
+void SubmapCollection<SubmapType>::fuseDistancesAtPositions(
+    const Pointcloud& points_G, const bool interpolate,
+    std::vector<FloatingPoint>* distances, Pointcloud* gradients_G,
+    std::vector<bool>* observed) const {
+  static_assert(SubmapTraits<SubmapType>::kHasEsdfLayer,
+                "Distance queries require submaps with an ESDF layer.");
+  CHECK_NOTNULL(distances);
+  CHECK_NOTNULL(observed);
+  const size_t num_points = points_G.size();
+  // Accumulating the weighted sums in the outputs
+  std::vector<FloatingPoint> weight_sums(num_points, 0.0f);
+  distances->assign(num_points, 0.0f);
+  if (gradients_G != nullptr) {
+    gradients_G->assign(num_points, Point::Zero());
+  }
+  // Binning the points by the cells of the spatial index, such that each
+  // submap only tests the points of the cells near it, rather than all of the
+  // points (e.g. of a trajectory spread over the map).
+  const FloatingPoint cell_size_inv = 1.0f / spatial_index_.cell_size();
+  voxblox::AnyIndexHashMapType<std::vector<size_t>>::type cell_point_indices;
+  for (size_t point_idx = 0; point_idx < num_points; point_idx++) {
+    cell_point_indices[voxblox::getGridIndexFromPoint<voxblox::AnyIndex>(
+                           points_G[point_idx], cell_size_inv)]
+        .push_back(point_idx);
+  }
+  // Finding the candidate submaps, and the points near each
+  // NOTE: The candidates are held by pointer, such that the lock on the
+  //       collection is only held during the lookup.
+  std::map<SubmapID, std::vector<size_t>> submap_point_indices;
+  std::vector<typename SubmapType::ConstPtr> candidate_submaps;
+  std::vector<std::vector<size_t>> candidate_point_indices;
+  SubmapPoseTable::ConstPtr pose_table;
+  {
+    const ReaderLock collection_lock(&collection_mutex_);
+    {
+      std::lock_guard<std::mutex> spatial_index_lock(spatial_index_mutex_);
+      updateSpatialIndex();
+      std::vector<SubmapID> cell_submap_ids;
+      for (const auto& cell_points_pair : cell_point_indices) {
+        BoundingBox cell_box_G;
+        for (const size_t point_idx : cell_points_pair.second) {
+          cell_box_G.extend(points_G[point_idx]);
+        }
+        spatial_index_.getSubmapsOverlapping(cell_box_G, &cell_submap_ids);
+        for (const SubmapID submap_id : cell_submap_ids) {
+          std::vector<size_t>& point_indices = submap_point_indices[submap_id];
+          point_indices.insert(point_indices.end(),
+                               cell_points_pair.second.begin(),
+                               cell_points_pair.second.end());
+        }
+      }
+    }
+    for (std::pair<const SubmapID, std::vector<size_t>>& submap_points_pair :
+         submap_point_indices) {
+      const auto submap_it = id_to_submap_.find(submap_points_pair.first);
+      if (submap_it != id_to_submap_.end() &&
+          submap_it->second->isEsdfReady()) {
+        candidate_submaps.push_back(submap_it->second);
+        candidate_point_indices.push_back(
+            std::move(submap_points_pair.second));
+      }
+    }
+    // The poses matching the candidates
+    pose_table = pose_table_.getSnapshot();
+  }
+  // Buffers reused between submaps
+  typedef Eigen::Matrix<FloatingPoint, 3, Eigen::Dynamic> PointMatrix;
+  std::vector<size_t> point_indices;
+  PointMatrix points_G_matrix;
+  PointMatrix points_S_matrix;
+  for (size_t candidate_idx = 0; candidate_idx < candidate_submaps.size();
+       candidate_idx++) {
+    const SubmapType& submap = *candidate_submaps[candidate_idx];
+    // Selecting the points (of the nearby cells) inside the submap
+    const BoundingBox submap_box_G = submap.getGlobalFrameBoundingBox();
+    point_indices.clear();
+    for (const size_t point_idx : candidate_point_indices[candidate_idx]) {
+      if (submap_box_G.contains(points_G[point_idx])) {
+        point_indices.push_back(point_idx);
+      }
+    }
+    if (point_indices.empty()) {
+      continue;
+    }
+    // Transforming the points into the submap frame, all at once
+    // NOTE: Written as a single matrix product such that Eigen vectorizes the
+    //       transformation.
+    points_G_matrix.resize(3, point_indices.size());
+    for (size_t i = 0; i < point_indices.size(); i++) {
+      points_G_matrix.col(i) = points_G[point_indices[i]];
+    }
+    const size_t pose_index = pose_table->findIndex(submap.getID());
+    CHECK_LT(pose_index, pose_table->size());
+    const Transformation& T_G_S = pose_table->getPoses()[pose_index];
+    const Transformation& T_S_G = pose_table->getInversePoses()[pose_index];
+    points_S_matrix.noalias() = T_S_G.getRotationMatrix() * points_G_matrix;
+    points_S_matrix.colwise() += T_S_G.getPosition();
+    const Eigen::Matrix<FloatingPoint, 3, 3> R_G_S = T_G_S.getRotationMatrix();
+    // Looking up the distances
+    const std::shared_ptr<const EsdfMap> esdf_map_ptr =
+        submap.getEsdfMapConstPtr();
+    const ReaderLock tsdf_lock = submap.getTsdfReaderLock();
+    const voxblox::Interpolator<voxblox::EsdfVoxel> esdf_interpolator(
+        &esdf_map_ptr->getEsdfLayer());
+    const voxblox::Interpolator<TsdfVoxel> tsdf_interpolator(
+        &submap.getTsdfMap().getTsdfLayer());
+    for (size_t i = 0; i < point_indices.size(); i++) {
+      const Point point_S = points_S_matrix.col(i);
+      FloatingPoint weight;
+      if (!tsdf_interpolator.getWeight(point_S, &weight, false) ||
+          weight <= 0.0f) {
+        continue;
+      }
+      FloatingPoint distance;
+      if (!esdf_interpolator.getDistance(point_S, &distance, interpolate)) {
+        continue;
+      }
+      Point gradient_S;
+      if (gradients_G != nullptr &&
+          !esdf_interpolator.getGradient(point_S, &gradient_S, interpolate)) {
+        continue;
+      }
+      const size_t point_idx = point_indices[i];
+      weight_sums[point_idx] += weight;
+      (*distances)[point_idx] += weight * distance;
+      if (gradients_G != nullptr) {
+        (*gradients_G)[point_idx] += weight * (R_G_S * gradient_S);
+      }
+    }
+  }
+  // Normalizing
+  observed->assign(num_points, false);
+  for (size_t point_idx = 0; point_idx < num_points; point_idx++) {
+    const FloatingPoint weight_sum = weight_sums[point_idx];
+    if (weight_sum > 0.0f) {
+      (*observed)[point_idx] = true;
+      (*distances)[point_idx] /= weight_sum;
+      if (gradients_G != nullptr) {
+        (*gradients_G)[point_idx] /= weight_sum;
+      }
+    }
+  }
+}
+
 }  // namespace cblox
 
 #endif  // CBLOX_CORE_SUBMAP_COLLECTION_INL_H_
@@ -0,0 +1,123 @@
+#ifndef CBLOX_CORE_SUBMAP_CREATION_POLICY_H_
+#define CBLOX_CORE_SUBMAP_CREATION_POLICY_H_
+
+#include <memory>
+#include <vector>
+
+#include "cblox/core/bounding_box.h"
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// What is known about the active submap when deciding whether to start a new
+// one. Updated by the caller after each integrated frame.
+// NOTE: Everything here is cheap to keep up to date per frame. The extent is
+//       the union of the bounding boxes of the integrated scans, rather than of
+//       the allocated blocks.
+struct ActiveSubmapState {
+  ActiveSubmapState()
+      : num_integrated_frames(0),
+        num_allocated_blocks(0),
+        memory_bytes(0) {}
+
+  // Resets the state for a submap started at T_G_S
+  void startNewSubmap(const Transformation& T_G_S_in) {
+    previous_extent_G = extent_G;
+    extent_G = BoundingBox();
+    T_G_S = T_G_S_in;
+    num_integrated_frames = 0;
+    num_allocated_blocks = 0;
+    memory_bytes = 0;
+  }
+
+  size_t num_integrated_frames;
+  // The submap origin and the latest sensor pose
+  Transformation T_G_S;
+  Transformation T_G_C;
+  size_t num_allocated_blocks;
+  size_t memory_bytes;
+  // The region covered by this submap's scans, and the previous submap's
+  BoundingBox extent_G;
+  BoundingBox previous_extent_G;
+};
+
+// Decides, once per integrated frame, whether the active submap is finished.
+class SubmapCreationPolicy {
+ public:
+  typedef std::shared_ptr<SubmapCreationPolicy> Ptr;
+  typedef std::shared_ptr<const SubmapCreationPolicy> ConstPtr;
+
+  virtual ~SubmapCreationPolicy() {}
+
+  virtual bool newSubmapRequired(const ActiveSubmapState& state) const = 0;
+};
+
+// A new submap every num_frames integrated frames
+class FrameCountSubmapPolicy : public SubmapCreationPolicy {
+ public:
+  explicit FrameCountSubmapPolicy(const size_t num_frames)
+      : num_frames_(num_frames) {}
+  bool newSubmapRequired(const ActiveSubmapState& state) const override;
+
+ private:
+  const size_t num_frames_;
+};
+
+// A new submap once the sensor moved (or turned) far enough from the submap
+// origin. Limits of zero are ignored.
+class MotionSubmapPolicy : public SubmapCreationPolicy {
+ public:
+  MotionSubmapPolicy(const FloatingPoint max_distance_m,
+                     const FloatingPoint max_rotation_rad)
+      : max_distance_m_(max_distance_m), max_rotation_rad_(max_rotation_rad) {}
+  bool newSubmapRequired(const ActiveSubmapState& state) const override;
+
+ private:
+  const FloatingPoint max_distance_m_;
+  const FloatingPoint max_rotation_rad_;
+};
+
+// A new submap once the active submap grew too large, in blocks or bytes.
+// Limits of zero are ignored.
+class SubmapSizePolicy : public SubmapCreationPolicy {
+ public:
+  SubmapSizePolicy(const size_t max_num_blocks, const size_t max_memory_bytes)
+      : max_num_blocks_(max_num_blocks), max_memory_bytes_(max_memory_bytes) {}
+  bool newSubmapRequired(const ActiveSubmapState& state) const override;
+
+ private:
+  const size_t max_num_blocks_;
+  const size_t max_memory_bytes_;
+};
+
+// True while the active submap has moved away from the previous one, i.e. at
+// most max_overlap of its extent (by volume) lies within the previous
+// submap's extent. Used as a requirement (see CompositeSubmapPolicy), such
+// that a stationary sensor doesn't produce a series of redundant submaps.
+class OverlapSubmapPolicy : public SubmapCreationPolicy {
+ public:
+  explicit OverlapSubmapPolicy(const FloatingPoint max_overlap)
+      : max_overlap_(max_overlap) {}
+  bool newSubmapRequired(const ActiveSubmapState& state) const override;
+
+ private:
+  const FloatingPoint max_overlap_;
+};
+
+// Combines policies. A new submap is required when any of the triggers fires
+// and all of the requirements hold. Without triggers, no new submaps are
+// created.
+class CompositeSubmapPolicy : public SubmapCreationPolicy {
+ public:
+  void addTrigger(const SubmapCreationPolicy::ConstPtr& policy);
+  void addRequirement(const SubmapCreationPolicy::ConstPtr& policy);
+  bool newSubmapRequired(const ActiveSubmapState& state) const override;
+
+ private:
+  std::vector<SubmapCreationPolicy::ConstPtr> triggers_;
+  std::vector<SubmapCreationPolicy::ConstPtr> requirements_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_SUBMAP_CREATION_POLICY_H_
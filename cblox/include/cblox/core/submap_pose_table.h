@@ -0,0 +1,88 @@
+#ifndef CBLOX_CORE_SUBMAP_POSE_TABLE_H_
+#define CBLOX_CORE_SUBMAP_POSE_TABLE_H_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// The poses of all submaps of a collection, as parallel arrays in ascending ID
+// order, together with their inverses.
+// NOTE: Tables are handed out as immutable snapshots (see
+//       SubmapPoseTableBuffer), so reading them takes no locks.
+class SubmapPoseTable {
+ public:
+  typedef std::shared_ptr<const SubmapPoseTable> ConstPtr;
+
+  SubmapPoseTable() : version_(0) {}
+
+  size_t size() const { return submap_ids_.size(); }
+  bool empty() const { return submap_ids_.empty(); }
+
+  // Increases with each published change of the table
+  size_t getVersion() const { return version_; }
+
+  // The arrays, indexed alike
+  const std::vector<SubmapID>& getIDs() const { return submap_ids_; }
+  const TransformationVector& getPoses() const { return T_G_S_vector_; }
+  const TransformationVector& getInversePoses() const {
+    return T_S_G_vector_;
+  }
+
+  // The index of the submap, or size() if it isn't in the table
+  size_t findIndex(const SubmapID submap_id) const;
+
+  bool getPose(const SubmapID submap_id, Transformation* T_G_S_ptr) const;
+  bool getInversePose(const SubmapID submap_id,
+                      Transformation* T_S_G_ptr) const;
+
+  // Building the table
+  void clear();
+  void reserve(const size_t num_submaps);
+  // NOTE: The IDs have to be appended in ascending order.
+  void append(const SubmapID submap_id, const Transformation& T_G_S);
+  bool setPose(const SubmapID submap_id, const Transformation& T_G_S);
+
+ private:
+  friend class SubmapPoseTableBuffer;
+
+  std::vector<SubmapID> submap_ids_;
+  TransformationVector T_G_S_vector_;
+  TransformationVector T_S_G_vector_;
+  size_t version_;
+};
+
+// Double buffers a pose table: updates are made to a copy, which is then
+// swapped in at once, such that readers always see either all or none of the
+// changes of an update.
+// NOTE: The previous table is reused for the next update, unless a reader still
+//       holds it, so steady state updates don't allocate.
+class SubmapPoseTableBuffer {
+ public:
+  typedef std::function<void(SubmapPoseTable*)> UpdateFunction;
+
+  SubmapPoseTableBuffer();
+
+  // The current table. Holding on to it doesn't block updates.
+  SubmapPoseTable::ConstPtr getSnapshot() const;
+
+  // Calls the function with a copy of the current table to modify, and then
+  // publishes the result. Updates are serialized.
+  void update(const UpdateFunction& update_function);
+
+ private:
+  // Serializes the updates
+  std::mutex update_mutex_;
+  // Guards swapping the current table (only)
+  mutable std::mutex snapshot_mutex_;
+  std::shared_ptr<SubmapPoseTable> current_table_;
+  std::shared_ptr<SubmapPoseTable> spare_table_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_SUBMAP_POSE_TABLE_H_
@@ -0,0 +1,56 @@
+#ifndef CBLOX_CORE_SUBMAP_SPATIAL_INDEX_H_
+#define CBLOX_CORE_SUBMAP_SPATIAL_INDEX_H_
+
+#include <map>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+#include "cblox/core/bounding_box.h"
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// A spatial index over the (global frame) bounding boxes of submaps.
+// NOTE: Space is divided into a hashed grid of cubic cells. Each submap is
+//       registered in all cells its box overlaps, such that queries only touch
+//       the submaps registered close to the query, rather than all submaps.
+class SubmapSpatialIndex {
+ public:
+  explicit SubmapSpatialIndex(const FloatingPoint cell_size);
+
+  // Adding, moving and removing submaps
+  void insertOrUpdate(const SubmapID submap_id, const BoundingBox& box_G);
+  void remove(const SubmapID submap_id);
+  void clear();
+
+  // Queries. The IDs are returned in ascending order and without duplicates.
+  void getSubmapsOverlapping(const BoundingBox& box_G,
+                             std::vector<SubmapID>* submap_ids) const;
+  void getSubmapsContaining(const Point& point_G,
+                            std::vector<SubmapID>* submap_ids) const;
+
+  size_t size() const { return submap_boxes_.size(); }
+  FloatingPoint cell_size() const { return cell_size_; }
+
+ private:
+  typedef voxblox::AnyIndex CellIndex;
+
+  CellIndex getCellIndex(const Point& point) const;
+
+  // Calls function(cell_index) for each cell overlapped by the box.
+  template <typename Function>
+  void forEachCell(const BoundingBox& box, const Function& function) const;
+
+  const FloatingPoint cell_size_;
+  const FloatingPoint cell_size_inv_;
+
+  // The submaps registered in each cell
+  voxblox::AnyIndexHashMapType<std::vector<SubmapID>>::type cells_;
+  // The box each submap is currently registered with
+  std::map<SubmapID, BoundingBox> submap_boxes_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_SUBMAP_SPATIAL_INDEX_H_
@@ -0,0 +1,155 @@
+#ifndef CBLOX_CORE_SUBMAP_STORAGE_H_
+#define CBLOX_CORE_SUBMAP_STORAGE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// Submaps stored contiguously in ascending ID order, with the (std::map like)
+// interface the collection uses. Lookups go through a table indexed by ID, so
+// are O(1), and iteration walks a vector.
+// NOTE: SubmapIDs are handed out sequentially, so the table is dense. IDs
+//       beyond kMaxIndexedId (e.g. from other tools) are found by binary search
+//       instead. Inserting anywhere but at the back, and erasing, are O(n),
+//       which is fine for loading and fusion. Both invalidate iterators and
+//       references, as for a vector.
+template <typename ValueType>
+class SubmapStorage {
+ public:
+  typedef std::pair<SubmapID, ValueType> value_type;
+  typedef typename std::vector<value_type>::iterator iterator;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+  typedef typename std::vector<value_type>::const_reverse_iterator
+      const_reverse_iterator;
+
+  static constexpr SubmapID kMaxIndexedId = (1u << 20) - 1;
+
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  const_reverse_iterator rbegin() const { return entries_.rbegin(); }
+  const_reverse_iterator rend() const { return entries_.rend(); }
+
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+  void reserve(const size_t num_entries) { entries_.reserve(num_entries); }
+  void clear() {
+    entries_.clear();
+    id_to_index_.clear();
+  }
+
+  iterator find(const SubmapID submap_id) {
+    return entries_.begin() + findIndex(submap_id);
+  }
+  const_iterator find(const SubmapID submap_id) const {
+    return entries_.begin() + findIndex(submap_id);
+  }
+  size_t count(const SubmapID submap_id) const {
+    return (findIndex(submap_id) == entries_.size()) ? 0 : 1;
+  }
+
+  ValueType& at(const SubmapID submap_id) {
+    const iterator it = find(submap_id);
+    CHECK(it != end()) << "No submap with ID: " << submap_id;
+    return it->second;
+  }
+  const ValueType& at(const SubmapID submap_id) const {
+    const const_iterator it = find(submap_id);
+    CHECK(it != end()) << "No submap with ID: " << submap_id;
+    return it->second;
+  }
+  ValueType& operator[](const SubmapID submap_id) {
+    return emplace(submap_id, ValueType()).first->second;
+  }
+
+  // Inserts the value, unless the ID is taken. Returns the entry of the ID,
+  // and whether the value was inserted.
+  std::pair<iterator, bool> emplace(const SubmapID submap_id,
+                                    ValueType value) {
+    const size_t existing_index = findIndex(submap_id);
+    if (existing_index != entries_.size()) {
+      return std::make_pair(entries_.begin() + existing_index, false);
+    }
+    // Usually at the back, as new submaps get the highest ID
+    const iterator insert_it =
+        (entries_.empty() || entries_.back().first < submap_id)
+            ? entries_.end()
+            : std::lower_bound(entries_.begin(), entries_.end(), submap_id,
+                               compareId);
+    const size_t insert_index = insert_it - entries_.begin();
+    entries_.insert(insert_it, value_type(submap_id, std::move(value)));
+    reindexFrom(insert_index);
+    return std::make_pair(entries_.begin() + insert_index, true);
+  }
+
+  size_t erase(const SubmapID submap_id) {
+    const size_t erase_index = findIndex(submap_id);
+    if (erase_index == entries_.size()) {
+      return 0;
+    }
+    if (submap_id <= kMaxIndexedId) {
+      id_to_index_[submap_id] = kNoIndex;
+    }
+    entries_.erase(entries_.begin() + erase_index);
+    reindexFrom(erase_index);
+    return 1;
+  }
+
+ private:
+  static constexpr uint32_t kNoIndex = std::numeric_limits<uint32_t>::max();
+
+  static bool compareId(const value_type& entry, const SubmapID submap_id) {
+    return entry.first < submap_id;
+  }
+
+  // The index of the entry, or size() if there is none
+  size_t findIndex(const SubmapID submap_id) const {
+    if (submap_id <= kMaxIndexedId) {
+      if (submap_id >= id_to_index_.size() ||
+          id_to_index_[submap_id] == kNoIndex) {
+        return entries_.size();
+      }
+      return id_to_index_[submap_id];
+    }
+    const const_iterator it = std::lower_bound(
+        entries_.begin(), entries_.end(), submap_id, compareId);
+    return (it != entries_.end() && it->first == submap_id)
+               ? static_cast<size_t>(it - entries_.begin())
+               : entries_.size();
+  }
+
+  // Updates the table for the entries which moved (from index on)
+  void reindexFrom(const size_t first_index) {
+    for (size_t index = first_index; index < entries_.size(); index++) {
+      const SubmapID submap_id = entries_[index].first;
+      if (submap_id > kMaxIndexedId) {
+        break;
+      }
+      if (submap_id >= id_to_index_.size()) {
+        id_to_index_.resize(submap_id + 1, kNoIndex);
+      }
+      id_to_index_[submap_id] = static_cast<uint32_t>(index);
+    }
+  }
+
+  std::vector<value_type> entries_;
+  std::vector<uint32_t> id_to_index_;
+};
+
+template <typename ValueType>
+constexpr SubmapID SubmapStorage<ValueType>::kMaxIndexedId;
+template <typename ValueType>
+constexpr uint32_t SubmapStorage<ValueType>::kNoIndex;
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_SUBMAP_STORAGE_H_
@@ -0,0 +1,37 @@
+#ifndef CBLOX_CORE_SUBMAP_TRAITS_H_
+#define CBLOX_CORE_SUBMAP_TRAITS_H_
+
+#include <glog/logging.h>
+
+#include "cblox/core/tsdf_esdf_submap.h"
+#include "cblox/core/tsdf_submap.h"
+
+namespace cblox {
+
+// Compile-time description of a submap type. Code templated on the submap type
+// (the collection, integrator, mesher and IO) picks its code paths from the
+// traits, rather than through virtual functions. All submap types hold a TSDF
+// (they derive from TsdfSubmap); the traits describe the layers beyond it.
+// NOTE: New submap types with additional layers specialize the traits below,
+//       next to the TsdfEsdfSubmap specialization.
+template <typename SubmapType>
+struct SubmapTraits {
+  static constexpr bool kHasEsdfLayer = false;
+  // Hands the layers derived from the TSDF over to a copy holding the same
+  // TSDF. The TSDF itself is copied by the collection.
+  static void shareDerivedLayers(const SubmapType& /*source_submap*/,
+                                 SubmapType* /*copy_ptr*/) {}
+};
+
+template <>
+struct SubmapTraits<TsdfEsdfSubmap> {
+  static constexpr bool kHasEsdfLayer = true;
+  static void shareDerivedLayers(const TsdfEsdfSubmap& source_submap,
+                                 TsdfEsdfSubmap* copy_ptr) {
+    CHECK_NOTNULL(copy_ptr)->shareEsdf(source_submap);
+  }
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_SUBMAP_TRAITS_H_
@@ -0,0 +1,42 @@
+#ifndef CBLOX_CORE_TSDF_BLOCK_ENCODING_H_
+#define CBLOX_CORE_TSDF_BLOCK_ENCODING_H_
+
+#include <cstdint>
+#include <string>
+
+#include "cblox/core/common.h"
+#include "cblox/core/tsdf_block_pool.h"
+
+namespace cblox {
+
+// A compact (lossy) encoding of the blocks of a TSDF layer, for frozen
+// submaps. Per voxel, the (log scaled) weight is quantized to 8 bits, and the
+// distance of observed voxels to 16 bits, both relative to the largest value
+// in their block. Unobserved voxels take a single byte.
+// NOTE: The errors are below 1e-4 of the largest distance in the block, and 2%
+//       of (1 + weight), which is well below the noise of the fused
+//       measurements.
+struct TsdfBlockEncodingConfig {
+  TsdfBlockEncodingConfig() : keep_colors(true), elide_empty_blocks(true) {}
+  // Colors take half of the bytes of observed voxels
+  bool keep_colors;
+  // Skips blocks without observed voxels
+  bool elide_empty_blocks;
+};
+
+// Appends the encoded blocks of the layer to bytes. Returns the number of
+// blocks encoded.
+size_t EncodeTsdfBlocks(const Layer<TsdfVoxel>& tsdf_layer,
+                        const TsdfBlockEncodingConfig& config,
+                        std::string* bytes);
+
+// Adds the encoded blocks to the layer, replacing existing blocks. Returns
+// false if the bytes are not a valid encoding for this layer. The blocks are
+// taken from the pool, if given.
+bool DecodeTsdfBlocks(const char* bytes, const size_t num_bytes,
+                      Layer<TsdfVoxel>* tsdf_layer_ptr,
+                      TsdfBlockPool* block_pool_ptr = nullptr);
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_TSDF_BLOCK_ENCODING_H_
@@ -0,0 +1,78 @@
+#ifndef CBLOX_CORE_TSDF_BLOCK_POOL_H_
+#define CBLOX_CORE_TSDF_BLOCK_POOL_H_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+struct TsdfBlockPoolStats {
+  // The blocks waiting to be reused, and the most the pool keeps
+  size_t num_pooled_blocks = 0;
+  size_t pooled_memory_bytes = 0;
+  size_t max_pooled_blocks = 0;
+  // Blocks handed out from the pool, and newly allocated because the pool had
+  // none for the requested index.
+  size_t num_reused_blocks = 0;
+  size_t num_allocated_blocks = 0;
+  // Blocks returned to the pool, and freed because the pool was full
+  size_t num_recycled_blocks = 0;
+  size_t num_freed_blocks = 0;
+};
+
+// Recycles the (fixed size) TSDF blocks of the submaps of a collection, such
+// that blocks freed by one submap (destroyed, paged out or compressed) are
+// reused by others, rather than going back to the heap.
+// NOTE: Blocks are pooled by block index, as voxblox blocks have a fixed
+//       origin. The indices are in the submap frames, and submaps are similar
+//       in extent around their origin, so the same indices come up in most
+//       submaps.
+// NOTE: Only blocks allocated through the pool are served from it, i.e. those
+//       of decoding and fusion, not yet those of the TSDF integrators.
+class TsdfBlockPool {
+ public:
+  typedef std::shared_ptr<TsdfBlockPool> Ptr;
+
+  TsdfBlockPool(const FloatingPoint voxel_size, const size_t voxels_per_side,
+                const size_t max_pooled_blocks);
+
+  // Adds a block (with cleared voxels) to the layer, replacing the block with
+  // this index (if any).
+  Block<TsdfVoxel>::Ptr allocateBlockPtrByIndex(
+      const voxblox::BlockIndex& block_index,
+      Layer<TsdfVoxel>* tsdf_layer_ptr);
+
+  // Removes all blocks from the layer. Those not held elsewhere are kept for
+  // reuse (up to the capacity of the pool).
+  void recycleAllBlocks(Layer<TsdfVoxel>* tsdf_layer_ptr);
+
+  // Frees the pooled blocks above the new capacity
+  void setMaxPooledBlocks(const size_t max_pooled_blocks);
+
+  TsdfBlockPoolStats getStats() const;
+
+ private:
+  bool matchesLayer(const Layer<TsdfVoxel>& tsdf_layer) const;
+  size_t getBlockMemoryBytes() const {
+    return voxels_per_side_ * voxels_per_side_ * voxels_per_side_ *
+           sizeof(TsdfVoxel);
+  }
+  // Drops pooled blocks until the capacity is met. Call with the mutex held.
+  void trimToCapacity();
+
+  const FloatingPoint voxel_size_;
+  const size_t voxels_per_side_;
+
+  mutable std::mutex mutex_;
+  size_t max_pooled_blocks_;
+  voxblox::AnyIndexHashMapType<std::vector<Block<TsdfVoxel>::Ptr>>::type
+      pooled_blocks_;
+  TsdfBlockPoolStats stats_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_CORE_TSDF_BLOCK_POOL_H_
@@ -1,7 +1,9 @@
 #ifndef CBLOX_CORE_TSDF_ESDF_SUBMAP_H_
 #define CBLOX_CORE_TSDF_ESDF_SUBMAP_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 
 #include <voxblox/integrator/esdf_integrator.h>
 
@@ -20,25 +22,50 @@ class TsdfEsdfSubmap : public TsdfSubmap {
                  voxblox::EsdfIntegrator::Config esdf_integrator_config =
                      voxblox::EsdfIntegrator::Config())
       : TsdfSubmap(T_M_S, submap_id, config),
-        esdf_integrator_config_(esdf_integrator_config) {
-    esdf_map_.reset(new EsdfMap(config));
+        esdf_map_config_(config),
+        esdf_integrator_config_(esdf_integrator_config),
+        esdf_ready_(false) {
+    esdf_map_.reset(new EsdfMap(esdf_map_config_));
   }
 
   ~TsdfEsdfSubmap() {
     if (!esdf_map_.unique()) {
-      LOG(WARNING) << "Underlying esdf map from SubmapID: " << submap_id_
-                   << " is NOT unique. Therefore its memory may leak.";
+      VLOG(1) << "Underlying esdf map from SubmapID: " << submap_id_
+              << " is shared, and kept by its other holders.";
     } else {
       LOG(INFO) << "EsdfSubmap " << submap_id_ << " is being deleted.";
     }
   }
 
   // Generate the ESDF from the TSDF
+  // NOTE: The ESDF is generated into a new map, which then replaces the current
+  //       one. Readers holding a pointer to the previous ESDF (see
+  //       getEsdfMapConstPtr()) are therefore not disturbed. Once generated,
+  //       the ESDF is marked as ready.
   void generateEsdf();
+  bool isEsdfReady() const { return esdf_ready_; }
+
+  // Takes over the ESDF (and its readiness) of a submap holding the same TSDF,
+  // e.g. when duplicating the submap, rather than copying or regenerating it.
+  // NOTE: The ESDF is shared copy-on-write. generateEsdf() swaps in a new map
+  //       rather than writing the current one, and getEsdfMapPtr() clones a
+  //       shared map before handing it out.
+  void shareEsdf(const TsdfEsdfSubmap &source_submap);
 
   // Returns the underlying ESDF map pointers
-  EsdfMap::Ptr getEsdfMapPtr() { return esdf_map_; }
-  const EsdfMap &getEsdfMap() const { return *esdf_map_; }
+  // NOTE: Returned by (shared) pointer, not by reference, such that the map
+  //       outlives a concurrent generateEsdf() swapping in its successor.
+  //       The mutable pointer is to a map held by this submap only: if any
+  //       other submap or reader holds the current map, it is first cloned.
+  //       Holders of the previous map keep seeing it as it was.
+  EsdfMap::Ptr getEsdfMapPtr();
+  std::shared_ptr<const EsdfMap> getEsdfMapConstPtr() const {
+    std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+    return esdf_map_;
+  }
+  std::shared_ptr<const EsdfMap> getEsdfMap() const {
+    return getEsdfMapConstPtr();
+  }
 
   /* NOTE: When converting TsdfEsdf submaps into protobuffs, only their
    *       TSDF map is converted. The ESDF can be recomputed when needed.
@@ -47,8 +74,15 @@ class TsdfEsdfSubmap : public TsdfSubmap {
    */
 
  private:
+  // Guards the ESDF map pointer (not the map itself)
+  mutable std::mutex esdf_map_mutex_;
   EsdfMap::Ptr esdf_map_;
+  const EsdfMap::Config esdf_map_config_;
   voxblox::EsdfIntegrator::Config esdf_integrator_config_;
+
+  // Serializes (concurrent) requests to generate the ESDF
+  std::mutex esdf_generation_mutex_;
+  std::atomic<bool> esdf_ready_;
 };
 }  // namespace cblox
 
@@ -1,15 +1,23 @@
 #ifndef CBLOX_CORE_TSDF_SUBMAP_H_
 #define CBLOX_CORE_TSDF_SUBMAP_H_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <string>
 
 #include <Eigen/Geometry>
 
 #include <glog/logging.h>
 
 #include "./TsdfSubmap.pb.h"
+#include "cblox/core/bounding_box.h"
 #include "cblox/core/common.h"
+#include "cblox/core/tsdf_block_encoding.h"
+#include "cblox/core/tsdf_block_pool.h"
+#include "cblox/io/submap_file.h"
+#include "cblox/utils/reader_writer_mutex.h"
 
 namespace cblox {
 
@@ -22,7 +30,25 @@ class TsdfSubmap {
 
   // Constructor
   TsdfSubmap(const Transformation& T_M_S, SubmapID submap_id, Config config)
-      : submap_id_(submap_id), T_M_S_(T_M_S) {
+      : submap_id_(submap_id),
+        tsdf_version_(newVersion()),
+        pose_version_(newVersion()),
+        frozen_(false),
+        last_access_stamp_(newAccessStamp()),
+        paged_out_(false),
+        paged_out_num_blocks_(0),
+        page_file_byte_offset_(0),
+        page_file_num_bytes_(0),
+        page_file_tsdf_version_(0),
+        compressed_(false),
+        encoded_num_blocks_(0),
+        num_accesses_(0),
+        num_page_ins_(0),
+        num_decompressions_(0),
+        bounding_boxes_valid_(false),
+        bounding_box_tsdf_version_(0),
+        bounding_box_pose_version_(0),
+        T_M_S_(T_M_S) {
     tsdf_map_.reset(new TsdfMap(config));
   }
 
@@ -32,15 +58,64 @@ class TsdfSubmap {
                    << " is NOT unique. Therefore its memory may leak.";
     } else {
       LOG(INFO) << "TsdfSubmap " << submap_id_ << " is being deleted.";
+      if (block_pool_) {
+        block_pool_->recycleAllBlocks(tsdf_map_->getTsdfLayerPtr());
+      }
     }
+    removePageFile();
   }
 
   // Returns the underlying TSDF map pointers
-  TsdfMap::Ptr getTsdfMapPtr() { return tsdf_map_; }
-  const TsdfMap& getTsdfMap() const { return *tsdf_map_; }
+  // NOTE: Mutable access to the TSDF counts as a modification.
+  // NOTE: Paged out submaps are paged in, and compressed submaps decompressed,
+  //       on access.
+  TsdfMap::Ptr getTsdfMapPtr() {
+    pageInIfRequired();
+    markTsdfModified();
+    return tsdf_map_;
+  }
+  const TsdfMap& getTsdfMap() const {
+    pageInIfRequired();
+    return *tsdf_map_;
+  }
+
+  // Modification stamps. These change each time the TSDF or the pose of the
+  // submap (possibly) changes, such that derived data (e.g. meshes) can be
+  // recomputed only when required. Stamps are unique over all submaps, such
+  // that a submap replaced by a copy never matches stale derived data.
+  // NOTE: Code which holds on to the TSDF layer (such as the integrator) has to
+  //       call markTsdfModified() itself.
+  void markTsdfModified() { tsdf_version_ = newVersion(); }
+  size_t getTsdfVersion() const { return tsdf_version_; }
+  size_t getPoseVersion() const { return pose_version_; }
+
+  // Concurrency. The TSDF is written under the writer lock, and read under the
+  // reader lock. Frozen submaps are no longer written, so their reader lock is
+  // a no-op, which makes reading them lock-free.
+  // NOTE: The collection freezes submaps when they stop being active, and
+  //       copies (rather than modifies) frozen submaps, such that readers
+  //       holding a pointer to a frozen submap may keep reading it while the
+  //       collection changes.
+  // NOTE: Taking the reader lock counts as an access to the submap (for
+  //       paging), and pages the submap in (or decompresses it) if needed.
+  ReaderLock getTsdfReaderLock() const {
+    last_access_stamp_ = newAccessStamp();
+    num_accesses_++;
+    pageInIfRequired();
+    return lockTsdfForReading();
+  }
+  WriterLock getTsdfWriterLock() { return WriterLock(tsdf_mutex_); }
+  bool isFrozen() const { return frozen_; }
+  void freeze() {
+    // Waiting for the running writes to finish
+    const WriterLock tsdf_lock(tsdf_mutex_);
+    frozen_ = true;
+  }
 
   // Submap pose interaction
-  const Transformation& getPose() const {
+  // NOTE: Returned by value, as the pose may be changed by another thread once
+  //       the lock is released.
+  Transformation getPose() const {
     std::unique_lock<std::mutex> lock(transformation_mutex);
     return T_M_S_;
   }
@@ -48,6 +123,7 @@ class TsdfSubmap {
   void setPose(const Transformation& T_M_S) {
     std::unique_lock<std::mutex> lock(transformation_mutex);
     T_M_S_ = T_M_S;
+    pose_version_ = newVersion();
   }
 
   SubmapID getID() const { return submap_id_; }
@@ -55,20 +131,175 @@ class TsdfSubmap {
   FloatingPoint block_size() const { return tsdf_map_->block_size(); }
 
   size_t getNumberAllocatedBlocks() const {
+    if (isPagedOut()) {
+      return paged_out_num_blocks_;
+    }
+    if (isCompressed()) {
+      return encoded_num_blocks_;
+    }
+    const ReaderLock tsdf_lock = lockTsdfForReading();
     return tsdf_map_->getTsdfLayer().getNumberOfAllocatedBlocks();
   }
 
+  // Paging. Paged out submaps keep their header, pose, bounding boxes and
+  // stamps in memory, while their blocks are written to file (in the
+  // saveToStream() format). They are paged back in transparently, on the next
+  // access to their TSDF.
+  // NOTE: Only frozen submaps may be paged out, and only while no one else is
+  //       reading them. The collection takes care of this, see
+  //       SubmapCollection::enforceMemoryBudget().
+  bool pageOut(const std::string& page_file_path);
+  // Writes the page file (unless the one from last time is still current)
+  // without dropping the blocks. Unlike pageOut(), this may be called while
+  // the submap is being read. A following pageOut() then only drops the
+  // blocks, such that the file I/O can happen outside of the collection lock.
+  bool writePageFile(const std::string& page_file_path);
+  bool isPagedOut() const { return paged_out_; }
+  // Makes this (new, empty) submap a paged out view of a submap stored in a
+  // shared file (e.g. a collection file), such that its blocks are only read on
+  // first access. The submap is frozen, and never removes the file.
+  void setPagedOutToFile(const io::SubmapFileReader::Ptr& file_reader_ptr,
+                         const uint64_t byte_offset, const uint64_t num_bytes,
+                         const size_t num_blocks,
+                         const BoundingBox& bounding_box_S);
+  // Compression. Compressed submaps keep their blocks in memory in the compact
+  // (lossy) encoding of tsdf_block_encoding.h, which takes a fraction of the
+  // memory. They are decompressed transparently, on the next access to their
+  // TSDF, and are saved and paged out without being decompressed.
+  // NOTE: As for paging, only frozen submaps may be compressed, and only while
+  //       no one else is reading them.
+  bool compress(const TsdfBlockEncodingConfig& encoding_config);
+  // Compression in two steps, as for paging. encodeTsdf() encodes the blocks,
+  // which may be done while the submap is being read. compress() with the
+  // result then only swaps the encoding in for the blocks, such that the
+  // encoding can happen outside of the collection lock. Returns false if the
+  // submap is already compressed (or paged out), or if its TSDF changed since.
+  struct EncodedTsdf {
+    std::string encoded_blocks;
+    size_t num_blocks = 0;
+    size_t tsdf_version = 0;
+  };
+  bool encodeTsdf(const TsdfBlockEncodingConfig& encoding_config,
+                  EncodedTsdf* encoded_tsdf_ptr) const;
+  bool compress(EncodedTsdf* encoded_tsdf_ptr);
+  bool isCompressed() const { return compressed_; }
+  // The memory taken up by the blocks of this submap, if in memory
+  size_t getResidentMemoryBytes() const;
+  // Stamp of the last access. Larger stamps are more recent.
+  size_t getLastAccessStamp() const { return last_access_stamp_; }
+  size_t getNumAccesses() const { return num_accesses_; }
+  size_t getNumPageIns() const { return num_page_ins_; }
+  size_t getNumDecompressions() const { return num_decompressions_; }
+
+  // The pool the blocks of this submap are returned to when freed (on
+  // destruction, paging out or compression), and decompressed blocks are taken
+  // from. Set by the collection, before the submap is shared.
+  void setBlockPool(const TsdfBlockPool::Ptr& block_pool_ptr) {
+    block_pool_ = block_pool_ptr;
+  }
+  const TsdfBlockPool::Ptr& getBlockPool() const { return block_pool_; }
+
+  // The axis aligned bounding box of the allocated blocks, in the submap frame
+  // (S) and in the global map frame (M). These are recomputed lazily, when the
+  // TSDF or the pose changed since they were last requested.
+  BoundingBox getSubmapFrameBoundingBox() const;
+  BoundingBox getGlobalFrameBoundingBox() const;
+
   // Getting the proto for this submap
   void getProto(TsdfSubmapProto* proto) const;
 
-  // Save the submap to file
-  bool saveToStream(std::fstream* outfile_ptr) const;
+  // Save the submap to file. The header written is returned (if requested).
+  // NOTE: Paged out submaps are copied from their page file, rather than paged
+  //       in.
+  bool saveToStream(std::fstream* outfile_ptr,
+                    TsdfSubmapProto* header_proto = nullptr) const;
+  // Appends the bytes saveToStream() writes, such that submaps can be
+  // serialized in parallel while being written in order.
+  bool serializeToString(std::string* bytes,
+                         TsdfSubmapProto* header_proto = nullptr) const;
+  // As serializeToString(), but with the blocks in the compact encoding (see
+  // compress()), e.g. to send the submap over the network.
+  // NOTE: The blocks of compressed submaps are taken as they are, and those of
+  //       paged out submaps as they were written.
+  bool serializeEncodedToString(const TsdfBlockEncodingConfig& encoding_config,
+                                std::string* bytes,
+                                TsdfSubmapProto* header_proto = nullptr) const;
 
  protected:
   SubmapID submap_id_;
   TsdfMap::Ptr tsdf_map_;
 
+  // Modification stamps
+  std::atomic<size_t> tsdf_version_;
+  std::atomic<size_t> pose_version_;
+
+  // Guards the TSDF of submaps which are not yet frozen
+  mutable ReaderWriterMutex tsdf_mutex_;
+  std::atomic<bool> frozen_;
+
  private:
+  // Returns a stamp which has not been handed out before
+  static size_t newVersion();
+  static size_t newAccessStamp();
+
+  // getProto() and serializeToString() without taking the TSDF lock. Call
+  // serializeTsdfToString() with the paging mutex held if compressed.
+  void fillProto(TsdfSubmapProto* proto) const;
+  bool serializeTsdfToString(std::string* bytes,
+                             TsdfSubmapProto* header_proto) const;
+
+  // Frees the blocks of the layer (to the pool, if set)
+  void removeAllBlocks(Layer<TsdfVoxel>* tsdf_layer_ptr) const;
+
+  // Locks the TSDF (if not frozen), without paging in or counting an access
+  ReaderLock lockTsdfForReading() const {
+    return isFrozen() ? ReaderLock() : ReaderLock(&tsdf_mutex_);
+  }
+
+  // Paging (and decompression)
+  void pageInIfRequired() const;
+  // Call with the paging mutex held
+  bool writePageFileLocked(const std::string& page_file_path);
+  bool hasPageFile() const {
+    return page_file_reader_ || !page_file_path_.empty();
+  }
+  io::SubmapFileReader::Ptr openPageFile() const;
+  bool copyPageToString(std::string* bytes,
+                        TsdfSubmapProto* header_proto) const;
+  void removePageFile();
+  mutable std::atomic<size_t> last_access_stamp_;
+  mutable std::mutex paging_mutex_;
+  mutable std::atomic<bool> paged_out_;
+  size_t paged_out_num_blocks_;
+  // The page file is either written (and owned) by this submap, or shared
+  // (e.g. the collection file this submap was loaded from).
+  std::string page_file_path_;
+  io::SubmapFileReader::Ptr page_file_reader_;
+  // Where the submap starts within the page file, and its length
+  uint64_t page_file_byte_offset_;
+  uint64_t page_file_num_bytes_;
+  // The TSDF stamp at which the page file was written
+  size_t page_file_tsdf_version_;
+  // The encoded blocks of compressed submaps (guarded by the paging mutex)
+  mutable std::atomic<bool> compressed_;
+  mutable std::string encoded_blocks_;
+  size_t encoded_num_blocks_;
+  mutable std::atomic<size_t> num_accesses_;
+  mutable std::atomic<size_t> num_page_ins_;
+  mutable std::atomic<size_t> num_decompressions_;
+  TsdfBlockPool::Ptr block_pool_;
+
+  // Recomputes the bounding boxes if outdated. Call with the box mutex held.
+  void updateBoundingBoxes() const;
+
+  // The cached bounding boxes and the stamps they were computed at
+  mutable std::mutex bounding_box_mutex_;
+  mutable bool bounding_boxes_valid_;
+  mutable size_t bounding_box_tsdf_version_;
+  mutable size_t bounding_box_pose_version_;
+  mutable BoundingBox bounding_box_S_;
+  mutable BoundingBox bounding_box_M_;
+
   // The pose of this submap in the global map frame
   mutable std::mutex transformation_mutex;
   Transformation T_M_S_;
@@ -0,0 +1,55 @@
+#ifndef CBLOX_INTEGRATOR_ASYNC_ESDF_GENERATOR_H_
+#define CBLOX_INTEGRATOR_ASYNC_ESDF_GENERATOR_H_
+
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/tsdf_esdf_submap.h"
+#include "cblox/utils/thread_pool.h"
+
+namespace cblox {
+
+// Generates the ESDFs of (finished) submaps on background threads, such that
+// the 100-500ms ESDF batch update doesn't block integration.
+class AsyncEsdfGenerator {
+ public:
+  typedef std::function<void(const TsdfEsdfSubmap::ConstPtr&)>
+      EsdfReadyCallback;
+
+  // NOTE: A single thread by default, such that the ESDF generation doesn't
+  //       compete with integration for cores.
+  explicit AsyncEsdfGenerator(const size_t num_threads = 1)
+      : thread_pool_(num_threads) {}
+
+  // Queues the ESDF generation of a submap. The future becomes ready once the
+  // submap's ESDF is ready.
+  std::shared_future<void> generateEsdf(const TsdfEsdfSubmap::Ptr& submap_ptr);
+
+  // Generates the ESDF of each submap finished in the collection.
+  // NOTE: The generator has to outlive the collection.
+  void attachToCollection(SubmapCollection<TsdfEsdfSubmap>* collection_ptr);
+
+  // Registers a function called (on a worker thread) with each submap once
+  // its ESDF is ready.
+  void addEsdfReadyCallback(const EsdfReadyCallback& callback);
+
+  size_t getNumPending() const { return thread_pool_.getNumPendingTasks(); }
+  void waitUntilIdle() const { thread_pool_.waitUntilIdle(); }
+
+ private:
+  void notifyEsdfReady(const TsdfEsdfSubmap::ConstPtr& submap_ptr) const;
+
+  mutable std::mutex callbacks_mutex_;
+  std::vector<EsdfReadyCallback> esdf_ready_callbacks_;
+
+  // NOTE: Declared last, such that the workers are joined before the members
+  //       they use are destroyed.
+  ThreadPool thread_pool_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_INTEGRATOR_ASYNC_ESDF_GENERATOR_H_
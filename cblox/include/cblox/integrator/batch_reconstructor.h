@@ -0,0 +1,112 @@
+#ifndef CBLOX_INTEGRATOR_BATCH_RECONSTRUCTOR_H_
+#define CBLOX_INTEGRATOR_BATCH_RECONSTRUCTOR_H_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <voxblox/integrator/tsdf_integrator.h>
+#include <voxblox/mesh/mesh_integrator.h>
+
+#include "cblox/core/common.h"
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/submap_creation_policy.h"
+#include "cblox/core/tsdf_submap.h"
+#include "cblox/integrator/point_cloud_downsampler.h"
+#include "cblox/integrator/tsdf_submap_collection_integrator.h"
+#include "cblox/io/scan_dataset_io.h"
+#include "cblox/mesh/submap_mesher.h"
+#include "cblox/utils/thread_pool.h"
+
+namespace cblox {
+
+struct BatchReconstructionConfig {
+  BatchReconstructionConfig()
+      : num_integrated_frames_per_submap(20),
+        mesh_finished_submaps(false),
+        num_meshing_threads(1) {}
+  // Only used without a (custom) submap creation policy
+  size_t num_integrated_frames_per_submap;
+  // Meshes submaps as they are finished, in the background, such that the
+  // mesh is (almost) ready when the last scan is integrated.
+  bool mesh_finished_submaps;
+  size_t num_meshing_threads;
+  // Merging the points of each scan per voxel before integrating
+  PointCloudDownsamplingConfig downsampling_config;
+};
+
+struct BatchReconstructionStats {
+  size_t num_frames = 0;
+  size_t num_points = 0;
+  // After downsampling (if enabled)
+  size_t num_integrated_points = 0;
+  double duration_s = 0.0;
+  // Of which spent waiting for the next scan to be read
+  double read_wait_duration_s = 0.0;
+};
+
+// Builds a submap collection from a stream of scans as fast as possible,
+// without ROS. Unlike the server, no scan is ever dropped: each one is
+// integrated in order, so the result only depends on the input.
+// NOTE: The next scan is read on another thread while the current one is
+//       integrated. Finished submaps are frozen, so they are meshed in the
+//       background without holding up integration.
+class BatchReconstructor {
+ public:
+  // Fills the scan and returns true, or returns false at the end of the input
+  typedef std::function<bool(PosedScan*)> ScanSource;
+
+  BatchReconstructor(
+      const TsdfMap::Config& tsdf_map_config,
+      const voxblox::TsdfIntegratorBase::Config& tsdf_integrator_config,
+      const voxblox::TsdfIntegratorType& tsdf_integrator_type,
+      const voxblox::MeshIntegratorConfig& mesh_config,
+      const BatchReconstructionConfig& config = BatchReconstructionConfig());
+  // Unregisters the background meshing from the collection, which may outlive
+  // the reconstructor (see getSubmapCollection()).
+  ~BatchReconstructor();
+
+  // Replaces the per frame count policy of the config
+  void setSubmapCreationPolicy(
+      const SubmapCreationPolicy::Ptr& submap_creation_policy);
+
+  // Integrates all scans of the source. Can be called repeatedly to continue
+  // the reconstruction.
+  BatchReconstructionStats run(const ScanSource& scan_source);
+  BatchReconstructionStats run(io::ScanDatasetReader* reader_ptr);
+
+  // The output. The mesh is built from the cached (background) submap meshes.
+  bool saveMap(const std::string& file_path) const;
+  bool saveMesh(const std::string& file_path);
+
+  const std::shared_ptr<SubmapCollection<TsdfSubmap>>& getSubmapCollection()
+      const {
+    return tsdf_submap_collection_ptr_;
+  }
+
+ private:
+  void integrateScan(const PosedScan& scan);
+  void updateActiveSubmapState(const PosedScan& scan);
+  void createNewSubMap(const Transformation& T_G_S);
+
+  const BatchReconstructionConfig config_;
+
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> tsdf_submap_collection_ptr_;
+  std::unique_ptr<TsdfSubmapCollectionIntegrator> integrator_ptr_;
+  SubmapMesher submap_mesher_;
+
+  SubmapCreationPolicy::Ptr submap_creation_policy_;
+  ActiveSubmapState active_submap_state_;
+
+  // The ID of the finished submap callback queuing the background meshing
+  bool has_submap_finished_callback_ = false;
+  size_t submap_finished_callback_id_ = 0;
+
+  // NOTE: Declared last, such that the workers are joined before the mesher and
+  //       collection they use are destroyed.
+  std::unique_ptr<ThreadPool> meshing_thread_pool_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_INTEGRATOR_BATCH_RECONSTRUCTOR_H_
@@ -0,0 +1,98 @@
+#ifndef CBLOX_INTEGRATOR_POINT_CLOUD_DOWNSAMPLER_H_
+#define CBLOX_INTEGRATOR_POINT_CLOUD_DOWNSAMPLER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <voxblox/core/block_hash.h>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+// Merging the points of a scan which fall into the same voxel before
+// integration. Dense (e.g. close range lidar) scans send many points into
+// each voxel, which cost a ray cast each but change the TSDF little beyond
+// the first.
+// NOTE: The TSDF integrators take no per-point weights, so a merged point is
+//       integrated with the weight of a single point, rather than that of the
+//       points it replaces. The voxel weights so grow slower (by up to the
+//       number of points per voxel), and a surface takes more scans to
+//       outweigh its old observations (e.g. after it moved). Hence off by
+//       default. Where the weights matter, the voxblox "merged" integrator
+//       merges the points per voxel while keeping their sum of weights.
+struct PointCloudDownsamplingConfig {
+  PointCloudDownsamplingConfig() : enable(false), voxel_size_factor(1.0f) {}
+  bool enable;
+  // The size of the cells points are merged in, relative to the TSDF voxels
+  FloatingPoint voxel_size_factor;
+};
+
+struct PointCloudDownsamplingStats {
+  // Of the last scan
+  size_t last_num_input_points = 0;
+  size_t last_num_output_points = 0;
+  // Since the start (or the last reset)
+  size_t num_scans = 0;
+  size_t num_input_points = 0;
+  size_t num_output_points = 0;
+  // The fraction of the points of the last scan which were merged away
+  double getLastReductionRatio() const {
+    return (last_num_input_points == 0)
+               ? 0.0
+               : 1.0 - static_cast<double>(last_num_output_points) /
+                           static_cast<double>(last_num_input_points);
+  }
+  // The fraction of all points which were merged away
+  double getReductionRatio() const {
+    return (num_input_points == 0)
+               ? 0.0
+               : 1.0 - static_cast<double>(num_output_points) /
+                           static_cast<double>(num_input_points);
+  }
+};
+
+// Buckets the points of a scan by the voxel of the submap (S) they fall into,
+// and replaces each bucket by the mean of its points and colors. The output
+// points stay in the sensor frame (C).
+// NOTE: The points of a bucket come from (almost) the same ray, so the merged
+//       point keeps the ray, while averaging out the range noise. Their
+//       weights are not kept (see PointCloudDownsamplingConfig). The buffers
+//       are kept between scans, such that downsampling doesn't allocate in
+//       steady state.
+class PointCloudDownsampler {
+ public:
+  PointCloudDownsampler(const PointCloudDownsamplingConfig& config,
+                        const FloatingPoint tsdf_voxel_size);
+
+  void downsample(const Transformation& T_S_C, const Pointcloud& points_C,
+                  const Colors& colors, Pointcloud* downsampled_points_C,
+                  Colors* downsampled_colors);
+
+  const PointCloudDownsamplingConfig& getConfig() const { return config_; }
+  const PointCloudDownsamplingStats& getStats() const { return stats_; }
+  void resetStats() { stats_ = PointCloudDownsamplingStats(); }
+
+ private:
+  // The sums of the points (and colors) of a cell
+  struct Cell {
+    Point point_sum_C;
+    uint32_t r_sum;
+    uint32_t g_sum;
+    uint32_t b_sum;
+    uint32_t a_sum;
+    uint32_t num_points;
+  };
+
+  const PointCloudDownsamplingConfig config_;
+  const FloatingPoint cell_size_inv_;
+
+  voxblox::LongIndexHashMapType<size_t>::type index_to_cell_;
+  std::vector<Cell> cells_;
+
+  PointCloudDownsamplingStats stats_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_INTEGRATOR_POINT_CLOUD_DOWNSAMPLER_H_
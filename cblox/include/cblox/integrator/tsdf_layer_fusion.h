@@ -0,0 +1,48 @@
+#ifndef CBLOX_INTEGRATOR_TSDF_LAYER_FUSION_H_
+#define CBLOX_INTEGRATOR_TSDF_LAYER_FUSION_H_
+
+#include <vector>
+
+#include "cblox/core/common.h"
+#include "cblox/core/tsdf_block_pool.h"
+
+namespace cblox {
+
+// Weighted fusion of voxel A into voxel B
+inline void fuseTsdfVoxel(const TsdfVoxel& voxel_A, TsdfVoxel* voxel_B_ptr) {
+  if (voxel_A.weight <= 0.0f) {
+    return;
+  }
+  const float combined_weight = voxel_A.weight + voxel_B_ptr->weight;
+  voxel_B_ptr->distance = (voxel_A.distance * voxel_A.weight +
+                           voxel_B_ptr->distance * voxel_B_ptr->weight) /
+                          combined_weight;
+  voxel_B_ptr->color =
+      Color::blendTwoColors(voxel_A.color, voxel_A.weight, voxel_B_ptr->color,
+                            voxel_B_ptr->weight);
+  voxel_B_ptr->weight = combined_weight;
+}
+
+// Fuses several TSDF layers A_i, at poses T_B_A_i, into layer B. The voxels of
+// B are interpolated from the layers A_i, block by block, over num_threads.
+// Returns the number of blocks of B fused into. New blocks are taken from the
+// pool, if given.
+// NOTE: Equivalent to calling voxblox::mergeLayerAintoLayerB() for each layer,
+//       without the intermediate (transformed) layers. The layers must not be
+//       modified concurrently.
+size_t fuseTsdfLayersIntoLayer(
+    const std::vector<const Layer<TsdfVoxel>*>& tsdf_layers_A,
+    const TransformationVector& T_B_A_vector, const size_t num_threads,
+    Layer<TsdfVoxel>* tsdf_layer_B_ptr,
+    TsdfBlockPool* block_pool_ptr = nullptr);
+
+// Fuses each cube of factor^3 voxels of layer A into a voxel of layer B, which
+// has factor times the voxel size (and the same voxels per side), e.g. to mesh
+// distant submaps at a lower resolution. Returns the number of blocks of B.
+size_t downsampleTsdfLayer(const Layer<TsdfVoxel>& tsdf_layer_A,
+                           const size_t factor,
+                           Layer<TsdfVoxel>* tsdf_layer_B_ptr);
+
+}  // namespace cblox
+
+#endif  // CBLOX_INTEGRATOR_TSDF_LAYER_FUSION_H_
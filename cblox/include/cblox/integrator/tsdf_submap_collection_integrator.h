@@ -2,6 +2,8 @@
 #define CBLOX_INTEGRATOR_TSDF_SUBMAP_COLLECTION_INTEGRATOR_H_
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <voxblox/core/tsdf_map.h>
 #include <voxblox/integrator/tsdf_integrator.h>
@@ -9,15 +11,58 @@
 #include "cblox/core/common.h"
 #include "cblox/core/submap_collection.h"
 #include "cblox/core/tsdf_submap.h"
+#include "cblox/integrator/point_cloud_downsampler.h"
 
 namespace cblox {
 
-class TsdfSubmapCollectionIntegrator {
+// Integration into previously finished submaps when revisiting an area. The
+// points of each scan which fall into the (global frame) bounding box of a
+// nearby submap are integrated into that submap, rather than into the active
+// submap, such that revisited areas extend the existing submaps instead of
+// being duplicated.
+struct RevisitIntegrationConfig {
+  RevisitIntegrationConfig()
+      : enable(false),
+        max_revisit_submaps(2),
+        min_point_fraction(0.1),
+        release_after_num_scans(10) {}
+  bool enable;
+  // The number of submaps integrated into (besides the active submap)
+  size_t max_revisit_submaps;
+  // The fraction of the points of a scan a submap has to contain in order to
+  // be integrated into
+  double min_point_fraction;
+  // Revisited submaps are finished (frozen) again after this many scans
+  // without points in them
+  size_t release_after_num_scans;
+};
+
+// The integrator type with the given name (see
+// voxblox::kTsdfIntegratorTypeNames). Fails on unknown names.
+inline voxblox::TsdfIntegratorType getTsdfIntegratorTypeFromName(
+    const std::string& integrator_type_name) {
+  int integrator_type_idx = 1;
+  for (const std::string& valid_integrator_type_name :
+       voxblox::kTsdfIntegratorTypeNames) {
+    if (integrator_type_name == valid_integrator_type_name) {
+      return static_cast<voxblox::TsdfIntegratorType>(integrator_type_idx);
+    }
+    ++integrator_type_idx;
+  }
+  LOG(FATAL) << "Unknown TSDF integrator type: " << integrator_type_name;
+  return voxblox::TsdfIntegratorType::kFast;
+}
+
+// Integrates scans into a submap collection. Generated for each submap type.
+// NOTE: Only the TSDF is integrated into. Layers derived from it (e.g. the
+//       ESDF) are computed once the submaps are finished.
+template <typename SubmapType>
+class SubmapCollectionIntegrator {
  public:
-  TsdfSubmapCollectionIntegrator(
+  SubmapCollectionIntegrator(
       const voxblox::TsdfIntegratorBase::Config& tsdf_integrator_config,
       const voxblox::TsdfIntegratorType& tsdf_integrator_type,
-      const std::shared_ptr<SubmapCollection<TsdfSubmap>>&
+      const std::shared_ptr<SubmapCollection<SubmapType>>&
           tsdf_submap_collection_ptr)
       : tsdf_integrator_config_(tsdf_integrator_config),
         tsdf_submap_collection_ptr_(tsdf_submap_collection_ptr),
@@ -29,10 +74,59 @@ class TsdfSubmapCollectionIntegrator {
   void integratePointCloud(const Transformation& T_G_C,
                            const Pointcloud& points_C, const Colors& colors);
 
+  // Integrates the scans of several sensors (e.g. taken within a short time
+  // window) into the active submap in one go. The submap is locked, and its
+  // derived data invalidated, once for the whole batch.
+  // NOTE: Each scan is ray cast from its own sensor origin, so they are passed
+  //       to the voxblox integrator one after another, which spreads each over
+  //       the integrator threads (see integrator_threads of its config).
+  void integratePointClouds(const AlignedVector<PosedScan>& scans);
+
   // Changes the active submap to the last one on the collection
   void switchToActiveSubmap();
 
+  // Revisit integration
+  // NOTE: Disabling it (or calling releaseRevisitSubmaps()) finishes the
+  //       revisited submaps.
+  void setRevisitConfig(const RevisitIntegrationConfig& revisit_config);
+  void releaseRevisitSubmaps();
+
+  // Downsampling the scans before integration (see PointCloudDownsampler)
+  // NOTE: The points are merged in the voxels of the active submap, also those
+  //       going to revisited submaps.
+  void setDownsamplingConfig(
+      const PointCloudDownsamplingConfig& downsampling_config);
+  PointCloudDownsamplingStats getDownsamplingStats() const;
+
  private:
+  // A revisited submap being integrated into
+  struct RevisitTarget {
+    typename SubmapType::Ptr submap_ptr;
+    voxblox::TsdfIntegratorBase::Ptr tsdf_integrator;
+    size_t num_scans_without_points;
+  };
+
+  // Integrates into a submap under its writer lock
+  static void integrateIntoSubmap(const Transformation& T_S_C,
+                                  const Pointcloud& points_C,
+                                  const Colors& colors,
+                                  voxblox::TsdfIntegratorBase* tsdf_integrator,
+                                  SubmapType* submap_ptr);
+
+  // Splits the points between the active and the revisited submaps, and
+  // integrates each part into its submap (in parallel).
+  void integratePointCloudWithRevisits(const Transformation& T_G_C,
+                                       const Pointcloud& points_C,
+                                       const Colors& colors);
+
+  // Picks the revisited submaps for a scan, and assigns each point to a
+  // target. Index 0 is the active submap, index i > 0 revisit target i - 1.
+  void assignPointsToTargets(const Pointcloud& points_G,
+                             std::vector<size_t>* point_targets);
+  // Adds a revisit target, finishing the stalest target if at capacity.
+  // Returns false if the submap couldn't be made writable.
+  bool addRevisitTarget(const SubmapID submap_id);
+
   // Initializes the integrator
   void initializeIntegrator(const TsdfMap::Ptr& tsdf_map_ptr);
 
@@ -45,13 +139,18 @@ class TsdfSubmapCollectionIntegrator {
   Transformation getSubmapRelativePose(const Transformation& T_G_C) const;
 
   // The submap collection
-  std::shared_ptr<cblox::SubmapCollection<TsdfSubmap>>
+  std::shared_ptr<cblox::SubmapCollection<SubmapType>>
       tsdf_submap_collection_ptr_;
 
   // Transform to the currently targeted submap
   // NOTE(alexmilane): T_G_S - Transformation between Submap base frame (S) and
   //                           the global tracking frame (G).
+  // NOTE: The inverse is kept as well, as it's used every frame.
   Transformation T_G_S_active_;
+  Transformation T_S_G_active_;
+
+  // The currently targeted submap. Used to flag its TSDF as modified.
+  typename SubmapType::Ptr active_submap_ptr_;
 
   // The integrator
   const voxblox::TsdfIntegratorBase::Config tsdf_integrator_config_;
@@ -59,8 +158,22 @@ class TsdfSubmapCollectionIntegrator {
 
   // Merging method for integrating new pointclouds
   const voxblox::TsdfIntegratorType method_;
+
+  // The revisited submaps
+  RevisitIntegrationConfig revisit_config_;
+  std::vector<RevisitTarget> revisit_targets_;
+
+  // Downsampling (if enabled), and the buffers of the downsampled scan(s)
+  std::unique_ptr<PointCloudDownsampler> downsampler_;
+  Pointcloud downsampled_points_C_;
+  Colors downsampled_colors_;
+  AlignedVector<PosedScan> downsampled_scans_;
 };
 
+typedef SubmapCollectionIntegrator<TsdfSubmap> TsdfSubmapCollectionIntegrator;
+
 }  // namespace cblox
 
+#include "cblox/integrator/tsdf_submap_collection_integrator_inl.h"
+
 #endif  // CBLOX_INTEGRATOR_TSDF_SUBMAP_COLLECTION_INTEGRATOR_H_
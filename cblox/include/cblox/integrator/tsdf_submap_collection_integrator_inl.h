@@ -0,0 +1,397 @@
+#ifndef CBLOX_INTEGRATOR_TSDF_SUBMAP_COLLECTION_INTEGRATOR_INL_H_
+#define CBLOX_INTEGRATOR_TSDF_SUBMAP_COLLECTION_INTEGRATOR_INL_H_
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "cblox/utils/parallel_for.h"
+
+namespace cblox {
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::integrateIntoSubmap(
+    const Transformation& T_S_C, const Pointcloud& points_C,
+    const Colors& colors, voxblox::TsdfIntegratorBase* tsdf_integrator,
+    SubmapType* submap_ptr) {
+  {
+    const WriterLock tsdf_lock = submap_ptr->getTsdfWriterLock();
+    // NOTE: Checked under the lock, as submaps are frozen under it.
+    CHECK(!submap_ptr->isFrozen())
+        << "Can't integrate. The integration target is frozen. Call "
+           "switchToActiveSubmap() after changing the active submap.";
+    tsdf_integrator->integratePointCloud(T_S_C, points_C, colors);
+  }
+  // Flagging the change, such that meshes etc. get recomputed.
+  submap_ptr->markTsdfModified();
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::integratePointCloud(
+    const Transformation& T_G_C, const Pointcloud& points_C,
+    const Colors& colors) {
+  CHECK(!tsdf_submap_collection_ptr_->empty())
+      << "Can't integrate. No submaps in collection.";
+  CHECK(tsdf_integrator_)
+      << "Can't integrate. Need to update integration target.";
+  // Getting the submap relative transform
+  // NOTE(alexmilane): T_S_C - Transformation between Camera frame (C) and
+  //                           the submap base frame (S).
+  const Transformation T_S_C = getSubmapRelativePose(T_G_C);
+  // Merging the points per voxel
+  if (downsampler_) {
+    downsampler_->downsample(T_S_C, points_C, colors, &downsampled_points_C_,
+                             &downsampled_colors_);
+  }
+  const Pointcloud& integrated_points_C =
+      downsampler_ ? downsampled_points_C_ : points_C;
+  const Colors& integrated_colors = downsampler_ ? downsampled_colors_ : colors;
+  if (revisit_config_.enable) {
+    integratePointCloudWithRevisits(T_G_C, integrated_points_C,
+                                    integrated_colors);
+    return;
+  }
+  // Passing data to the tsdf integrator
+  integrateIntoSubmap(T_S_C, integrated_points_C, integrated_colors,
+                      tsdf_integrator_.get(), active_submap_ptr_.get());
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::integratePointClouds(
+    const AlignedVector<PosedScan>& scans) {
+  CHECK(!tsdf_submap_collection_ptr_->empty())
+      << "Can't integrate. No submaps in collection.";
+  CHECK(tsdf_integrator_)
+      << "Can't integrate. Need to update integration target.";
+  // NOTE: Revisit integration splits each scan by target submap, so the scans
+  //       are integrated one by one.
+  if (revisit_config_.enable) {
+    for (const PosedScan& scan : scans) {
+      integratePointCloud(scan.T_G_C, scan.points_C, scan.colors);
+    }
+    return;
+  }
+  // Merging the points per voxel (into buffers kept between batches)
+  const AlignedVector<PosedScan>* integrated_scans = &scans;
+  if (downsampler_) {
+    downsampled_scans_.resize(scans.size());
+    for (size_t scan_idx = 0; scan_idx < scans.size(); scan_idx++) {
+      const PosedScan& scan = scans[scan_idx];
+      PosedScan& downsampled_scan = downsampled_scans_[scan_idx];
+      downsampled_scan.T_G_C = scan.T_G_C;
+      downsampler_->downsample(getSubmapRelativePose(scan.T_G_C),
+                               scan.points_C, scan.colors,
+                               &downsampled_scan.points_C,
+                               &downsampled_scan.colors);
+    }
+    integrated_scans = &downsampled_scans_;
+  }
+  {
+    const WriterLock tsdf_lock = active_submap_ptr_->getTsdfWriterLock();
+    CHECK(!active_submap_ptr_->isFrozen())
+        << "Can't integrate. The integration target is frozen. Call "
+           "switchToActiveSubmap() after changing the active submap.";
+    for (const PosedScan& scan : *integrated_scans) {
+      CHECK_EQ(scan.points_C.size(), scan.colors.size());
+      tsdf_integrator_->integratePointCloud(getSubmapRelativePose(scan.T_G_C),
+                                            scan.points_C, scan.colors);
+    }
+  }
+  active_submap_ptr_->markTsdfModified();
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::setDownsamplingConfig(
+    const PointCloudDownsamplingConfig& downsampling_config) {
+  if (downsampling_config.enable) {
+    LOG_IF(WARNING, method_ != voxblox::TsdfIntegratorType::kMerged)
+        << "Downsampling the scans integrates each merged point with the "
+           "weight of a single point, lowering the TSDF weights. Consider the "
+           "\"merged\" integrator instead.";
+    downsampler_.reset(new PointCloudDownsampler(
+        downsampling_config,
+        tsdf_submap_collection_ptr_->getConfig().tsdf_voxel_size));
+  } else {
+    downsampler_.reset();
+  }
+}
+
+template <typename SubmapType>
+PointCloudDownsamplingStats
+SubmapCollectionIntegrator<SubmapType>::getDownsamplingStats() const {
+  return downsampler_ ? downsampler_->getStats()
+                      : PointCloudDownsamplingStats();
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::integratePointCloudWithRevisits(
+    const Transformation& T_G_C, const Pointcloud& points_C,
+    const Colors& colors) {
+  CHECK_EQ(points_C.size(), colors.size());
+  // The points in the global frame, to test them against the submap boxes
+  Pointcloud points_G;
+  points_G.reserve(points_C.size());
+  for (const Point& point_C : points_C) {
+    points_G.push_back(T_G_C * point_C);
+  }
+  std::vector<size_t> point_targets;
+  assignPointsToTargets(points_G, &point_targets);
+  // Splitting the scan
+  // NOTE: Each point (and so its ray) goes to a single submap, such that no
+  //       measurement is fused twice.
+  const size_t num_targets = revisit_targets_.size() + 1;
+  std::vector<Pointcloud> target_points_C(num_targets);
+  std::vector<Colors> target_colors(num_targets);
+  for (size_t point_index = 0; point_index < points_C.size(); point_index++) {
+    const size_t target_index = point_targets[point_index];
+    target_points_C[target_index].push_back(points_C[point_index]);
+    target_colors[target_index].push_back(colors[point_index]);
+  }
+  // The (inverse) poses of the revisited submaps
+  const SubmapPoseTable::ConstPtr pose_table =
+      tsdf_submap_collection_ptr_->getPoseTable();
+  // Integrating the parts in parallel, each submap on a single thread
+  parallelFor(num_targets, num_targets, [&](const size_t target_index) {
+    if (target_points_C[target_index].empty()) {
+      return;
+    }
+    if (target_index == 0) {
+      integrateIntoSubmap(getSubmapRelativePose(T_G_C),
+                          target_points_C[target_index],
+                          target_colors[target_index], tsdf_integrator_.get(),
+                          active_submap_ptr_.get());
+    } else {
+      const RevisitTarget& target = revisit_targets_[target_index - 1];
+      Transformation T_S_G;
+      if (!pose_table->getInversePose(target.submap_ptr->getID(), &T_S_G)) {
+        T_S_G = target.submap_ptr->getPose().inverse();
+      }
+      const Transformation T_S_C = T_S_G * T_G_C;
+      integrateIntoSubmap(T_S_C, target_points_C[target_index],
+                          target_colors[target_index],
+                          target.tsdf_integrator.get(),
+                          target.submap_ptr.get());
+    }
+  });
+  // Only the active submap is re-indexed automatically
+  for (size_t target_index = 1; target_index < num_targets; target_index++) {
+    if (!target_points_C[target_index].empty()) {
+      tsdf_submap_collection_ptr_->markSubmapModified(
+          revisit_targets_[target_index - 1].submap_ptr->getID());
+    }
+  }
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::assignPointsToTargets(
+    const Pointcloud& points_G, std::vector<size_t>* point_targets) {
+  CHECK_NOTNULL(point_targets);
+  point_targets->assign(points_G.size(), 0);
+  // Aging the targets. Those with points in this scan are reset below.
+  for (RevisitTarget& target : revisit_targets_) {
+    target.num_scans_without_points++;
+  }
+  // The submaps near the scan
+  std::vector<std::pair<size_t, SubmapID>> num_points_and_ids;
+  if (!points_G.empty()) {
+    BoundingBox scan_box_G;
+    for (const Point& point_G : points_G) {
+      scan_box_G.extend(point_G);
+    }
+    std::vector<SubmapID> candidate_ids;
+    tsdf_submap_collection_ptr_->getSubmapsOverlapping(scan_box_G,
+                                                       &candidate_ids);
+    const size_t min_num_points = std::max(
+        static_cast<size_t>(std::ceil(revisit_config_.min_point_fraction *
+                                      points_G.size())),
+        static_cast<size_t>(1));
+    for (const SubmapID submap_id : candidate_ids) {
+      if (submap_id == active_submap_ptr_->getID()) {
+        continue;
+      }
+      const typename SubmapType::ConstPtr submap_ptr =
+          tsdf_submap_collection_ptr_->getSubMapConstPtrById(submap_id);
+      if (!submap_ptr) {
+        continue;
+      }
+      const BoundingBox submap_box_G = submap_ptr->getGlobalFrameBoundingBox();
+      const size_t num_points = static_cast<size_t>(
+          std::count_if(points_G.begin(), points_G.end(),
+                        [&submap_box_G](const Point& point_G) {
+                          return submap_box_G.contains(point_G);
+                        }));
+      if (num_points >= min_num_points) {
+        num_points_and_ids.emplace_back(num_points, submap_id);
+      }
+    }
+  }
+  // The submaps with the most points are integrated into
+  std::sort(num_points_and_ids.rbegin(), num_points_and_ids.rend());
+  if (num_points_and_ids.size() > revisit_config_.max_revisit_submaps) {
+    num_points_and_ids.resize(revisit_config_.max_revisit_submaps);
+  }
+  std::vector<SubmapID> new_ids;
+  for (const std::pair<size_t, SubmapID>& num_points_and_id :
+       num_points_and_ids) {
+    const auto target_it = std::find_if(
+        revisit_targets_.begin(), revisit_targets_.end(),
+        [&num_points_and_id](const RevisitTarget& target) {
+          return target.submap_ptr->getID() == num_points_and_id.second;
+        });
+    if (target_it != revisit_targets_.end()) {
+      target_it->num_scans_without_points = 0;
+    } else {
+      new_ids.push_back(num_points_and_id.second);
+    }
+  }
+  for (const SubmapID submap_id : new_ids) {
+    addRevisitTarget(submap_id);
+  }
+  // Finishing the submaps which haven't been revisited for a while
+  for (auto target_it = revisit_targets_.begin();
+       target_it != revisit_targets_.end();) {
+    if (target_it->num_scans_without_points >
+        revisit_config_.release_after_num_scans) {
+      tsdf_submap_collection_ptr_->finishWritableSubMap(target_it->submap_ptr);
+      target_it = revisit_targets_.erase(target_it);
+    } else {
+      ++target_it;
+    }
+  }
+  // Assigning the points to the submaps picked for this scan. Points outside
+  // of them go to the active submap.
+  std::vector<BoundingBox> target_boxes_G;
+  std::vector<size_t> target_indices;
+  for (size_t target_index = 0; target_index < revisit_targets_.size();
+       target_index++) {
+    if (revisit_targets_[target_index].num_scans_without_points == 0) {
+      target_boxes_G.push_back(revisit_targets_[target_index]
+                                   .submap_ptr->getGlobalFrameBoundingBox());
+      target_indices.push_back(target_index + 1);
+    }
+  }
+  if (target_boxes_G.empty()) {
+    return;
+  }
+  for (size_t point_index = 0; point_index < points_G.size(); point_index++) {
+    for (size_t box_index = 0; box_index < target_boxes_G.size();
+         box_index++) {
+      if (target_boxes_G[box_index].contains(points_G[point_index])) {
+        (*point_targets)[point_index] = target_indices[box_index];
+        break;
+      }
+    }
+  }
+}
+
+template <typename SubmapType>
+bool SubmapCollectionIntegrator<SubmapType>::addRevisitTarget(
+    const SubmapID submap_id) {
+  // Making room, by finishing the target revisited least recently
+  if (!revisit_targets_.empty() &&
+      revisit_targets_.size() >= revisit_config_.max_revisit_submaps) {
+    const auto stalest_it = std::max_element(
+        revisit_targets_.begin(), revisit_targets_.end(),
+        [](const RevisitTarget& lhs, const RevisitTarget& rhs) {
+          return lhs.num_scans_without_points < rhs.num_scans_without_points;
+        });
+    tsdf_submap_collection_ptr_->finishWritableSubMap(stalest_it->submap_ptr);
+    revisit_targets_.erase(stalest_it);
+  }
+  RevisitTarget target;
+  target.submap_ptr = tsdf_submap_collection_ptr_->getWritableSubMapPtr(
+      submap_id);
+  if (!target.submap_ptr) {
+    return false;
+  }
+  // NOTE: The targets are integrated into concurrently, so share the integrator
+  //       threads.
+  voxblox::TsdfIntegratorBase::Config revisit_integrator_config =
+      tsdf_integrator_config_;
+  revisit_integrator_config.integrator_threads = std::max(
+      revisit_integrator_config.integrator_threads /
+          (revisit_config_.max_revisit_submaps + 1),
+      static_cast<size_t>(1));
+  target.tsdf_integrator = voxblox::TsdfIntegratorFactory::create(
+      method_, revisit_integrator_config,
+      target.submap_ptr->getTsdfMapPtr()->getTsdfLayerPtr());
+  target.num_scans_without_points = 0;
+  revisit_targets_.push_back(target);
+  VLOG(1) << "Integrating into revisited submap #" << submap_id;
+  return true;
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::setRevisitConfig(
+    const RevisitIntegrationConfig& revisit_config) {
+  revisit_config_ = revisit_config;
+  if (!revisit_config_.enable ||
+      revisit_targets_.size() > revisit_config_.max_revisit_submaps) {
+    releaseRevisitSubmaps();
+  }
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::releaseRevisitSubmaps() {
+  for (const RevisitTarget& target : revisit_targets_) {
+    tsdf_submap_collection_ptr_->finishWritableSubMap(target.submap_ptr);
+  }
+  revisit_targets_.clear();
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::switchToActiveSubmap() {
+  // Setting the server members to point to this submap
+  // NOTE(alexmillane): This is slightly confusing because the collection is
+  //                    increased in size elsewhere but we change the
+  //                    integration target to the new submap here. The result is
+  //                    that between new submap creation and activation the
+  //                    integrator wont be affecting the latest submap in the
+  //                    collection.
+  active_submap_ptr_ = tsdf_submap_collection_ptr_->getActiveSubMapPtr();
+  updateIntegratorTarget(active_submap_ptr_->getTsdfMapPtr());
+  T_G_S_active_ = active_submap_ptr_->getPose();
+  T_S_G_active_ = T_G_S_active_.inverse();
+  // A revisited submap which became active is written through the active
+  // integrator (and stays writable).
+  revisit_targets_.erase(
+      std::remove_if(revisit_targets_.begin(), revisit_targets_.end(),
+                     [this](const RevisitTarget& target) {
+                       return target.submap_ptr->getID() ==
+                              active_submap_ptr_->getID();
+                     }),
+      revisit_targets_.end());
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::initializeIntegrator(
+    const TsdfMap::Ptr& tsdf_map_ptr) {
+  CHECK(tsdf_map_ptr);
+  // Creating with the voxblox provided factory
+  tsdf_integrator_ = voxblox::TsdfIntegratorFactory::create(
+      method_, tsdf_integrator_config_, tsdf_map_ptr->getTsdfLayerPtr());
+}
+
+template <typename SubmapType>
+void SubmapCollectionIntegrator<SubmapType>::updateIntegratorTarget(
+    const TsdfMap::Ptr& tsdf_map_ptr) {
+  CHECK(tsdf_map_ptr);
+  // Creating the integrator if not yet created.
+  // Otherwise, changing the integration target.
+  if (tsdf_integrator_ == nullptr) {
+    initializeIntegrator(tsdf_map_ptr);
+  } else {
+    tsdf_integrator_->setLayer(tsdf_map_ptr->getTsdfLayerPtr());
+  }
+}
+
+template <typename SubmapType>
+Transformation SubmapCollectionIntegrator<SubmapType>::getSubmapRelativePose(
+    const Transformation& T_G_C) const {
+  return (T_S_G_active_ * T_G_C);
+}
+
+}  // namespace cblox
+
+#endif  // CBLOX_INTEGRATOR_TSDF_SUBMAP_COLLECTION_INTEGRATOR_INL_H_
@@ -0,0 +1,50 @@
+#ifndef CBLOX_IO_SCAN_DATASET_IO_H_
+#define CBLOX_IO_SCAN_DATASET_IO_H_
+
+#include <fstream>
+#include <string>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+
+namespace io {
+
+// Reads the scans of a dataset file one at a time, such that long datasets
+// are never held in memory. Two (text) formats are read:
+//  - Inline scans, one after another:
+//      scan <x> <y> <z> <qw> <qx> <qy> <qz> <num_points>
+//      <x> <y> <z> [<r> <g> <b>]    (num_points lines)
+//  - A list of point files with their poses, one per line:
+//      <points file> <x> <y> <z> <qw> <qx> <qy> <qz>
+//    Files ending in ".bin" hold float32 x, y, z, intensity per point (as in
+//    KITTI), other files "<x> <y> <z> [<r> <g> <b>]" per line. Relative
+//    paths are relative to the list.
+// Empty lines and lines starting with '#' are skipped.
+class ScanDatasetReader {
+ public:
+  explicit ScanDatasetReader(const std::string& file_path);
+
+  bool isOpen() const { return file_.is_open(); }
+
+  // Reads the next scan into scan_ptr (reusing its buffers). Returns false at
+  // the end of the dataset, or on an invalid scan (see hasError()).
+  bool readNextScan(PosedScan* scan_ptr);
+  bool hasError() const { return has_error_; }
+  size_t getNumScansRead() const { return num_scans_read_; }
+
+ private:
+  bool readInlinePoints(const size_t num_points, PosedScan* scan_ptr);
+  bool readPointsFile(const std::string& points_file_path,
+                      PosedScan* scan_ptr) const;
+
+  std::ifstream file_;
+  std::string directory_;
+  bool has_error_;
+  size_t num_scans_read_;
+};
+
+}  // namespace io
+}  // namespace cblox
+
+#endif  // CBLOX_IO_SCAN_DATASET_IO_H_
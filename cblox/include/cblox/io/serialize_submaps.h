@@ -0,0 +1,65 @@
+#ifndef CBLOX_IO_SERIALIZE_SUBMAPS_H_
+#define CBLOX_IO_SERIALIZE_SUBMAPS_H_
+
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "./TsdfSubmap.pb.h"
+#include "cblox/utils/thread_pool.h"
+
+namespace cblox {
+namespace io {
+
+// Serializes the submaps (see TsdfSubmap::serializeToString()) on a pool of
+// num_threads, while calling write_function(submap_index, bytes, header_proto)
+// for each submap, in order, on the calling thread. Returns false as soon as a
+// submap can't be serialized, or write_function returns false.
+// NOTE: Only a window of submaps is serialized ahead of the writing, which
+//       bounds the memory taken up by the serialized submaps.
+template <typename SubmapConstPtr, typename WriteFunction>
+bool SerializeSubmapsInOrder(const std::vector<SubmapConstPtr> &submap_ptrs,
+                             const size_t num_threads,
+                             const WriteFunction &write_function) {
+  const size_t num_submaps = submap_ptrs.size();
+  std::vector<std::string> submap_bytes(num_submaps);
+  std::vector<TsdfSubmapProto> submap_headers(num_submaps);
+  std::vector<char> submap_serialized(num_submaps, false);
+  std::vector<std::future<void>> serialization_futures(num_submaps);
+  // NOTE: Declared after the buffers, such that queued work is done before they
+  //       are destroyed (also on failure).
+  ThreadPool thread_pool(std::max(num_threads, static_cast<size_t>(1)));
+  const size_t window_size = thread_pool.num_threads() + 1;
+  const auto serialize_submap = [&](const size_t submap_index) {
+    serialization_futures[submap_index] =
+        thread_pool.enqueue([&, submap_index]() {
+          submap_serialized[submap_index] =
+              submap_ptrs[submap_index]->serializeToString(
+                  &submap_bytes[submap_index], &submap_headers[submap_index]);
+        });
+  };
+  for (size_t submap_index = 0;
+       submap_index < std::min(window_size, num_submaps); submap_index++) {
+    serialize_submap(submap_index);
+  }
+  for (size_t submap_index = 0; submap_index < num_submaps; submap_index++) {
+    serialization_futures[submap_index].wait();
+    if (submap_index + window_size < num_submaps) {
+      serialize_submap(submap_index + window_size);
+    }
+    if (!submap_serialized[submap_index] ||
+        !write_function(submap_index, submap_bytes[submap_index],
+                        submap_headers[submap_index])) {
+      return false;
+    }
+    // Releasing the memory
+    std::string().swap(submap_bytes[submap_index]);
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace cblox
+
+#endif  // CBLOX_IO_SERIALIZE_SUBMAPS_H_
@@ -0,0 +1,84 @@
+#ifndef CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_H_
+#define CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_H_
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include "cblox/core/common.h"
+#include "cblox/core/submap_collection.h"
+#include "cblox/utils/parallel_for.h"
+
+namespace cblox {
+namespace io {
+
+// Writes incremental checkpoints of a submap collection (e.g. for crash
+// recovery), such that each checkpoint only writes what changed.
+// NOTE: The checkpoint file is a log. Each checkpoint appends the submaps which
+//       are new or modified since the previous checkpoint, small records for
+//       the submaps of which only the pose changed, and records for removed
+//       submaps. Once the file grows beyond max_file_size_ratio times the size
+//       of the submaps it describes, it is compacted (rewritten with the
+//       current submaps only). The first checkpoint written by a checkpointer
+//       also compacts.
+// NOTE: Checkpoint files are loaded like collection files (see
+//       LoadSubmapCollection() and LoadSubmapCollectionLazily()), which replay
+//       the checkpoints completely written.
+template <typename SubmapType>
+class SubmapCollectionCheckpointer {
+ public:
+  explicit SubmapCollectionCheckpointer(
+      const std::string &file_path, const double max_file_size_ratio = 2.0,
+      const size_t num_threads = getDefaultNumThreads());
+
+  // Writes a checkpoint, compacting if required
+  bool checkpoint(const SubmapCollection<SubmapType> &submap_collection);
+  // Rewrites the file with the current submaps only
+  bool compact(const SubmapCollection<SubmapType> &submap_collection);
+
+  const std::string &getFilePath() const { return file_path_; }
+  // The size of the checkpoint file, and the number of bytes the last
+  // checkpoint wrote
+  uint64_t getFileNumBytes() const { return file_num_bytes_; }
+  uint64_t getLastCheckpointNumBytes() const {
+    return last_checkpoint_num_bytes_;
+  }
+
+ private:
+  // The state of a submap at the last checkpoint
+  struct CheckpointedSubmap {
+    size_t tsdf_version;
+    size_t pose_version;
+    uint64_t num_bytes;
+  };
+  typedef std::map<SubmapID, CheckpointedSubmap> CheckpointedSubmapMap;
+
+  // Writes a checkpoint of the (changed) submaps at the current position of
+  // the file, updating the checkpointed submaps.
+  bool writeCheckpoint(const SubmapCollection<SubmapType> &submap_collection,
+                       const bool write_all_submaps,
+                       CheckpointedSubmapMap *checkpointed_submaps,
+                       std::fstream *outfile_ptr) const;
+
+  // The size of the submaps the file describes
+  uint64_t getCheckpointedNumBytes() const;
+
+  const std::string file_path_;
+  const double max_file_size_ratio_;
+  const size_t num_threads_;
+
+  // Whether the file was written (compacted) by this checkpointer. Only then
+  // the submaps checkpointed are known.
+  bool file_written_;
+  uint64_t file_num_bytes_;
+  uint64_t last_checkpoint_num_bytes_;
+  CheckpointedSubmapMap checkpointed_submaps_;
+};
+
+}  // namespace io
+}  // namespace cblox
+
+#include "cblox/io/submap_collection_checkpointer_inl.h"
+
+#endif  // CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_H_
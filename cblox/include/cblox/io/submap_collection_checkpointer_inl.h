@@ -0,0 +1,251 @@
+#ifndef CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_INL_H_
+#define CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_INL_H_
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "./TsdfSubmapCollection.pb.h"
+
+#include "cblox/io/serialize_submaps.h"
+#include "cblox/io/submap_file.h"
+#include "cblox/utils/bounding_box_protobuf_utils.h"
+#include "cblox/utils/quat_transformation_protobuf_utils.h"
+
+namespace cblox {
+namespace io {
+
+template <typename SubmapType>
+SubmapCollectionCheckpointer<SubmapType>::SubmapCollectionCheckpointer(
+    const std::string& file_path, const double max_file_size_ratio,
+    const size_t num_threads)
+    : file_path_(file_path),
+      max_file_size_ratio_(max_file_size_ratio),
+      num_threads_(num_threads),
+      file_written_(false),
+      file_num_bytes_(0),
+      last_checkpoint_num_bytes_(0) {
+  CHECK(!file_path_.empty());
+  CHECK_GE(max_file_size_ratio_, 1.0);
+}
+
+template <typename SubmapType>
+bool SubmapCollectionCheckpointer<SubmapType>::checkpoint(
+    const SubmapCollection<SubmapType>& submap_collection) {
+  if (!file_written_ ||
+      file_num_bytes_ > max_file_size_ratio_ * getCheckpointedNumBytes()) {
+    return compact(submap_collection);
+  }
+  // Dropping anything after the last checkpoint (i.e. a failed checkpoint)
+  if (::truncate(file_path_.c_str(), file_num_bytes_) != 0) {
+    LOG(ERROR) << "Could not truncate the checkpoint file: " << file_path_;
+    return false;
+  }
+  std::fstream outfile;
+  outfile.open(file_path_,
+               std::fstream::in | std::fstream::out | std::fstream::binary);
+  if (!outfile.is_open()) {
+    LOG(ERROR) << "Could not open file for writing: " << file_path_;
+    return false;
+  }
+  outfile.seekp(file_num_bytes_);
+  // Appending the checkpoint
+  CheckpointedSubmapMap checkpointed_submaps = checkpointed_submaps_;
+  constexpr bool kWriteAllSubmaps = false;
+  if (!writeCheckpoint(submap_collection, kWriteAllSubmaps,
+                       &checkpointed_submaps, &outfile)) {
+    LOG(ERROR) << "Could not write the checkpoint to: " << file_path_;
+    return false;
+  }
+  const uint64_t file_num_bytes = outfile.tellp();
+  outfile.close();
+  if (outfile.fail() || !SyncFileToDisk(file_path_)) {
+    LOG(ERROR) << "Could not write the checkpoint to: " << file_path_;
+    return false;
+  }
+  last_checkpoint_num_bytes_ = file_num_bytes - file_num_bytes_;
+  file_num_bytes_ = file_num_bytes;
+  checkpointed_submaps_.swap(checkpointed_submaps);
+  LOG(INFO) << "Checkpointed " << last_checkpoint_num_bytes_
+            << " bytes to: " << file_path_;
+  return true;
+}
+
+template <typename SubmapType>
+bool SubmapCollectionCheckpointer<SubmapType>::compact(
+    const SubmapCollection<SubmapType>& submap_collection) {
+  // NOTE: As when saving collections, a temporary file replaces the checkpoint
+  //       file once complete.
+  const std::string tmp_file_path = file_path_ + ".tmp";
+  std::fstream outfile;
+  outfile.open(tmp_file_path, std::fstream::out | std::fstream::binary |
+                                  std::fstream::trunc);
+  if (!outfile.is_open()) {
+    LOG(ERROR) << "Could not open file for writing: " << tmp_file_path;
+    return false;
+  }
+  // The header
+  TsdfSubmapCollectionProto tsdf_submap_collection_proto;
+  tsdf_submap_collection_proto.set_num_submaps(0);
+  tsdf_submap_collection_proto.set_format_version(
+      kCollectionFileFormatVersion);
+  tsdf_submap_collection_proto.set_is_checkpoint(true);
+  // A single checkpoint holding all submaps
+  CheckpointedSubmapMap checkpointed_submaps;
+  constexpr bool kWriteAllSubmaps = true;
+  if (!WriteCheckpointFileMagic(&outfile) ||
+      !voxblox::utils::writeProtoMsgToStream(tsdf_submap_collection_proto,
+                                             &outfile) ||
+      !writeCheckpoint(submap_collection, kWriteAllSubmaps,
+                       &checkpointed_submaps, &outfile)) {
+    LOG(ERROR) << "Could not write the checkpoint to: " << tmp_file_path;
+    outfile.close();
+    std::remove(tmp_file_path.c_str());
+    return false;
+  }
+  const uint64_t file_num_bytes = outfile.tellp();
+  outfile.close();
+  if (outfile.fail() || !SyncFileToDisk(tmp_file_path) ||
+      std::rename(tmp_file_path.c_str(), file_path_.c_str()) != 0) {
+    LOG(ERROR) << "Could not write the checkpoint to: " << file_path_;
+    std::remove(tmp_file_path.c_str());
+    return false;
+  }
+  file_written_ = true;
+  file_num_bytes_ = file_num_bytes;
+  last_checkpoint_num_bytes_ = file_num_bytes;
+  checkpointed_submaps_.swap(checkpointed_submaps);
+  LOG(INFO) << "Compacted the checkpoint (" << file_num_bytes_
+            << " bytes) at: " << file_path_;
+  return true;
+}
+
+template <typename SubmapType>
+bool SubmapCollectionCheckpointer<SubmapType>::writeCheckpoint(
+    const SubmapCollection<SubmapType>& submap_collection,
+    const bool write_all_submaps, CheckpointedSubmapMap* checkpointed_submaps,
+    std::fstream* outfile_ptr) const {
+  CHECK_NOTNULL(checkpointed_submaps);
+  CHECK_NOTNULL(outfile_ptr);
+  const auto write_record =
+      [outfile_ptr](const TsdfSubmapCheckpointRecordProto& record_proto) {
+        return voxblox::utils::writeProtoMsgToStream(record_proto,
+                                                     outfile_ptr);
+      };
+  // Taking a snapshot of the collection
+  const std::vector<typename SubmapType::ConstPtr> submap_ptrs =
+      submap_collection.getSubMapConstPtrs();
+  const SubmapID active_submap_id = submap_collection.getActiveSubMapID();
+  // Finding what changed. Submaps whose TSDF changed are written in full,
+  // submaps of which only the pose changed get a pose record.
+  // NOTE: The stamps are read before writing, such that changes made in the
+  //       meantime are written at the next checkpoint.
+  std::vector<typename SubmapType::ConstPtr> changed_submap_ptrs;
+  std::vector<std::pair<size_t, size_t>> changed_submap_versions;
+  std::set<SubmapID> submap_ids;
+  size_t num_pose_records = 0;
+  for (const typename SubmapType::ConstPtr& submap_ptr : submap_ptrs) {
+    const SubmapID submap_id = submap_ptr->getID();
+    const size_t tsdf_version = submap_ptr->getTsdfVersion();
+    const size_t pose_version = submap_ptr->getPoseVersion();
+    submap_ids.insert(submap_id);
+    const auto it = checkpointed_submaps->find(submap_id);
+    if (write_all_submaps || it == checkpointed_submaps->end() ||
+        it->second.tsdf_version != tsdf_version) {
+      changed_submap_ptrs.push_back(submap_ptr);
+      changed_submap_versions.emplace_back(tsdf_version, pose_version);
+    } else if (it->second.pose_version != pose_version) {
+      TsdfSubmapCheckpointRecordProto record_proto;
+      record_proto.set_type(TsdfSubmapCheckpointRecordProto::POSE);
+      record_proto.set_id(submap_id);
+      conversions::transformKindrToProto(submap_ptr->getPose(),
+                                         record_proto.mutable_transform());
+      if (!write_record(record_proto)) {
+        return false;
+      }
+      it->second.pose_version = pose_version;
+      num_pose_records++;
+    }
+  }
+  // The submaps which were removed
+  size_t num_remove_records = 0;
+  for (auto it = checkpointed_submaps->begin();
+       it != checkpointed_submaps->end();) {
+    if (submap_ids.count(it->first) > 0) {
+      ++it;
+      continue;
+    }
+    TsdfSubmapCheckpointRecordProto record_proto;
+    record_proto.set_type(TsdfSubmapCheckpointRecordProto::REMOVE);
+    record_proto.set_id(it->first);
+    if (!write_record(record_proto)) {
+      return false;
+    }
+    it = checkpointed_submaps->erase(it);
+    num_remove_records++;
+  }
+  // The new and modified submaps, each a record followed by the submap
+  const auto write_submap = [&](const size_t submap_index,
+                                const std::string& bytes,
+                                const TsdfSubmapProto& tsdf_sub_map_proto) {
+    TsdfSubmapCheckpointRecordProto record_proto;
+    record_proto.set_type(TsdfSubmapCheckpointRecordProto::SUBMAP);
+    TsdfSubmapIndexEntryProto* index_entry_proto =
+        record_proto.mutable_submap();
+    index_entry_proto->set_id(tsdf_sub_map_proto.id());
+    index_entry_proto->set_num_bytes(bytes.size());
+    index_entry_proto->set_num_blocks(tsdf_sub_map_proto.num_blocks());
+    *index_entry_proto->mutable_transform() = tsdf_sub_map_proto.transform();
+    conversions::boundingBoxToProto(
+        changed_submap_ptrs[submap_index]->getSubmapFrameBoundingBox(),
+        index_entry_proto->mutable_bounding_box());
+    if (!write_record(record_proto) ||
+        !outfile_ptr->write(bytes.data(), bytes.size())) {
+      return false;
+    }
+    CheckpointedSubmap& checkpointed_submap =
+        (*checkpointed_submaps)[tsdf_sub_map_proto.id()];
+    checkpointed_submap.tsdf_version =
+        changed_submap_versions[submap_index].first;
+    checkpointed_submap.pose_version =
+        changed_submap_versions[submap_index].second;
+    checkpointed_submap.num_bytes = bytes.size();
+    return true;
+  };
+  if (!SerializeSubmapsInOrder(changed_submap_ptrs, num_threads_,
+                               write_submap)) {
+    return false;
+  }
+  // Committing
+  TsdfSubmapCheckpointRecordProto record_proto;
+  record_proto.set_type(TsdfSubmapCheckpointRecordProto::COMMIT);
+  record_proto.set_active_submap_id(active_submap_id);
+  if (!write_record(record_proto)) {
+    return false;
+  }
+  VLOG(1) << "Checkpoint of " << changed_submap_ptrs.size() << " submaps, "
+          << num_pose_records << " poses and " << num_remove_records
+          << " removed submaps.";
+  return true;
+}
+
+template <typename SubmapType>
+uint64_t SubmapCollectionCheckpointer<SubmapType>::getCheckpointedNumBytes()
+    const {
+  uint64_t checkpointed_num_bytes = 0;
+  for (const auto& id_checkpointed_submap_pair : checkpointed_submaps_) {
+    checkpointed_num_bytes += id_checkpointed_submap_pair.second.num_bytes;
+  }
+  return checkpointed_num_bytes;
+}
+
+}  // namespace io
+}  // namespace cblox
+
+#endif  // CBLOX_IO_SUBMAP_COLLECTION_CHECKPOINTER_INL_H_
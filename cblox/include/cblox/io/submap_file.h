@@ -0,0 +1,132 @@
+#ifndef CBLOX_IO_SUBMAP_FILE_H_
+#define CBLOX_IO_SUBMAP_FILE_H_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <google/protobuf/message.h>
+
+#include "./TsdfSubmap.pb.h"
+#include "./TsdfSubmapCollection.pb.h"
+#include "cblox/core/common.h"
+
+namespace cblox {
+namespace io {
+
+// The layout of a collection file (format version 1 onwards):
+//   TsdfSubmapCollectionProto          (the header)
+//   TsdfSubmapProto, BlockProto...     (for each submap)
+//   TsdfSubmapCollectionIndexProto    (the index)
+//   uint64 byte offset of the index, uint64 magic number
+// All messages are length delimited. Readers of the original format (version
+// 0, without the index) read the submaps and stop, so still read version 1
+// files.
+// Format version 2 files may hold compressed submaps (see
+// TsdfSubmap::compress()), written with their blocks encoded as raw bytes
+// (see TsdfSubmapProto::num_encoded_block_bytes). Readers of earlier versions
+// can't read these, so this breaks the format for them. Files of later
+// versions than known are rejected.
+constexpr uint32_t kIndexedCollectionFileFormatVersion = 1;
+constexpr uint32_t kCollectionFileFormatVersion = 2;
+
+// Writes the index and the trailer pointing to it, at the current position.
+bool WriteCollectionIndex(const TsdfSubmapCollectionIndexProto &index_proto,
+                          std::fstream *outfile_ptr);
+
+// Writes the magic which starts checkpoint files (see
+// SubmapCollectionCheckpointer), at the current position. Readers unaware of
+// checkpoint files fail on it, rather than reading an empty collection.
+bool WriteCheckpointFileMagic(std::fstream *outfile_ptr);
+
+// Reads the index of a collection file. Returns false if the file can't be
+// read, is of an unknown (later) format version, or has no index (i.e. was
+// written in the original format).
+// NOTE: For checkpoint files (see SubmapCollectionCheckpointer) the index is
+//       the result of replaying the checkpoints.
+bool ReadCollectionIndex(const std::string &file_path,
+                         TsdfSubmapCollectionIndexProto *index_proto);
+
+// Reads a length delimited message (as written by
+// voxblox::utils::writeProtoMsgToStream()) at byte_offset, and advances
+// byte_offset past it.
+// NOTE: The voxblox readers track the offset in 32 bits, which limits them to
+//       the first 4 GB of a file.
+// Whether the header is of a format version this reader knows. Logs an error
+// otherwise.
+bool IsKnownCollectionFileFormatVersion(
+    const TsdfSubmapCollectionProto &tsdf_submap_collection_proto);
+
+bool ReadProtoMsgFromStream(std::fstream *stream_ptr,
+                            google::protobuf::Message *message,
+                            uint64_t *byte_offset_ptr);
+
+// Appends a length delimited message to bytes, in the same format
+void AppendProtoMsgToString(const google::protobuf::Message &message,
+                            std::string *bytes);
+// Parses a length delimited message at byte_offset of bytes, and advances
+// byte_offset past it
+bool ParseProtoMsgFromString(const std::string &bytes,
+                             google::protobuf::Message *message,
+                             uint64_t *byte_offset_ptr);
+
+// Reads a submap (its header and blocks, or only the blocks described by its
+// header) at byte_offset, and advances byte_offset past it. The blocks are
+// either BlockProtos, or in the compact encoding (see tsdf_block_encoding.h).
+bool ReadBlocksFromStream(std::fstream *stream_ptr,
+                          const TsdfSubmapProto &tsdf_submap_proto,
+                          uint64_t *byte_offset_ptr,
+                          Layer<TsdfVoxel> *tsdf_layer_ptr);
+bool ReadSubmapFromStream(std::fstream *stream_ptr, uint64_t *byte_offset_ptr,
+                          TsdfSubmapProto *tsdf_submap_proto,
+                          Layer<TsdfVoxel> *tsdf_layer_ptr);
+// Parses a submap from its bytes, e.g. as read by
+// SubmapFileReader::readBytes(), such that the parsing may happen in parallel.
+bool ParseSubmapFromString(const std::string &bytes,
+                           TsdfSubmapProto *tsdf_submap_proto,
+                           Layer<TsdfVoxel> *tsdf_layer_ptr);
+
+// Flushes a (written and closed) file to disk
+bool SyncFileToDisk(const std::string &file_path);
+
+// A file holding submaps (in the TsdfSubmap::saveToStream() format), open for
+// reading at any offset, e.g. a collection file or a page file.
+// NOTE: Readers share the open file, which keeps its contents readable when it
+//       is replaced on disk (e.g. when a collection is saved over the file it
+//       was loaded from).
+class SubmapFileReader {
+ public:
+  typedef std::shared_ptr<SubmapFileReader> Ptr;
+
+  // Returns nullptr if the file can't be opened
+  static Ptr open(const std::string &file_path);
+
+  // Reads the header of the submap at byte_offset, and optionally its length
+  bool readSubmapHeader(const uint64_t byte_offset,
+                        TsdfSubmapProto *tsdf_submap_proto,
+                        uint64_t *num_header_bytes = nullptr);
+  // Reads the header and the blocks of the submap at byte_offset
+  bool readSubmap(const uint64_t byte_offset,
+                  TsdfSubmapProto *tsdf_submap_proto,
+                  Layer<TsdfVoxel> *tsdf_layer_ptr);
+  // Appends a range of the file to bytes
+  bool readBytes(const uint64_t byte_offset, const uint64_t num_bytes,
+                 std::string *bytes);
+
+  const std::string &getFilePath() const { return file_path_; }
+
+ private:
+  explicit SubmapFileReader(const std::string &file_path);
+
+  const std::string file_path_;
+  // Guards the position of the stream
+  std::mutex mutex_;
+  std::fstream file_;
+};
+
+}  // namespace io
+}  // namespace cblox
+
+#endif  // CBLOX_IO_SUBMAP_FILE_H_
@@ -0,0 +1,181 @@
+#ifndef CBLOX_IO_SUBMAP_STREAM_H_
+#define CBLOX_IO_SUBMAP_STREAM_H_
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "./TsdfSubmapCollection.pb.h"
+
+#include "cblox/core/common.h"
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/tsdf_block_encoding.h"
+#include "cblox/utils/parallel_for.h"
+
+namespace cblox {
+namespace io {
+
+struct SubmapStreamConfig {
+  SubmapStreamConfig()
+      : compress_submaps(true),
+        max_part_num_bytes(8 << 20),
+        num_threads(getDefaultNumThreads()) {}
+  // Sends the blocks in the compact (lossy) encoding of tsdf_block_encoding.h
+  bool compress_submaps;
+  TsdfBlockEncodingConfig encoding_config;
+  // Updates are split into parts of about this size (submaps are not split)
+  size_t max_part_num_bytes;
+  size_t num_threads;
+};
+
+// Turns a submap collection into a stream of updates for remote consumers
+// (e.g. a planner on another machine), which mirror the collection with a
+// SubmapStreamReceiver.
+// NOTE: Each delta holds the submaps which are new or modified since the
+//       previous delta, small records for the submaps of which only the pose
+//       changed, and records for removed submaps (as the checkpoints of the
+//       SubmapCollectionCheckpointer). Consumers joining late start from a
+//       snapshot, and apply the deltas which follow.
+// NOTE: Frozen submaps no longer change, so their bytes are kept and reused by
+//       later snapshots, such that each submap is only serialized (and
+//       compressed) once. This costs the memory of the serialized map.
+template <typename SubmapType>
+class SubmapStreamPublisher {
+ public:
+  explicit SubmapStreamPublisher(
+      const SubmapStreamConfig &config = SubmapStreamConfig());
+
+  // The parts of the next delta. Leaves the parts empty (without numbering a
+  // delta) if nothing changed since the previous delta.
+  void getDelta(const SubmapCollection<SubmapType> &submap_collection,
+                std::vector<std::string> *parts);
+  // Numbers the next delta without serializing it (e.g. while no one is
+  // listening). Receivers which miss it catch up from a snapshot.
+  void skipDelta(const SubmapCollection<SubmapType> &submap_collection);
+  // The parts of a snapshot of all submaps, numbered as the previous delta.
+  // NOTE: The snapshot may include changes made after the previous delta. The
+  //       next delta includes them again, which is harmless, as applying
+  //       updates is idempotent.
+  void getSnapshot(const SubmapCollection<SubmapType> &submap_collection,
+                   std::vector<std::string> *parts);
+
+  // The number of the previous delta
+  uint64_t getSequenceNumber() const;
+
+ private:
+  // The state of a submap when last sent
+  struct StreamedSubmap {
+    size_t tsdf_version;
+    size_t pose_version;
+  };
+
+  // A submap to send, with its stamps and pose when it was found
+  struct SubmapToSend {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    typename SubmapType::ConstPtr submap_ptr;
+    size_t tsdf_version;
+    size_t pose_version;
+    Transformation T_G_S;
+  };
+
+  // A serialized submap and the record describing it
+  struct SerializedSubmap {
+    size_t tsdf_version;
+    std::shared_ptr<const std::string> bytes;
+    TsdfSubmapCheckpointRecordProto record_proto;
+  };
+
+  // What changed since the previous delta. Call with the mutex held.
+  void findChanges(const SubmapCollection<SubmapType> &submap_collection,
+                   const bool all_submaps,
+                   AlignedVector<SubmapToSend> *submaps_to_send,
+                   AlignedVector<SubmapToSend> *moved_submaps,
+                   std::vector<SubmapID> *removed_submap_ids) const;
+
+  // Serializes the submaps (over the threads), reusing the bytes of frozen
+  // submaps serialized before. Submaps which can't be serialized are left
+  // out. Call with the mutex held.
+  void serializeSubmaps(const AlignedVector<SubmapToSend> &submaps_to_send,
+                        std::vector<SerializedSubmap> *serialized_submaps);
+
+  // Splits the records and submaps into parts
+  void writeUpdate(
+      const bool is_snapshot, const SubmapID active_submap_id,
+      const std::vector<TsdfSubmapCheckpointRecordProto> &record_protos,
+      const std::vector<SerializedSubmap> &serialized_submaps,
+      std::vector<std::string> *parts) const;
+
+  const SubmapStreamConfig config_;
+
+  mutable std::mutex mutex_;
+  uint64_t sequence_number_;
+  SubmapID streamed_active_submap_id_;
+  std::map<SubmapID, StreamedSubmap> streamed_submaps_;
+  std::map<SubmapID, SerializedSubmap> frozen_submap_cache_;
+};
+
+// Mirrors a collection from the updates of a SubmapStreamPublisher, in the
+// order they were published. Deltas received before the first snapshot, or
+// after a delta was missed, are held back until a snapshot is added.
+// NOTE: The mirrored submaps are frozen, such that they are read without locks.
+//       The receiver itself is not thread safe.
+template <typename SubmapType>
+class SubmapStreamReceiver {
+ public:
+  SubmapStreamReceiver(
+      const typename SubmapCollection<SubmapType>::Ptr &submap_collection_ptr,
+      const size_t max_buffered_parts = 1000,
+      const size_t num_threads = getDefaultNumThreads());
+
+  // Applies a part of a delta or snapshot. Returns false if the part is
+  // malformed or out of order, in which case a (new) snapshot is required.
+  bool addUpdatePart(const std::string &bytes);
+
+  // Whether a snapshot is needed to catch up: before the first snapshot, and
+  // after a delta was missed
+  bool requiresSnapshot() const { return !synced_; }
+  // The number of the last delta applied
+  uint64_t getSequenceNumber() const { return sequence_number_; }
+  // The submap active in the published collection
+  SubmapID getActiveSubmapID() const { return active_submap_id_; }
+
+  const typename SubmapCollection<SubmapType>::Ptr &getSubmapCollection()
+      const {
+    return submap_collection_ptr_;
+  }
+
+ private:
+  // Applies (or holds back) a part of a delta
+  bool addDeltaPart(const TsdfSubmapStreamUpdateProto &update_proto,
+                    const std::string &bytes,
+                    const uint64_t submaps_byte_offset);
+  // Applies the deltas held back which follow the snapshot
+  void applyBufferedDeltas();
+  // Applies the records of a part to the collection
+  bool applyPart(const TsdfSubmapStreamUpdateProto &update_proto,
+                 const std::string &bytes, const uint64_t submaps_byte_offset);
+  void bufferDeltaPart(const std::string &bytes);
+
+  const typename SubmapCollection<SubmapType>::Ptr submap_collection_ptr_;
+  const size_t max_buffered_parts_;
+  const size_t num_threads_;
+
+  bool synced_;
+  bool receiving_snapshot_;
+  uint64_t sequence_number_;
+  // The next part expected of the update being received
+  uint32_t next_part_index_;
+  SubmapID active_submap_id_;
+  std::deque<std::string> buffered_delta_parts_;
+};
+
+}  // namespace io
+}  // namespace cblox
+
+#include "cblox/io/submap_stream_inl.h"
+
+#endif  // CBLOX_IO_SUBMAP_STREAM_H_
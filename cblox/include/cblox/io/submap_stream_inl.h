@@ -0,0 +1,497 @@
+#ifndef CBLOX_IO_SUBMAP_STREAM_INL_H_
+#define CBLOX_IO_SUBMAP_STREAM_INL_H_
+
+#include <atomic>
+#include <set>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "cblox/io/submap_file.h"
+#include "cblox/utils/bounding_box_protobuf_utils.h"
+#include "cblox/utils/quat_transformation_protobuf_utils.h"
+
+namespace cblox {
+namespace io {
+
+template <typename SubmapType>
+SubmapStreamPublisher<SubmapType>::SubmapStreamPublisher(
+    const SubmapStreamConfig& config)
+    : config_(config), sequence_number_(0), streamed_active_submap_id_(0) {
+  CHECK_GT(config_.max_part_num_bytes, 0u);
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::getDelta(
+    const SubmapCollection<SubmapType>& submap_collection,
+    std::vector<std::string>* parts) {
+  CHECK_NOTNULL(parts);
+  parts->clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  const SubmapID active_submap_id = submap_collection.getActiveSubMapID();
+  AlignedVector<SubmapToSend> submaps_to_send;
+  AlignedVector<SubmapToSend> moved_submaps;
+  std::vector<SubmapID> removed_submap_ids;
+  findChanges(submap_collection, false, &submaps_to_send, &moved_submaps,
+              &removed_submap_ids);
+  if (submaps_to_send.empty() && moved_submaps.empty() &&
+      removed_submap_ids.empty() &&
+      active_submap_id == streamed_active_submap_id_) {
+    return;
+  }
+  // The records of the moved and removed submaps
+  std::vector<TsdfSubmapCheckpointRecordProto> record_protos;
+  record_protos.reserve(moved_submaps.size() + removed_submap_ids.size());
+  for (const SubmapToSend& moved_submap : moved_submaps) {
+    TsdfSubmapCheckpointRecordProto record_proto;
+    record_proto.set_type(TsdfSubmapCheckpointRecordProto::POSE);
+    record_proto.set_id(moved_submap.submap_ptr->getID());
+    conversions::transformKindrToProto(moved_submap.T_G_S,
+                                       record_proto.mutable_transform());
+    record_protos.push_back(record_proto);
+    streamed_submaps_[moved_submap.submap_ptr->getID()].pose_version =
+        moved_submap.pose_version;
+  }
+  for (const SubmapID submap_id : removed_submap_ids) {
+    TsdfSubmapCheckpointRecordProto record_proto;
+    record_proto.set_type(TsdfSubmapCheckpointRecordProto::REMOVE);
+    record_proto.set_id(submap_id);
+    record_protos.push_back(record_proto);
+    streamed_submaps_.erase(submap_id);
+    frozen_submap_cache_.erase(submap_id);
+  }
+  // The new and modified submaps
+  std::vector<SerializedSubmap> serialized_submaps;
+  serializeSubmaps(submaps_to_send, &serialized_submaps);
+  std::map<SubmapID, size_t> pose_versions;
+  for (const SubmapToSend& submap_to_send : submaps_to_send) {
+    pose_versions[submap_to_send.submap_ptr->getID()] =
+        submap_to_send.pose_version;
+  }
+  for (const SerializedSubmap& serialized_submap : serialized_submaps) {
+    const SubmapID submap_id = serialized_submap.record_proto.submap().id();
+    StreamedSubmap& streamed_submap = streamed_submaps_[submap_id];
+    streamed_submap.tsdf_version = serialized_submap.tsdf_version;
+    streamed_submap.pose_version = pose_versions[submap_id];
+  }
+  streamed_active_submap_id_ = active_submap_id;
+  sequence_number_++;
+  writeUpdate(false, active_submap_id, record_protos, serialized_submaps,
+              parts);
+  VLOG(1) << "Submap stream delta " << sequence_number_ << ": "
+          << serialized_submaps.size() << " submaps, " << moved_submaps.size()
+          << " poses and " << removed_submap_ids.size()
+          << " removed submaps in " << parts->size() << " parts.";
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::skipDelta(
+    const SubmapCollection<SubmapType>& submap_collection) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const SubmapID active_submap_id = submap_collection.getActiveSubMapID();
+  AlignedVector<SubmapToSend> submaps_to_send;
+  AlignedVector<SubmapToSend> moved_submaps;
+  std::vector<SubmapID> removed_submap_ids;
+  findChanges(submap_collection, false, &submaps_to_send, &moved_submaps,
+              &removed_submap_ids);
+  if (submaps_to_send.empty() && moved_submaps.empty() &&
+      removed_submap_ids.empty() &&
+      active_submap_id == streamed_active_submap_id_) {
+    return;
+  }
+  for (const SubmapToSend& submap_to_send : submaps_to_send) {
+    StreamedSubmap& streamed_submap =
+        streamed_submaps_[submap_to_send.submap_ptr->getID()];
+    streamed_submap.tsdf_version = submap_to_send.tsdf_version;
+    streamed_submap.pose_version = submap_to_send.pose_version;
+  }
+  for (const SubmapToSend& moved_submap : moved_submaps) {
+    streamed_submaps_[moved_submap.submap_ptr->getID()].pose_version =
+        moved_submap.pose_version;
+  }
+  for (const SubmapID submap_id : removed_submap_ids) {
+    streamed_submaps_.erase(submap_id);
+    frozen_submap_cache_.erase(submap_id);
+  }
+  streamed_active_submap_id_ = active_submap_id;
+  sequence_number_++;
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::getSnapshot(
+    const SubmapCollection<SubmapType>& submap_collection,
+    std::vector<std::string>* parts) {
+  CHECK_NOTNULL(parts);
+  parts->clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  const SubmapID active_submap_id = submap_collection.getActiveSubMapID();
+  AlignedVector<SubmapToSend> submaps_to_send;
+  findChanges(submap_collection, true, &submaps_to_send, nullptr, nullptr);
+  std::vector<SerializedSubmap> serialized_submaps;
+  serializeSubmaps(submaps_to_send, &serialized_submaps);
+  writeUpdate(true, active_submap_id,
+              std::vector<TsdfSubmapCheckpointRecordProto>(),
+              serialized_submaps, parts);
+  VLOG(1) << "Submap stream snapshot at " << sequence_number_ << ": "
+          << serialized_submaps.size() << " submaps in " << parts->size()
+          << " parts.";
+}
+
+template <typename SubmapType>
+uint64_t SubmapStreamPublisher<SubmapType>::getSequenceNumber() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return sequence_number_;
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::findChanges(
+    const SubmapCollection<SubmapType>& submap_collection,
+    const bool all_submaps, AlignedVector<SubmapToSend>* submaps_to_send,
+    AlignedVector<SubmapToSend>* moved_submaps,
+    std::vector<SubmapID>* removed_submap_ids) const {
+  CHECK_NOTNULL(submaps_to_send);
+  CHECK(all_submaps || (moved_submaps != nullptr &&
+                        removed_submap_ids != nullptr));
+  // NOTE: The stamps are read before the pose (and later the TSDF), such that
+  //       changes made in the meantime are sent (again) with the next delta.
+  // NOTE: Only the stamps and poses are read here, so the submaps are iterated
+  //       in a view, rather than copying out all pointers on every update.
+  std::set<SubmapID> submap_ids;
+  const typename SubmapCollection<SubmapType>::ConstSubmapView submap_view =
+      submap_collection.getSubMapView();
+  for (auto submap_it = submap_view.begin(); submap_it != submap_view.end();
+       ++submap_it) {
+    const typename SubmapType::ConstPtr submap_ptr = submap_it.getPtr();
+    SubmapToSend submap_to_send;
+    submap_to_send.submap_ptr = submap_ptr;
+    submap_to_send.tsdf_version = submap_ptr->getTsdfVersion();
+    submap_to_send.pose_version = submap_ptr->getPoseVersion();
+    submap_to_send.T_G_S = submap_ptr->getPose();
+    if (all_submaps) {
+      submaps_to_send->push_back(submap_to_send);
+      continue;
+    }
+    submap_ids.insert(submap_ptr->getID());
+    const auto it = streamed_submaps_.find(submap_ptr->getID());
+    if (it == streamed_submaps_.end() ||
+        it->second.tsdf_version != submap_to_send.tsdf_version) {
+      submaps_to_send->push_back(submap_to_send);
+    } else if (it->second.pose_version != submap_to_send.pose_version) {
+      moved_submaps->push_back(submap_to_send);
+    }
+  }
+  if (all_submaps) {
+    return;
+  }
+  for (const auto& id_streamed_submap_pair : streamed_submaps_) {
+    if (submap_ids.count(id_streamed_submap_pair.first) == 0) {
+      removed_submap_ids->push_back(id_streamed_submap_pair.first);
+    }
+  }
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::serializeSubmaps(
+    const AlignedVector<SubmapToSend>& submaps_to_send,
+    std::vector<SerializedSubmap>* serialized_submaps) {
+  CHECK_NOTNULL(serialized_submaps);
+  const size_t num_submaps = submaps_to_send.size();
+  std::vector<SerializedSubmap> submaps(num_submaps);
+  std::vector<char> submap_cached(num_submaps, false);
+  // Reusing the bytes of frozen submaps
+  for (size_t submap_index = 0; submap_index < num_submaps; submap_index++) {
+    const SubmapToSend& submap_to_send = submaps_to_send[submap_index];
+    const auto it =
+        frozen_submap_cache_.find(submap_to_send.submap_ptr->getID());
+    if (it != frozen_submap_cache_.end() &&
+        it->second.tsdf_version == submap_to_send.tsdf_version) {
+      submaps[submap_index] = it->second;
+      submap_cached[submap_index] = true;
+    }
+  }
+  parallelFor(num_submaps, config_.num_threads, [&](const size_t submap_index) {
+    if (submap_cached[submap_index]) {
+      return;
+    }
+    const SubmapType& submap = *submaps_to_send[submap_index].submap_ptr;
+    std::shared_ptr<std::string> bytes = std::make_shared<std::string>();
+    TsdfSubmapProto tsdf_sub_map_proto;
+    const bool serialized =
+        config_.compress_submaps
+            ? submap.serializeEncodedToString(config_.encoding_config,
+                                              bytes.get(), &tsdf_sub_map_proto)
+            : submap.serializeToString(bytes.get(), &tsdf_sub_map_proto);
+    if (!serialized) {
+      LOG(ERROR) << "Could not serialize submap " << submap.getID()
+                 << " for the submap stream.";
+      return;
+    }
+    SerializedSubmap& serialized_submap = submaps[submap_index];
+    serialized_submap.tsdf_version = submaps_to_send[submap_index].tsdf_version;
+    serialized_submap.bytes = bytes;
+    serialized_submap.record_proto.set_type(
+        TsdfSubmapCheckpointRecordProto::SUBMAP);
+    TsdfSubmapIndexEntryProto* index_entry_proto =
+        serialized_submap.record_proto.mutable_submap();
+    index_entry_proto->set_id(submap.getID());
+    index_entry_proto->set_num_bytes(bytes->size());
+    index_entry_proto->set_num_blocks(tsdf_sub_map_proto.num_blocks());
+    conversions::boundingBoxToProto(submap.getSubmapFrameBoundingBox(),
+                                    index_entry_proto->mutable_bounding_box());
+  });
+  serialized_submaps->clear();
+  serialized_submaps->reserve(num_submaps);
+  for (size_t submap_index = 0; submap_index < num_submaps; submap_index++) {
+    SerializedSubmap& serialized_submap = submaps[submap_index];
+    if (!serialized_submap.bytes) {
+      continue;
+    }
+    const SubmapToSend& submap_to_send = submaps_to_send[submap_index];
+    if (!submap_cached[submap_index] && submap_to_send.submap_ptr->isFrozen()) {
+      frozen_submap_cache_[submap_to_send.submap_ptr->getID()] =
+          serialized_submap;
+    }
+    // The pose in the header of the bytes may be outdated, the record's isn't
+    conversions::transformKindrToProto(
+        submap_to_send.T_G_S,
+        serialized_submap.record_proto.mutable_submap()->mutable_transform());
+    serialized_submaps->push_back(std::move(serialized_submap));
+  }
+}
+
+template <typename SubmapType>
+void SubmapStreamPublisher<SubmapType>::writeUpdate(
+    const bool is_snapshot, const SubmapID active_submap_id,
+    const std::vector<TsdfSubmapCheckpointRecordProto>& record_protos,
+    const std::vector<SerializedSubmap>& serialized_submaps,
+    std::vector<std::string>* parts) const {
+  CHECK_NOTNULL(parts);
+  // The pose and remove records go into the first part
+  std::vector<TsdfSubmapStreamUpdateProto> update_protos(1);
+  std::vector<std::vector<const std::string*>> part_submap_bytes(1);
+  std::vector<size_t> part_num_bytes(1, 0);
+  for (const TsdfSubmapCheckpointRecordProto& record_proto : record_protos) {
+    *update_protos.back().add_records() = record_proto;
+  }
+  for (const SerializedSubmap& serialized_submap : serialized_submaps) {
+    const size_t num_bytes = serialized_submap.bytes->size();
+    if (part_num_bytes.back() > 0 &&
+        part_num_bytes.back() + num_bytes > config_.max_part_num_bytes) {
+      update_protos.emplace_back();
+      part_submap_bytes.emplace_back();
+      part_num_bytes.push_back(0);
+    }
+    *update_protos.back().add_records() = serialized_submap.record_proto;
+    part_submap_bytes.back().push_back(serialized_submap.bytes.get());
+    part_num_bytes.back() += num_bytes;
+  }
+  const size_t num_parts = update_protos.size();
+  parts->resize(num_parts);
+  for (size_t part_index = 0; part_index < num_parts; part_index++) {
+    TsdfSubmapStreamUpdateProto& update_proto = update_protos[part_index];
+    update_proto.set_sequence_number(sequence_number_);
+    update_proto.set_is_snapshot(is_snapshot);
+    update_proto.set_part_index(part_index);
+    update_proto.set_num_parts(num_parts);
+    update_proto.set_active_submap_id(active_submap_id);
+    std::string& part = (*parts)[part_index];
+    AppendProtoMsgToString(update_proto, &part);
+    part.reserve(part.size() + part_num_bytes[part_index]);
+    for (const std::string* bytes : part_submap_bytes[part_index]) {
+      part.append(*bytes);
+    }
+  }
+}
+
+template <typename SubmapType>
+SubmapStreamReceiver<SubmapType>::SubmapStreamReceiver(
+    const typename SubmapCollection<SubmapType>::Ptr& submap_collection_ptr,
+    const size_t max_buffered_parts, const size_t num_threads)
+    : submap_collection_ptr_(submap_collection_ptr),
+      max_buffered_parts_(max_buffered_parts),
+      num_threads_(num_threads),
+      synced_(false),
+      receiving_snapshot_(false),
+      sequence_number_(0),
+      next_part_index_(0),
+      active_submap_id_(0) {
+  CHECK(submap_collection_ptr_);
+  CHECK_GT(max_buffered_parts_, 0u);
+}
+
+template <typename SubmapType>
+bool SubmapStreamReceiver<SubmapType>::addUpdatePart(
+    const std::string& bytes) {
+  TsdfSubmapStreamUpdateProto update_proto;
+  uint64_t submaps_byte_offset = 0;
+  if (!ParseProtoMsgFromString(bytes, &update_proto, &submaps_byte_offset)) {
+    LOG(ERROR) << "Could not parse the submap stream update.";
+    return false;
+  }
+  if (!update_proto.is_snapshot()) {
+    return addDeltaPart(update_proto, bytes, submaps_byte_offset);
+  }
+  // A snapshot replaces everything received before
+  if (update_proto.part_index() == 0) {
+    submap_collection_ptr_->clear();
+    synced_ = false;
+    receiving_snapshot_ = true;
+    next_part_index_ = 0;
+  }
+  if (!receiving_snapshot_ || update_proto.part_index() != next_part_index_) {
+    LOG(WARNING) << "Received part " << update_proto.part_index()
+                 << " of a submap stream snapshot out of order.";
+    receiving_snapshot_ = false;
+    return false;
+  }
+  if (!applyPart(update_proto, bytes, submaps_byte_offset)) {
+    receiving_snapshot_ = false;
+    return false;
+  }
+  next_part_index_++;
+  if (next_part_index_ < update_proto.num_parts()) {
+    return true;
+  }
+  receiving_snapshot_ = false;
+  synced_ = true;
+  sequence_number_ = update_proto.sequence_number();
+  next_part_index_ = 0;
+  VLOG(1) << "Applied the submap stream snapshot at "
+          << sequence_number_ << ".";
+  applyBufferedDeltas();
+  return true;
+}
+
+template <typename SubmapType>
+bool SubmapStreamReceiver<SubmapType>::addDeltaPart(
+    const TsdfSubmapStreamUpdateProto& update_proto, const std::string& bytes,
+    const uint64_t submaps_byte_offset) {
+  if (!synced_) {
+    bufferDeltaPart(bytes);
+    return true;
+  }
+  // Deltas included in the snapshot
+  if (update_proto.sequence_number() <= sequence_number_) {
+    return true;
+  }
+  if (update_proto.sequence_number() != sequence_number_ + 1 ||
+      update_proto.part_index() != next_part_index_) {
+    LOG(WARNING) << "Missed a part of submap stream delta "
+                 << sequence_number_ + 1 << ", a snapshot is required.";
+    synced_ = false;
+    next_part_index_ = 0;
+    buffered_delta_parts_.clear();
+    bufferDeltaPart(bytes);
+    return true;
+  }
+  if (!applyPart(update_proto, bytes, submaps_byte_offset)) {
+    synced_ = false;
+    next_part_index_ = 0;
+    return false;
+  }
+  next_part_index_++;
+  if (next_part_index_ == update_proto.num_parts()) {
+    sequence_number_ = update_proto.sequence_number();
+    next_part_index_ = 0;
+  }
+  return true;
+}
+
+template <typename SubmapType>
+void SubmapStreamReceiver<SubmapType>::applyBufferedDeltas() {
+  std::deque<std::string> buffered_delta_parts;
+  buffered_delta_parts.swap(buffered_delta_parts_);
+  for (std::string& bytes : buffered_delta_parts) {
+    // Holding back the rest once a delta was missed
+    if (!synced_) {
+      bufferDeltaPart(bytes);
+      continue;
+    }
+    TsdfSubmapStreamUpdateProto update_proto;
+    uint64_t submaps_byte_offset = 0;
+    if (ParseProtoMsgFromString(bytes, &update_proto, &submaps_byte_offset)) {
+      addDeltaPart(update_proto, bytes, submaps_byte_offset);
+    }
+  }
+}
+
+template <typename SubmapType>
+bool SubmapStreamReceiver<SubmapType>::applyPart(
+    const TsdfSubmapStreamUpdateProto& update_proto, const std::string& bytes,
+    const uint64_t submaps_byte_offset) {
+  // Finding where the submaps start, such that they're parsed in parallel
+  std::vector<const TsdfSubmapIndexEntryProto*> index_entry_protos;
+  std::vector<uint64_t> submap_byte_offsets;
+  SubmapPoseMap T_G_S_map;
+  std::vector<SubmapID> removed_submap_ids;
+  uint64_t byte_offset = submaps_byte_offset;
+  for (const TsdfSubmapCheckpointRecordProto& record_proto :
+       update_proto.records()) {
+    if (record_proto.type() == TsdfSubmapCheckpointRecordProto::SUBMAP) {
+      if (byte_offset + record_proto.submap().num_bytes() > bytes.size()) {
+        LOG(ERROR) << "The submaps of the submap stream update are truncated.";
+        return false;
+      }
+      index_entry_protos.push_back(&record_proto.submap());
+      submap_byte_offsets.push_back(byte_offset);
+      byte_offset += record_proto.submap().num_bytes();
+    } else if (record_proto.type() == TsdfSubmapCheckpointRecordProto::POSE) {
+      conversions::transformProtoToKindr(record_proto.transform(),
+                                         &T_G_S_map[record_proto.id()]);
+    } else if (record_proto.type() ==
+               TsdfSubmapCheckpointRecordProto::REMOVE) {
+      removed_submap_ids.push_back(record_proto.id());
+    }
+  }
+  const typename SubmapType::Config& submap_config =
+      submap_collection_ptr_->getConfig();
+  const size_t num_submaps = index_entry_protos.size();
+  std::vector<typename SubmapType::Ptr> submap_ptrs(num_submaps);
+  std::atomic<bool> success(true);
+  parallelFor(num_submaps, num_threads_, [&](const size_t submap_index) {
+    if (!success) {
+      return;
+    }
+    const TsdfSubmapIndexEntryProto& index_entry_proto =
+        *index_entry_protos[submap_index];
+    Transformation T_G_S;
+    conversions::transformProtoToKindr(index_entry_proto.transform(), &T_G_S);
+    typename SubmapType::Ptr submap_ptr(
+        new SubmapType(T_G_S, index_entry_proto.id(), submap_config));
+    TsdfSubmapProto tsdf_sub_map_proto;
+    if (!ParseSubmapFromString(
+            bytes.substr(submap_byte_offsets[submap_index],
+                         index_entry_proto.num_bytes()),
+            &tsdf_sub_map_proto,
+            submap_ptr->getTsdfMapPtr()->getTsdfLayerPtr())) {
+      LOG(ERROR) << "Could not parse submap " << index_entry_proto.id()
+                 << " of the submap stream update.";
+      success = false;
+      return;
+    }
+    submap_ptr->freeze();
+    submap_ptrs[submap_index] = submap_ptr;
+  });
+  if (!success) {
+    return false;
+  }
+  submap_collection_ptr_->removeSubMaps(removed_submap_ids);
+  submap_collection_ptr_->replaceSubMaps(submap_ptrs);
+  submap_collection_ptr_->updatePoses(T_G_S_map);
+  active_submap_id_ = update_proto.active_submap_id();
+  return true;
+}
+
+template <typename SubmapType>
+void SubmapStreamReceiver<SubmapType>::bufferDeltaPart(
+    const std::string& bytes) {
+  if (buffered_delta_parts_.size() >= max_buffered_parts_) {
+    buffered_delta_parts_.pop_front();
+  }
+  buffered_delta_parts_.push_back(bytes);
+}
+
+}  // namespace io
+}  // namespace cblox
+
+#endif  // CBLOX_IO_SUBMAP_STREAM_INL_H_
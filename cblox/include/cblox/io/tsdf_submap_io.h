@@ -5,12 +5,14 @@
 
 #include "cblox/core/common.h"
 #include "cblox/core/submap_collection.h"
+#include "cblox/utils/parallel_for.h"
 
 namespace cblox {
 namespace io {
 
+template <typename SubmapType>
 bool SaveTsdfSubmapCollection(
-    const SubmapCollection<TsdfSubmap> &tsdf_submap_collection,
+    const SubmapCollection<SubmapType> &tsdf_submap_collection,
     const std::string &file_path);
 
 template <typename SubmapType>
@@ -19,8 +21,20 @@ bool LoadSubmapFromStream(
     typename SubmapCollection<SubmapType>::Ptr tsdf_submap_collection_ptr,
     uint32_t *tmp_byte_offset_ptr);
 
+// Loads all submaps of a collection file. Indexed files are loaded over
+// num_threads.
 template <typename SubmapType>
 bool LoadSubmapCollection(
+    const std::string &file_path,
+    typename SubmapCollection<SubmapType>::Ptr *tsdf_submap_collection_ptr,
+    const size_t num_threads = getDefaultNumThreads());
+
+// Reads only the index of a collection file. The submaps are added paged out,
+// and are read from the file on first access (see
+// TsdfSubmap::setPagedOutToFile()). The last submap is activated. Files in the
+// original format (without an index) are loaded in full.
+template <typename SubmapType>
+bool LoadSubmapCollectionLazily(
     const std::string &file_path,
     typename SubmapCollection<SubmapType>::Ptr *tsdf_submap_collection_ptr);
 
@@ -1,9 +1,10 @@
 #ifndef CBLOX_IO_TSDF_SUBMAP_IO_INL_H_
 #define CBLOX_IO_TSDF_SUBMAP_IO_INL_H_
 
+#include <atomic>
+#include <limits>
 #include <string>
-
-#include <voxblox/io/layer_io.h>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -11,96 +12,266 @@
 #include "./TsdfSubmap.pb.h"
 #include "./TsdfSubmapCollection.pb.h"
 
+#include "cblox/io/submap_file.h"
+#include "cblox/utils/bounding_box_protobuf_utils.h"
+#include "cblox/utils/parallel_for.h"
 #include "cblox/utils/quat_transformation_protobuf_utils.h"
 
 namespace cblox {
 namespace io {
+namespace internal {
 
+// Reads a submap into a new submap object, which is not part of a collection
+// yet. Returns nullptr on failure.
 template <typename SubmapType>
-bool LoadSubmapFromStream(
+typename SubmapType::Ptr ReadSubmap(
     std::fstream *proto_file_ptr,
-    typename SubmapCollection<SubmapType>::Ptr tsdf_submap_collection_ptr,
-    uint32_t *tmp_byte_offset_ptr) {
-  CHECK_NOTNULL(proto_file_ptr);
-  CHECK(tsdf_submap_collection_ptr);
-  CHECK_NOTNULL(tmp_byte_offset_ptr);
-
+    const typename SubmapType::Config &submap_config,
+    uint64_t *byte_offset_ptr) {
   // Getting the header for this submap
   TsdfSubmapProto tsdf_sub_map_proto;
-  if (!voxblox::utils::readProtoMsgFromStream(
-          proto_file_ptr, &tsdf_sub_map_proto, tmp_byte_offset_ptr)) {
+  if (!ReadProtoMsgFromStream(proto_file_ptr, &tsdf_sub_map_proto,
+                              byte_offset_ptr)) {
     LOG(ERROR) << "Could not read tsdf sub map protobuf message.";
-    return false;
+    return typename SubmapType::Ptr();
   }
-
   // Getting the transformation
   Transformation T_M_S;
-  QuatTransformationProto transformation_proto = tsdf_sub_map_proto.transform();
-  conversions::transformProtoToKindr(transformation_proto, &T_M_S);
-
-  LOG(INFO) << "Tsdf submap id: " << tsdf_sub_map_proto.id();
-  LOG(INFO) << "Tsdf number of allocated blocks: "
-            << tsdf_sub_map_proto.num_blocks();
-  Eigen::Vector3 t = T_M_S.getPosition();
-  Quaternion q = T_M_S.getRotation();
-  LOG(INFO) << "[ " << t.x() << ", " << t.y() << ", " << t.z() << ", " << q.w()
-            << q.x() << ", " << q.y() << ", " << q.z() << " ]";
-
-  // Creating a new submap to hold the data
-  tsdf_submap_collection_ptr->createNewSubMap(T_M_S, tsdf_sub_map_proto.id());
-
+  conversions::transformProtoToKindr(tsdf_sub_map_proto.transform(), &T_M_S);
+  VLOG(2) << "Tsdf submap id: " << tsdf_sub_map_proto.id()
+          << ", number of allocated blocks: "
+          << tsdf_sub_map_proto.num_blocks()
+          << ", position: " << T_M_S.getPosition().transpose();
   // Getting the blocks for this submap (the tsdf layer)
-  if (!voxblox::io::LoadBlocksFromStream(
-          tsdf_sub_map_proto.num_blocks(),
-          Layer<TsdfVoxel>::BlockMergingStrategy::kReplace, proto_file_ptr,
-          tsdf_submap_collection_ptr->getActiveTsdfMapPtr()->getTsdfLayerPtr(),
-          tmp_byte_offset_ptr)) {
+  typename SubmapType::Ptr submap_ptr(
+      new SubmapType(T_M_S, tsdf_sub_map_proto.id(), submap_config));
+  if (!ReadBlocksFromStream(proto_file_ptr, tsdf_sub_map_proto,
+                            byte_offset_ptr,
+                            submap_ptr->getTsdfMapPtr()->getTsdfLayerPtr())) {
     LOG(ERROR) << "Could not load the blocks from stream.";
+    return typename SubmapType::Ptr();
+  }
+  return submap_ptr;
+}
+
+// Adds the loaded submaps to the collection in one go. As when creating the
+// submaps one after another, the last submap ends up active. Returns false,
+// adding none, if any of the IDs is already in the collection.
+template <typename SubmapType>
+bool AddLoadedSubmaps(
+    const std::vector<typename SubmapType::Ptr> &submap_ptrs,
+    SubmapCollection<SubmapType> *tsdf_submap_collection_ptr) {
+  CHECK_NOTNULL(tsdf_submap_collection_ptr);
+  if (submap_ptrs.empty()) {
+    return true;
+  }
+  for (size_t submap_index = 0; submap_index + 1 < submap_ptrs.size();
+       submap_index++) {
+    submap_ptrs[submap_index]->freeze();
+  }
+  if (!tsdf_submap_collection_ptr->addSubMaps(submap_ptrs)) {
     return false;
   }
+  tsdf_submap_collection_ptr->activateSubMap(submap_ptrs.back()->getID());
+  tsdf_submap_collection_ptr->enforceMemoryBudget();
+  return true;
+}
+
+// Loads the submaps of an indexed file in parallel. The file reads are
+// serialized (by the reader), while the submaps are parsed concurrently, each
+// into its own map.
+template <typename SubmapType>
+bool LoadIndexedSubmaps(
+    const std::string &file_path,
+    const TsdfSubmapCollectionIndexProto &index_proto,
+    const size_t num_threads,
+    SubmapCollection<SubmapType> *tsdf_submap_collection_ptr) {
+  CHECK_NOTNULL(tsdf_submap_collection_ptr);
+  const SubmapFileReader::Ptr file_reader_ptr =
+      SubmapFileReader::open(file_path);
+  if (!file_reader_ptr) {
+    return false;
+  }
+  const typename SubmapType::Config &submap_config =
+      tsdf_submap_collection_ptr->getConfig();
+  const size_t num_submaps = index_proto.submaps_size();
+  std::vector<typename SubmapType::Ptr> submap_ptrs(num_submaps);
+  std::atomic<bool> success(true);
+  std::atomic<size_t> num_loaded(0);
+  parallelFor(num_submaps, num_threads, [&](const size_t submap_index) {
+    if (!success) {
+      return;
+    }
+    const TsdfSubmapIndexEntryProto &index_entry_proto =
+        index_proto.submaps(submap_index);
+    Transformation T_M_S;
+    conversions::transformProtoToKindr(index_entry_proto.transform(), &T_M_S);
+    typename SubmapType::Ptr submap_ptr(
+        new SubmapType(T_M_S, index_entry_proto.id(), submap_config));
+    std::string bytes;
+    TsdfSubmapProto tsdf_sub_map_proto;
+    if (!file_reader_ptr->readBytes(index_entry_proto.byte_offset(),
+                                    index_entry_proto.num_bytes(), &bytes) ||
+        !ParseSubmapFromString(
+            bytes, &tsdf_sub_map_proto,
+            submap_ptr->getTsdfMapPtr()->getTsdfLayerPtr())) {
+      LOG(ERROR) << "Could not load the tsdf sub map with ID: "
+                 << index_entry_proto.id();
+      success = false;
+      return;
+    }
+    submap_ptrs[submap_index] = submap_ptr;
+    VLOG(2) << "Loaded tsdf submap id: " << index_entry_proto.id();
+    const size_t num_loaded_now = ++num_loaded;
+    VLOG_IF(1, num_loaded_now % 100 == 0)
+        << "Loaded " << num_loaded_now << " of " << num_submaps
+        << " submaps.";
+  });
+  if (!success) {
+    return false;
+  }
+  return AddLoadedSubmaps(submap_ptrs, tsdf_submap_collection_ptr);
+}
+
+}  // namespace internal
+
+template <typename SubmapType>
+bool SaveTsdfSubmapCollection(
+    const SubmapCollection<SubmapType> &tsdf_submap_collection,
+    const std::string &file_path) {
+  return tsdf_submap_collection.saveToFile(file_path);
+}
 
+template <typename SubmapType>
+bool LoadSubmapFromStream(
+    std::fstream *proto_file_ptr,
+    typename SubmapCollection<SubmapType>::Ptr tsdf_submap_collection_ptr,
+    uint32_t *tmp_byte_offset_ptr) {
+  CHECK_NOTNULL(proto_file_ptr);
+  CHECK(tsdf_submap_collection_ptr);
+  CHECK_NOTNULL(tmp_byte_offset_ptr);
+  uint64_t byte_offset = *tmp_byte_offset_ptr;
+  const typename SubmapType::Ptr submap_ptr = internal::ReadSubmap<SubmapType>(
+      proto_file_ptr, tsdf_submap_collection_ptr->getConfig(), &byte_offset);
+  if (!submap_ptr) {
+    return false;
+  }
+  // NOTE: The offset of this interface is 32 bits, like the voxblox readers.
+  CHECK_LE(byte_offset, std::numeric_limits<uint32_t>::max());
+  *tmp_byte_offset_ptr = static_cast<uint32_t>(byte_offset);
+  if (!tsdf_submap_collection_ptr->addSubMap(submap_ptr)) {
+    return false;
+  }
+  tsdf_submap_collection_ptr->activateSubMap(submap_ptr->getID());
   return true;
 }
 
 template <typename SubmapType>
 bool LoadSubmapCollection(
     const std::string &file_path,
-    typename SubmapCollection<SubmapType>::Ptr *tsdf_submap_collection_ptr) {
+    typename SubmapCollection<SubmapType>::Ptr *tsdf_submap_collection_ptr,
+    const size_t num_threads) {
   CHECK_NOTNULL(tsdf_submap_collection_ptr);
+  CHECK(*tsdf_submap_collection_ptr);
+  // Indexed files are loaded in parallel
+  TsdfSubmapCollectionIndexProto index_proto;
+  if (ReadCollectionIndex(file_path, &index_proto)) {
+    const bool success = internal::LoadIndexedSubmaps<SubmapType>(
+        file_path, index_proto, num_threads,
+        tsdf_submap_collection_ptr->get());
+    LOG_IF(INFO, success) << "Loaded " << index_proto.submaps_size()
+                          << " submaps from: " << file_path;
+    return success;
+  }
   // Open and check the file
   std::fstream proto_file;
-  proto_file.open(file_path, std::fstream::in);
+  proto_file.open(file_path, std::fstream::in | std::fstream::binary);
   if (!proto_file.is_open()) {
     LOG(ERROR) << "Could not open protobuf file to load layer: " << file_path;
     return false;
   }
-  // Unused byte offset result.
-  uint32_t tmp_byte_offset = 0;
+  uint64_t byte_offset = 0;
   // Loading the header
   TsdfSubmapCollectionProto tsdf_submap_collection_proto;
-  if (!voxblox::utils::readProtoMsgFromStream(
-          &proto_file, &tsdf_submap_collection_proto, &tmp_byte_offset)) {
+  if (!ReadProtoMsgFromStream(&proto_file, &tsdf_submap_collection_proto,
+                              &byte_offset)) {
     LOG(ERROR) << "Could not read tsdf submap collection map protobuf message.";
     return false;
   }
-
-  LOG(INFO) << "tsdf_submap_collection_proto.num_submaps(): "
-            << tsdf_submap_collection_proto.num_submaps();
-
-  // Loading each of the tsdf sub maps
-  for (size_t sub_map_index = 0;
-       sub_map_index < tsdf_submap_collection_proto.num_submaps();
+  if (!IsKnownCollectionFileFormatVersion(tsdf_submap_collection_proto)) {
+    return false;
+  }
+  // Loading each of the tsdf sub maps (one after another, as the submaps can
+  // only be found by reading the ones before them)
+  const size_t num_submaps = tsdf_submap_collection_proto.num_submaps();
+  std::vector<typename SubmapType::Ptr> submap_ptrs;
+  submap_ptrs.reserve(num_submaps);
+  for (size_t sub_map_index = 0; sub_map_index < num_submaps;
        sub_map_index++) {
-    LOG(INFO) << "Loading tsdf sub map number: " << sub_map_index;
-    // Loading the submaps
-    if (!LoadSubmapFromStream<SubmapType>(
-            &proto_file, *tsdf_submap_collection_ptr, &tmp_byte_offset)) {
+    VLOG_EVERY_N(1, 100) << "Loading tsdf sub map number: " << sub_map_index;
+    submap_ptrs.push_back(internal::ReadSubmap<SubmapType>(
+        &proto_file, (*tsdf_submap_collection_ptr)->getConfig(),
+        &byte_offset));
+    if (!submap_ptrs.back()) {
       LOG(ERROR) << "Could not load the tsdf sub map from stream.";
       return false;
     }
   }
   // Because grown ups clean up after themselves
   proto_file.close();
+  if (!internal::AddLoadedSubmaps(submap_ptrs,
+                                  tsdf_submap_collection_ptr->get())) {
+    return false;
+  }
+  LOG(INFO) << "Loaded " << num_submaps << " submaps from: " << file_path;
+  return true;
+}
+
+template <typename SubmapType>
+bool LoadSubmapCollectionLazily(
+    const std::string &file_path,
+    typename SubmapCollection<SubmapType>::Ptr *tsdf_submap_collection_ptr) {
+  CHECK_NOTNULL(tsdf_submap_collection_ptr);
+  CHECK(*tsdf_submap_collection_ptr);
+  // Reading the index
+  TsdfSubmapCollectionIndexProto index_proto;
+  if (!ReadCollectionIndex(file_path, &index_proto)) {
+    LOG(INFO) << "No index found, loading all submaps from: " << file_path;
+    return LoadSubmapCollection<SubmapType>(file_path,
+                                            tsdf_submap_collection_ptr);
+  }
+  // The submaps share the open file
+  const SubmapFileReader::Ptr file_reader_ptr =
+      SubmapFileReader::open(file_path);
+  if (!file_reader_ptr) {
+    return false;
+  }
+  // Creating the (paged out) submaps
+  const typename SubmapType::Config &submap_config =
+      (*tsdf_submap_collection_ptr)->getConfig();
+  std::vector<typename SubmapType::Ptr> submap_ptrs;
+  submap_ptrs.reserve(index_proto.submaps_size());
+  for (const TsdfSubmapIndexEntryProto &index_entry_proto :
+       index_proto.submaps()) {
+    Transformation T_M_S;
+    conversions::transformProtoToKindr(index_entry_proto.transform(), &T_M_S);
+    BoundingBox bounding_box_S;
+    conversions::boundingBoxProtoToBoundingBox(
+        index_entry_proto.bounding_box(), &bounding_box_S);
+    typename SubmapType::Ptr submap_ptr(
+        new SubmapType(T_M_S, index_entry_proto.id(), submap_config));
+    submap_ptr->setPagedOutToFile(
+        file_reader_ptr, index_entry_proto.byte_offset(),
+        index_entry_proto.num_bytes(), index_entry_proto.num_blocks(),
+        bounding_box_S);
+    submap_ptrs.push_back(submap_ptr);
+  }
+  if (!internal::AddLoadedSubmaps(submap_ptrs,
+                                  tsdf_submap_collection_ptr->get())) {
+    return false;
+  }
+  LOG(INFO) << "Indexed " << submap_ptrs.size()
+            << " submaps from: " << file_path;
   return true;
 }
 
@@ -1,9 +1,12 @@
 #ifndef CBLOX_MESH_SUBMAP_MESHER_H_
 #define CBLOX_MESH_SUBMAP_MESHER_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 
+#include <voxblox/core/block_hash.h>
 #include <voxblox/core/tsdf_map.h>
 #include <voxblox/integrator/merge_integration.h>
 #include <voxblox/integrator/tsdf_integrator.h>
@@ -14,6 +17,7 @@
 #include "cblox/core/common.h"
 #include "cblox/core/submap_collection.h"
 #include "cblox/core/tsdf_submap.h"
+#include "cblox/utils/parallel_for.h"
 
 namespace cblox {
 
@@ -24,40 +28,107 @@ using voxblox::MeshIntegratorConfig;
 using voxblox::Color;
 using voxblox::VertexIndex;
 
+// The side length (in blocks) of the tiles in which the combined mesh is built.
+constexpr size_t kDefaultCombinedMeshTileSizeBlocks = 8;
+
+// Level of detail of the cached submap meshes. Frozen submaps further from the
+// viewpoint are meshed from their TSDF downsampled (see downsampleTsdfLayer()),
+// by a factor of two per level.
+// NOTE: A submap within full_resolution_radius_m (from its bounding box) is at
+//       level 0, i.e. full resolution. Each doubling of the distance beyond
+//       adds a level, up to max_level. Submaps which are not frozen (e.g. the
+//       active submap) are always at full resolution.
+struct MeshLodConfig {
+  MeshLodConfig()
+      : enable(false), full_resolution_radius_m(20.0f), max_level(2) {}
+  bool enable;
+  FloatingPoint full_resolution_radius_m;
+  size_t max_level;
+};
+
 class SubmapMesher {
  public:
   typedef std::shared_ptr<SubmapMesher> Ptr;
   typedef std::shared_ptr<const SubmapMesher> ConstPtr;
 
   // Constructor
+  // NOTE: Submaps are meshed in parallel over num_threads.
   SubmapMesher(const TsdfMap::Config &submap_config,
-               const MeshIntegratorConfig &mesh_config)
-      : tsdf_map_config_(submap_config), mesh_config_(mesh_config) {}
+               const MeshIntegratorConfig &mesh_config,
+               const size_t num_threads = getDefaultNumThreads())
+      : tsdf_map_config_(submap_config),
+        mesh_config_(mesh_config),
+        num_threads_(num_threads) {}
 
   // Generating various meshes
+  // NOTE: The separated mesh is generated from the mesh cache (see below), so
+  //       only changed submaps are re-meshed. It is at full resolution, also
+  //       with level of detail.
   template <typename SubmapType>
   void generateSeparatedMesh(
       const SubmapCollection<SubmapType> &submap_collection,
       MeshLayer *seperated_mesh_layer_ptr);
+  // NOTE: The combined mesh is built by walking the global block grid in cubic
+  //       tiles. For each tile only the overlapping submap blocks are fused
+  //       into a scratch layer, which is meshed and released. Peak memory is
+  //       therefore bounded by the tile size rather than by the size of the
+  //       map, and tiles are processed in parallel.
   template <typename SubmapType>
   void generateCombinedMesh(
+      const SubmapCollection<SubmapType> &submap_collection,
+      MeshLayer *combined_mesh_layer_ptr,
+      const size_t tile_size_blocks = kDefaultCombinedMeshTileSizeBlocks);
+  // Generates the combined mesh by meshing the full projected TSDF map.
+  template <typename SubmapType>
+  void generateCombinedMeshFromProjectedMap(
       const SubmapCollection<SubmapType> &submap_collection,
       MeshLayer *combined_mesh_layer_ptr);
+  template <typename SubmapType>
   void generatePatchMeshes(
-      const SubmapCollection<TsdfSubmap> &tsdf_submap_collection,
+      const SubmapCollection<SubmapType> &submap_collection,
       std::vector<MeshLayer::Ptr> *sub_map_mesh_layers);
 
-  // Generates mesh layers from the TSDF submaps
+  // Generates mesh layers from the TSDF submaps. The output is in the order
+  // of the input submaps.
   template <typename SubmapType>
   void generateSeparatedMeshLayers(
       const std::vector<typename SubmapType::ConstPtr> &sub_maps,
       std::vector<MeshLayer::Ptr> *sub_map_mesh_layers);
 
+  // The per-submap mesh cache. Updating the cache re-meshes only the submaps
+  // whose TSDF changed since they were last meshed, and re-transforms into the
+  // global frame (G) only the submaps whose pose (or mesh) changed. Entries of
+  // submaps which are no longer in the collection are dropped. The cached
+  // meshes in G are colored by submap index (as in the separated mesh).
+  // NOTE: With level of detail enabled (and use_lod), the submaps are meshed at
+  //       the level of their distance to the viewpoint. The meshes of the level
+  //       in use and of the levels next to it are cached, so moving back and
+  //       forth across a level boundary doesn't re-mesh. The others are
+  //       dropped.
+  // NOTE: With frozen_only, the submaps still being written (e.g. the active
+  //       one) are left as they are, such that meshing doesn't wait on (or
+  //       hold up) their writers.
+  template <typename SubmapType>
+  void updateMeshCache(const SubmapCollection<SubmapType> &submap_collection,
+                       const bool use_lod = true,
+                       const bool frozen_only = false);
+  // Gets the cached meshes in G, in submap-ID order.
+  void getCachedMeshLayers(
+      std::vector<SubmapID> *submap_ids,
+      std::vector<MeshLayer::ConstPtr> *mesh_layers_G) const;
+  void clearMeshCache();
+
+  // Level of detail of the mesh cache
+  void setLodConfig(const MeshLodConfig &lod_config);
+  // The position (e.g. of the sensor) the levels are selected relative to
+  void setLodViewpoint(const Point &viewpoint_G);
+
   // Transforms a vector of mesh layers by a vector of posses
   static void transformMeshLayers(
       const std::vector<MeshLayer::ConstPtr> &sub_map_mesh_layers,
       const AlignedVector<Transformation> &sub_map_poses,
-      std::vector<MeshLayer::Ptr> *transformed_sub_map_mesh_layers);
+      std::vector<MeshLayer::Ptr> *transformed_sub_map_mesh_layers,
+      const size_t num_threads = getDefaultNumThreads());
   // Transforms a single mesh layer
   static MeshLayer::Ptr transformMeshLayer(
       const MeshLayer &mesh_layer, const Transformation &transformation);
@@ -69,8 +140,10 @@ class SubmapMesher {
       MeshLayer *combined_mesh_layer_ptr);
 
   // Transform and add funcions
-  // TODO(alex.millane): There's a lot of code duplication in the
-  //                     implementation of the below functions. Clean up.
+  // NOTE: The layer versions transform the vertex arrays of each mesh in one
+  //       go, and bin the triangles to the output blocks (of their first
+  //       vertex) before appending them. Normals are rotated along with the
+  //       vertices.
   static void transformAndAddTrianglesToLayer(const MeshLayer &input_mesh_layer,
                                               const Transformation &T_B_A,
                                               MeshLayer *output_mesh_layer);
@@ -86,13 +159,75 @@ class SubmapMesher {
 
   // Functions for coloring meshes
   static void colorMeshLayersWithIndex(
-      std::vector<MeshLayer::Ptr> *sub_map_mesh_layers);
+      std::vector<MeshLayer::Ptr> *sub_map_mesh_layers,
+      const size_t num_threads = getDefaultNumThreads());
   static void colorMeshLayer(const Color &color_in, MeshLayer *mesh_layer_ptr);
 
  private:
+  // A cached submap mesh and the state of the submap it was generated from
+  struct CachedSubmapMesh {
+    // The meshes in the submap frame (S), by level of detail (nullptr if not
+    // generated, or dropped), and the level in use
+    std::vector<MeshLayer::Ptr> mesh_layers_S;
+    size_t tsdf_version = 0;
+    size_t lod_level = 0;
+    // The mesh transformed into G and colored
+    MeshLayer::Ptr mesh_layer_G;
+    size_t pose_version = 0;
+    Color color;
+  };
+
+  // A tile of the global block grid used when building the combined mesh.
+  // Maps the blocks of the tile, and of a one block border around it, to the
+  // indices of the submaps which (may) have data in them.
+  struct CombinedMeshTile {
+    voxblox::AnyIndexHashMapType<std::vector<size_t>>::type
+        block_to_submap_indices;
+  };
+
+  // Tiled combined meshing of a list of TSDF layers with poses T_G_S.
+  void generateCombinedMeshFromLayers(
+      const std::vector<const Layer<TsdfVoxel> *> &tsdf_layers,
+      const AlignedVector<Transformation> &T_G_S_vector,
+      const size_t tile_size_blocks, MeshLayer *combined_mesh_layer_ptr) const;
+
+  // Adds the triangles of the input layer, transformed by T_B_A (or as they
+  // are, if nullptr), to the output layer.
+  static void addTrianglesToLayerBatched(const MeshLayer &input_mesh_layer,
+                                         const Transformation *T_B_A_ptr,
+                                         MeshLayer *output_mesh_layer);
+
+  // Meshes a single TSDF map
+  MeshLayer::Ptr generateMeshLayer(
+      const TsdfMap &tsdf_map, const MeshIntegratorConfig &mesh_config) const;
+  // Meshes the TSDF layer at a level of detail (downsampled by 2^lod_level)
+  MeshLayer::Ptr generateLodMeshLayer(
+      const Layer<TsdfVoxel> &tsdf_layer, const size_t lod_level,
+      const MeshIntegratorConfig &mesh_config) const;
+  // The level at which a submap at this distance from the viewpoint is
+  // meshed. Call with the cache mutex held.
+  size_t getLodLevel(const FloatingPoint distance) const;
+  // The mesh config for submaps which are meshed num_parallel at a time.
+  // Splits the mesh integrator threads to avoid oversubscribing the cores.
+  MeshIntegratorConfig getParallelMeshConfig(const size_t num_parallel) const;
+  // Colors used for a submap in the separated mesh
+  static Color getIndexColor(const size_t sub_map_index,
+                             const size_t num_sub_maps);
+
   // The configs
   const TsdfMap::Config tsdf_map_config_;
   const MeshIntegratorConfig mesh_config_;
+
+  // The number of threads used for meshing
+  const size_t num_threads_;
+
+  // The mesh cache
+  mutable std::mutex mesh_cache_mutex_;
+  std::map<SubmapID, CachedSubmapMesh> mesh_cache_;
+
+  // Level of detail (guarded by the cache mutex)
+  MeshLodConfig lod_config_;
+  Point lod_viewpoint_G_ = Point::Zero();
 };
 
 }  // namespace cblox
@@ -1,6 +1,8 @@
 #ifndef CBLOX_MESH_SUBMAP_MESHER_INL_H_
 #define CBLOX_MESH_SUBMAP_MESHER_INL_H_
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 namespace cblox {
@@ -9,26 +11,56 @@ void SubmapMesher::generateSeparatedMesh(
     const SubmapCollection<SubmapType>& submap_collection,
     MeshLayer* seperated_mesh_layer_ptr) {
   CHECK_NOTNULL(seperated_mesh_layer_ptr);
+  // Bringing the (colored, transformed) submap meshes up to date
+  constexpr bool kUseLod = false;
+  updateMeshCache(submap_collection, kUseLod);
+  std::vector<SubmapID> submap_ids;
+  std::vector<MeshLayer::ConstPtr> sub_map_mesh_layers_G;
+  getCachedMeshLayers(&submap_ids, &sub_map_mesh_layers_G);
+  // Combining the mesh layers
+  LOG(INFO) << "Starting combining mesh layers.";
+  for (const MeshLayer::ConstPtr& mesh_layer_G_ptr : sub_map_mesh_layers_G) {
+    addTrianglesToLayer(*mesh_layer_G_ptr, seperated_mesh_layer_ptr);
+  }
+}
+
+template <typename SubmapType>
+void SubmapMesher::generatePatchMeshes(
+    const SubmapCollection<SubmapType>& submap_collection,
+    std::vector<MeshLayer::Ptr>* sub_map_mesh_layers_ptr) {
+  CHECK_NOTNULL(sub_map_mesh_layers_ptr);
   // Getting the submaps
   const std::vector<typename SubmapType::ConstPtr> sub_maps =
       submap_collection.getSubMapConstPtrs();
   // Generating the mesh layers
-  std::vector<MeshLayer::Ptr> sub_map_mesh_layers;
-  generateSeparatedMeshLayers<SubmapType>(sub_maps, &sub_map_mesh_layers);
-  // Coloring the mesh layers
-  colorMeshLayersWithIndex(&sub_map_mesh_layers);
-  // Get submap transforms
-  AlignedVector<Transformation> sub_map_poses;
-  submap_collection.getSubMapPoses(&sub_map_poses);
-  // Combining the mesh layers
-  // NOTE(alexmillane): Have to construct a vector of pointers to const...
-  combineMeshLayers(std::vector<MeshLayer::ConstPtr>(
-                        sub_map_mesh_layers.begin(), sub_map_mesh_layers.end()),
-                    sub_map_poses, seperated_mesh_layer_ptr);
+  generateSeparatedMeshLayers<SubmapType>(sub_maps, sub_map_mesh_layers_ptr);
 }
 
 template <typename SubmapType>
 void SubmapMesher::generateCombinedMesh(
+    const SubmapCollection<SubmapType>& submap_collection,
+    MeshLayer* combined_mesh_layer_ptr, const size_t tile_size_blocks) {
+  CHECK_NOTNULL(combined_mesh_layer_ptr);
+  // Getting the submap layers and poses
+  // NOTE: The submaps are held, and read locked, until meshing is done, as
+  //       their layers are accessed by raw pointer.
+  const std::vector<typename SubmapType::ConstPtr> sub_maps =
+      submap_collection.getSubMapConstPtrs();
+  std::vector<ReaderLock> tsdf_locks;
+  std::vector<const Layer<TsdfVoxel>*> tsdf_layers;
+  AlignedVector<Transformation> T_G_S_vector;
+  for (const typename SubmapType::ConstPtr& sub_map_ptr : sub_maps) {
+    tsdf_locks.push_back(sub_map_ptr->getTsdfReaderLock());
+    tsdf_layers.push_back(&(sub_map_ptr->getTsdfMap().getTsdfLayer()));
+    T_G_S_vector.push_back(sub_map_ptr->getPose());
+  }
+  // Tile by tile meshing
+  generateCombinedMeshFromLayers(tsdf_layers, T_G_S_vector, tile_size_blocks,
+                                 combined_mesh_layer_ptr);
+}
+
+template <typename SubmapType>
+void SubmapMesher::generateCombinedMeshFromProjectedMap(
     const SubmapCollection<SubmapType>& submap_collection,
     MeshLayer* combined_mesh_layer_ptr) {
   CHECK_NOTNULL(combined_mesh_layer_ptr);
@@ -49,29 +81,136 @@ void SubmapMesher::generateSeparatedMeshLayers(
     const std::vector<typename SubmapType::ConstPtr>& sub_maps,
     std::vector<MeshLayer::Ptr>* sub_map_mesh_layers) {
   CHECK_NOTNULL(sub_map_mesh_layers);
+  // NOTE: The output is sized up front such that each thread writes its result
+  //       to the slot of its submap, keeping the order of the input.
   sub_map_mesh_layers->clear();
-  sub_map_mesh_layers->reserve(sub_maps.size());
-  // Looping over the sub maps and generating meshs
-  size_t mesh_index = 0;
-  for (typename SubmapType::ConstPtr sub_map_ptr : sub_maps) {
+  sub_map_mesh_layers->resize(sub_maps.size());
+  LOG(INFO) << "Generating meshes for " << sub_maps.size() << " submaps on "
+            << num_threads_ << " threads.";
+  const MeshIntegratorConfig submap_mesh_config =
+      getParallelMeshConfig(sub_maps.size());
+  // Meshing the submaps in parallel
+  parallelFor(sub_maps.size(), num_threads_, [&](const size_t mesh_index) {
+    const typename SubmapType::ConstPtr& sub_map_ptr = sub_maps[mesh_index];
     CHECK_NOTNULL(sub_map_ptr.get());
-    LOG(INFO) << "Generating mesh for submap number #" << mesh_index;
-    mesh_index++;
-    // Getting the TSDF data
-    const TsdfMap& tsdf_map = sub_map_ptr->getTsdfMap();
-    // Creating a mesh layer to hold the mesh fragment
-    MeshLayer::Ptr mesh_layer_ptr(
-        new MeshLayer(sub_map_ptr->getTsdfMap().block_size()));
+    VLOG(1) << "Generating mesh for submap number #" << mesh_index;
     // Generating the mesh
-    MeshIntegrator<TsdfVoxel> mesh_integrator(
-        mesh_config_, tsdf_map.getTsdfLayer(), mesh_layer_ptr.get());
-    constexpr bool only_mesh_updated_blocks = false;
-    constexpr bool clear_updated_flag = false;
-    mesh_integrator.generateMesh(only_mesh_updated_blocks, clear_updated_flag);
-    // Pushing this mesh layer to the output
-    sub_map_mesh_layers->push_back(mesh_layer_ptr);
+    const ReaderLock tsdf_lock = sub_map_ptr->getTsdfReaderLock();
+    MeshLayer::Ptr mesh_layer_ptr =
+        generateMeshLayer(sub_map_ptr->getTsdfMap(), submap_mesh_config);
+    // Storing this mesh layer in the output
+    (*sub_map_mesh_layers)[mesh_index] = mesh_layer_ptr;
+  });
+}
+
+template <typename SubmapType>
+void SubmapMesher::updateMeshCache(
+    const SubmapCollection<SubmapType>& submap_collection,
+    const bool use_lod, const bool frozen_only) {
+  std::lock_guard<std::mutex> cache_lock(mesh_cache_mutex_);
+  // Dropping the meshes of submaps which no longer exist (e.g. fused)
+  for (auto it = mesh_cache_.begin(); it != mesh_cache_.end();) {
+    if (!submap_collection.exists(it->first)) {
+      it = mesh_cache_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // Creating the cache entries up front, such that the threads below only
+  // modify existing (distinct) entries. Submaps which are skipped get none.
+  const std::vector<typename SubmapType::ConstPtr> sub_maps =
+      submap_collection.getSubMapConstPtrs();
+  std::vector<CachedSubmapMesh*> cache_entries;
+  cache_entries.reserve(sub_maps.size());
+  for (const typename SubmapType::ConstPtr& sub_map_ptr : sub_maps) {
+    CHECK_NOTNULL(sub_map_ptr.get());
+    cache_entries.push_back((frozen_only && !sub_map_ptr->isFrozen())
+                                ? nullptr
+                                : &mesh_cache_[sub_map_ptr->getID()]);
   }
+  // Updating the entries in parallel
+  const MeshIntegratorConfig submap_mesh_config =
+      getParallelMeshConfig(sub_maps.size());
+  std::atomic<size_t> num_remeshed(0);
+  std::atomic<size_t> num_retransformed(0);
+  std::atomic<size_t> num_reduced(0);
+  const size_t num_sub_maps = sub_maps.size();
+  parallelFor(num_sub_maps, num_threads_, [&](const size_t sub_map_index) {
+    if (cache_entries[sub_map_index] == nullptr) {
+      return;
+    }
+    const SubmapType& sub_map = *sub_maps[sub_map_index];
+    CachedSubmapMesh& cache_entry = *cache_entries[sub_map_index];
+    // NOTE: The stamps are read before doing the work, such that changes which
+    //       happen during the work are picked up at the next update.
+    const size_t tsdf_version = sub_map.getTsdfVersion();
+    const size_t pose_version = sub_map.getPoseVersion();
+    bool mesh_layer_G_outdated = !cache_entry.mesh_layer_G ||
+                                 (cache_entry.pose_version != pose_version);
+    // The meshes of all levels are outdated when the TSDF changed
+    if (cache_entry.mesh_layers_S.empty() ||
+        (cache_entry.tsdf_version != tsdf_version)) {
+      cache_entry.mesh_layers_S.assign(1, MeshLayer::Ptr());
+      cache_entry.tsdf_version = tsdf_version;
+    }
+    const size_t lod_level =
+        (use_lod && sub_map.isFrozen())
+            ? getLodLevel(sub_map.getGlobalFrameBoundingBox().distanceTo(
+                  lod_viewpoint_G_))
+            : 0;
+    if (cache_entry.mesh_layers_S.size() <= lod_level) {
+      cache_entry.mesh_layers_S.resize(lod_level + 1);
+    }
+    // Meshing at this level (if required)
+    MeshLayer::Ptr& mesh_layer_S = cache_entry.mesh_layers_S[lod_level];
+    if (!mesh_layer_S) {
+      const ReaderLock tsdf_lock = sub_map.getTsdfReaderLock();
+      mesh_layer_S =
+          (lod_level == 0)
+              ? generateMeshLayer(sub_map.getTsdfMap(), submap_mesh_config)
+              : generateLodMeshLayer(sub_map.getTsdfMap().getTsdfLayer(),
+                                     lod_level, submap_mesh_config);
+      mesh_layer_G_outdated = true;
+      num_remeshed++;
+    }
+    if (cache_entry.lod_level != lod_level || !cache_entry.mesh_layer_G) {
+      cache_entry.lod_level = lod_level;
+      mesh_layer_G_outdated = true;
+      // Dropping the levels more than one away from the one in use
+      if (cache_entry.mesh_layers_S.size() > lod_level + 2) {
+        cache_entry.mesh_layers_S.resize(lod_level + 2);
+      }
+      for (size_t level = 0; level + 1 < lod_level; level++) {
+        cache_entry.mesh_layers_S[level].reset();
+      }
+    }
+    if (lod_level > 0) {
+      num_reduced++;
+    }
+    // Re-transforming (if required)
+    const Color color = getIndexColor(sub_map_index, num_sub_maps);
+    if (mesh_layer_G_outdated) {
+      cache_entry.mesh_layer_G =
+          transformMeshLayer(*mesh_layer_S, sub_map.getPose());
+      cache_entry.pose_version = pose_version;
+      colorMeshLayer(color, cache_entry.mesh_layer_G.get());
+      cache_entry.color = color;
+      num_retransformed++;
+    } else if (cache_entry.color.r != color.r ||
+               cache_entry.color.g != color.g ||
+               cache_entry.color.b != color.b ||
+               cache_entry.color.a != color.a) {
+      // The color depends on the number of submaps, so may have changed.
+      colorMeshLayer(color, cache_entry.mesh_layer_G.get());
+      cache_entry.color = color;
+    }
+  });
+  LOG(INFO) << "Updated the mesh cache. Re-meshed " << num_remeshed
+            << " and re-transformed " << num_retransformed << " of "
+            << num_sub_maps << " submaps (" << num_reduced
+            << " at reduced detail).";
 }
+
 }  // namespace cblox
 
 #endif  // CBLOX_MESH_SUBMAP_MESHER_INL_H_
@@ -0,0 +1,20 @@
+#ifndef CBLOX_UTILS_BOUNDING_BOX_PROTOBUF_UTILS_H_
+#define CBLOX_UTILS_BOUNDING_BOX_PROTOBUF_UTILS_H_
+
+#include "./TsdfSubmapCollection.pb.h"
+
+#include "cblox/core/bounding_box.h"
+
+namespace cblox {
+namespace conversions {
+
+void boundingBoxToProto(const BoundingBox &bounding_box,
+                        BoundingBoxProto *bounding_box_proto);
+
+void boundingBoxProtoToBoundingBox(const BoundingBoxProto &bounding_box_proto,
+                                   BoundingBox *bounding_box);
+
+}  // namespace conversions
+}  // namespace cblox
+
+#endif  // CBLOX_UTILS_BOUNDING_BOX_PROTOBUF_UTILS_H_
@@ -0,0 +1,52 @@
+#ifndef CBLOX_UTILS_PARALLEL_FOR_H_
+#define CBLOX_UTILS_PARALLEL_FOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace cblox {
+
+// The number of threads used when none is specified.
+inline size_t getDefaultNumThreads() {
+  const size_t num_hardware_threads = std::thread::hardware_concurrency();
+  return (num_hardware_threads > 0) ? num_hardware_threads : 1;
+}
+
+// Calls function(index) for each index in [0, num_items), spread over
+// num_threads threads (the calling thread being one of them).
+// NOTE: Indices are handed out one at a time, such that items of uneven cost
+//       (e.g. submaps of different sizes) balance over the threads. The
+//       function must be safe to call concurrently for different indices.
+template <typename Function>
+void parallelFor(const size_t num_items, const size_t num_threads,
+                 const Function& function) {
+  const size_t num_workers = std::min(num_threads, num_items);
+  if (num_workers <= 1) {
+    for (size_t index = 0; index < num_items; index++) {
+      function(index);
+    }
+    return;
+  }
+  std::atomic<size_t> next_index(0);
+  const auto worker = [&]() {
+    size_t index;
+    while ((index = next_index++) < num_items) {
+      function(index);
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_workers - 1);
+  for (size_t thread_index = 1; thread_index < num_workers; thread_index++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace cblox
+
+#endif  // CBLOX_UTILS_PARALLEL_FOR_H_
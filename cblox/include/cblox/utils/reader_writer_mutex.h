@@ -0,0 +1,109 @@
+#ifndef CBLOX_UTILS_READER_WRITER_MUTEX_H_
+#define CBLOX_UTILS_READER_WRITER_MUTEX_H_
+
+#include <condition_variable>
+#include <mutex>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+// A mutex which is held either by any number of readers, or by a single writer.
+// NOTE: std::shared_timed_mutex requires C++14 and we build with C++11. Writers
+//       are preferred: once a writer waits, new readers wait behind it, such
+//       that a stream of readers (e.g. planner queries) can't starve the
+//       integrator. As a consequence, a thread must not take a reader lock on a
+//       mutex it already holds.
+class ReaderWriterMutex {
+ public:
+  ReaderWriterMutex()
+      : num_readers_(0), num_writers_waiting_(0), writer_active_(false) {}
+
+  // Exclusive ownership (usable with std::unique_lock)
+  void lock() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_writers_waiting_++;
+    condition_.wait(lock,
+                    [this]() { return !writer_active_ && num_readers_ == 0; });
+    num_writers_waiting_--;
+    writer_active_ = true;
+  }
+  void unlock() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      writer_active_ = false;
+    }
+    condition_.notify_all();
+  }
+
+  // Shared ownership
+  void lock_shared() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this]() {
+      return !writer_active_ && num_writers_waiting_ == 0;
+    });
+    num_readers_++;
+  }
+  void unlock_shared() {
+    bool notify = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      CHECK_GT(num_readers_, 0u);
+      num_readers_--;
+      notify = (num_readers_ == 0);
+    }
+    if (notify) {
+      condition_.notify_all();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  size_t num_readers_;
+  size_t num_writers_waiting_;
+  bool writer_active_;
+};
+
+// Holds shared ownership of a ReaderWriterMutex for its lifetime (the C++11
+// stand-in for std::shared_lock). Default constructed locks hold nothing.
+class ReaderLock {
+ public:
+  ReaderLock() : mutex_(nullptr) {}
+  explicit ReaderLock(ReaderWriterMutex* mutex) : mutex_(mutex) {
+    CHECK_NOTNULL(mutex_)->lock_shared();
+  }
+  ~ReaderLock() { unlock(); }
+
+  ReaderLock(ReaderLock&& other) : mutex_(other.mutex_) {
+    other.mutex_ = nullptr;
+  }
+  ReaderLock& operator=(ReaderLock&& other) {
+    if (this != &other) {
+      unlock();
+      mutex_ = other.mutex_;
+      other.mutex_ = nullptr;
+    }
+    return *this;
+  }
+  ReaderLock(const ReaderLock&) = delete;
+  ReaderLock& operator=(const ReaderLock&) = delete;
+
+  void unlock() {
+    if (mutex_ != nullptr) {
+      mutex_->unlock_shared();
+      mutex_ = nullptr;
+    }
+  }
+  bool owns_lock() const { return mutex_ != nullptr; }
+
+ private:
+  ReaderWriterMutex* mutex_;
+};
+
+// Exclusive ownership
+typedef std::unique_lock<ReaderWriterMutex> WriterLock;
+
+}  // namespace cblox
+
+#endif  // CBLOX_UTILS_READER_WRITER_MUTEX_H_
@@ -0,0 +1,52 @@
+#ifndef CBLOX_UTILS_THREAD_POOL_H_
+#define CBLOX_UTILS_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cblox/utils/parallel_for.h"
+
+namespace cblox {
+
+// A fixed number of worker threads, executing the queued tasks in order.
+// NOTE: On destruction the queued tasks are still run, such that no future is
+//       left unfulfilled.
+class ThreadPool {
+ public:
+  explicit ThreadPool(const size_t num_threads = getDefaultNumThreads());
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queues a task. The future becomes ready once the task has run.
+  std::future<void> enqueue(const std::function<void()>& task);
+
+  // The number of tasks queued or running
+  size_t getNumPendingTasks() const;
+  // Blocks until all queued tasks have run
+  void waitUntilIdle() const;
+
+  size_t num_threads() const { return threads_.size(); }
+
+ private:
+  void workerLoop();
+
+  std::vector<std::thread> threads_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable task_condition_;
+  mutable std::condition_variable idle_condition_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  size_t num_running_tasks_;
+  bool stop_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_UTILS_THREAD_POOL_H_
@@ -0,0 +1,78 @@
+#ifndef CBLOX_UTILS_UNION_FIND_H_
+#define CBLOX_UTILS_UNION_FIND_H_
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace cblox {
+
+// Disjoint sets of IDs (e.g. the connected components of a set of ID pairs),
+// with union by size and path compression.
+template <typename IdType>
+class UnionFind {
+ public:
+  // Adds the ID as a set of its own (if not yet present)
+  void add(const IdType id) {
+    if (parents_.emplace(id, id).second) {
+      set_sizes_[id] = 1;
+    }
+  }
+
+  // The representative ID of the set of this ID
+  IdType find(const IdType id) {
+    add(id);
+    IdType root = id;
+    while (parents_[root] != root) {
+      root = parents_[root];
+    }
+    // Pointing the path directly at the root
+    IdType current = id;
+    while (current != root) {
+      const IdType parent = parents_[current];
+      parents_[current] = root;
+      current = parent;
+    }
+    return root;
+  }
+
+  // Joins the sets of the two IDs
+  void unite(const IdType id_1, const IdType id_2) {
+    IdType root_1 = find(id_1);
+    IdType root_2 = find(id_2);
+    if (root_1 == root_2) {
+      return;
+    }
+    if (set_sizes_[root_1] < set_sizes_[root_2]) {
+      std::swap(root_1, root_2);
+    }
+    parents_[root_2] = root_1;
+    set_sizes_[root_1] += set_sizes_[root_2];
+    set_sizes_.erase(root_2);
+  }
+
+  // The sets, each in ascending order, keyed by their representative
+  std::map<IdType, std::vector<IdType>> getSets() {
+    std::map<IdType, std::vector<IdType>> sets;
+    // NOTE: The IDs are visited in ascending order (std::map), which sorts the
+    //       sets.
+    std::vector<IdType> ids;
+    ids.reserve(parents_.size());
+    for (const auto& id_parent_pair : parents_) {
+      ids.push_back(id_parent_pair.first);
+    }
+    for (const IdType id : ids) {
+      sets[find(id)].push_back(id);
+    }
+    return sets;
+  }
+
+ private:
+  std::map<IdType, IdType> parents_;
+  std::map<IdType, size_t> set_sizes_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_UTILS_UNION_FIND_H_
@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <voxblox/integrator/tsdf_integrator.h>
+#include <voxblox/mesh/mesh_integrator.h>
+
+#include "cblox/core/common.h"
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/tsdf_submap.h"
+#include "cblox/integrator/tsdf_submap_collection_integrator.h"
+#include "cblox/io/scan_dataset_io.h"
+#include "cblox/io/tsdf_submap_io.h"
+#include "cblox/mesh/submap_mesher.h"
+
+// Benchmarks the hot paths of cblox (integration, meshing, projection, fusion
+// and saving/loading) without ROS, on a synthetic or recorded scan dataset.
+//
+// The results are written as CSV, one row per benchmark:
+//   name,num_items,item_unit,duration_s,items_per_second
+// Given the results of a previous run (--baseline_csv), the benchmark fails
+// (exit code 1) if any throughput regressed by more than
+// --max_regression_fraction, such that upgrades can be gated on it.
+//
+// Recorded datasets are read with io::ScanDatasetReader (see
+// cblox/io/scan_dataset_io.h for the formats).
+
+DEFINE_string(dataset, "",
+              "Recorded scan dataset. A synthetic dataset is used if empty.");
+DEFINE_int32(num_frames, 100, "Number of synthetic scans.");
+DEFINE_int32(num_points_per_frame, 20000, "Number of points per synth. scan.");
+DEFINE_int32(frames_per_submap, 20, "Number of scans per submap.");
+DEFINE_double(voxel_size, 0.1, "TSDF voxel size (m).");
+DEFINE_int32(voxels_per_side, 16, "TSDF voxels per block side.");
+DEFINE_double(truncation_distance_vox, 4.0, "Truncation distance (voxels).");
+DEFINE_string(method, "fast", "TSDF integrator (simple, merged or fast).");
+DEFINE_int32(num_repetitions, 3, "Repetitions of the meshing benchmarks.");
+DEFINE_string(work_directory, "/tmp", "Directory for the save/load files.");
+DEFINE_string(output_csv, "", "Results file. Written to stdout if empty.");
+DEFINE_string(baseline_csv, "", "Results of a previous run to compare to.");
+DEFINE_double(max_regression_fraction, 0.2,
+              "Allowed throughput loss relative to the baseline.");
+
+namespace cblox {
+namespace {
+
+struct BenchmarkResult {
+  std::string name;
+  double num_items;
+  std::string item_unit;
+  double duration_s;
+  double itemsPerSecond() const {
+    return (duration_s > 0.0) ? num_items / duration_s : 0.0;
+  }
+};
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+  double elapsedSec() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_)
+        .count();
+  }
+
+ private:
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// Scans of a box shaped room (20 x 20 x 5m), taken from a sensor moving on a
+// circle inside it.
+AlignedVector<PosedScan> createSyntheticDataset(
+    const size_t num_frames, const size_t num_points_per_frame) {
+  const Point room_min(-10.0, -10.0, 0.0);
+  const Point room_max(10.0, 10.0, 5.0);
+  constexpr FloatingPoint kTrajectoryRadius = 5.0;
+  constexpr FloatingPoint kSensorHeight = 1.5;
+  std::mt19937 generator(0);
+  std::normal_distribution<FloatingPoint> direction_distribution(0.0, 1.0);
+  AlignedVector<PosedScan> scans(num_frames);
+  for (size_t frame_index = 0; frame_index < num_frames; frame_index++) {
+    PosedScan& scan = scans[frame_index];
+    const FloatingPoint angle = 2.0 * M_PI * frame_index / num_frames;
+    const Point position_G(kTrajectoryRadius * std::cos(angle),
+                           kTrajectoryRadius * std::sin(angle), kSensorHeight);
+    // Yawed by the angle on the circle
+    const Transformation::Rotation rotation(std::cos(0.5 * angle), 0.0, 0.0,
+                                            std::sin(0.5 * angle));
+    scan.T_G_C = Transformation(rotation, position_G);
+    scan.points_C.reserve(num_points_per_frame);
+    scan.colors.reserve(num_points_per_frame);
+    for (size_t point_index = 0; point_index < num_points_per_frame;
+         point_index++) {
+      const Point direction_C = Point(direction_distribution(generator),
+                                      direction_distribution(generator),
+                                      direction_distribution(generator))
+                                    .normalized();
+      // The distance at which the ray leaves the room
+      const Point direction_G = scan.T_G_C.getRotation().rotate(direction_C);
+      FloatingPoint distance = std::numeric_limits<FloatingPoint>::max();
+      for (int axis = 0; axis < 3; axis++) {
+        if (direction_G[axis] != 0.0) {
+          const FloatingPoint wall =
+              (direction_G[axis] > 0.0) ? room_max[axis] : room_min[axis];
+          distance = std::min(
+              distance, (wall - position_G[axis]) / direction_G[axis]);
+        }
+      }
+      scan.points_C.push_back(distance * direction_C);
+      scan.colors.push_back(Color(128, 128, 128));
+    }
+  }
+  return scans;
+}
+
+bool loadRecordedDataset(const std::string& file_path,
+                         AlignedVector<PosedScan>* scans_ptr) {
+  CHECK_NOTNULL(scans_ptr);
+  io::ScanDatasetReader reader(file_path);
+  PosedScan scan;
+  while (reader.readNextScan(&scan)) {
+    scans_ptr->push_back(scan);
+  }
+  return !reader.hasError() && !scans_ptr->empty();
+}
+
+BenchmarkResult benchmarkIntegration(
+    const AlignedVector<PosedScan>& scans,
+    const voxblox::TsdfIntegratorBase::Config& integrator_config,
+    const std::shared_ptr<SubmapCollection<TsdfSubmap>>& collection_ptr) {
+  TsdfSubmapCollectionIntegrator integrator(
+      integrator_config, getTsdfIntegratorTypeFromName(FLAGS_method),
+      collection_ptr);
+  const size_t frames_per_submap =
+      static_cast<size_t>(std::max(FLAGS_frames_per_submap, 1));
+  size_t num_points = 0;
+  const Stopwatch stopwatch;
+  for (size_t scan_index = 0; scan_index < scans.size(); scan_index++) {
+    const PosedScan& scan = scans[scan_index];
+    if (scan_index % frames_per_submap == 0) {
+      collection_ptr->createNewSubMap(scan.T_G_C);
+      integrator.switchToActiveSubmap();
+    }
+    integrator.integratePointCloud(scan.T_G_C, scan.points_C, scan.colors);
+    num_points += scan.points_C.size();
+  }
+  return {"integrate_point_cloud", static_cast<double>(num_points), "points",
+          stopwatch.elapsedSec()};
+}
+
+BenchmarkResult benchmarkSeparatedMesh(
+    const TsdfMap::Config& map_config,
+    const SubmapCollection<TsdfSubmap>& collection) {
+  double duration_s = 0.0;
+  for (int repetition = 0; repetition < FLAGS_num_repetitions; repetition++) {
+    // NOTE: A fresh mesher per repetition, as the mesh cache would otherwise
+    //       skip the work.
+    SubmapMesher mesher(map_config, voxblox::MeshIntegratorConfig());
+    MeshLayer mesh_layer(collection.block_size());
+    const Stopwatch stopwatch;
+    mesher.generateSeparatedMesh(collection, &mesh_layer);
+    duration_s += stopwatch.elapsedSec();
+  }
+  return {"separated_mesh",
+          static_cast<double>(collection.getNumberAllocatedBlocks()) *
+              FLAGS_num_repetitions,
+          "blocks", duration_s};
+}
+
+BenchmarkResult benchmarkCombinedMesh(
+    const TsdfMap::Config& map_config,
+    const SubmapCollection<TsdfSubmap>& collection) {
+  SubmapMesher mesher(map_config, voxblox::MeshIntegratorConfig());
+  double duration_s = 0.0;
+  for (int repetition = 0; repetition < FLAGS_num_repetitions; repetition++) {
+    MeshLayer mesh_layer(collection.block_size());
+    const Stopwatch stopwatch;
+    mesher.generateCombinedMesh(collection, &mesh_layer);
+    duration_s += stopwatch.elapsedSec();
+  }
+  return {"combined_mesh",
+          static_cast<double>(collection.getNumberAllocatedBlocks()) *
+              FLAGS_num_repetitions,
+          "blocks", duration_s};
+}
+
+BenchmarkResult benchmarkProjectedMap(
+    const SubmapCollection<TsdfSubmap>& collection) {
+  double duration_s = 0.0;
+  for (int repetition = 0; repetition < FLAGS_num_repetitions; repetition++) {
+    const Stopwatch stopwatch;
+    const TsdfMap::Ptr projected_map_ptr = collection.getProjectedMap();
+    duration_s += stopwatch.elapsedSec();
+    CHECK(projected_map_ptr);
+  }
+  return {"get_projected_map",
+          static_cast<double>(collection.getNumberAllocatedBlocks()) *
+              FLAGS_num_repetitions,
+          "blocks", duration_s};
+}
+
+void benchmarkSaveAndLoad(const SubmapCollection<TsdfSubmap>& collection,
+                          std::vector<BenchmarkResult>* results_ptr) {
+  CHECK_NOTNULL(results_ptr);
+  const std::string file_path =
+      FLAGS_work_directory + "/cblox_benchmark_collection.tsdf";
+  // Saving
+  const Stopwatch save_stopwatch;
+  CHECK(io::SaveTsdfSubmapCollection(collection, file_path))
+      << "Could not save to: " << file_path;
+  const double save_duration_s = save_stopwatch.elapsedSec();
+  std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+  const double num_megabytes =
+      static_cast<double>(file.tellg()) / (1024.0 * 1024.0);
+  file.close();
+  results_ptr->push_back({"save", num_megabytes, "MB", save_duration_s});
+  // Loading
+  SubmapCollection<TsdfSubmap>::Ptr loaded_collection_ptr =
+      std::make_shared<SubmapCollection<TsdfSubmap>>(collection.getConfig());
+  const Stopwatch load_stopwatch;
+  CHECK(io::LoadSubmapCollection<TsdfSubmap>(file_path,
+                                             &loaded_collection_ptr))
+      << "Could not load: " << file_path;
+  results_ptr->push_back(
+      {"load", num_megabytes, "MB", load_stopwatch.elapsedSec()});
+  CHECK_EQ(loaded_collection_ptr->size(), collection.size());
+  std::remove(file_path.c_str());
+}
+
+// Fuses the submaps pairwise (0 into 1, 2 into 3, ...). Run last, as it
+// consumes the collection.
+BenchmarkResult benchmarkFuseSubmapPairs(
+    SubmapCollection<TsdfSubmap>* collection_ptr) {
+  CHECK_NOTNULL(collection_ptr);
+  const std::vector<SubmapID> submap_ids = collection_ptr->getIDs();
+  size_t num_fused_blocks = 0;
+  double duration_s = 0.0;
+  for (size_t id_index = 0; id_index + 1 < submap_ids.size(); id_index += 2) {
+    const SubmapID submap_id_1 = submap_ids[id_index + 1];
+    const SubmapID submap_id_2 = submap_ids[id_index];
+    num_fused_blocks +=
+        collection_ptr->getSubMap(submap_id_2).getNumberAllocatedBlocks();
+    const Stopwatch stopwatch;
+    collection_ptr->fuseSubmapPair(SubmapIdPair(submap_id_1, submap_id_2));
+    duration_s += stopwatch.elapsedSec();
+  }
+  return {"fuse_submap_pair", static_cast<double>(num_fused_blocks), "blocks",
+          duration_s};
+}
+
+void writeResults(const std::vector<BenchmarkResult>& results,
+                  std::ostream* stream_ptr) {
+  CHECK_NOTNULL(stream_ptr);
+  *stream_ptr << "name,num_items,item_unit,duration_s,items_per_second\n";
+  for (const BenchmarkResult& result : results) {
+    *stream_ptr << result.name << "," << result.num_items << ","
+                << result.item_unit << "," << result.duration_s << ","
+                << result.itemsPerSecond() << "\n";
+  }
+}
+
+// Reads the throughputs (by benchmark name) of a results file.
+bool readThroughputs(const std::string& file_path,
+                     std::map<std::string, double>* throughputs_ptr) {
+  CHECK_NOTNULL(throughputs_ptr);
+  std::ifstream file(file_path);
+  if (!file.is_open()) {
+    LOG(ERROR) << "Could not open baseline: " << file_path;
+    return false;
+  }
+  std::string line;
+  // Skipping the header
+  std::getline(file, line);
+  while (std::getline(file, line)) {
+    std::vector<std::string> fields;
+    std::istringstream line_stream(line);
+    std::string field;
+    while (std::getline(line_stream, field, ',')) {
+      fields.push_back(field);
+    }
+    if (fields.size() != 5) {
+      LOG(ERROR) << "Invalid baseline line: " << line;
+      return false;
+    }
+    (*throughputs_ptr)[fields[0]] = std::stod(fields[4]);
+  }
+  return true;
+}
+
+// Returns false if any throughput regressed beyond the allowed fraction.
+bool compareToBaseline(const std::vector<BenchmarkResult>& results,
+                       const std::map<std::string, double>& baseline) {
+  bool passed = true;
+  for (const BenchmarkResult& result : results) {
+    const auto baseline_it = baseline.find(result.name);
+    if (baseline_it == baseline.end() || baseline_it->second <= 0.0) {
+      LOG(WARNING) << "No baseline for: " << result.name;
+      continue;
+    }
+    const double ratio = result.itemsPerSecond() / baseline_it->second;
+    const bool regressed = ratio < 1.0 - FLAGS_max_regression_fraction;
+    LOG(INFO) << result.name << ": " << ratio << "x the baseline throughput"
+              << (regressed ? " (REGRESSION)" : "");
+    passed = passed && !regressed;
+  }
+  return passed;
+}
+
+int runBenchmarks() {
+  // The dataset
+  AlignedVector<PosedScan> scans;
+  if (FLAGS_dataset.empty()) {
+    scans = createSyntheticDataset(
+        static_cast<size_t>(std::max(FLAGS_num_frames, 1)),
+        static_cast<size_t>(std::max(FLAGS_num_points_per_frame, 1)));
+  } else if (!loadRecordedDataset(FLAGS_dataset, &scans)) {
+    return 1;
+  }
+  LOG(INFO) << "Benchmarking on " << scans.size() << " scans.";
+  // The configs
+  TsdfMap::Config map_config;
+  map_config.tsdf_voxel_size = FLAGS_voxel_size;
+  map_config.tsdf_voxels_per_side = FLAGS_voxels_per_side;
+  voxblox::TsdfIntegratorBase::Config integrator_config;
+  integrator_config.default_truncation_distance =
+      FLAGS_truncation_distance_vox * FLAGS_voxel_size;
+  // Running
+  std::vector<BenchmarkResult> results;
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> collection_ptr(
+      new SubmapCollection<TsdfSubmap>(map_config));
+  results.push_back(
+      benchmarkIntegration(scans, integrator_config, collection_ptr));
+  LOG(INFO) << "Integrated " << collection_ptr->size() << " submaps with "
+            << collection_ptr->getNumberAllocatedBlocks() << " blocks.";
+  results.push_back(benchmarkSeparatedMesh(map_config, *collection_ptr));
+  results.push_back(benchmarkCombinedMesh(map_config, *collection_ptr));
+  results.push_back(benchmarkProjectedMap(*collection_ptr));
+  benchmarkSaveAndLoad(*collection_ptr, &results);
+  results.push_back(benchmarkFuseSubmapPairs(collection_ptr.get()));
+  // Output
+  if (FLAGS_output_csv.empty()) {
+    writeResults(results, &std::cout);
+  } else {
+    std::ofstream output_file(FLAGS_output_csv);
+    CHECK(output_file.is_open()) << "Could not open: " << FLAGS_output_csv;
+    writeResults(results, &output_file);
+  }
+  // The regression check
+  if (!FLAGS_baseline_csv.empty()) {
+    std::map<std::string, double> baseline;
+    if (!readThroughputs(FLAGS_baseline_csv, &baseline)) {
+      return 1;
+    }
+    if (!compareToBaseline(results, baseline)) {
+      LOG(ERROR) << "Throughput regressed relative to the baseline.";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InstallFailureSignalHandler();
+  return cblox::runBenchmarks();
+}
@@ -0,0 +1,78 @@
+#include "cblox/core/submap_creation_policy.h"
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+bool FrameCountSubmapPolicy::newSubmapRequired(
+    const ActiveSubmapState& state) const {
+  return state.num_integrated_frames > num_frames_;
+}
+
+bool MotionSubmapPolicy::newSubmapRequired(
+    const ActiveSubmapState& state) const {
+  const Transformation T_S_C = state.T_G_S.inverse() * state.T_G_C;
+  if (max_distance_m_ > 0.0 && T_S_C.getPosition().norm() > max_distance_m_) {
+    return true;
+  }
+  if (max_rotation_rad_ > 0.0) {
+    const Eigen::AngleAxis<FloatingPoint> rotation_S_C(
+        T_S_C.getRotation().toImplementation());
+    if (rotation_S_C.angle() > max_rotation_rad_) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SubmapSizePolicy::newSubmapRequired(
+    const ActiveSubmapState& state) const {
+  return (max_num_blocks_ > 0 &&
+          state.num_allocated_blocks > max_num_blocks_) ||
+         (max_memory_bytes_ > 0 && state.memory_bytes > max_memory_bytes_);
+}
+
+bool OverlapSubmapPolicy::newSubmapRequired(
+    const ActiveSubmapState& state) const {
+  const FloatingPoint volume = state.extent_G.volume();
+  if (volume <= 0.0) {
+    return false;
+  }
+  const FloatingPoint overlap =
+      state.extent_G.intersection(state.previous_extent_G).volume() / volume;
+  return overlap <= max_overlap_;
+}
+
+void CompositeSubmapPolicy::addTrigger(
+    const SubmapCreationPolicy::ConstPtr& policy) {
+  CHECK(policy);
+  triggers_.push_back(policy);
+}
+
+void CompositeSubmapPolicy::addRequirement(
+    const SubmapCreationPolicy::ConstPtr& policy) {
+  CHECK(policy);
+  requirements_.push_back(policy);
+}
+
+bool CompositeSubmapPolicy::newSubmapRequired(
+    const ActiveSubmapState& state) const {
+  bool triggered = false;
+  for (const SubmapCreationPolicy::ConstPtr& trigger : triggers_) {
+    if (trigger->newSubmapRequired(state)) {
+      triggered = true;
+      break;
+    }
+  }
+  if (!triggered) {
+    return false;
+  }
+  for (const SubmapCreationPolicy::ConstPtr& requirement : requirements_) {
+    if (!requirement->newSubmapRequired(state)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace cblox
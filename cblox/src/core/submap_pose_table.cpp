@@ -0,0 +1,99 @@
+#include "cblox/core/submap_pose_table.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+size_t SubmapPoseTable::findIndex(const SubmapID submap_id) const {
+  const auto it =
+      std::lower_bound(submap_ids_.begin(), submap_ids_.end(), submap_id);
+  if (it == submap_ids_.end() || *it != submap_id) {
+    return submap_ids_.size();
+  }
+  return it - submap_ids_.begin();
+}
+
+bool SubmapPoseTable::getPose(const SubmapID submap_id,
+                              Transformation* T_G_S_ptr) const {
+  CHECK_NOTNULL(T_G_S_ptr);
+  const size_t index = findIndex(submap_id);
+  if (index == size()) {
+    return false;
+  }
+  *T_G_S_ptr = T_G_S_vector_[index];
+  return true;
+}
+
+bool SubmapPoseTable::getInversePose(const SubmapID submap_id,
+                                     Transformation* T_S_G_ptr) const {
+  CHECK_NOTNULL(T_S_G_ptr);
+  const size_t index = findIndex(submap_id);
+  if (index == size()) {
+    return false;
+  }
+  *T_S_G_ptr = T_S_G_vector_[index];
+  return true;
+}
+
+void SubmapPoseTable::clear() {
+  submap_ids_.clear();
+  T_G_S_vector_.clear();
+  T_S_G_vector_.clear();
+}
+
+void SubmapPoseTable::reserve(const size_t num_submaps) {
+  submap_ids_.reserve(num_submaps);
+  T_G_S_vector_.reserve(num_submaps);
+  T_S_G_vector_.reserve(num_submaps);
+}
+
+void SubmapPoseTable::append(const SubmapID submap_id,
+                             const Transformation& T_G_S) {
+  CHECK(submap_ids_.empty() || submap_ids_.back() < submap_id);
+  submap_ids_.push_back(submap_id);
+  T_G_S_vector_.push_back(T_G_S);
+  T_S_G_vector_.push_back(T_G_S.inverse());
+}
+
+bool SubmapPoseTable::setPose(const SubmapID submap_id,
+                              const Transformation& T_G_S) {
+  const size_t index = findIndex(submap_id);
+  if (index == size()) {
+    return false;
+  }
+  T_G_S_vector_[index] = T_G_S;
+  T_S_G_vector_[index] = T_G_S.inverse();
+  return true;
+}
+
+SubmapPoseTableBuffer::SubmapPoseTableBuffer()
+    : current_table_(std::make_shared<SubmapPoseTable>()) {}
+
+SubmapPoseTable::ConstPtr SubmapPoseTableBuffer::getSnapshot() const {
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+  return current_table_;
+}
+
+void SubmapPoseTableBuffer::update(const UpdateFunction& update_function) {
+  std::lock_guard<std::mutex> update_lock(update_mutex_);
+  // NOTE: Readers only get hold of the current table, so once the spare table
+  //       is unique it stays so.
+  std::shared_ptr<SubmapPoseTable> next_table;
+  if (spare_table_ && spare_table_.unique()) {
+    next_table.swap(spare_table_);
+    *next_table = *current_table_;
+  } else {
+    next_table = std::make_shared<SubmapPoseTable>(*current_table_);
+  }
+  update_function(next_table.get());
+  next_table->version_ = current_table_->version_ + 1;
+  {
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex_);
+    current_table_.swap(next_table);
+  }
+  spare_table_ = std::move(next_table);
+}
+
+}  // namespace cblox
@@ -0,0 +1,118 @@
+#include "cblox/core/submap_spatial_index.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+SubmapSpatialIndex::SubmapSpatialIndex(const FloatingPoint cell_size)
+    : cell_size_(cell_size), cell_size_inv_(1.0 / cell_size) {
+  CHECK_GT(cell_size_, 0.0);
+}
+
+SubmapSpatialIndex::CellIndex SubmapSpatialIndex::getCellIndex(
+    const Point& point) const {
+  return (point * cell_size_inv_)
+      .array()
+      .floor()
+      .cast<voxblox::IndexElement>()
+      .matrix();
+}
+
+template <typename Function>
+void SubmapSpatialIndex::forEachCell(const BoundingBox& box,
+                                     const Function& function) const {
+  if (box.isEmpty()) {
+    return;
+  }
+  const CellIndex min_index = getCellIndex(box.min_corner);
+  const CellIndex max_index = getCellIndex(box.max_corner);
+  CellIndex cell_index;
+  for (cell_index.x() = min_index.x(); cell_index.x() <= max_index.x();
+       cell_index.x()++) {
+    for (cell_index.y() = min_index.y(); cell_index.y() <= max_index.y();
+         cell_index.y()++) {
+      for (cell_index.z() = min_index.z(); cell_index.z() <= max_index.z();
+           cell_index.z()++) {
+        function(cell_index);
+      }
+    }
+  }
+}
+
+void SubmapSpatialIndex::insertOrUpdate(const SubmapID submap_id,
+                                        const BoundingBox& box_G) {
+  remove(submap_id);
+  submap_boxes_[submap_id] = box_G;
+  forEachCell(box_G, [this, submap_id](const CellIndex& cell_index) {
+    cells_[cell_index].push_back(submap_id);
+  });
+}
+
+void SubmapSpatialIndex::remove(const SubmapID submap_id) {
+  const auto box_it = submap_boxes_.find(submap_id);
+  if (box_it == submap_boxes_.end()) {
+    return;
+  }
+  forEachCell(box_it->second, [this, submap_id](const CellIndex& cell_index) {
+    auto cell_it = cells_.find(cell_index);
+    if (cell_it == cells_.end()) {
+      return;
+    }
+    std::vector<SubmapID>& cell_submap_ids = cell_it->second;
+    cell_submap_ids.erase(std::remove(cell_submap_ids.begin(),
+                                      cell_submap_ids.end(), submap_id),
+                          cell_submap_ids.end());
+    if (cell_submap_ids.empty()) {
+      cells_.erase(cell_it);
+    }
+  });
+  submap_boxes_.erase(box_it);
+}
+
+void SubmapSpatialIndex::clear() {
+  cells_.clear();
+  submap_boxes_.clear();
+}
+
+void SubmapSpatialIndex::getSubmapsOverlapping(
+    const BoundingBox& box_G, std::vector<SubmapID>* submap_ids) const {
+  CHECK_NOTNULL(submap_ids);
+  submap_ids->clear();
+  // Gathering the candidates from the cells, then checking their boxes.
+  forEachCell(box_G, [this, &box_G, submap_ids](const CellIndex& cell_index) {
+    const auto cell_it = cells_.find(cell_index);
+    if (cell_it == cells_.end()) {
+      return;
+    }
+    for (const SubmapID submap_id : cell_it->second) {
+      if (submap_boxes_.at(submap_id).overlaps(box_G)) {
+        submap_ids->push_back(submap_id);
+      }
+    }
+  });
+  // Submaps spanning several cells are found more than once.
+  std::sort(submap_ids->begin(), submap_ids->end());
+  submap_ids->erase(std::unique(submap_ids->begin(), submap_ids->end()),
+                    submap_ids->end());
+}
+
+void SubmapSpatialIndex::getSubmapsContaining(
+    const Point& point_G, std::vector<SubmapID>* submap_ids) const {
+  CHECK_NOTNULL(submap_ids);
+  submap_ids->clear();
+  // A point lies in a single cell, so each submap appears at most once.
+  const auto cell_it = cells_.find(getCellIndex(point_G));
+  if (cell_it == cells_.end()) {
+    return;
+  }
+  for (const SubmapID submap_id : cell_it->second) {
+    if (submap_boxes_.at(submap_id).contains(point_G)) {
+      submap_ids->push_back(submap_id);
+    }
+  }
+  std::sort(submap_ids->begin(), submap_ids->end());
+}
+
+}  // namespace cblox
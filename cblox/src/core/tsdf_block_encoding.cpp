@@ -0,0 +1,242 @@
+#include "cblox/core/tsdf_block_encoding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+namespace {
+
+// The layout of the encoding (all values little endian):
+//   uint8 version, uint8 flags, uint16 voxels per side, uint32 number of blocks
+//   for each block:
+//     int32 x 3 block index, float distance scale, float weight scale
+//     for each voxel:
+//       uint8 weight, and for observed voxels (non-zero weight):
+//       int16 distance, and uint8 x 3 color (if kept)
+constexpr uint8_t kEncodingVersion = 1;
+constexpr uint8_t kHasColorsFlag = 1;
+constexpr FloatingPoint kMaxQuantizedDistance = 32767.0;
+constexpr FloatingPoint kMaxQuantizedWeight = 255.0;
+
+void appendUint(const uint32_t value, const size_t num_bytes,
+                std::string* bytes) {
+  for (size_t byte_index = 0; byte_index < num_bytes; byte_index++) {
+    bytes->push_back(static_cast<char>((value >> (8 * byte_index)) & 0xff));
+  }
+}
+
+void appendFloat(const float value, std::string* bytes) {
+  uint32_t value_bits;
+  static_assert(sizeof(value_bits) == sizeof(value), "Unexpected float size.");
+  std::memcpy(&value_bits, &value, sizeof(value));
+  appendUint(value_bits, sizeof(value_bits), bytes);
+}
+
+// Reads the encoding front to back, failing (rather than reading past the
+// end) on truncated input.
+class ByteReader {
+ public:
+  ByteReader(const char* bytes, const size_t num_bytes)
+      : bytes_(bytes), num_bytes_(num_bytes), position_(0) {}
+
+  bool readUint(const size_t num_bytes, uint32_t* value) {
+    if (position_ + num_bytes > num_bytes_) {
+      return false;
+    }
+    *value = 0;
+    for (size_t byte_index = 0; byte_index < num_bytes; byte_index++) {
+      const unsigned char byte =
+          static_cast<unsigned char>(bytes_[position_ + byte_index]);
+      *value |= static_cast<uint32_t>(byte) << (8 * byte_index);
+    }
+    position_ += num_bytes;
+    return true;
+  }
+
+  bool readFloat(float* value) {
+    uint32_t value_bits;
+    if (!readUint(sizeof(value_bits), &value_bits)) {
+      return false;
+    }
+    std::memcpy(value, &value_bits, sizeof(value_bits));
+    return true;
+  }
+
+  bool atEnd() const { return position_ == num_bytes_; }
+
+ private:
+  const char* bytes_;
+  const size_t num_bytes_;
+  size_t position_;
+};
+
+bool isObserved(const TsdfVoxel& voxel) { return voxel.weight > 0.0; }
+
+}  // namespace
+
+size_t EncodeTsdfBlocks(const Layer<TsdfVoxel>& tsdf_layer,
+                        const TsdfBlockEncodingConfig& config,
+                        std::string* bytes) {
+  CHECK_NOTNULL(bytes);
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer.getAllAllocatedBlocks(&block_indices);
+  const size_t num_voxels_per_block = tsdf_layer.voxels_per_side() *
+                                      tsdf_layer.voxels_per_side() *
+                                      tsdf_layer.voxels_per_side();
+  // The header. The number of blocks is filled in at the end.
+  const size_t header_byte_offset = bytes->size();
+  appendUint(kEncodingVersion, 1, bytes);
+  appendUint(config.keep_colors ? kHasColorsFlag : 0, 1, bytes);
+  appendUint(tsdf_layer.voxels_per_side(), 2, bytes);
+  appendUint(0, 4, bytes);
+  uint32_t num_encoded_blocks = 0;
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    const Block<TsdfVoxel>& block = tsdf_layer.getBlockByIndex(block_index);
+    // The quantization ranges of this block
+    FloatingPoint max_abs_distance = 0.0;
+    FloatingPoint max_weight = 0.0;
+    for (size_t voxel_index = 0; voxel_index < num_voxels_per_block;
+         voxel_index++) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(voxel_index);
+      if (isObserved(voxel)) {
+        max_abs_distance = std::max(max_abs_distance, std::abs(voxel.distance));
+        max_weight = std::max(max_weight, voxel.weight);
+      }
+    }
+    if (max_weight <= 0.0 && config.elide_empty_blocks) {
+      continue;
+    }
+    const FloatingPoint distance_scale =
+        max_abs_distance / kMaxQuantizedDistance;
+    const FloatingPoint weight_scale =
+        std::log1p(max_weight) / kMaxQuantizedWeight;
+    appendUint(static_cast<uint32_t>(block_index.x()), 4, bytes);
+    appendUint(static_cast<uint32_t>(block_index.y()), 4, bytes);
+    appendUint(static_cast<uint32_t>(block_index.z()), 4, bytes);
+    appendFloat(distance_scale, bytes);
+    appendFloat(weight_scale, bytes);
+    // The voxels
+    for (size_t voxel_index = 0; voxel_index < num_voxels_per_block;
+         voxel_index++) {
+      const TsdfVoxel& voxel = block.getVoxelByLinearIndex(voxel_index);
+      if (!isObserved(voxel)) {
+        appendUint(0, 1, bytes);
+        continue;
+      }
+      // NOTE: Observed voxels keep a non-zero weight, such that they stay
+      //       observed (however small their weight).
+      const FloatingPoint quantized_weight =
+          std::round(std::log1p(voxel.weight) / weight_scale);
+      appendUint(static_cast<uint32_t>(std::min(
+                     std::max(quantized_weight, FloatingPoint(1.0)),
+                     kMaxQuantizedWeight)),
+                 1, bytes);
+      const FloatingPoint quantized_distance =
+          (distance_scale > 0.0) ? std::round(voxel.distance / distance_scale)
+                                 : 0.0;
+      appendUint(
+          static_cast<uint32_t>(static_cast<int16_t>(quantized_distance)), 2,
+          bytes);
+      if (config.keep_colors) {
+        appendUint(voxel.color.r, 1, bytes);
+        appendUint(voxel.color.g, 1, bytes);
+        appendUint(voxel.color.b, 1, bytes);
+      }
+    }
+    num_encoded_blocks++;
+  }
+  // Filling in the number of blocks
+  for (size_t byte_index = 0; byte_index < 4; byte_index++) {
+    (*bytes)[header_byte_offset + 4 + byte_index] =
+        static_cast<char>((num_encoded_blocks >> (8 * byte_index)) & 0xff);
+  }
+  return num_encoded_blocks;
+}
+
+bool DecodeTsdfBlocks(const char* bytes, const size_t num_bytes,
+                      Layer<TsdfVoxel>* tsdf_layer_ptr,
+                      TsdfBlockPool* block_pool_ptr) {
+  CHECK_NOTNULL(bytes);
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  ByteReader reader(bytes, num_bytes);
+  uint32_t version, flags, voxels_per_side, num_blocks;
+  if (!reader.readUint(1, &version) || !reader.readUint(1, &flags) ||
+      !reader.readUint(2, &voxels_per_side) ||
+      !reader.readUint(4, &num_blocks)) {
+    LOG(ERROR) << "Could not read the header of the encoded blocks.";
+    return false;
+  }
+  if (version != kEncodingVersion) {
+    LOG(ERROR) << "Unknown block encoding version: " << version;
+    return false;
+  }
+  if (voxels_per_side != tsdf_layer_ptr->voxels_per_side()) {
+    LOG(ERROR) << "The encoded blocks have " << voxels_per_side
+               << " voxels per side, the layer has "
+               << tsdf_layer_ptr->voxels_per_side();
+    return false;
+  }
+  const bool has_colors = (flags & kHasColorsFlag) != 0;
+  const size_t num_voxels_per_block =
+      voxels_per_side * voxels_per_side * voxels_per_side;
+  for (uint32_t block_number = 0; block_number < num_blocks; block_number++) {
+    uint32_t x, y, z;
+    float distance_scale, weight_scale;
+    if (!reader.readUint(4, &x) || !reader.readUint(4, &y) ||
+        !reader.readUint(4, &z) || !reader.readFloat(&distance_scale) ||
+        !reader.readFloat(&weight_scale)) {
+      LOG(ERROR) << "Could not read encoded block number " << block_number;
+      return false;
+    }
+    const voxblox::BlockIndex block_index(static_cast<int32_t>(x),
+                                          static_cast<int32_t>(y),
+                                          static_cast<int32_t>(z));
+    Block<TsdfVoxel>::Ptr block_ptr =
+        (block_pool_ptr != nullptr)
+            ? block_pool_ptr->allocateBlockPtrByIndex(block_index,
+                                                      tsdf_layer_ptr)
+            : tsdf_layer_ptr->allocateBlockPtrByIndex(block_index);
+    for (size_t voxel_index = 0; voxel_index < num_voxels_per_block;
+         voxel_index++) {
+      TsdfVoxel& voxel = block_ptr->getVoxelByLinearIndex(voxel_index);
+      voxel = TsdfVoxel();
+      uint32_t quantized_weight;
+      if (!reader.readUint(1, &quantized_weight)) {
+        LOG(ERROR) << "Could not read encoded block number " << block_number;
+        return false;
+      }
+      if (quantized_weight == 0) {
+        continue;
+      }
+      uint32_t quantized_distance;
+      if (!reader.readUint(2, &quantized_distance)) {
+        LOG(ERROR) << "Could not read encoded block number " << block_number;
+        return false;
+      }
+      voxel.weight = std::expm1(quantized_weight * weight_scale);
+      voxel.distance =
+          static_cast<int16_t>(quantized_distance) * distance_scale;
+      if (has_colors) {
+        uint32_t r, g, b;
+        if (!reader.readUint(1, &r) || !reader.readUint(1, &g) ||
+            !reader.readUint(1, &b)) {
+          LOG(ERROR) << "Could not read encoded block number " << block_number;
+          return false;
+        }
+        voxel.color = Color(r, g, b);
+      }
+    }
+    block_ptr->set_has_data(true);
+  }
+  if (!reader.atEnd()) {
+    LOG(ERROR) << "Unexpected bytes after the encoded blocks.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace cblox
@@ -0,0 +1,112 @@
+#include "cblox/core/tsdf_block_pool.h"
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+TsdfBlockPool::TsdfBlockPool(const FloatingPoint voxel_size,
+                             const size_t voxels_per_side,
+                             const size_t max_pooled_blocks)
+    : voxel_size_(voxel_size),
+      voxels_per_side_(voxels_per_side),
+      max_pooled_blocks_(max_pooled_blocks) {
+  stats_.max_pooled_blocks = max_pooled_blocks;
+}
+
+Block<TsdfVoxel>::Ptr TsdfBlockPool::allocateBlockPtrByIndex(
+    const voxblox::BlockIndex& block_index, Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  Block<TsdfVoxel>::Ptr block_ptr;
+  if (matchesLayer(*tsdf_layer_ptr)) {
+    std::lock_guard<std::mutex> pool_lock(mutex_);
+    const auto it = pooled_blocks_.find(block_index);
+    if (it != pooled_blocks_.end()) {
+      block_ptr = it->second.back();
+      it->second.pop_back();
+      if (it->second.empty()) {
+        pooled_blocks_.erase(it);
+      }
+      stats_.num_pooled_blocks--;
+      stats_.num_reused_blocks++;
+    } else {
+      stats_.num_allocated_blocks++;
+    }
+  }
+  tsdf_layer_ptr->removeBlock(block_index);
+  if (!block_ptr) {
+    return tsdf_layer_ptr->allocateNewBlock(block_index);
+  }
+  // Clearing the block of its previous submap
+  for (size_t linear_index = 0; linear_index < block_ptr->num_voxels();
+       linear_index++) {
+    block_ptr->getVoxelByLinearIndex(linear_index) = TsdfVoxel();
+  }
+  block_ptr->set_has_data(false);
+  block_ptr->updated().reset();
+  tsdf_layer_ptr->insertBlock(std::make_pair(block_index, block_ptr));
+  return block_ptr;
+}
+
+void TsdfBlockPool::recycleAllBlocks(Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  if (!matchesLayer(*tsdf_layer_ptr)) {
+    tsdf_layer_ptr->removeAllBlocks();
+    return;
+  }
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer_ptr->getAllAllocatedBlocks(&block_indices);
+  std::lock_guard<std::mutex> pool_lock(mutex_);
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    Block<TsdfVoxel>::Ptr block_ptr =
+        tsdf_layer_ptr->getBlockPtrByIndex(block_index);
+    tsdf_layer_ptr->removeBlock(block_index);
+    // NOTE: Blocks still held elsewhere (e.g. by a copy of the layer being
+    //       read) are left to their owners.
+    if (!block_ptr.unique()) {
+      continue;
+    }
+    if (stats_.num_pooled_blocks >= max_pooled_blocks_) {
+      stats_.num_freed_blocks++;
+      continue;
+    }
+    pooled_blocks_[block_index].push_back(block_ptr);
+    stats_.num_pooled_blocks++;
+    stats_.num_recycled_blocks++;
+  }
+}
+
+void TsdfBlockPool::setMaxPooledBlocks(const size_t max_pooled_blocks) {
+  std::lock_guard<std::mutex> pool_lock(mutex_);
+  max_pooled_blocks_ = max_pooled_blocks;
+  stats_.max_pooled_blocks = max_pooled_blocks;
+  trimToCapacity();
+}
+
+TsdfBlockPoolStats TsdfBlockPool::getStats() const {
+  std::lock_guard<std::mutex> pool_lock(mutex_);
+  TsdfBlockPoolStats stats = stats_;
+  stats.pooled_memory_bytes = stats.num_pooled_blocks * getBlockMemoryBytes();
+  return stats;
+}
+
+bool TsdfBlockPool::matchesLayer(const Layer<TsdfVoxel>& tsdf_layer) const {
+  return tsdf_layer.voxels_per_side() == voxels_per_side_ &&
+         std::abs(tsdf_layer.voxel_size() - voxel_size_) < 1e-6;
+}
+
+void TsdfBlockPool::trimToCapacity() {
+  while (stats_.num_pooled_blocks > max_pooled_blocks_) {
+    auto it = pooled_blocks_.begin();
+    CHECK(it != pooled_blocks_.end());
+    it->second.pop_back();
+    if (it->second.empty()) {
+      pooled_blocks_.erase(it);
+    }
+    stats_.num_pooled_blocks--;
+    stats_.num_freed_blocks++;
+  }
+}
+
+}  // namespace cblox
@@ -3,13 +3,46 @@
 namespace cblox {
 
 void TsdfEsdfSubmap::generateEsdf() {
-  // Instantiate the integrator
-  voxblox::EsdfIntegrator esdf_integrator(esdf_integrator_config_,
-                                          tsdf_map_->getTsdfLayerPtr(),
-                                          esdf_map_->getEsdfLayerPtr());
-  // Generate the ESDF
-  LOG(INFO) << "Generating ESDF from TSDF for submap with ID: " << submap_id_;
-  esdf_integrator.updateFromTsdfLayerBatch();
+  std::lock_guard<std::mutex> generation_lock(esdf_generation_mutex_);
+  EsdfMap::Ptr esdf_map(new EsdfMap(esdf_map_config_));
+  {
+    const ReaderLock tsdf_lock = getTsdfReaderLock();
+    // Instantiate the integrator
+    voxblox::EsdfIntegrator esdf_integrator(esdf_integrator_config_,
+                                            tsdf_map_->getTsdfLayerPtr(),
+                                            esdf_map->getEsdfLayerPtr());
+    // Generate the ESDF
+    LOG(INFO) << "Generating ESDF from TSDF for submap with ID: "
+              << submap_id_;
+    esdf_integrator.updateFromTsdfLayerBatch();
+  }
+  // Swapping in the new ESDF
+  {
+    std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+    esdf_map_ = esdf_map;
+  }
+  esdf_ready_ = true;
+}
+
+EsdfMap::Ptr TsdfEsdfSubmap::getEsdfMapPtr() {
+  std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+  if (!esdf_map_.unique()) {
+    esdf_map_.reset(new EsdfMap(esdf_map_->getEsdfLayer()));
+  }
+  return esdf_map_;
+}
+
+void TsdfEsdfSubmap::shareEsdf(const TsdfEsdfSubmap& source_submap) {
+  CHECK_NE(&source_submap, this);
+  std::lock_guard<std::mutex> generation_lock(esdf_generation_mutex_);
+  esdf_integrator_config_ = source_submap.esdf_integrator_config_;
+  {
+    std::lock_guard<std::mutex> source_esdf_lock(
+        source_submap.esdf_map_mutex_);
+    std::lock_guard<std::mutex> esdf_lock(esdf_map_mutex_);
+    esdf_map_ = source_submap.esdf_map_;
+    esdf_ready_ = source_submap.esdf_ready_.load();
+  }
 }
 
 }  // namespace cblox
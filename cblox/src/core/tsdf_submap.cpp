@@ -1,42 +1,427 @@
 #include "cblox/core/tsdf_submap.h"
+
+#include <cstdio>
+#include <fstream>
+
+#include <voxblox/utils/protobuf_utils.h>
+
 #include "cblox/utils/quat_transformation_protobuf_utils.h"
 
 namespace cblox {
 
+size_t TsdfSubmap::newVersion() {
+  static std::atomic<size_t> next_version(0);
+  return next_version++;
+}
+
+size_t TsdfSubmap::newAccessStamp() {
+  static std::atomic<size_t> next_access_stamp(0);
+  return next_access_stamp++;
+}
+
 void TsdfSubmap::getProto(TsdfSubmapProto* proto) const {
+  const ReaderLock tsdf_lock = getTsdfReaderLock();
+  fillProto(proto);
+}
+
+void TsdfSubmap::fillProto(TsdfSubmapProto* proto) const {
   CHECK_NOTNULL(proto);
   // Getting the relevant data
   size_t num_blocks = tsdf_map_->getTsdfLayer().getNumberOfAllocatedBlocks();
   QuatTransformationProto* transformation_proto_ptr =
       new QuatTransformationProto();
-  conversions::transformKindrToProto(T_M_S_, transformation_proto_ptr);
+  conversions::transformKindrToProto(getPose(), transformation_proto_ptr);
   // Filling out the description of the submap
   proto->set_id(submap_id_);
   proto->set_num_blocks(num_blocks);
   proto->set_allocated_transform(transformation_proto_ptr);
 }
 
-bool TsdfSubmap::saveToStream(std::fstream* outfile_ptr) const {
+BoundingBox TsdfSubmap::getSubmapFrameBoundingBox() const {
+  std::lock_guard<std::mutex> bounding_box_lock(bounding_box_mutex_);
+  updateBoundingBoxes();
+  return bounding_box_S_;
+}
+
+BoundingBox TsdfSubmap::getGlobalFrameBoundingBox() const {
+  std::lock_guard<std::mutex> bounding_box_lock(bounding_box_mutex_);
+  updateBoundingBoxes();
+  return bounding_box_M_;
+}
+
+void TsdfSubmap::updateBoundingBoxes() const {
+  // NOTE: The stamps are read before recomputing, such that changes made in the
+  //       meantime trigger another update.
+  const size_t tsdf_version = tsdf_version_;
+  const size_t pose_version = pose_version_;
+  if (bounding_boxes_valid_ && tsdf_version == bounding_box_tsdf_version_ &&
+      pose_version == bounding_box_pose_version_) {
+    return;
+  }
+  // The box in S only changes with the TSDF
+  if (!bounding_boxes_valid_ || tsdf_version != bounding_box_tsdf_version_) {
+    const ReaderLock tsdf_lock = getTsdfReaderLock();
+    const Layer<TsdfVoxel>& tsdf_layer = tsdf_map_->getTsdfLayer();
+    const FloatingPoint block_size = tsdf_layer.block_size();
+    voxblox::BlockIndexList block_indices;
+    tsdf_layer.getAllAllocatedBlocks(&block_indices);
+    bounding_box_S_ = BoundingBox();
+    for (const voxblox::BlockIndex& block_index : block_indices) {
+      const Point block_origin = block_index.cast<FloatingPoint>() * block_size;
+      bounding_box_S_.extend(block_origin);
+      bounding_box_S_.extend(block_origin + Point::Constant(block_size));
+    }
+  }
+  bounding_box_M_ = bounding_box_S_.transformed(getPose());
+  bounding_box_tsdf_version_ = tsdf_version;
+  bounding_box_pose_version_ = pose_version;
+  bounding_boxes_valid_ = true;
+}
+
+bool TsdfSubmap::saveToStream(std::fstream* outfile_ptr,
+                              TsdfSubmapProto* header_proto) const {
   CHECK_NOTNULL(outfile_ptr);
-  // Saving the TSDF submap header
-  TsdfSubmapProto tsdf_sub_map_proto;
-  getProto(&tsdf_sub_map_proto);
-  if (!voxblox::utils::writeProtoMsgToStream(tsdf_sub_map_proto, outfile_ptr)) {
-    LOG(ERROR) << "Could not write tsdf sub map message.";
-    outfile_ptr->close();
+  std::string bytes;
+  if (!serializeToString(&bytes, header_proto)) {
+    return false;
+  }
+  if (!outfile_ptr->write(bytes.data(), bytes.size())) {
+    LOG(ERROR) << "Could not write tsdf sub map to stream.";
     return false;
   }
-  // Saving the blocks
-  constexpr bool kIncludeAllBlocks = true;
+  return true;
+}
+
+bool TsdfSubmap::serializeToString(std::string* bytes,
+                                   TsdfSubmapProto* header_proto) const {
+  {
+    std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+    if (paged_out_) {
+      return copyPageToString(bytes, header_proto);
+    }
+    if (compressed_) {
+      return serializeTsdfToString(bytes, header_proto);
+    }
+  }
+  // Holding the lock throughout, such that header and blocks match
+  const ReaderLock tsdf_lock = getTsdfReaderLock();
+  return serializeTsdfToString(bytes, header_proto);
+}
+
+bool TsdfSubmap::serializeEncodedToString(
+    const TsdfBlockEncodingConfig& encoding_config, std::string* bytes,
+    TsdfSubmapProto* header_proto) const {
+  CHECK_NOTNULL(bytes);
+  {
+    std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+    if (paged_out_) {
+      return copyPageToString(bytes, header_proto);
+    }
+    if (compressed_) {
+      return serializeTsdfToString(bytes, header_proto);
+    }
+  }
+  const ReaderLock tsdf_lock = getTsdfReaderLock();
+  TsdfSubmapProto tsdf_sub_map_proto;
+  fillProto(&tsdf_sub_map_proto);
+  std::string encoded_blocks;
+  tsdf_sub_map_proto.set_num_blocks(EncodeTsdfBlocks(
+      tsdf_map_->getTsdfLayer(), encoding_config, &encoded_blocks));
+  tsdf_sub_map_proto.set_num_encoded_block_bytes(encoded_blocks.size());
+  io::AppendProtoMsgToString(tsdf_sub_map_proto, bytes);
+  if (header_proto != nullptr) {
+    *header_proto = tsdf_sub_map_proto;
+  }
+  bytes->append(encoded_blocks);
+  return true;
+}
+
+bool TsdfSubmap::serializeTsdfToString(std::string* bytes,
+                                       TsdfSubmapProto* header_proto) const {
+  CHECK_NOTNULL(bytes);
+  // The TSDF submap header
+  TsdfSubmapProto tsdf_sub_map_proto;
+  fillProto(&tsdf_sub_map_proto);
+  if (compressed_) {
+    tsdf_sub_map_proto.set_num_blocks(encoded_num_blocks_);
+    tsdf_sub_map_proto.set_num_encoded_block_bytes(encoded_blocks_.size());
+  }
+  io::AppendProtoMsgToString(tsdf_sub_map_proto, bytes);
+  if (header_proto != nullptr) {
+    *header_proto = tsdf_sub_map_proto;
+  }
+  // The blocks. Compressed submaps are written as they are.
+  if (compressed_) {
+    bytes->append(encoded_blocks_);
+    return true;
+  }
+  const Layer<TsdfVoxel>& tsdf_layer = tsdf_map_->getTsdfLayer();
+  voxblox::BlockIndexList block_indices;
+  tsdf_layer.getAllAllocatedBlocks(&block_indices);
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    voxblox::BlockProto block_proto;
+    tsdf_layer.getBlockByIndex(block_index).getProto(&block_proto);
+    io::AppendProtoMsgToString(block_proto, bytes);
+  }
+  return true;
+}
+
+size_t TsdfSubmap::getResidentMemoryBytes() const {
+  if (isPagedOut()) {
+    return 0;
+  }
+  if (isCompressed()) {
+    std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+    if (compressed_) {
+      return encoded_blocks_.size();
+    }
+  }
+  const ReaderLock tsdf_lock = lockTsdfForReading();
   const Layer<TsdfVoxel>& tsdf_layer = tsdf_map_->getTsdfLayer();
-  if (!tsdf_layer.saveBlocksToStream(kIncludeAllBlocks,
-                                     voxblox::BlockIndexList(), outfile_ptr)) {
-    LOG(ERROR) << "Could not write sub map blocks to stream.";
-    outfile_ptr->close();
+  return tsdf_layer.getNumberOfAllocatedBlocks() *
+         tsdf_layer.voxels_per_side() * tsdf_layer.voxels_per_side() *
+         tsdf_layer.voxels_per_side() * sizeof(TsdfVoxel);
+}
+
+bool TsdfSubmap::writePageFile(const std::string& page_file_path) {
+  CHECK(isFrozen()) << "Only frozen submaps can be paged out.";
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  if (paged_out_) {
+    return true;
+  }
+  return writePageFileLocked(page_file_path);
+}
+
+bool TsdfSubmap::writePageFileLocked(const std::string& page_file_path) {
+  // Writing the blocks, unless the page file from last time is still current
+  const size_t tsdf_version = tsdf_version_;
+  if (hasPageFile() && page_file_tsdf_version_ == tsdf_version) {
+    return true;
+  }
+  removePageFile();
+  std::string bytes;
+  serializeTsdfToString(&bytes, nullptr);
+  std::fstream outfile;
+  outfile.open(page_file_path, std::fstream::out | std::fstream::binary |
+                                   std::fstream::trunc);
+  if (!outfile.is_open()) {
+    LOG(ERROR) << "Could not open file for paging out submap " << submap_id_
+               << ": " << page_file_path;
     return false;
   }
-  // Success
+  if (!outfile.write(bytes.data(), bytes.size())) {
+    LOG(ERROR) << "Could not page out submap " << submap_id_;
+    outfile.close();
+    std::remove(page_file_path.c_str());
+    return false;
+  }
+  outfile.close();
+  page_file_num_bytes_ = bytes.size();
+  page_file_path_ = page_file_path;
+  page_file_byte_offset_ = 0;
+  page_file_tsdf_version_ = tsdf_version;
   return true;
 }
 
+bool TsdfSubmap::pageOut(const std::string& page_file_path) {
+  CHECK(isFrozen()) << "Only frozen submaps can be paged out.";
+  // The bounding boxes stay in memory, so are brought up to date beforehand.
+  // NOTE: Before taking the paging mutex, as updating them reads the TSDF,
+  //       which takes the mutex to page in (or decompress) the submap.
+  getSubmapFrameBoundingBox();
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  if (paged_out_) {
+    return true;
+  }
+  if (!writePageFileLocked(page_file_path)) {
+    return false;
+  }
+  // Dropping the blocks
+  if (compressed_) {
+    paged_out_num_blocks_ = encoded_num_blocks_;
+    std::string().swap(encoded_blocks_);
+    compressed_ = false;
+  } else {
+    Layer<TsdfVoxel>* tsdf_layer_ptr = tsdf_map_->getTsdfLayerPtr();
+    paged_out_num_blocks_ = tsdf_layer_ptr->getNumberOfAllocatedBlocks();
+    removeAllBlocks(tsdf_layer_ptr);
+  }
+  paged_out_ = true;
+  VLOG(1) << "Paged out submap " << submap_id_;
+  return true;
+}
+
+bool TsdfSubmap::compress(const TsdfBlockEncodingConfig& encoding_config) {
+  EncodedTsdf encoded_tsdf;
+  if (!encodeTsdf(encoding_config, &encoded_tsdf)) {
+    return isPagedOut() || isCompressed();
+  }
+  return compress(&encoded_tsdf);
+}
+
+bool TsdfSubmap::encodeTsdf(const TsdfBlockEncodingConfig& encoding_config,
+                            EncodedTsdf* encoded_tsdf_ptr) const {
+  CHECK_NOTNULL(encoded_tsdf_ptr);
+  CHECK(isFrozen()) << "Only frozen submaps can be compressed.";
+  // NOTE: Held such that the blocks aren't dropped (paged out or compressed)
+  //       while encoding. Readers of the resident blocks don't take it.
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  if (paged_out_ || compressed_) {
+    return false;
+  }
+  encoded_tsdf_ptr->tsdf_version = tsdf_version_;
+  encoded_tsdf_ptr->num_blocks =
+      EncodeTsdfBlocks(tsdf_map_->getTsdfLayer(), encoding_config,
+                       &encoded_tsdf_ptr->encoded_blocks);
+  encoded_tsdf_ptr->encoded_blocks.shrink_to_fit();
+  return true;
+}
+
+bool TsdfSubmap::compress(EncodedTsdf* encoded_tsdf_ptr) {
+  CHECK_NOTNULL(encoded_tsdf_ptr);
+  CHECK(isFrozen()) << "Only frozen submaps can be compressed.";
+  // The bounding boxes stay as they are, so are brought up to date beforehand
+  // (and before taking the paging mutex, see pageOut()).
+  getSubmapFrameBoundingBox();
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  if (paged_out_ || compressed_ ||
+      encoded_tsdf_ptr->tsdf_version != tsdf_version_) {
+    return false;
+  }
+  Layer<TsdfVoxel>* tsdf_layer_ptr = tsdf_map_->getTsdfLayerPtr();
+  const size_t num_blocks = tsdf_layer_ptr->getNumberOfAllocatedBlocks();
+  encoded_num_blocks_ = encoded_tsdf_ptr->num_blocks;
+  encoded_blocks_.swap(encoded_tsdf_ptr->encoded_blocks);
+  removeAllBlocks(tsdf_layer_ptr);
+  compressed_ = true;
+  VLOG(1) << "Compressed submap " << submap_id_ << " from " << num_blocks
+          << " blocks to " << encoded_blocks_.size() << " bytes ("
+          << encoded_num_blocks_ << " blocks).";
+  return true;
+}
+
+void TsdfSubmap::setPagedOutToFile(
+    const io::SubmapFileReader::Ptr& file_reader_ptr,
+    const uint64_t byte_offset, const uint64_t num_bytes,
+    const size_t num_blocks, const BoundingBox& bounding_box_S) {
+  CHECK(file_reader_ptr);
+  freeze();
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  CHECK_EQ(tsdf_map_->getTsdfLayer().getNumberOfAllocatedBlocks(), 0u)
+      << "Only empty submaps can be attached to a file.";
+  removePageFile();
+  const size_t tsdf_version = tsdf_version_;
+  page_file_reader_ = file_reader_ptr;
+  page_file_byte_offset_ = byte_offset;
+  page_file_num_bytes_ = num_bytes;
+  page_file_tsdf_version_ = tsdf_version;
+  paged_out_num_blocks_ = num_blocks;
+  // The blocks are not in memory, so the boxes can't be computed from them
+  {
+    std::lock_guard<std::mutex> bounding_box_lock(bounding_box_mutex_);
+    const size_t pose_version = pose_version_;
+    bounding_box_S_ = bounding_box_S;
+    bounding_box_M_ = bounding_box_S.transformed(getPose());
+    bounding_box_tsdf_version_ = tsdf_version;
+    bounding_box_pose_version_ = pose_version;
+    bounding_boxes_valid_ = true;
+  }
+  paged_out_ = true;
+}
+
+io::SubmapFileReader::Ptr TsdfSubmap::openPageFile() const {
+  // NOTE: Owned page files are opened on demand, such that paged out submaps
+  //       don't hold on to file descriptors.
+  if (page_file_reader_) {
+    return page_file_reader_;
+  }
+  return io::SubmapFileReader::open(page_file_path_);
+}
+
+bool TsdfSubmap::copyPageToString(std::string* bytes,
+                                  TsdfSubmapProto* header_proto) const {
+  CHECK_NOTNULL(bytes);
+  const io::SubmapFileReader::Ptr file_reader_ptr = openPageFile();
+  if (!file_reader_ptr) {
+    LOG(ERROR) << "Could not open the page file of submap " << submap_id_;
+    return false;
+  }
+  // The header is rewritten, as the pose may have changed since paging out
+  TsdfSubmapProto page_header_proto;
+  uint64_t num_header_bytes = 0;
+  if (!file_reader_ptr->readSubmapHeader(
+          page_file_byte_offset_, &page_header_proto, &num_header_bytes)) {
+    LOG(ERROR) << "Could not read the page file of submap " << submap_id_;
+    return false;
+  }
+  TsdfSubmapProto tsdf_sub_map_proto;
+  fillProto(&tsdf_sub_map_proto);
+  tsdf_sub_map_proto.set_num_blocks(page_header_proto.num_blocks());
+  if (page_header_proto.has_num_encoded_block_bytes()) {
+    tsdf_sub_map_proto.set_num_encoded_block_bytes(
+        page_header_proto.num_encoded_block_bytes());
+  }
+  io::AppendProtoMsgToString(tsdf_sub_map_proto, bytes);
+  if (header_proto != nullptr) {
+    *header_proto = tsdf_sub_map_proto;
+  }
+  // The blocks are copied as they are
+  const uint64_t blocks_byte_offset = page_file_byte_offset_ + num_header_bytes;
+  return file_reader_ptr->readBytes(
+      blocks_byte_offset, page_file_num_bytes_ - num_header_bytes, bytes);
+}
+
+void TsdfSubmap::pageInIfRequired() const {
+  if (!paged_out_ && !compressed_) {
+    return;
+  }
+  std::lock_guard<std::mutex> paging_lock(paging_mutex_);
+  if (compressed_) {
+    CHECK(DecodeTsdfBlocks(encoded_blocks_.data(), encoded_blocks_.size(),
+                           tsdf_map_->getTsdfLayerPtr(), block_pool_.get()))
+        << "Could not decompress submap " << submap_id_;
+    std::string().swap(encoded_blocks_);
+    num_decompressions_++;
+    compressed_ = false;
+    VLOG(1) << "Decompressed submap " << submap_id_;
+    return;
+  }
+  // Another thread may have paged the submap in while we waited
+  if (!paged_out_) {
+    return;
+  }
+  // NOTE: The blocks only exist in the page file, so failing to read it back is
+  //       fatal.
+  const io::SubmapFileReader::Ptr file_reader_ptr = openPageFile();
+  CHECK(file_reader_ptr) << "Could not open the page file of submap "
+                         << submap_id_;
+  TsdfSubmapProto tsdf_sub_map_proto;
+  CHECK(file_reader_ptr->readSubmap(page_file_byte_offset_,
+                                    &tsdf_sub_map_proto,
+                                    tsdf_map_->getTsdfLayerPtr()))
+      << "Could not read the page file of submap " << submap_id_ << ": "
+      << file_reader_ptr->getFilePath();
+  num_page_ins_++;
+  paged_out_ = false;
+  VLOG(1) << "Paged in submap " << submap_id_ << " from "
+          << file_reader_ptr->getFilePath();
+}
+
+void TsdfSubmap::removeAllBlocks(Layer<TsdfVoxel>* tsdf_layer_ptr) const {
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  if (block_pool_) {
+    block_pool_->recycleAllBlocks(tsdf_layer_ptr);
+  } else {
+    tsdf_layer_ptr->removeAllBlocks();
+  }
+}
+
+void TsdfSubmap::removePageFile() {
+  page_file_reader_.reset();
+  if (!page_file_path_.empty()) {
+    std::remove(page_file_path_.c_str());
+    page_file_path_.clear();
+  }
+}
+
 }  // namespace cblox
@@ -0,0 +1,45 @@
+#include "cblox/integrator/async_esdf_generator.h"
+
+namespace cblox {
+
+std::shared_future<void> AsyncEsdfGenerator::generateEsdf(
+    const TsdfEsdfSubmap::Ptr& submap_ptr) {
+  CHECK(submap_ptr);
+  VLOG(1) << "Queuing ESDF generation for submap with ID: "
+          << submap_ptr->getID();
+  return thread_pool_
+      .enqueue([this, submap_ptr]() {
+        submap_ptr->generateEsdf();
+        notifyEsdfReady(submap_ptr);
+      })
+      .share();
+}
+
+void AsyncEsdfGenerator::attachToCollection(
+    SubmapCollection<TsdfEsdfSubmap>* collection_ptr) {
+  CHECK_NOTNULL(collection_ptr);
+  collection_ptr->addSubmapFinishedCallback(
+      [this](const TsdfEsdfSubmap::Ptr& submap_ptr) {
+        generateEsdf(submap_ptr);
+      });
+}
+
+void AsyncEsdfGenerator::addEsdfReadyCallback(
+    const EsdfReadyCallback& callback) {
+  std::lock_guard<std::mutex> callbacks_lock(callbacks_mutex_);
+  esdf_ready_callbacks_.push_back(callback);
+}
+
+void AsyncEsdfGenerator::notifyEsdfReady(
+    const TsdfEsdfSubmap::ConstPtr& submap_ptr) const {
+  std::vector<EsdfReadyCallback> callbacks;
+  {
+    std::lock_guard<std::mutex> callbacks_lock(callbacks_mutex_);
+    callbacks = esdf_ready_callbacks_;
+  }
+  for (const EsdfReadyCallback& callback : callbacks) {
+    callback(submap_ptr);
+  }
+}
+
+}  // namespace cblox
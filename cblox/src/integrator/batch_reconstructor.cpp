@@ -0,0 +1,180 @@
+#include "cblox/integrator/batch_reconstructor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+#include <voxblox/io/mesh_ply.h>
+
+namespace cblox {
+
+namespace {
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+BatchReconstructor::BatchReconstructor(
+    const TsdfMap::Config& tsdf_map_config,
+    const voxblox::TsdfIntegratorBase::Config& tsdf_integrator_config,
+    const voxblox::TsdfIntegratorType& tsdf_integrator_type,
+    const voxblox::MeshIntegratorConfig& mesh_config,
+    const BatchReconstructionConfig& config)
+    : config_(config),
+      tsdf_submap_collection_ptr_(
+          new SubmapCollection<TsdfSubmap>(tsdf_map_config)),
+      integrator_ptr_(new TsdfSubmapCollectionIntegrator(
+          tsdf_integrator_config, tsdf_integrator_type,
+          tsdf_submap_collection_ptr_)),
+      submap_mesher_(tsdf_map_config, mesh_config,
+                     std::max<size_t>(config.num_meshing_threads, 1)),
+      submap_creation_policy_(std::make_shared<FrameCountSubmapPolicy>(
+          std::max<size_t>(config.num_integrated_frames_per_submap, 1))) {
+  integrator_ptr_->setDownsamplingConfig(config_.downsampling_config);
+  if (config_.mesh_finished_submaps) {
+    meshing_thread_pool_.reset(new ThreadPool(1));
+    // NOTE: At most one update is queued behind the running one. Each update
+    //       meshes all submaps changed since the last, so further updates would
+    //       be redundant.
+    // NOTE: Only the frozen submaps are meshed, such that the background
+    //       meshing never takes the reader lock of the active submap, which
+    //       the integrator writes.
+    has_submap_finished_callback_ = true;
+    submap_finished_callback_id_ =
+        tsdf_submap_collection_ptr_->addSubmapFinishedCallback(
+            [this](const TsdfSubmap::Ptr& /*submap_ptr*/) {
+              if (meshing_thread_pool_->getNumPendingTasks() < 2) {
+                meshing_thread_pool_->enqueue([this]() {
+                  constexpr bool kUseLod = false;
+                  constexpr bool kFrozenOnly = true;
+                  submap_mesher_.updateMeshCache(*tsdf_submap_collection_ptr_,
+                                                 kUseLod, kFrozenOnly);
+                });
+              }
+            });
+  }
+}
+
+BatchReconstructor::~BatchReconstructor() {
+  if (has_submap_finished_callback_) {
+    tsdf_submap_collection_ptr_->removeSubmapFinishedCallback(
+        submap_finished_callback_id_);
+  }
+}
+
+void BatchReconstructor::setSubmapCreationPolicy(
+    const SubmapCreationPolicy::Ptr& submap_creation_policy) {
+  CHECK(submap_creation_policy);
+  submap_creation_policy_ = submap_creation_policy;
+}
+
+BatchReconstructionStats BatchReconstructor::run(
+    const ScanSource& scan_source) {
+  BatchReconstructionStats stats;
+  const size_t num_downsampled_points_start =
+      integrator_ptr_->getDownsamplingStats().num_output_points;
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  // Double buffering: the next scan is read while the current is integrated,
+  // on a reader thread kept for the whole run.
+  ThreadPool reader_thread_pool(1);
+  PosedScan scans[2];
+  size_t current_index = 0;
+  bool has_scan = scan_source(&scans[current_index]);
+  while (has_scan) {
+    const size_t next_index = 1 - current_index;
+    bool has_next_scan = false;
+    std::future<void> next_scan_future = reader_thread_pool.enqueue(
+        [&scan_source, &scans, &has_next_scan, next_index]() {
+          has_next_scan = scan_source(&scans[next_index]);
+        });
+    integrateScan(scans[current_index]);
+    stats.num_frames++;
+    stats.num_points += scans[current_index].points_C.size();
+    const std::chrono::steady_clock::time_point wait_start =
+        std::chrono::steady_clock::now();
+    next_scan_future.get();
+    has_scan = has_next_scan;
+    stats.read_wait_duration_s += secondsSince(wait_start);
+    current_index = next_index;
+    VLOG_EVERY_N(1, 100) << "Integrated " << stats.num_frames << " scans.";
+  }
+  stats.duration_s = secondsSince(start);
+  stats.num_integrated_points =
+      config_.downsampling_config.enable
+          ? integrator_ptr_->getDownsamplingStats().num_output_points -
+                num_downsampled_points_start
+          : stats.num_points;
+  LOG(INFO) << "Integrated " << stats.num_frames << " scans ("
+            << stats.num_points << " points, " << stats.num_integrated_points
+            << " after downsampling) into "
+            << tsdf_submap_collection_ptr_->size() << " submaps in "
+            << stats.duration_s << "s (" << stats.read_wait_duration_s
+            << "s waiting for input), "
+            << stats.num_frames / std::max(stats.duration_s, 1e-9)
+            << " scans/s.";
+  return stats;
+}
+
+BatchReconstructionStats BatchReconstructor::run(
+    io::ScanDatasetReader* reader_ptr) {
+  CHECK_NOTNULL(reader_ptr);
+  return run([reader_ptr](PosedScan* scan_ptr) {
+    return reader_ptr->readNextScan(scan_ptr);
+  });
+}
+
+void BatchReconstructor::integrateScan(const PosedScan& scan) {
+  CHECK_EQ(scan.points_C.size(), scan.colors.size());
+  if (tsdf_submap_collection_ptr_->empty()) {
+    createNewSubMap(scan.T_G_C);
+  }
+  integrator_ptr_->integratePointCloud(scan.T_G_C, scan.points_C, scan.colors);
+  updateActiveSubmapState(scan);
+  if (submap_creation_policy_->newSubmapRequired(active_submap_state_)) {
+    createNewSubMap(scan.T_G_C);
+  }
+}
+
+void BatchReconstructor::updateActiveSubmapState(const PosedScan& scan) {
+  // NOTE: As in the server, the scan box is found in the sensor frame and then
+  //       transformed.
+  active_submap_state_.num_integrated_frames++;
+  active_submap_state_.T_G_C = scan.T_G_C;
+  BoundingBox scan_box_C;
+  for (const Point& point_C : scan.points_C) {
+    scan_box_C.extend(point_C);
+  }
+  active_submap_state_.extent_G.extend(scan_box_C.transformed(scan.T_G_C));
+  const TsdfSubmap& active_submap =
+      tsdf_submap_collection_ptr_->getActiveSubMap();
+  active_submap_state_.num_allocated_blocks =
+      active_submap.getNumberAllocatedBlocks();
+  active_submap_state_.memory_bytes = active_submap.getResidentMemoryBytes();
+}
+
+void BatchReconstructor::createNewSubMap(const Transformation& T_G_S) {
+  tsdf_submap_collection_ptr_->createNewSubMap(T_G_S);
+  integrator_ptr_->switchToActiveSubmap();
+  active_submap_state_.startNewSubmap(T_G_S);
+}
+
+bool BatchReconstructor::saveMap(const std::string& file_path) const {
+  return tsdf_submap_collection_ptr_->saveToFile(file_path);
+}
+
+bool BatchReconstructor::saveMesh(const std::string& file_path) {
+  if (meshing_thread_pool_) {
+    meshing_thread_pool_->waitUntilIdle();
+  }
+  MeshLayer mesh_layer(tsdf_submap_collection_ptr_->block_size());
+  submap_mesher_.generateSeparatedMesh(*tsdf_submap_collection_ptr_,
+                                       &mesh_layer);
+  return voxblox::outputMeshLayerAsPly(file_path, mesh_layer);
+}
+
+}  // namespace cblox
@@ -0,0 +1,69 @@
+#include "cblox/integrator/point_cloud_downsampler.h"
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+PointCloudDownsampler::PointCloudDownsampler(
+    const PointCloudDownsamplingConfig& config,
+    const FloatingPoint tsdf_voxel_size)
+    : config_(config),
+      cell_size_inv_(1.0f / (tsdf_voxel_size * config.voxel_size_factor)) {
+  CHECK_GT(tsdf_voxel_size, 0.0f);
+  CHECK_GT(config.voxel_size_factor, 0.0f);
+}
+
+void PointCloudDownsampler::downsample(const Transformation& T_S_C,
+                                       const Pointcloud& points_C,
+                                       const Colors& colors,
+                                       Pointcloud* downsampled_points_C,
+                                       Colors* downsampled_colors) {
+  CHECK_NOTNULL(downsampled_points_C);
+  CHECK_NOTNULL(downsampled_colors);
+  CHECK_EQ(points_C.size(), colors.size());
+  // Bucketing the points, in the order their cells are first hit
+  index_to_cell_.clear();
+  cells_.clear();
+  for (size_t point_idx = 0; point_idx < points_C.size(); point_idx++) {
+    const Point& point_C = points_C[point_idx];
+    const voxblox::GlobalIndex cell_index =
+        voxblox::getGridIndexFromPoint<voxblox::GlobalIndex>(T_S_C * point_C,
+                                                             cell_size_inv_);
+    const auto insert_result =
+        index_to_cell_.emplace(cell_index, cells_.size());
+    if (insert_result.second) {
+      cells_.push_back(Cell{Point::Zero(), 0u, 0u, 0u, 0u, 0u});
+    }
+    Cell& cell = cells_[insert_result.first->second];
+    const Color& color = colors[point_idx];
+    cell.point_sum_C += point_C;
+    cell.r_sum += color.r;
+    cell.g_sum += color.g;
+    cell.b_sum += color.b;
+    cell.a_sum += color.a;
+    cell.num_points++;
+  }
+  // Averaging
+  downsampled_points_C->clear();
+  downsampled_colors->clear();
+  downsampled_points_C->reserve(cells_.size());
+  downsampled_colors->reserve(cells_.size());
+  for (const Cell& cell : cells_) {
+    downsampled_points_C->push_back(
+        cell.point_sum_C / static_cast<FloatingPoint>(cell.num_points));
+    Color color;
+    color.r = static_cast<uint8_t>(cell.r_sum / cell.num_points);
+    color.g = static_cast<uint8_t>(cell.g_sum / cell.num_points);
+    color.b = static_cast<uint8_t>(cell.b_sum / cell.num_points);
+    color.a = static_cast<uint8_t>(cell.a_sum / cell.num_points);
+    downsampled_colors->push_back(color);
+  }
+  // Bookkeeping
+  stats_.last_num_input_points = points_C.size();
+  stats_.last_num_output_points = cells_.size();
+  stats_.num_scans++;
+  stats_.num_input_points += points_C.size();
+  stats_.num_output_points += cells_.size();
+}
+
+}  // namespace cblox
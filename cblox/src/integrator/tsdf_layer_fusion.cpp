@@ -0,0 +1,191 @@
+#include "cblox/integrator/tsdf_layer_fusion.h"
+
+#include <limits>
+
+#include <glog/logging.h>
+
+#include <voxblox/interpolator/interpolator.h>
+
+#include "cblox/utils/parallel_for.h"
+
+namespace cblox {
+
+using voxblox::BlockIndex;
+using voxblox::BlockIndexList;
+using voxblox::IndexElement;
+
+size_t fuseTsdfLayersIntoLayer(
+    const std::vector<const Layer<TsdfVoxel>*>& tsdf_layers_A,
+    const TransformationVector& T_B_A_vector, const size_t num_threads,
+    Layer<TsdfVoxel>* tsdf_layer_B_ptr, TsdfBlockPool* block_pool_ptr) {
+  CHECK_NOTNULL(tsdf_layer_B_ptr);
+  CHECK_EQ(tsdf_layers_A.size(), T_B_A_vector.size());
+  const FloatingPoint voxel_size = tsdf_layer_B_ptr->voxel_size();
+  const FloatingPoint block_size = tsdf_layer_B_ptr->block_size();
+  const FloatingPoint block_size_inv = 1.0 / block_size;
+  // Pass 1: Finding the blocks of B covered by each layer
+  voxblox::AnyIndexHashMapType<std::vector<size_t>>::type
+      block_to_layer_indices;
+  for (size_t layer_index = 0; layer_index < tsdf_layers_A.size();
+       layer_index++) {
+    const Layer<TsdfVoxel>& tsdf_layer_A = *CHECK_NOTNULL(
+        tsdf_layers_A[layer_index]);
+    CHECK_NEAR(tsdf_layer_A.block_size(), block_size, 1e-6);
+    const Transformation& T_B_A = T_B_A_vector[layer_index];
+    BlockIndexList block_indices_A;
+    tsdf_layer_A.getAllAllocatedBlocks(&block_indices_A);
+    for (const BlockIndex& block_index_A : block_indices_A) {
+      // The bounding box of the block in B, padded by a voxel to account for
+      // interpolation.
+      const Point origin_A = block_index_A.cast<FloatingPoint>() * block_size;
+      Point min_B = Point::Constant(std::numeric_limits<FloatingPoint>::max());
+      Point max_B = -min_B;
+      for (int corner_index = 0; corner_index < 8; corner_index++) {
+        const Point corner_offset((corner_index & 1) ? block_size : 0.0f,
+                                  (corner_index & 2) ? block_size : 0.0f,
+                                  (corner_index & 4) ? block_size : 0.0f);
+        const Point corner_B = T_B_A * (origin_A + corner_offset);
+        min_B = min_B.cwiseMin(corner_B);
+        max_B = max_B.cwiseMax(corner_B);
+      }
+      min_B -= Point::Constant(voxel_size);
+      max_B += Point::Constant(voxel_size);
+      const BlockIndex min_index = (min_B * block_size_inv)
+                                       .array()
+                                       .floor()
+                                       .cast<IndexElement>()
+                                       .matrix();
+      const BlockIndex max_index = (max_B * block_size_inv)
+                                       .array()
+                                       .floor()
+                                       .cast<IndexElement>()
+                                       .matrix();
+      BlockIndex block_index_B;
+      for (block_index_B.x() = min_index.x();
+           block_index_B.x() <= max_index.x(); block_index_B.x()++) {
+        for (block_index_B.y() = min_index.y();
+             block_index_B.y() <= max_index.y(); block_index_B.y()++) {
+          for (block_index_B.z() = min_index.z();
+               block_index_B.z() <= max_index.z(); block_index_B.z()++) {
+            std::vector<size_t>& layer_indices =
+                block_to_layer_indices[block_index_B];
+            if (layer_indices.empty() || layer_indices.back() != layer_index) {
+              layer_indices.push_back(layer_index);
+            }
+          }
+        }
+      }
+    }
+  }
+  // Allocating the blocks up front, as the layer can't be modified
+  // concurrently. The threads below only write to (distinct) blocks.
+  struct BlockToFuse {
+    BlockIndex block_index;
+    Block<TsdfVoxel>::Ptr block_ptr;
+    const std::vector<size_t>* layer_indices;
+    bool newly_allocated;
+    bool fused;
+  };
+  std::vector<BlockToFuse> blocks_to_fuse;
+  blocks_to_fuse.reserve(block_to_layer_indices.size());
+  for (const auto& block_layers_pair : block_to_layer_indices) {
+    BlockToFuse block_to_fuse;
+    block_to_fuse.block_index = block_layers_pair.first;
+    block_to_fuse.block_ptr =
+        tsdf_layer_B_ptr->getBlockPtrByIndex(block_layers_pair.first);
+    block_to_fuse.newly_allocated = !block_to_fuse.block_ptr;
+    if (block_to_fuse.newly_allocated) {
+      block_to_fuse.block_ptr =
+          (block_pool_ptr != nullptr)
+              ? block_pool_ptr->allocateBlockPtrByIndex(
+                    block_layers_pair.first, tsdf_layer_B_ptr)
+              : tsdf_layer_B_ptr->allocateBlockPtrByIndex(
+                    block_layers_pair.first);
+    }
+    block_to_fuse.layer_indices = &block_layers_pair.second;
+    block_to_fuse.fused = false;
+    blocks_to_fuse.push_back(block_to_fuse);
+  }
+  // Pass 2: Fusing block by block (in parallel)
+  std::vector<voxblox::Interpolator<TsdfVoxel>> interpolators;
+  interpolators.reserve(tsdf_layers_A.size());
+  TransformationVector T_A_B_vector;
+  T_A_B_vector.reserve(tsdf_layers_A.size());
+  for (size_t layer_index = 0; layer_index < tsdf_layers_A.size();
+       layer_index++) {
+    interpolators.emplace_back(tsdf_layers_A[layer_index]);
+    T_A_B_vector.push_back(T_B_A_vector[layer_index].inverse());
+  }
+  parallelFor(blocks_to_fuse.size(), num_threads, [&](const size_t index) {
+    BlockToFuse& block_to_fuse = blocks_to_fuse[index];
+    Block<TsdfVoxel>& block_B = *block_to_fuse.block_ptr;
+    for (size_t linear_index = 0; linear_index < block_B.num_voxels();
+         linear_index++) {
+      const Point voxel_center_B =
+          block_B.computeCoordinatesFromLinearIndex(linear_index);
+      TsdfVoxel& voxel_B = block_B.getVoxelByLinearIndex(linear_index);
+      for (const size_t layer_index : *block_to_fuse.layer_indices) {
+        const Point voxel_center_A = T_A_B_vector[layer_index] * voxel_center_B;
+        TsdfVoxel voxel_A;
+        constexpr bool kInterpolate = true;
+        if (interpolators[layer_index].getVoxel(voxel_center_A, &voxel_A,
+                                                kInterpolate) &&
+            voxel_A.weight > 0.0f) {
+          fuseTsdfVoxel(voxel_A, &voxel_B);
+          block_to_fuse.fused = true;
+        }
+      }
+    }
+    if (block_to_fuse.fused) {
+      block_B.set_has_data(true);
+    }
+  });
+  // Removing the (padding) blocks which received no data
+  size_t num_fused_blocks = 0;
+  for (const BlockToFuse& block_to_fuse : blocks_to_fuse) {
+    if (block_to_fuse.fused) {
+      num_fused_blocks++;
+    } else if (block_to_fuse.newly_allocated) {
+      tsdf_layer_B_ptr->removeBlock(block_to_fuse.block_index);
+    }
+  }
+  return num_fused_blocks;
+}
+
+size_t downsampleTsdfLayer(const Layer<TsdfVoxel>& tsdf_layer_A,
+                           const size_t factor,
+                           Layer<TsdfVoxel>* tsdf_layer_B_ptr) {
+  CHECK_NOTNULL(tsdf_layer_B_ptr);
+  CHECK_GT(factor, 0u);
+  CHECK_EQ(tsdf_layer_A.voxels_per_side(), tsdf_layer_B_ptr->voxels_per_side());
+  CHECK_NEAR(tsdf_layer_B_ptr->voxel_size(),
+             tsdf_layer_A.voxel_size() * static_cast<FloatingPoint>(factor),
+             1e-6);
+  // NOTE: Both grids start at the origin, so each block of A lies within a
+  //       single block of B, and each voxel of A within a single voxel of B.
+  BlockIndexList block_indices_A;
+  tsdf_layer_A.getAllAllocatedBlocks(&block_indices_A);
+  for (const BlockIndex& block_index_A : block_indices_A) {
+    const Block<TsdfVoxel>& block_A =
+        tsdf_layer_A.getBlockByIndex(block_index_A);
+    const Point block_center =
+        block_A.origin() + Point::Constant(0.5 * block_A.block_size());
+    Block<TsdfVoxel>::Ptr block_B_ptr =
+        tsdf_layer_B_ptr->allocateBlockPtrByCoordinates(block_center);
+    for (size_t linear_index = 0; linear_index < block_A.num_voxels();
+         linear_index++) {
+      const TsdfVoxel& voxel_A = block_A.getVoxelByLinearIndex(linear_index);
+      if (voxel_A.weight <= 0.0f) {
+        continue;
+      }
+      fuseTsdfVoxel(voxel_A,
+                    &block_B_ptr->getVoxelByCoordinates(
+                        block_A.computeCoordinatesFromLinearIndex(
+                            linear_index)));
+      block_B_ptr->set_has_data(true);
+    }
+  }
+  return tsdf_layer_B_ptr->getNumberOfAllocatedBlocks();
+}
+
+}  // namespace cblox
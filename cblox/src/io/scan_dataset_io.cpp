@@ -0,0 +1,147 @@
+#include "cblox/io/scan_dataset_io.h"
+
+#include <sstream>
+
+#include <glog/logging.h>
+
+namespace cblox {
+namespace io {
+
+namespace {
+
+const std::string kInlineScanTag = "scan";
+const std::string kBinaryPointsExtension = ".bin";
+
+bool endsWith(const std::string& string, const std::string& suffix) {
+  return string.size() >= suffix.size() &&
+         string.compare(string.size() - suffix.size(), suffix.size(),
+                        suffix) == 0;
+}
+
+// Parses "<x> <y> <z> [<r> <g> <b>]". Points without a color are grey.
+bool parsePoint(const std::string& line, Point* point_ptr, Color* color_ptr) {
+  std::istringstream point_stream(line);
+  if (!(point_stream >> point_ptr->x() >> point_ptr->y() >> point_ptr->z())) {
+    return false;
+  }
+  int r = 128, g = 128, b = 128;
+  point_stream >> r >> g >> b;
+  *color_ptr = Color(r, g, b);
+  return true;
+}
+
+bool parsePose(std::istringstream* stream_ptr, Transformation* T_G_C_ptr) {
+  FloatingPoint x, y, z, qw, qx, qy, qz;
+  if (!(*stream_ptr >> x >> y >> z >> qw >> qx >> qy >> qz)) {
+    return false;
+  }
+  *T_G_C_ptr = Transformation(
+      Transformation::Rotation(
+          Eigen::Quaternion<FloatingPoint>(qw, qx, qy, qz).normalized()),
+      Point(x, y, z));
+  return true;
+}
+
+}  // namespace
+
+ScanDatasetReader::ScanDatasetReader(const std::string& file_path)
+    : file_(file_path), has_error_(false), num_scans_read_(0) {
+  if (!file_.is_open()) {
+    LOG(ERROR) << "Could not open the scan dataset: " << file_path;
+    has_error_ = true;
+  }
+  const size_t last_separator = file_path.find_last_of('/');
+  if (last_separator != std::string::npos) {
+    directory_ = file_path.substr(0, last_separator + 1);
+  }
+}
+
+bool ScanDatasetReader::readNextScan(PosedScan* scan_ptr) {
+  CHECK_NOTNULL(scan_ptr);
+  if (has_error_) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(file_, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream line_stream(line);
+    std::string first_token;
+    line_stream >> first_token;
+    bool success = parsePose(&line_stream, &scan_ptr->T_G_C);
+    if (success && first_token == kInlineScanTag) {
+      size_t num_points;
+      success = (line_stream >> num_points) &&
+                readInlinePoints(num_points, scan_ptr);
+    } else if (success) {
+      const std::string points_file_path =
+          (first_token[0] == '/') ? first_token : directory_ + first_token;
+      success = readPointsFile(points_file_path, scan_ptr);
+    }
+    if (!success) {
+      LOG(ERROR) << "Invalid scan number " << num_scans_read_ << ": " << line;
+      has_error_ = true;
+      return false;
+    }
+    num_scans_read_++;
+    return true;
+  }
+  return false;
+}
+
+bool ScanDatasetReader::readInlinePoints(const size_t num_points,
+                                         PosedScan* scan_ptr) {
+  scan_ptr->points_C.resize(num_points);
+  scan_ptr->colors.resize(num_points);
+  std::string line;
+  for (size_t point_index = 0; point_index < num_points; point_index++) {
+    if (!std::getline(file_, line) ||
+        !parsePoint(line, &scan_ptr->points_C[point_index],
+                    &scan_ptr->colors[point_index])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ScanDatasetReader::readPointsFile(const std::string& points_file_path,
+                                       PosedScan* scan_ptr) const {
+  scan_ptr->points_C.clear();
+  scan_ptr->colors.clear();
+  if (endsWith(points_file_path, kBinaryPointsExtension)) {
+    std::ifstream points_file(points_file_path, std::ios::binary);
+    if (!points_file.is_open()) {
+      LOG(ERROR) << "Could not open: " << points_file_path;
+      return false;
+    }
+    float values[4];
+    while (points_file.read(reinterpret_cast<char*>(values), sizeof(values))) {
+      scan_ptr->points_C.push_back(Point(values[0], values[1], values[2]));
+      scan_ptr->colors.push_back(Color(128, 128, 128));
+    }
+    return true;
+  }
+  std::ifstream points_file(points_file_path);
+  if (!points_file.is_open()) {
+    LOG(ERROR) << "Could not open: " << points_file_path;
+    return false;
+  }
+  std::string line;
+  Point point_C;
+  Color color;
+  while (std::getline(points_file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    if (!parsePoint(line, &point_C, &color)) {
+      return false;
+    }
+    scan_ptr->points_C.push_back(point_C);
+    scan_ptr->colors.push_back(color);
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace cblox
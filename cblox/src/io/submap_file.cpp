@@ -0,0 +1,476 @@
+#include "cblox/io/submap_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <voxblox/utils/protobuf_utils.h>
+
+#include "cblox/core/tsdf_block_encoding.h"
+
+namespace cblox {
+namespace io {
+
+namespace {
+
+// Marks the end of files with an index ("CBLXIDX1")
+constexpr uint64_t kIndexMagicNumber = 0x31584449584c4243;
+constexpr size_t kTrailerNumBytes = 2 * sizeof(uint64_t);
+
+// Starts checkpoint files. The leading bytes are not a valid message length
+// (a varint of over 10 bytes), such that readers which don't know checkpoint
+// files fail to read the header, rather than reading an empty collection.
+constexpr char kCheckpointFileMagic[] =
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "CBLXCKPT";
+constexpr size_t kCheckpointFileMagicNumBytes =
+    sizeof(kCheckpointFileMagic) - 1;
+
+// Whether the file starts with the checkpoint magic
+bool hasCheckpointFileMagic(std::fstream* infile_ptr) {
+  char magic[kCheckpointFileMagicNumBytes];
+  infile_ptr->clear();
+  infile_ptr->seekg(0, std::ios_base::beg);
+  return infile_ptr->read(magic, kCheckpointFileMagicNumBytes) &&
+         std::equal(magic, magic + kCheckpointFileMagicNumBytes,
+                    kCheckpointFileMagic);
+}
+
+// The trailer is written byte by byte, such that it doesn't depend on the
+// endianness of the machine.
+void writeUint64(const uint64_t value, std::fstream* outfile_ptr) {
+  for (size_t byte_index = 0; byte_index < sizeof(uint64_t); byte_index++) {
+    outfile_ptr->put(static_cast<char>((value >> (8 * byte_index)) & 0xff));
+  }
+}
+
+uint64_t readUint64(const char* bytes) {
+  uint64_t value = 0;
+  for (size_t byte_index = 0; byte_index < sizeof(uint64_t); byte_index++) {
+    const unsigned char byte = static_cast<unsigned char>(bytes[byte_index]);
+    value |= static_cast<uint64_t>(byte) << (8 * byte_index);
+  }
+  return value;
+}
+
+// Replays the (complete) checkpoints of a checkpoint file, starting at
+// byte_offset, into the index of the submaps they leave behind.
+bool readCheckpointIndex(std::fstream* infile_ptr, uint64_t byte_offset,
+                         TsdfSubmapCollectionIndexProto* index_proto) {
+  infile_ptr->clear();
+  infile_ptr->seekg(0, std::ios_base::end);
+  const uint64_t file_num_bytes = infile_ptr->tellg();
+  std::map<SubmapID, TsdfSubmapIndexEntryProto> id_to_entry;
+  SubmapID active_submap_id = 0;
+  size_t num_checkpoints = 0;
+  std::vector<TsdfSubmapCheckpointRecordProto> uncommitted_records;
+  bool truncated = false;
+  while (byte_offset < file_num_bytes) {
+    TsdfSubmapCheckpointRecordProto record_proto;
+    if (!ReadProtoMsgFromStream(infile_ptr, &record_proto, &byte_offset)) {
+      truncated = true;
+      break;
+    }
+    if (record_proto.type() == TsdfSubmapCheckpointRecordProto::SUBMAP) {
+      // The submap follows the record
+      record_proto.mutable_submap()->set_byte_offset(byte_offset);
+      byte_offset += record_proto.submap().num_bytes();
+      if (byte_offset > file_num_bytes) {
+        truncated = true;
+        break;
+      }
+    }
+    if (record_proto.type() != TsdfSubmapCheckpointRecordProto::COMMIT) {
+      uncommitted_records.push_back(record_proto);
+      continue;
+    }
+    // Applying the checkpoint
+    for (const TsdfSubmapCheckpointRecordProto& uncommitted_record_proto :
+         uncommitted_records) {
+      switch (uncommitted_record_proto.type()) {
+        case TsdfSubmapCheckpointRecordProto::SUBMAP:
+          id_to_entry[uncommitted_record_proto.submap().id()] =
+              uncommitted_record_proto.submap();
+          break;
+        case TsdfSubmapCheckpointRecordProto::POSE: {
+          const auto it = id_to_entry.find(uncommitted_record_proto.id());
+          if (it != id_to_entry.end()) {
+            *it->second.mutable_transform() =
+                uncommitted_record_proto.transform();
+          }
+          break;
+        }
+        case TsdfSubmapCheckpointRecordProto::REMOVE:
+          id_to_entry.erase(uncommitted_record_proto.id());
+          break;
+        default:
+          break;
+      }
+    }
+    uncommitted_records.clear();
+    active_submap_id = record_proto.active_submap_id();
+    num_checkpoints++;
+  }
+  if (truncated || !uncommitted_records.empty()) {
+    LOG(WARNING) << "Ignoring an incomplete checkpoint at the end of the file.";
+  }
+  // The active submap goes last, such that loading activates it
+  index_proto->Clear();
+  for (const auto& id_entry_pair : id_to_entry) {
+    if (id_entry_pair.first != active_submap_id) {
+      *index_proto->add_submaps() = id_entry_pair.second;
+    }
+  }
+  const auto active_it = id_to_entry.find(active_submap_id);
+  if (active_it != id_to_entry.end()) {
+    *index_proto->add_submaps() = active_it->second;
+  }
+  VLOG(1) << "Replayed " << num_checkpoints << " checkpoints.";
+  return true;
+}
+
+}  // namespace
+
+bool WriteCollectionIndex(const TsdfSubmapCollectionIndexProto& index_proto,
+                          std::fstream* outfile_ptr) {
+  CHECK_NOTNULL(outfile_ptr);
+  const uint64_t index_byte_offset = outfile_ptr->tellp();
+  if (!voxblox::utils::writeProtoMsgToStream(index_proto, outfile_ptr)) {
+    LOG(ERROR) << "Could not write submap collection index message.";
+    return false;
+  }
+  writeUint64(index_byte_offset, outfile_ptr);
+  writeUint64(kIndexMagicNumber, outfile_ptr);
+  return outfile_ptr->good();
+}
+
+bool WriteCheckpointFileMagic(std::fstream* outfile_ptr) {
+  CHECK_NOTNULL(outfile_ptr);
+  return static_cast<bool>(
+      outfile_ptr->write(kCheckpointFileMagic, kCheckpointFileMagicNumBytes));
+}
+
+bool ReadCollectionIndex(const std::string& file_path,
+                         TsdfSubmapCollectionIndexProto* index_proto) {
+  CHECK_NOTNULL(index_proto);
+  std::fstream infile;
+  infile.open(file_path, std::fstream::in | std::fstream::binary);
+  if (!infile.is_open()) {
+    LOG(ERROR) << "Could not open submap collection file: " << file_path;
+    return false;
+  }
+  // The header of checkpoint files follows the magic
+  const bool has_checkpoint_magic = hasCheckpointFileMagic(&infile);
+  uint64_t byte_offset =
+      has_checkpoint_magic ? kCheckpointFileMagicNumBytes : 0;
+  TsdfSubmapCollectionProto tsdf_submap_collection_proto;
+  if (!ReadProtoMsgFromStream(&infile, &tsdf_submap_collection_proto,
+                              &byte_offset)) {
+    LOG(ERROR) << "Could not read tsdf submap collection map protobuf message.";
+    return false;
+  }
+  if (!IsKnownCollectionFileFormatVersion(tsdf_submap_collection_proto)) {
+    return false;
+  }
+  // Files in the original format don't have a version
+  if (tsdf_submap_collection_proto.format_version() <
+      kIndexedCollectionFileFormatVersion) {
+    return false;
+  }
+  // NOTE: Checkpoint files written before the magic was introduced are only
+  //       marked in the header.
+  if (has_checkpoint_magic || tsdf_submap_collection_proto.is_checkpoint()) {
+    if (!tsdf_submap_collection_proto.is_checkpoint()) {
+      LOG(ERROR) << "Checkpoint file has no checkpoint header: " << file_path;
+      return false;
+    }
+    return readCheckpointIndex(&infile, byte_offset, index_proto);
+  }
+  // Finding the index through the trailer
+  infile.clear();
+  infile.seekg(0, std::ios_base::end);
+  const uint64_t file_num_bytes = infile.tellg();
+  if (file_num_bytes < kTrailerNumBytes) {
+    LOG(ERROR) << "Submap collection file is truncated: " << file_path;
+    return false;
+  }
+  char trailer[kTrailerNumBytes];
+  infile.seekg(file_num_bytes - kTrailerNumBytes, std::ios_base::beg);
+  if (!infile.read(trailer, kTrailerNumBytes) ||
+      readUint64(trailer + sizeof(uint64_t)) != kIndexMagicNumber) {
+    LOG(ERROR) << "Submap collection file has no valid index: " << file_path;
+    return false;
+  }
+  byte_offset = readUint64(trailer);
+  if (!ReadProtoMsgFromStream(&infile, index_proto, &byte_offset)) {
+    LOG(ERROR) << "Could not read submap collection index message.";
+    return false;
+  }
+  if (index_proto->submaps_size() !=
+      static_cast<int>(tsdf_submap_collection_proto.num_submaps())) {
+    LOG(ERROR) << "Submap collection index doesn't match the header.";
+    return false;
+  }
+  return true;
+}
+
+bool IsKnownCollectionFileFormatVersion(
+    const TsdfSubmapCollectionProto& tsdf_submap_collection_proto) {
+  if (tsdf_submap_collection_proto.format_version() >
+      kCollectionFileFormatVersion) {
+    LOG(ERROR) << "Unknown submap collection file format version "
+               << tsdf_submap_collection_proto.format_version()
+               << " (this reader knows up to version "
+               << kCollectionFileFormatVersion << ").";
+    return false;
+  }
+  return true;
+}
+
+bool ReadProtoMsgFromStream(std::fstream* stream_ptr,
+                            google::protobuf::Message* message,
+                            uint64_t* byte_offset_ptr) {
+  CHECK_NOTNULL(stream_ptr);
+  CHECK_NOTNULL(message);
+  CHECK_NOTNULL(byte_offset_ptr);
+  stream_ptr->clear();
+  stream_ptr->seekg(*byte_offset_ptr, std::ios_base::beg);
+  // NOTE: The input stream reads ahead, so the position of the stream is not
+  //       the end of the message afterwards.
+  google::protobuf::io::IstreamInputStream raw_in(stream_ptr);
+  google::protobuf::io::CodedInputStream coded_in(&raw_in);
+  uint32_t message_size;
+  if (!coded_in.ReadVarint32(&message_size)) {
+    LOG(ERROR) << "Could not read protobuf message size.";
+    return false;
+  }
+  const google::protobuf::io::CodedInputStream::Limit limit =
+      coded_in.PushLimit(message_size);
+  if (!message->ParseFromCodedStream(&coded_in)) {
+    LOG(ERROR) << "Could not read protobuf message.";
+    return false;
+  }
+  coded_in.PopLimit(limit);
+  *byte_offset_ptr += coded_in.CurrentPosition();
+  return true;
+}
+
+void AppendProtoMsgToString(const google::protobuf::Message& message,
+                            std::string* bytes) {
+  CHECK_NOTNULL(bytes);
+  google::protobuf::io::StringOutputStream raw_out(bytes);
+  google::protobuf::io::CodedOutputStream coded_out(&raw_out);
+  coded_out.WriteVarint32(message.ByteSize());
+  message.SerializeToCodedStream(&coded_out);
+}
+
+bool ParseProtoMsgFromString(const std::string& bytes,
+                             google::protobuf::Message* message,
+                             uint64_t* byte_offset_ptr) {
+  CHECK_NOTNULL(message);
+  CHECK_NOTNULL(byte_offset_ptr);
+  if (*byte_offset_ptr >= bytes.size()) {
+    return false;
+  }
+  google::protobuf::io::CodedInputStream coded_in(
+      reinterpret_cast<const uint8_t*>(bytes.data()) + *byte_offset_ptr,
+      static_cast<int>(bytes.size() - *byte_offset_ptr));
+  uint32_t message_size;
+  if (!coded_in.ReadVarint32(&message_size)) {
+    return false;
+  }
+  const google::protobuf::io::CodedInputStream::Limit limit =
+      coded_in.PushLimit(message_size);
+  if (!message->ParseFromCodedStream(&coded_in)) {
+    return false;
+  }
+  coded_in.PopLimit(limit);
+  *byte_offset_ptr += coded_in.CurrentPosition();
+  return true;
+}
+
+bool ReadBlocksFromStream(std::fstream* stream_ptr,
+                          const TsdfSubmapProto& tsdf_submap_proto,
+                          uint64_t* byte_offset_ptr,
+                          Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(stream_ptr);
+  CHECK_NOTNULL(byte_offset_ptr);
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  // Encoded blocks are read in one go
+  if (tsdf_submap_proto.has_num_encoded_block_bytes()) {
+    std::string bytes(tsdf_submap_proto.num_encoded_block_bytes(), '\0');
+    stream_ptr->clear();
+    stream_ptr->seekg(*byte_offset_ptr, std::ios_base::beg);
+    if (!stream_ptr->read(&bytes[0], bytes.size())) {
+      LOG(ERROR) << "Could not read the encoded blocks.";
+      return false;
+    }
+    *byte_offset_ptr += bytes.size();
+    return DecodeTsdfBlocks(bytes.data(), bytes.size(), tsdf_layer_ptr);
+  }
+  for (size_t block_index = 0; block_index < tsdf_submap_proto.num_blocks();
+       block_index++) {
+    voxblox::BlockProto block_proto;
+    if (!ReadProtoMsgFromStream(stream_ptr, &block_proto, byte_offset_ptr)) {
+      LOG(ERROR) << "Could not read block protobuf message number "
+                 << block_index;
+      return false;
+    }
+    if (!tsdf_layer_ptr->addBlockFromProto(
+            block_proto, Layer<TsdfVoxel>::BlockMergingStrategy::kReplace)) {
+      LOG(ERROR) << "Could not add the block protobuf message to the layer!";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadSubmapFromStream(std::fstream* stream_ptr, uint64_t* byte_offset_ptr,
+                          TsdfSubmapProto* tsdf_submap_proto,
+                          Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_submap_proto);
+  if (!ReadProtoMsgFromStream(stream_ptr, tsdf_submap_proto,
+                              byte_offset_ptr)) {
+    LOG(ERROR) << "Could not read tsdf sub map protobuf message.";
+    return false;
+  }
+  return ReadBlocksFromStream(stream_ptr, *tsdf_submap_proto, byte_offset_ptr,
+                              tsdf_layer_ptr);
+}
+
+bool ParseSubmapFromString(const std::string& bytes,
+                           TsdfSubmapProto* tsdf_submap_proto,
+                           Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_submap_proto);
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  google::protobuf::io::ArrayInputStream raw_in(bytes.data(), bytes.size());
+  // NOTE: A coded stream per message, as coded streams limit the total number
+  //       of bytes they read. Destroying a coded stream hands back the bytes it
+  //       read ahead, such that raw_in is positioned at the end of the message.
+  const auto parse_message = [&raw_in](google::protobuf::Message* message) {
+    google::protobuf::io::CodedInputStream coded_in(&raw_in);
+    uint32_t message_size;
+    if (!coded_in.ReadVarint32(&message_size)) {
+      return false;
+    }
+    const google::protobuf::io::CodedInputStream::Limit limit =
+        coded_in.PushLimit(message_size);
+    if (!message->ParseFromCodedStream(&coded_in)) {
+      return false;
+    }
+    coded_in.PopLimit(limit);
+    return true;
+  };
+  if (!parse_message(tsdf_submap_proto)) {
+    LOG(ERROR) << "Could not parse tsdf sub map protobuf message.";
+    return false;
+  }
+  if (tsdf_submap_proto->has_num_encoded_block_bytes()) {
+    const uint64_t blocks_byte_offset = raw_in.ByteCount();
+    const uint64_t num_encoded_block_bytes =
+        tsdf_submap_proto->num_encoded_block_bytes();
+    if (blocks_byte_offset + num_encoded_block_bytes > bytes.size()) {
+      LOG(ERROR) << "The encoded blocks are truncated.";
+      return false;
+    }
+    return DecodeTsdfBlocks(bytes.data() + blocks_byte_offset,
+                            num_encoded_block_bytes, tsdf_layer_ptr);
+  }
+  for (size_t block_index = 0; block_index < tsdf_submap_proto->num_blocks();
+       block_index++) {
+    voxblox::BlockProto block_proto;
+    if (!parse_message(&block_proto)) {
+      LOG(ERROR) << "Could not parse block protobuf message number "
+                 << block_index;
+      return false;
+    }
+    if (!tsdf_layer_ptr->addBlockFromProto(
+            block_proto, Layer<TsdfVoxel>::BlockMergingStrategy::kReplace)) {
+      LOG(ERROR) << "Could not add the block protobuf message to the layer!";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SyncFileToDisk(const std::string& file_path) {
+  const int file_descriptor = ::open(file_path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    LOG(ERROR) << "Could not open file for syncing: " << file_path;
+    return false;
+  }
+  const bool success = (::fsync(file_descriptor) == 0);
+  ::close(file_descriptor);
+  if (!success) {
+    LOG(ERROR) << "Could not sync file to disk: " << file_path;
+  }
+  return success;
+}
+
+SubmapFileReader::SubmapFileReader(const std::string& file_path)
+    : file_path_(file_path) {
+  file_.open(file_path_, std::fstream::in | std::fstream::binary);
+}
+
+SubmapFileReader::Ptr SubmapFileReader::open(const std::string& file_path) {
+  Ptr reader_ptr(new SubmapFileReader(file_path));
+  if (!reader_ptr->file_.is_open()) {
+    LOG(ERROR) << "Could not open submap file: " << file_path;
+    return Ptr();
+  }
+  return reader_ptr;
+}
+
+bool SubmapFileReader::readSubmapHeader(const uint64_t byte_offset,
+                                        TsdfSubmapProto* tsdf_submap_proto,
+                                        uint64_t* num_header_bytes) {
+  CHECK_NOTNULL(tsdf_submap_proto);
+  std::lock_guard<std::mutex> file_lock(mutex_);
+  uint64_t end_byte_offset = byte_offset;
+  if (!ReadProtoMsgFromStream(&file_, tsdf_submap_proto, &end_byte_offset)) {
+    LOG(ERROR) << "Could not read tsdf sub map protobuf message.";
+    return false;
+  }
+  if (num_header_bytes != nullptr) {
+    *num_header_bytes = end_byte_offset - byte_offset;
+  }
+  return true;
+}
+
+bool SubmapFileReader::readSubmap(const uint64_t byte_offset,
+                                  TsdfSubmapProto* tsdf_submap_proto,
+                                  Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_submap_proto);
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  std::lock_guard<std::mutex> file_lock(mutex_);
+  uint64_t current_byte_offset = byte_offset;
+  return ReadSubmapFromStream(&file_, &current_byte_offset, tsdf_submap_proto,
+                              tsdf_layer_ptr);
+}
+
+bool SubmapFileReader::readBytes(const uint64_t byte_offset,
+                                 const uint64_t num_bytes,
+                                 std::string* bytes) {
+  CHECK_NOTNULL(bytes);
+  std::lock_guard<std::mutex> file_lock(mutex_);
+  file_.clear();
+  file_.seekg(byte_offset, std::ios_base::beg);
+  const size_t initial_num_bytes = bytes->size();
+  bytes->resize(initial_num_bytes + num_bytes);
+  if (!file_.read(&(*bytes)[initial_num_bytes], num_bytes)) {
+    LOG(ERROR) << "Could not read " << num_bytes << " bytes from "
+               << file_path_;
+    bytes->resize(initial_num_bytes);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace io
+}  // namespace cblox
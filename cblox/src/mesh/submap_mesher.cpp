@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include <glog/logging.h>
 
+#include <voxblox/interpolator/interpolator.h>
+
+#include "cblox/integrator/tsdf_layer_fusion.h"
 #include "cblox/mesh/submap_mesher.h"
 
 namespace cblox {
@@ -11,16 +20,300 @@ using voxblox::BlockIndex;
 using voxblox::BlockIndexList;
 using voxblox::Point;
 
-void SubmapMesher::generatePatchMeshes(
-    const SubmapCollection<TsdfSubmap>& tsdf_submap_collection,
-    std::vector<MeshLayer::Ptr>* sub_map_mesh_layers_ptr) {
-  CHECK_NOTNULL(sub_map_mesh_layers_ptr);
-  // Getting the submaps
-  const std::vector<TsdfSubmap::ConstPtr> tsdf_sub_maps =
-      tsdf_submap_collection.getSubMapConstPtrs();
-  // Generating the mesh layers
-  generateSeparatedMeshLayers<TsdfSubmap>(tsdf_sub_maps,
-                                          sub_map_mesh_layers_ptr);
+namespace {
+
+// Floor division, such that negative grid indices map to the right tile.
+inline IndexElement floorDivide(const IndexElement numerator,
+                                const IndexElement denominator) {
+  return (numerator >= 0) ? (numerator / denominator)
+                          : ((numerator - denominator + 1) / denominator);
+}
+
+inline BlockIndex getTileIndex(const BlockIndex& block_index,
+                               const IndexElement tile_size) {
+  return BlockIndex(floorDivide(block_index.x(), tile_size),
+                    floorDivide(block_index.y(), tile_size),
+                    floorDivide(block_index.z(), tile_size));
+}
+
+// Appends the triangles of mesh A to mesh B
+inline void appendMesh(const Mesh& mesh_A, Mesh* mesh_B_ptr) {
+  const VertexIndex index_offset = mesh_B_ptr->vertices.size();
+  mesh_B_ptr->vertices.insert(mesh_B_ptr->vertices.end(),
+                              mesh_A.vertices.begin(), mesh_A.vertices.end());
+  mesh_B_ptr->normals.insert(mesh_B_ptr->normals.end(), mesh_A.normals.begin(),
+                             mesh_A.normals.end());
+  mesh_B_ptr->colors.insert(mesh_B_ptr->colors.end(), mesh_A.colors.begin(),
+                            mesh_A.colors.end());
+  mesh_B_ptr->indices.reserve(mesh_B_ptr->indices.size() +
+                              mesh_A.indices.size());
+  for (const VertexIndex vertex_index : mesh_A.indices) {
+    mesh_B_ptr->indices.push_back(vertex_index + index_offset);
+  }
+  mesh_B_ptr->updated = true;
+}
+
+}  // namespace
+
+void SubmapMesher::getCachedMeshLayers(
+    std::vector<SubmapID>* submap_ids,
+    std::vector<MeshLayer::ConstPtr>* mesh_layers_G) const {
+  CHECK_NOTNULL(submap_ids);
+  CHECK_NOTNULL(mesh_layers_G);
+  std::lock_guard<std::mutex> cache_lock(mesh_cache_mutex_);
+  submap_ids->clear();
+  mesh_layers_G->clear();
+  submap_ids->reserve(mesh_cache_.size());
+  mesh_layers_G->reserve(mesh_cache_.size());
+  for (const auto& id_cache_entry_pair : mesh_cache_) {
+    // Skipping submaps not meshed yet (see frozen_only of updateMeshCache())
+    if (!id_cache_entry_pair.second.mesh_layer_G) {
+      continue;
+    }
+    submap_ids->push_back(id_cache_entry_pair.first);
+    mesh_layers_G->push_back(id_cache_entry_pair.second.mesh_layer_G);
+  }
+}
+
+void SubmapMesher::clearMeshCache() {
+  std::lock_guard<std::mutex> cache_lock(mesh_cache_mutex_);
+  mesh_cache_.clear();
+}
+
+void SubmapMesher::setLodConfig(const MeshLodConfig& lod_config) {
+  std::lock_guard<std::mutex> cache_lock(mesh_cache_mutex_);
+  lod_config_ = lod_config;
+}
+
+void SubmapMesher::setLodViewpoint(const Point& viewpoint_G) {
+  std::lock_guard<std::mutex> cache_lock(mesh_cache_mutex_);
+  lod_viewpoint_G_ = viewpoint_G;
+}
+
+size_t SubmapMesher::getLodLevel(const FloatingPoint distance) const {
+  if (!lod_config_.enable || lod_config_.full_resolution_radius_m <= 0.0f ||
+      distance <= lod_config_.full_resolution_radius_m) {
+    return 0;
+  }
+  const FloatingPoint num_doublings =
+      std::log2(distance / lod_config_.full_resolution_radius_m);
+  return std::min(lod_config_.max_level,
+                  static_cast<size_t>(num_doublings) + 1);
+}
+
+void SubmapMesher::generateCombinedMeshFromLayers(
+    const std::vector<const Layer<TsdfVoxel>*>& tsdf_layers,
+    const AlignedVector<Transformation>& T_G_S_vector,
+    const size_t tile_size_blocks, MeshLayer* combined_mesh_layer_ptr) const {
+  CHECK_NOTNULL(combined_mesh_layer_ptr);
+  CHECK_EQ(tsdf_layers.size(), T_G_S_vector.size());
+  CHECK_GT(tile_size_blocks, 0u);
+  const FloatingPoint voxel_size = tsdf_map_config_.tsdf_voxel_size;
+  const size_t voxels_per_side = tsdf_map_config_.tsdf_voxels_per_side;
+  const FloatingPoint block_size = voxel_size * voxels_per_side;
+  const FloatingPoint block_size_inv = 1.0 / block_size;
+  const IndexElement tile_size = static_cast<IndexElement>(tile_size_blocks);
+
+  // Pass 1: Finding the global blocks which each submap (may) contribute to,
+  // and binning them into tiles. Blocks on the edge of a tile also go into the
+  // border of the neighbouring tiles.
+  voxblox::AnyIndexHashMapType<CombinedMeshTile>::type tiles;
+  for (size_t submap_index = 0; submap_index < tsdf_layers.size();
+       submap_index++) {
+    CHECK_NOTNULL(tsdf_layers[submap_index]);
+    const Layer<TsdfVoxel>& tsdf_layer = *tsdf_layers[submap_index];
+    CHECK_NEAR(tsdf_layer.block_size(), block_size, 1e-6);
+    const Transformation& T_G_S = T_G_S_vector[submap_index];
+    BlockIndexList block_indices;
+    tsdf_layer.getAllAllocatedBlocks(&block_indices);
+    for (const BlockIndex& block_index_S : block_indices) {
+      // The bounding box of the block in G, padded by a voxel to account for
+      // interpolation.
+      const Point origin_S = block_index_S.cast<FloatingPoint>() * block_size;
+      Point min_G = Point::Constant(std::numeric_limits<FloatingPoint>::max());
+      Point max_G = -min_G;
+      for (int corner_index = 0; corner_index < 8; corner_index++) {
+        const Point corner_offset((corner_index & 1) ? block_size : 0.0f,
+                                  (corner_index & 2) ? block_size : 0.0f,
+                                  (corner_index & 4) ? block_size : 0.0f);
+        const Point corner_G = T_G_S * (origin_S + corner_offset);
+        min_G = min_G.cwiseMin(corner_G);
+        max_G = max_G.cwiseMax(corner_G);
+      }
+      min_G -= Point::Constant(voxel_size);
+      max_G += Point::Constant(voxel_size);
+      const BlockIndex min_index = (min_G * block_size_inv)
+                                       .array()
+                                       .floor()
+                                       .cast<IndexElement>()
+                                       .matrix();
+      const BlockIndex max_index = (max_G * block_size_inv)
+                                       .array()
+                                       .floor()
+                                       .cast<IndexElement>()
+                                       .matrix();
+      // Adding the covered global blocks to the tiles
+      BlockIndex block_index_G;
+      for (block_index_G.x() = min_index.x();
+           block_index_G.x() <= max_index.x(); block_index_G.x()++) {
+        for (block_index_G.y() = min_index.y();
+             block_index_G.y() <= max_index.y(); block_index_G.y()++) {
+          for (block_index_G.z() = min_index.z();
+               block_index_G.z() <= max_index.z(); block_index_G.z()++) {
+            const BlockIndex tile_index =
+                getTileIndex(block_index_G, tile_size);
+            const BlockIndex block_in_tile =
+                block_index_G - tile_index * tile_size;
+            // The offsets of the tiles this block is part of (its own, and
+            // those it borders).
+            std::vector<IndexElement> tile_offsets[3];
+            for (int axis = 0; axis < 3; axis++) {
+              tile_offsets[axis].push_back(0);
+              if (block_in_tile(axis) == 0) {
+                tile_offsets[axis].push_back(-1);
+              }
+              if (block_in_tile(axis) == tile_size - 1) {
+                tile_offsets[axis].push_back(1);
+              }
+            }
+            for (const IndexElement dx : tile_offsets[0]) {
+              for (const IndexElement dy : tile_offsets[1]) {
+                for (const IndexElement dz : tile_offsets[2]) {
+                  std::vector<size_t>& submap_indices =
+                      tiles[tile_index + BlockIndex(dx, dy, dz)]
+                          .block_to_submap_indices[block_index_G];
+                  if (submap_indices.empty() ||
+                      submap_indices.back() != submap_index) {
+                    submap_indices.push_back(submap_index);
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  LOG(INFO) << "Generating the combined mesh in " << tiles.size()
+            << " tiles of " << tile_size_blocks << "^3 blocks.";
+
+  // Pass 2: Fusing and meshing tile by tile (in parallel).
+  std::vector<std::pair<BlockIndex, const CombinedMeshTile*>> tile_list;
+  tile_list.reserve(tiles.size());
+  for (const auto& index_tile_pair : tiles) {
+    tile_list.emplace_back(index_tile_pair.first, &index_tile_pair.second);
+  }
+  std::vector<voxblox::Interpolator<TsdfVoxel>> interpolators;
+  interpolators.reserve(tsdf_layers.size());
+  AlignedVector<Transformation> T_S_G_vector;
+  T_S_G_vector.reserve(tsdf_layers.size());
+  for (size_t submap_index = 0; submap_index < tsdf_layers.size();
+       submap_index++) {
+    interpolators.emplace_back(tsdf_layers[submap_index]);
+    T_S_G_vector.push_back(T_G_S_vector[submap_index].inverse());
+  }
+  const MeshIntegratorConfig tile_mesh_config =
+      getParallelMeshConfig(tile_list.size());
+  std::mutex combined_mesh_mutex;
+  parallelFor(tile_list.size(), num_threads_, [&](const size_t tile_number) {
+    const BlockIndex& tile_index = tile_list[tile_number].first;
+    const CombinedMeshTile& tile = *tile_list[tile_number].second;
+    // The scratch layer holding the fused TSDF of this tile and its border
+    Layer<TsdfVoxel> tile_tsdf_layer(voxel_size, voxels_per_side);
+    for (const auto& block_submaps_pair : tile.block_to_submap_indices) {
+      Block<TsdfVoxel>::Ptr block_ptr =
+          tile_tsdf_layer.allocateBlockPtrByIndex(block_submaps_pair.first);
+      for (size_t linear_index = 0; linear_index < block_ptr->num_voxels();
+           linear_index++) {
+        const Point voxel_center_G =
+            block_ptr->computeCoordinatesFromLinearIndex(linear_index);
+        TsdfVoxel& voxel_G = block_ptr->getVoxelByLinearIndex(linear_index);
+        for (const size_t submap_index : block_submaps_pair.second) {
+          const Point voxel_center_S =
+              T_S_G_vector[submap_index] * voxel_center_G;
+          TsdfVoxel voxel_S;
+          constexpr bool kInterpolate = true;
+          if (interpolators[submap_index].getVoxel(voxel_center_S, &voxel_S,
+                                                   kInterpolate)) {
+            fuseTsdfVoxel(voxel_S, &voxel_G);
+          }
+        }
+      }
+    }
+    // Meshing the tile
+    MeshLayer tile_mesh_layer(block_size);
+    MeshIntegrator<TsdfVoxel> mesh_integrator(tile_mesh_config, tile_tsdf_layer,
+                                              &tile_mesh_layer);
+    constexpr bool only_mesh_updated_blocks = false;
+    constexpr bool clear_updated_flag = false;
+    mesh_integrator.generateMesh(only_mesh_updated_blocks, clear_updated_flag);
+    // Moving the meshes of the blocks inside the tile to the output. The
+    // meshes of the border are incomplete and belong to the neighbouring tiles.
+    BlockIndexList mesh_indices;
+    tile_mesh_layer.getAllAllocatedMeshes(&mesh_indices);
+    std::lock_guard<std::mutex> combined_mesh_lock(combined_mesh_mutex);
+    for (const BlockIndex& mesh_index : mesh_indices) {
+      if (getTileIndex(mesh_index, tile_size) != tile_index) {
+        continue;
+      }
+      const Mesh& tile_mesh = tile_mesh_layer.getMeshByIndex(mesh_index);
+      if (tile_mesh.vertices.empty()) {
+        continue;
+      }
+      appendMesh(tile_mesh,
+                 combined_mesh_layer_ptr->allocateMeshPtrByIndex(mesh_index)
+                     .get());
+    }
+  });
+}
+
+MeshLayer::Ptr SubmapMesher::generateMeshLayer(
+    const TsdfMap& tsdf_map, const MeshIntegratorConfig& mesh_config) const {
+  // Creating a mesh layer to hold the mesh fragment
+  MeshLayer::Ptr mesh_layer_ptr(new MeshLayer(tsdf_map.block_size()));
+  // Generating the mesh
+  MeshIntegrator<TsdfVoxel> mesh_integrator(
+      mesh_config, tsdf_map.getTsdfLayer(), mesh_layer_ptr.get());
+  constexpr bool only_mesh_updated_blocks = false;
+  constexpr bool clear_updated_flag = false;
+  mesh_integrator.generateMesh(only_mesh_updated_blocks, clear_updated_flag);
+  return mesh_layer_ptr;
+}
+
+MeshLayer::Ptr SubmapMesher::generateLodMeshLayer(
+    const Layer<TsdfVoxel>& tsdf_layer, const size_t lod_level,
+    const MeshIntegratorConfig& mesh_config) const {
+  const size_t factor = static_cast<size_t>(1) << lod_level;
+  Layer<TsdfVoxel> lod_tsdf_layer(
+      tsdf_layer.voxel_size() * static_cast<FloatingPoint>(factor),
+      tsdf_layer.voxels_per_side());
+  downsampleTsdfLayer(tsdf_layer, factor, &lod_tsdf_layer);
+  MeshLayer::Ptr mesh_layer_ptr(new MeshLayer(lod_tsdf_layer.block_size()));
+  MeshIntegrator<TsdfVoxel> mesh_integrator(mesh_config, lod_tsdf_layer,
+                                            mesh_layer_ptr.get());
+  constexpr bool only_mesh_updated_blocks = false;
+  constexpr bool clear_updated_flag = false;
+  mesh_integrator.generateMesh(only_mesh_updated_blocks, clear_updated_flag);
+  return mesh_layer_ptr;
+}
+
+MeshIntegratorConfig SubmapMesher::getParallelMeshConfig(
+    const size_t num_parallel) const {
+  MeshIntegratorConfig mesh_config = mesh_config_;
+  const size_t num_concurrent =
+      std::max<size_t>(1, std::min(num_threads_, num_parallel));
+  mesh_config.integrator_threads =
+      std::max<size_t>(1, mesh_config_.integrator_threads / num_concurrent);
+  return mesh_config;
+}
+
+Color SubmapMesher::getIndexColor(const size_t sub_map_index,
+                                  const size_t num_sub_maps) {
+  const double color_map_index =
+      (num_sub_maps > 1) ? static_cast<double>(sub_map_index) /
+                               static_cast<double>(num_sub_maps - 1)
+                         : 0.0;
+  return voxblox::rainbowColorMap(color_map_index);
 }
 
 void SubmapMesher::combineMeshLayers(
@@ -45,23 +338,24 @@ void SubmapMesher::combineMeshLayers(
 void SubmapMesher::transformMeshLayers(
     const std::vector<MeshLayer::ConstPtr>& sub_map_mesh_layers,
     const AlignedVector<Transformation>& sub_map_poses,
-    std::vector<MeshLayer::Ptr>* transformed_sub_map_mesh_layers) {
+    std::vector<MeshLayer::Ptr>* transformed_sub_map_mesh_layers,
+    const size_t num_threads) {
   CHECK_NOTNULL(transformed_sub_map_mesh_layers);
+  CHECK_EQ(sub_map_mesh_layers.size(), sub_map_poses.size());
   transformed_sub_map_mesh_layers->clear();
-  transformed_sub_map_mesh_layers->reserve(sub_map_mesh_layers.size());
-  // Looping over all the mesh layers for the submaps
+  transformed_sub_map_mesh_layers->resize(sub_map_mesh_layers.size());
+  // Transforming the mesh layers of the submaps in parallel
   LOG(INFO) << "Starting Transforming mesh layers.";
-  for (size_t sub_map_index = 0; sub_map_index < sub_map_mesh_layers.size();
-       sub_map_index++) {
-    // Getting the mesh layer and the transform
-    const Transformation& T_M_S = sub_map_poses[sub_map_index];
-    MeshLayer::ConstPtr mesh_layer_ptr = sub_map_mesh_layers[sub_map_index];
-    // Making a new layer for the transformed triangles
-    MeshLayer::Ptr transformed_mesh_layer_ptr =
-        transformMeshLayer(*mesh_layer_ptr, T_M_S);
-    // Adding to the mesh layer vector
-    transformed_sub_map_mesh_layers->push_back(transformed_mesh_layer_ptr);
-  }
+  parallelFor(sub_map_mesh_layers.size(), num_threads,
+              [&](const size_t sub_map_index) {
+                // Getting the mesh layer and the transform
+                const Transformation& T_M_S = sub_map_poses[sub_map_index];
+                MeshLayer::ConstPtr mesh_layer_ptr =
+                    sub_map_mesh_layers[sub_map_index];
+                // Making a new layer for the transformed triangles
+                (*transformed_sub_map_mesh_layers)[sub_map_index] =
+                    transformMeshLayer(*mesh_layer_ptr, T_M_S);
+              });
 }
 
 MeshLayer::Ptr SubmapMesher::transformMeshLayer(
@@ -77,20 +371,17 @@ MeshLayer::Ptr SubmapMesher::transformMeshLayer(
 }
 
 void SubmapMesher::colorMeshLayersWithIndex(
-    std::vector<MeshLayer::Ptr>* sub_map_mesh_layers) {
-  // Looping over submaps and coloring
-  size_t num_sub_maps = sub_map_mesh_layers->size();
-  for (size_t sub_map_index = 0; sub_map_index < num_sub_maps;
-       sub_map_index++) {
+    std::vector<MeshLayer::Ptr>* sub_map_mesh_layers,
+    const size_t num_threads) {
+  CHECK_NOTNULL(sub_map_mesh_layers);
+  // Coloring the submaps in parallel
+  const size_t num_sub_maps = sub_map_mesh_layers->size();
+  parallelFor(num_sub_maps, num_threads, [&](const size_t sub_map_index) {
     // Extracting the mesh layer
     MeshLayer* mesh_layer_ptr = ((*sub_map_mesh_layers)[sub_map_index]).get();
-    // Generating a color
-    double color_map_index = static_cast<double>(sub_map_index) /
-                             static_cast<double>(num_sub_maps - 1);
-    Color sub_map_color = voxblox::rainbowColorMap(color_map_index);
     // Coloring this mesh layer
-    colorMeshLayer(sub_map_color, mesh_layer_ptr);
-  }
+    colorMeshLayer(getIndexColor(sub_map_index, num_sub_maps), mesh_layer_ptr);
+  });
 }
 
 void SubmapMesher::colorMeshLayer(const Color& color_in,
@@ -111,29 +402,116 @@ void SubmapMesher::colorMeshLayer(const Color& color_in,
 void SubmapMesher::transformAndAddTrianglesToLayer(
     const MeshLayer& input_mesh_layer, const Transformation& T_B_A,
     MeshLayer* output_mesh_layer) {
+  addTrianglesToLayerBatched(input_mesh_layer, &T_B_A, output_mesh_layer);
+}
+
+void SubmapMesher::addTrianglesToLayerBatched(
+    const MeshLayer& input_mesh_layer, const Transformation* T_B_A_ptr,
+    MeshLayer* output_mesh_layer) {
   CHECK_NOTNULL(output_mesh_layer);
-  // Looping over all the blocks on this layer
+  static_assert(sizeof(Point) == 3 * sizeof(FloatingPoint),
+                "Points must be packed to be mapped as a matrix.");
+  typedef Eigen::Matrix<FloatingPoint, 3, Eigen::Dynamic> Matrix3X;
+  // Gathering the input meshes
   BlockIndexList block_index_list;
   input_mesh_layer.getAllAllocatedMeshes(&block_index_list);
-
+  std::vector<const Mesh*> input_meshes;
+  input_meshes.reserve(block_index_list.size());
   for (const BlockIndex& block_index : block_index_list) {
-    // Getting mesh in this submap block
-    Mesh mesh = input_mesh_layer.getMeshByIndex(block_index);
-    // Loop over points and adding to the global mesh. Incrementing in
-    // triplets
-    size_t num_vertices = mesh.vertices.size();
-    if (num_vertices > 0) {
-      for (VertexIndex start_index = 0; start_index < num_vertices - 2;
-           start_index = start_index + 3) {
-        // Transforming the first triangle vertex to the world frame
-        Point vertex_1_M = T_B_A * mesh.vertices[start_index];
-        // Getting the mesh at the location of the first vertex of the
-        // triangle
-        Mesh::Ptr mesh_combined_ptr =
-            output_mesh_layer->allocateMeshPtrByCoordinates(vertex_1_M);
-        // Transforming the triangle and adding it to the combined mesh
-        transformAndAddTriangleToMesh(mesh, start_index, T_B_A,
-                                      mesh_combined_ptr.get());
+    const Mesh& mesh = input_mesh_layer.getMeshByIndex(block_index);
+    if (mesh.vertices.size() >= 3) {
+      input_meshes.push_back(&mesh);
+    }
+  }
+  // Transforming the vertex (and normal) arrays of each mesh in one go
+  std::vector<Pointcloud> vertices_B(input_meshes.size());
+  std::vector<Pointcloud> normals_B(input_meshes.size());
+  if (T_B_A_ptr != nullptr) {
+    const Eigen::Matrix<FloatingPoint, 3, 3> R_B_A =
+        T_B_A_ptr->getRotationMatrix();
+    const Point t_B_A = T_B_A_ptr->getPosition();
+    for (size_t mesh_index = 0; mesh_index < input_meshes.size();
+         mesh_index++) {
+      const Mesh& mesh = *input_meshes[mesh_index];
+      const size_t num_vertices = mesh.vertices.size();
+      vertices_B[mesh_index].resize(num_vertices);
+      Eigen::Map<Matrix3X>(vertices_B[mesh_index].data()->data(), 3,
+                           num_vertices)
+          .noalias() = (R_B_A * Eigen::Map<const Matrix3X>(
+                                    mesh.vertices.data()->data(), 3,
+                                    num_vertices))
+                           .colwise() +
+                       t_B_A;
+      if (mesh.hasNormals()) {
+        normals_B[mesh_index].resize(num_vertices);
+        Eigen::Map<Matrix3X>(normals_B[mesh_index].data()->data(), 3,
+                             num_vertices)
+            .noalias() = R_B_A * Eigen::Map<const Matrix3X>(
+                                     mesh.normals.data()->data(), 3,
+                                     num_vertices);
+      }
+    }
+  }
+  const auto get_vertices = [&](const size_t mesh_index) -> const Pointcloud& {
+    return (T_B_A_ptr != nullptr) ? vertices_B[mesh_index]
+                                  : input_meshes[mesh_index]->vertices;
+  };
+  const auto get_normals = [&](const size_t mesh_index) -> const Pointcloud& {
+    return (T_B_A_ptr != nullptr) ? normals_B[mesh_index]
+                                  : input_meshes[mesh_index]->normals;
+  };
+  // Binning the triangles to the output blocks of their first vertex
+  typedef std::pair<uint32_t, uint32_t> MeshTriangleIndex;
+  voxblox::AnyIndexHashMapType<std::vector<MeshTriangleIndex>>::type
+      block_to_triangles;
+  for (size_t mesh_index = 0; mesh_index < input_meshes.size(); mesh_index++) {
+    const Pointcloud& vertices = get_vertices(mesh_index);
+    for (size_t start_index = 0; start_index + 2 < vertices.size();
+         start_index += 3) {
+      block_to_triangles[output_mesh_layer->computeBlockIndexFromCoordinates(
+                             vertices[start_index])]
+          .emplace_back(mesh_index, start_index);
+    }
+  }
+  // Appending the triangles, block by block
+  for (const auto& block_triangles_pair : block_to_triangles) {
+    Mesh::Ptr output_mesh_ptr =
+        output_mesh_layer->allocateMeshPtrByIndex(block_triangles_pair.first);
+    const std::vector<MeshTriangleIndex>& triangles =
+        block_triangles_pair.second;
+    const size_t num_new_vertices = 3 * triangles.size();
+    output_mesh_ptr->vertices.reserve(output_mesh_ptr->vertices.size() +
+                                      num_new_vertices);
+    output_mesh_ptr->normals.reserve(output_mesh_ptr->normals.size() +
+                                     num_new_vertices);
+    output_mesh_ptr->colors.reserve(output_mesh_ptr->colors.size() +
+                                    num_new_vertices);
+    output_mesh_ptr->indices.reserve(output_mesh_ptr->indices.size() +
+                                     num_new_vertices);
+    for (const MeshTriangleIndex& triangle : triangles) {
+      const Mesh& input_mesh = *input_meshes[triangle.first];
+      const Pointcloud& vertices = get_vertices(triangle.first);
+      const size_t start_index = triangle.second;
+      output_mesh_ptr->vertices.insert(output_mesh_ptr->vertices.end(),
+                                       vertices.begin() + start_index,
+                                       vertices.begin() + start_index + 3);
+      if (input_mesh.hasNormals()) {
+        const Pointcloud& normals = get_normals(triangle.first);
+        output_mesh_ptr->normals.insert(output_mesh_ptr->normals.end(),
+                                        normals.begin() + start_index,
+                                        normals.begin() + start_index + 3);
+      }
+      if (input_mesh.hasColors()) {
+        output_mesh_ptr->colors.insert(
+            output_mesh_ptr->colors.end(),
+            input_mesh.colors.begin() + start_index,
+            input_mesh.colors.begin() + start_index + 3);
+      }
+      if (input_mesh.hasTriangles()) {
+        const VertexIndex current_max_index = output_mesh_ptr->indices.size();
+        output_mesh_ptr->indices.push_back(current_max_index + 0);
+        output_mesh_ptr->indices.push_back(current_max_index + 1);
+        output_mesh_ptr->indices.push_back(current_max_index + 2);
       }
     }
   }
@@ -154,9 +532,13 @@ void SubmapMesher::transformAndAddTriangleToMesh(const Mesh& input_mesh,
   output_mesh->vertices.push_back(vertex_2_M);
   output_mesh->vertices.push_back(vertex_3_M);
   if (input_mesh.hasNormals()) {
-    output_mesh->normals.push_back(input_mesh.normals[start_index]);
-    output_mesh->normals.push_back(input_mesh.normals[start_index + 1]);
-    output_mesh->normals.push_back(input_mesh.normals[start_index + 2]);
+    const Quaternion& q_B_A = T_B_A.getRotation();
+    output_mesh->normals.push_back(
+        q_B_A.rotate(input_mesh.normals[start_index]));
+    output_mesh->normals.push_back(
+        q_B_A.rotate(input_mesh.normals[start_index + 1]));
+    output_mesh->normals.push_back(
+        q_B_A.rotate(input_mesh.normals[start_index + 2]));
   }
   if (input_mesh.hasColors()) {
     output_mesh->colors.push_back(input_mesh.colors[start_index]);
@@ -173,29 +555,7 @@ void SubmapMesher::transformAndAddTriangleToMesh(const Mesh& input_mesh,
 
 void SubmapMesher::addTrianglesToLayer(const MeshLayer& input_mesh_layer,
                                        MeshLayer* output_mesh_layer) {
-  CHECK_NOTNULL(output_mesh_layer);
-  // Looping over all the blocks on this layer
-  BlockIndexList block_index_list;
-  input_mesh_layer.getAllAllocatedMeshes(&block_index_list);
-  for (const BlockIndex& block_index : block_index_list) {
-    // Getting mesh in this submap block
-    Mesh mesh = input_mesh_layer.getMeshByIndex(block_index);
-    // Loop over points and adding to the global mesh. Incrementing in
-    // triplets
-    size_t num_vertices = mesh.vertices.size();
-    if (num_vertices > 0) {
-      for (VertexIndex start_index = 0; start_index < num_vertices - 2;
-           start_index = start_index + 3) {
-        // Getting the mesh at the location of the first vertex of the
-        // triangle
-        Mesh::Ptr mesh_combined_ptr =
-            output_mesh_layer->allocateMeshPtrByCoordinates(
-                mesh.vertices[start_index]);
-        // Transforming the triangle and adding it to the combined mesh
-        addTriangleToMesh(mesh, start_index, mesh_combined_ptr.get());
-      }
-    }
-  }
+  addTrianglesToLayerBatched(input_mesh_layer, nullptr, output_mesh_layer);
 }
 
 void SubmapMesher::addTriangleToMesh(const Mesh& input_mesh,
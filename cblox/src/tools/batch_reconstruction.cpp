@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "cblox/integrator/batch_reconstructor.h"
+#include "cblox/io/scan_dataset_io.h"
+
+// Reconstructs a submap collection from a scan dataset (see
+// cblox/io/scan_dataset_io.h for the formats), as fast as the CPU allows and
+// without ROS. Every scan is integrated, in order.
+
+DEFINE_string(dataset, "", "The scan dataset.");
+DEFINE_string(output_map, "", "The output submap collection file.");
+DEFINE_string(output_mesh, "", "The output (separated) mesh, as PLY.");
+DEFINE_int32(num_integrated_frames_per_submap, 20,
+             "Number of scans per submap.");
+DEFINE_double(voxel_size, 0.2, "TSDF voxel size (m).");
+DEFINE_int32(voxels_per_side, 16, "TSDF voxels per block side.");
+DEFINE_double(truncation_distance_vox, 4.0, "Truncation distance (voxels).");
+DEFINE_double(max_ray_length_m, 25.0, "Maximum integrated ray length (m).");
+DEFINE_string(method, "fast", "TSDF integrator (simple, merged or fast).");
+DEFINE_bool(mesh_in_background, true,
+            "Meshes finished submaps while integrating (with --output_mesh).");
+DEFINE_int32(num_meshing_threads, 2, "Threads for background meshing.");
+DEFINE_double(downsampling_voxel_size_factor, 0.0,
+              "Merges the points of each scan per cell of this size (in "
+              "voxels) before integrating. Disabled if zero.");
+
+namespace cblox {
+namespace {
+
+int runBatchReconstruction() {
+  if (FLAGS_dataset.empty() ||
+      (FLAGS_output_map.empty() && FLAGS_output_mesh.empty())) {
+    LOG(ERROR) << "Specify --dataset and --output_map and/or --output_mesh.";
+    return 1;
+  }
+  io::ScanDatasetReader reader(FLAGS_dataset);
+  if (!reader.isOpen()) {
+    return 1;
+  }
+  // The configs
+  TsdfMap::Config tsdf_map_config;
+  tsdf_map_config.tsdf_voxel_size = FLAGS_voxel_size;
+  tsdf_map_config.tsdf_voxels_per_side = FLAGS_voxels_per_side;
+  voxblox::TsdfIntegratorBase::Config tsdf_integrator_config;
+  tsdf_integrator_config.default_truncation_distance =
+      FLAGS_truncation_distance_vox * FLAGS_voxel_size;
+  tsdf_integrator_config.max_ray_length_m = FLAGS_max_ray_length_m;
+  BatchReconstructionConfig config;
+  config.num_integrated_frames_per_submap =
+      static_cast<size_t>(std::max(FLAGS_num_integrated_frames_per_submap, 1));
+  config.mesh_finished_submaps =
+      FLAGS_mesh_in_background && !FLAGS_output_mesh.empty();
+  config.num_meshing_threads =
+      static_cast<size_t>(std::max(FLAGS_num_meshing_threads, 1));
+  config.downsampling_config.enable =
+      (FLAGS_downsampling_voxel_size_factor > 0.0);
+  config.downsampling_config.voxel_size_factor =
+      static_cast<FloatingPoint>(FLAGS_downsampling_voxel_size_factor);
+  // Reconstructing
+  BatchReconstructor reconstructor(
+      tsdf_map_config, tsdf_integrator_config,
+      getTsdfIntegratorTypeFromName(FLAGS_method),
+      voxblox::MeshIntegratorConfig(), config);
+  reconstructor.run(&reader);
+  if (reader.hasError()) {
+    LOG(ERROR) << "Stopped at the invalid scan number "
+               << reader.getNumScansRead() << " of the dataset.";
+    return 1;
+  }
+  // Output
+  if (!FLAGS_output_map.empty() && !reconstructor.saveMap(FLAGS_output_map)) {
+    LOG(ERROR) << "Could not save the map to: " << FLAGS_output_map;
+    return 1;
+  }
+  if (!FLAGS_output_mesh.empty() &&
+      !reconstructor.saveMesh(FLAGS_output_mesh)) {
+    LOG(ERROR) << "Could not save the mesh to: " << FLAGS_output_mesh;
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InstallFailureSignalHandler();
+  return cblox::runBatchReconstruction();
+}
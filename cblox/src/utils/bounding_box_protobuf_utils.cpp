@@ -0,0 +1,31 @@
+#include "cblox/utils/bounding_box_protobuf_utils.h"
+
+#include <glog/logging.h>
+
+namespace cblox {
+namespace conversions {
+
+void boundingBoxToProto(const BoundingBox& bounding_box,
+                        BoundingBoxProto* bounding_box_proto) {
+  CHECK_NOTNULL(bounding_box_proto);
+  bounding_box_proto->set_min_x(bounding_box.min_corner.x());
+  bounding_box_proto->set_min_y(bounding_box.min_corner.y());
+  bounding_box_proto->set_min_z(bounding_box.min_corner.z());
+  bounding_box_proto->set_max_x(bounding_box.max_corner.x());
+  bounding_box_proto->set_max_y(bounding_box.max_corner.y());
+  bounding_box_proto->set_max_z(bounding_box.max_corner.z());
+}
+
+void boundingBoxProtoToBoundingBox(const BoundingBoxProto& bounding_box_proto,
+                                   BoundingBox* bounding_box) {
+  CHECK_NOTNULL(bounding_box);
+  bounding_box->min_corner =
+      Point(bounding_box_proto.min_x(), bounding_box_proto.min_y(),
+            bounding_box_proto.min_z());
+  bounding_box->max_corner =
+      Point(bounding_box_proto.max_x(), bounding_box_proto.max_y(),
+            bounding_box_proto.max_z());
+}
+
+}  // namespace conversions
+}  // namespace cblox
@@ -0,0 +1,75 @@
+#include "cblox/utils/thread_pool.h"
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+ThreadPool::ThreadPool(const size_t num_threads)
+    : num_running_tasks_(0), stop_(false) {
+  CHECK_GT(num_threads, 0u);
+  threads_.reserve(num_threads);
+  for (size_t thread_idx = 0; thread_idx < num_threads; thread_idx++) {
+    threads_.emplace_back(&ThreadPool::workerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  task_condition_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+std::future<void> ThreadPool::enqueue(const std::function<void()>& task) {
+  std::packaged_task<void()> packaged_task(task);
+  std::future<void> future = packaged_task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stop_) << "Can't queue tasks on a stopping thread pool.";
+    tasks_.push_back(std::move(packaged_task));
+  }
+  task_condition_.notify_one();
+  return future;
+}
+
+size_t ThreadPool::getNumPendingTasks() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.size() + num_running_tasks_;
+}
+
+void ThreadPool::waitUntilIdle() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_condition_.wait(
+      lock, [this]() { return tasks_.empty() && num_running_tasks_ == 0; });
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_condition_.wait(lock,
+                           [this]() { return stop_ || !tasks_.empty(); });
+      // Draining the queue before stopping
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+      num_running_tasks_++;
+    }
+    // NOTE: Exceptions thrown by the task end up in its future.
+    task();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      num_running_tasks_--;
+    }
+    idle_condition_.notify_all();
+  }
+}
+
+}  // namespace cblox
@@ -0,0 +1,153 @@
+#include <string>
+
+#include <unistd.h>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/tsdf_submap.h"
+
+#include "./tsdf_test_utils.h"
+
+namespace cblox {
+
+class SubmapPagingTest : public ::testing::Test {
+ protected:
+  SubmapPagingTest() : expected_layer_(kVoxelSize, kVoxelsPerSide) {
+    config_.tsdf_voxel_size = kVoxelSize;
+    config_.tsdf_voxels_per_side = kVoxelsPerSide;
+  }
+
+  void SetUp() override { test::fillTsdfLayer(&expected_layer_); }
+
+  // A frozen submap holding the expected layer
+  TsdfSubmap::Ptr createFrozenSubmap(const SubmapID submap_id) const {
+    TsdfSubmap::Ptr submap_ptr(
+        new TsdfSubmap(Transformation(), submap_id, config_));
+    test::fillTsdfLayer(submap_ptr->getTsdfMapPtr()->getTsdfLayerPtr());
+    submap_ptr->freeze();
+    return submap_ptr;
+  }
+
+  std::string getPageFilePath(const SubmapID submap_id) const {
+    return "/tmp/cblox_test_page_" + std::to_string(::getpid()) + "_submap_" +
+           std::to_string(submap_id) + ".tsdf";
+  }
+
+  void expectLayerExact(const TsdfSubmap& submap) const {
+    test::expectTsdfLayersNear(expected_layer_,
+                               submap.getTsdfMap().getTsdfLayer(), 0.0, 0.0,
+                               true);
+  }
+  void expectLayerNear(const TsdfSubmap& submap) const {
+    test::expectTsdfLayersNear(expected_layer_,
+                               submap.getTsdfMap().getTsdfLayer(),
+                               1e-4 * 4.0 * kVoxelSize + 1e-6, 0.02, true);
+  }
+
+  static constexpr FloatingPoint kVoxelSize = 0.1;
+  static constexpr size_t kVoxelsPerSide = 8;
+
+  TsdfMap::Config config_;
+  Layer<TsdfVoxel> expected_layer_;
+};
+
+constexpr FloatingPoint SubmapPagingTest::kVoxelSize;
+constexpr size_t SubmapPagingTest::kVoxelsPerSide;
+
+TEST_F(SubmapPagingTest, PageOutAndIn) {
+  TsdfSubmap::Ptr submap_ptr = createFrozenSubmap(1);
+  const size_t num_blocks = submap_ptr->getNumberAllocatedBlocks();
+  const BoundingBox bounding_box_S = submap_ptr->getSubmapFrameBoundingBox();
+  ASSERT_TRUE(submap_ptr->pageOut(getPageFilePath(1)));
+  EXPECT_TRUE(submap_ptr->isPagedOut());
+  EXPECT_EQ(submap_ptr->getResidentMemoryBytes(), 0u);
+  // Kept while paged out
+  EXPECT_EQ(submap_ptr->getNumberAllocatedBlocks(), num_blocks);
+  EXPECT_EQ(submap_ptr->getSubmapFrameBoundingBox().min_corner,
+            bounding_box_S.min_corner);
+  EXPECT_EQ(submap_ptr->getSubmapFrameBoundingBox().max_corner,
+            bounding_box_S.max_corner);
+  // Paged in on access, without loss
+  expectLayerExact(*submap_ptr);
+  EXPECT_FALSE(submap_ptr->isPagedOut());
+  EXPECT_EQ(submap_ptr->getNumPageIns(), 1u);
+  EXPECT_EQ(submap_ptr->getNumberAllocatedBlocks(), num_blocks);
+}
+
+TEST_F(SubmapPagingTest, CompressAndDecompress) {
+  TsdfSubmap::Ptr submap_ptr = createFrozenSubmap(1);
+  const size_t resident_memory_bytes = submap_ptr->getResidentMemoryBytes();
+  ASSERT_TRUE(submap_ptr->compress(TsdfBlockEncodingConfig()));
+  EXPECT_TRUE(submap_ptr->isCompressed());
+  EXPECT_LT(submap_ptr->getResidentMemoryBytes(), resident_memory_bytes);
+  expectLayerNear(*submap_ptr);
+  EXPECT_FALSE(submap_ptr->isCompressed());
+  EXPECT_EQ(submap_ptr->getNumDecompressions(), 1u);
+}
+
+TEST_F(SubmapPagingTest, PageOutCompressed) {
+  TsdfSubmap::Ptr submap_ptr = createFrozenSubmap(1);
+  ASSERT_TRUE(submap_ptr->compress(TsdfBlockEncodingConfig()));
+  ASSERT_TRUE(submap_ptr->pageOut(getPageFilePath(1)));
+  EXPECT_TRUE(submap_ptr->isPagedOut());
+  EXPECT_FALSE(submap_ptr->isCompressed());
+  expectLayerNear(*submap_ptr);
+}
+
+TEST_F(SubmapPagingTest, EncodingGoesStaleOnModification) {
+  TsdfSubmap::Ptr submap_ptr = createFrozenSubmap(1);
+  TsdfSubmap::EncodedTsdf encoded_tsdf;
+  ASSERT_TRUE(
+      submap_ptr->encodeTsdf(TsdfBlockEncodingConfig(), &encoded_tsdf));
+  submap_ptr->markTsdfModified();
+  EXPECT_FALSE(submap_ptr->compress(&encoded_tsdf));
+  EXPECT_FALSE(submap_ptr->isCompressed());
+  // A fresh encoding is swapped in
+  ASSERT_TRUE(
+      submap_ptr->encodeTsdf(TsdfBlockEncodingConfig(), &encoded_tsdf));
+  EXPECT_TRUE(submap_ptr->compress(&encoded_tsdf));
+  EXPECT_TRUE(submap_ptr->isCompressed());
+  expectLayerNear(*submap_ptr);
+}
+
+TEST_F(SubmapPagingTest, CollectionEnforcesMemoryBudget) {
+  SubmapCollection<TsdfSubmap> submap_collection(config_);
+  SubmapPagingConfig paging_config;
+  paging_config.enable_paging = true;
+  paging_config.max_resident_memory_mb = 0.0;
+  paging_config.compress_finished_submaps = true;
+  submap_collection.setPagingConfig(paging_config);
+  constexpr SubmapID kNumSubmaps = 3;
+  for (SubmapID submap_id = 0; submap_id < kNumSubmaps; submap_id++) {
+    submap_collection.createNewSubMap(Transformation(), submap_id);
+    test::fillTsdfLayer(
+        submap_collection.getActiveTsdfMapPtr()->getTsdfLayerPtr());
+  }
+  // NOTE: Submaps held elsewhere are skipped, which the one just finished is
+  //       while the finished callbacks run, so enforcing again.
+  submap_collection.enforceMemoryBudget();
+  const SubmapPagingStats paging_stats = submap_collection.getPagingStats();
+  EXPECT_EQ(paging_stats.num_paged_out_submaps, kNumSubmaps - 1);
+  EXPECT_GT(paging_stats.resident_memory_bytes, 0u);
+  // The active submap stays in memory, the finished ones are paged back in
+  EXPECT_FALSE(submap_collection.getActiveSubMap().isPagedOut());
+  for (SubmapID submap_id = 0; submap_id < kNumSubmaps; submap_id++) {
+    ASSERT_TRUE(submap_collection.exists(submap_id));
+    if (submap_id + 1 == kNumSubmaps) {
+      expectLayerExact(submap_collection.getSubMap(submap_id));
+    } else {
+      EXPECT_TRUE(submap_collection.getSubMap(submap_id).isPagedOut());
+      expectLayerNear(submap_collection.getSubMap(submap_id));
+    }
+  }
+}
+
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
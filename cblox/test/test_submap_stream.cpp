@@ -0,0 +1,190 @@
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "cblox/core/submap_collection.h"
+#include "cblox/core/tsdf_submap.h"
+#include "cblox/io/submap_stream.h"
+
+#include "./tsdf_test_utils.h"
+
+namespace cblox {
+
+class SubmapStreamTest : public ::testing::Test {
+ protected:
+  SubmapStreamTest() : expected_layer_(kVoxelSize, kVoxelsPerSide) {
+    config_.tsdf_voxel_size = kVoxelSize;
+    config_.tsdf_voxels_per_side = kVoxelsPerSide;
+  }
+
+  void SetUp() override {
+    test::fillTsdfLayer(&expected_layer_);
+    submap_collection_ptr_.reset(new SubmapCollection<TsdfSubmap>(config_));
+    receiver_collection_ptr_.reset(new SubmapCollection<TsdfSubmap>(config_));
+    // Two submaps, the first one finished
+    for (SubmapID submap_id = 0; submap_id < kNumSubmaps; submap_id++) {
+      submap_collection_ptr_->createNewSubMap(getPose(submap_id), submap_id);
+      test::fillTsdfLayer(
+          submap_collection_ptr_->getActiveTsdfMapPtr()->getTsdfLayerPtr());
+    }
+  }
+
+  static Transformation getPose(const SubmapID submap_id) {
+    return Transformation(Transformation::Rotation(1.0, 0.0, 0.0, 0.0),
+                          Point(2.0 * submap_id, 1.0, 0.0));
+  }
+
+  void addParts(const std::vector<std::string>& parts,
+                io::SubmapStreamReceiver<TsdfSubmap>* receiver_ptr) const {
+    for (const std::string& part : parts) {
+      EXPECT_TRUE(receiver_ptr->addUpdatePart(part));
+    }
+  }
+
+  void expectPose(const SubmapID submap_id,
+                  const Transformation& T_G_S_expected) const {
+    Transformation T_G_S;
+    ASSERT_TRUE(receiver_collection_ptr_->getSubMapPose(submap_id, &T_G_S));
+    EXPECT_TRUE(T_G_S.getTransformationMatrix().isApprox(
+        T_G_S_expected.getTransformationMatrix(), 1e-6));
+  }
+
+  void expectMirrored(const FloatingPoint distance_tolerance,
+                      const FloatingPoint weight_tolerance) const {
+    ASSERT_EQ(receiver_collection_ptr_->size(), submap_collection_ptr_->size());
+    for (const SubmapID submap_id : submap_collection_ptr_->getIDs()) {
+      ASSERT_TRUE(receiver_collection_ptr_->exists(submap_id));
+      const TsdfSubmap& submap = receiver_collection_ptr_->getSubMap(submap_id);
+      EXPECT_TRUE(submap.isFrozen());
+      test::expectTsdfLayersNear(expected_layer_,
+                                 submap.getTsdfMap().getTsdfLayer(),
+                                 distance_tolerance, weight_tolerance, true);
+      Transformation T_G_S;
+      ASSERT_TRUE(submap_collection_ptr_->getSubMapPose(submap_id, &T_G_S));
+      expectPose(submap_id, T_G_S);
+    }
+  }
+
+  static constexpr FloatingPoint kVoxelSize = 0.1;
+  static constexpr size_t kVoxelsPerSide = 8;
+  static constexpr SubmapID kNumSubmaps = 2;
+
+  TsdfMap::Config config_;
+  Layer<TsdfVoxel> expected_layer_;
+  SubmapCollection<TsdfSubmap>::Ptr submap_collection_ptr_;
+  SubmapCollection<TsdfSubmap>::Ptr receiver_collection_ptr_;
+};
+
+constexpr FloatingPoint SubmapStreamTest::kVoxelSize;
+constexpr size_t SubmapStreamTest::kVoxelsPerSide;
+constexpr SubmapID SubmapStreamTest::kNumSubmaps;
+
+TEST_F(SubmapStreamTest, SnapshotRoundTrip) {
+  io::SubmapStreamConfig stream_config;
+  stream_config.compress_submaps = false;
+  io::SubmapStreamPublisher<TsdfSubmap> publisher(stream_config);
+  io::SubmapStreamReceiver<TsdfSubmap> receiver(receiver_collection_ptr_);
+  EXPECT_TRUE(receiver.requiresSnapshot());
+  std::vector<std::string> parts;
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  ASSERT_FALSE(parts.empty());
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver.requiresSnapshot());
+  EXPECT_EQ(receiver.getActiveSubmapID(), kNumSubmaps - 1);
+  expectMirrored(0.0, 0.0);
+}
+
+TEST_F(SubmapStreamTest, CompressedSnapshotRoundTrip) {
+  io::SubmapStreamPublisher<TsdfSubmap> publisher;
+  io::SubmapStreamReceiver<TsdfSubmap> receiver(receiver_collection_ptr_);
+  std::vector<std::string> parts;
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver.requiresSnapshot());
+  expectMirrored(1e-4 * 4.0 * kVoxelSize + 1e-6, 0.02);
+}
+
+TEST_F(SubmapStreamTest, SmallPartsRoundTrip) {
+  io::SubmapStreamConfig stream_config;
+  stream_config.compress_submaps = false;
+  stream_config.max_part_num_bytes = 1;
+  io::SubmapStreamPublisher<TsdfSubmap> publisher(stream_config);
+  io::SubmapStreamReceiver<TsdfSubmap> receiver(receiver_collection_ptr_);
+  std::vector<std::string> parts;
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  // NOTE: Submaps are not split, so one part per submap
+  EXPECT_EQ(parts.size(), kNumSubmaps);
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver.requiresSnapshot());
+  expectMirrored(0.0, 0.0);
+}
+
+TEST_F(SubmapStreamTest, DeltasRoundTrip) {
+  io::SubmapStreamConfig stream_config;
+  stream_config.compress_submaps = false;
+  io::SubmapStreamPublisher<TsdfSubmap> publisher(stream_config);
+  io::SubmapStreamReceiver<TsdfSubmap> receiver(receiver_collection_ptr_);
+  // A delta before the snapshot is held back, and dropped as included in it
+  std::vector<std::string> parts;
+  publisher.getDelta(*submap_collection_ptr_, &parts);
+  ASSERT_FALSE(parts.empty());
+  addParts(parts, &receiver);
+  EXPECT_TRUE(receiver.requiresSnapshot());
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver.requiresSnapshot());
+  EXPECT_EQ(receiver.getSequenceNumber(), publisher.getSequenceNumber());
+  expectMirrored(0.0, 0.0);
+  // Nothing changed
+  publisher.getDelta(*submap_collection_ptr_, &parts);
+  EXPECT_TRUE(parts.empty());
+  // A moved submap
+  const Transformation T_G_S_moved(
+      Transformation::Rotation(0.0, 0.0, 0.0, 1.0), Point(-1.0, 3.0, 0.5));
+  ASSERT_TRUE(submap_collection_ptr_->setSubMapPose(0, T_G_S_moved));
+  publisher.getDelta(*submap_collection_ptr_, &parts);
+  ASSERT_FALSE(parts.empty());
+  addParts(parts, &receiver);
+  EXPECT_EQ(receiver.getSequenceNumber(), publisher.getSequenceNumber());
+  expectPose(0, T_G_S_moved);
+  // A removed submap
+  EXPECT_EQ(submap_collection_ptr_->removeSubMaps(std::vector<SubmapID>(1, 0)),
+            1u);
+  publisher.getDelta(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver_collection_ptr_->exists(0));
+  expectMirrored(0.0, 0.0);
+}
+
+TEST_F(SubmapStreamTest, MissedDeltaRequiresSnapshot) {
+  io::SubmapStreamConfig stream_config;
+  stream_config.compress_submaps = false;
+  io::SubmapStreamPublisher<TsdfSubmap> publisher(stream_config);
+  io::SubmapStreamReceiver<TsdfSubmap> receiver(receiver_collection_ptr_);
+  std::vector<std::string> parts;
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  ASSERT_FALSE(receiver.requiresSnapshot());
+  // Skipping a delta
+  ASSERT_TRUE(submap_collection_ptr_->setSubMapPose(0, getPose(5)));
+  publisher.skipDelta(*submap_collection_ptr_);
+  ASSERT_TRUE(submap_collection_ptr_->setSubMapPose(1, getPose(6)));
+  publisher.getDelta(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  EXPECT_TRUE(receiver.requiresSnapshot());
+  // Catching up
+  publisher.getSnapshot(*submap_collection_ptr_, &parts);
+  addParts(parts, &receiver);
+  EXPECT_FALSE(receiver.requiresSnapshot());
+  expectMirrored(0.0, 0.0);
+}
+
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
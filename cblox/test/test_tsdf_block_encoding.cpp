@@ -0,0 +1,103 @@
+#include <string>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include "cblox/core/tsdf_block_encoding.h"
+#include "cblox/core/tsdf_block_pool.h"
+
+#include "./tsdf_test_utils.h"
+
+namespace cblox {
+
+class TsdfBlockEncodingTest : public ::testing::Test {
+ protected:
+  TsdfBlockEncodingTest()
+      : tsdf_layer_(kVoxelSize, kVoxelsPerSide),
+        decoded_layer_(kVoxelSize, kVoxelsPerSide) {}
+
+  void SetUp() override { test::fillTsdfLayer(&tsdf_layer_); }
+
+  // The bounds of the quantization errors (see tsdf_block_encoding.h)
+  FloatingPoint getDistanceTolerance() const {
+    return 1e-4 * 4.0 * kVoxelSize + 1e-6;
+  }
+  static constexpr FloatingPoint kWeightTolerance = 0.02;
+
+  static constexpr FloatingPoint kVoxelSize = 0.1;
+  static constexpr size_t kVoxelsPerSide = 8;
+
+  Layer<TsdfVoxel> tsdf_layer_;
+  Layer<TsdfVoxel> decoded_layer_;
+};
+
+constexpr FloatingPoint TsdfBlockEncodingTest::kWeightTolerance;
+constexpr FloatingPoint TsdfBlockEncodingTest::kVoxelSize;
+constexpr size_t TsdfBlockEncodingTest::kVoxelsPerSide;
+
+TEST_F(TsdfBlockEncodingTest, RoundTrip) {
+  TsdfBlockEncodingConfig config;
+  std::string bytes;
+  // The empty block is elided
+  const size_t num_blocks = EncodeTsdfBlocks(tsdf_layer_, config, &bytes);
+  EXPECT_EQ(num_blocks, tsdf_layer_.getNumberOfAllocatedBlocks() - 1);
+  ASSERT_TRUE(DecodeTsdfBlocks(bytes.data(), bytes.size(), &decoded_layer_));
+  EXPECT_EQ(decoded_layer_.getNumberOfAllocatedBlocks(), num_blocks);
+  test::expectTsdfLayersNear(tsdf_layer_, decoded_layer_,
+                             getDistanceTolerance(), kWeightTolerance, true);
+}
+
+TEST_F(TsdfBlockEncodingTest, RoundTripWithoutColorsAndEmptyBlocks) {
+  TsdfBlockEncodingConfig config;
+  config.keep_colors = false;
+  config.elide_empty_blocks = false;
+  std::string bytes;
+  const size_t num_blocks = EncodeTsdfBlocks(tsdf_layer_, config, &bytes);
+  EXPECT_EQ(num_blocks, tsdf_layer_.getNumberOfAllocatedBlocks());
+  ASSERT_TRUE(DecodeTsdfBlocks(bytes.data(), bytes.size(), &decoded_layer_));
+  EXPECT_EQ(decoded_layer_.getNumberOfAllocatedBlocks(), num_blocks);
+  test::expectTsdfLayersNear(tsdf_layer_, decoded_layer_,
+                             getDistanceTolerance(), kWeightTolerance, false);
+}
+
+TEST_F(TsdfBlockEncodingTest, RoundTripThroughPool) {
+  TsdfBlockPool block_pool(kVoxelSize, kVoxelsPerSide, 100);
+  TsdfBlockEncodingConfig config;
+  std::string bytes;
+  EncodeTsdfBlocks(tsdf_layer_, config, &bytes);
+  // Decoding twice, the second time into recycled blocks
+  ASSERT_TRUE(DecodeTsdfBlocks(bytes.data(), bytes.size(), &decoded_layer_,
+                               &block_pool));
+  block_pool.recycleAllBlocks(&decoded_layer_);
+  EXPECT_EQ(decoded_layer_.getNumberOfAllocatedBlocks(), 0u);
+  ASSERT_TRUE(DecodeTsdfBlocks(bytes.data(), bytes.size(), &decoded_layer_,
+                               &block_pool));
+  EXPECT_GT(block_pool.getStats().num_reused_blocks, 0u);
+  test::expectTsdfLayersNear(tsdf_layer_, decoded_layer_,
+                             getDistanceTolerance(), kWeightTolerance, true);
+}
+
+TEST_F(TsdfBlockEncodingTest, RejectsTruncatedBytes) {
+  TsdfBlockEncodingConfig config;
+  std::string bytes;
+  EncodeTsdfBlocks(tsdf_layer_, config, &bytes);
+  EXPECT_FALSE(
+      DecodeTsdfBlocks(bytes.data(), bytes.size() - 1, &decoded_layer_));
+  EXPECT_FALSE(DecodeTsdfBlocks(bytes.data(), 3, &decoded_layer_));
+}
+
+TEST_F(TsdfBlockEncodingTest, RejectsOtherLayout) {
+  TsdfBlockEncodingConfig config;
+  std::string bytes;
+  EncodeTsdfBlocks(tsdf_layer_, config, &bytes);
+  Layer<TsdfVoxel> other_layer(kVoxelSize, 2 * kVoxelsPerSide);
+  EXPECT_FALSE(DecodeTsdfBlocks(bytes.data(), bytes.size(), &other_layer));
+}
+
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  google::InitGoogleLogging(argv[0]);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+#ifndef CBLOX_TEST_TSDF_TEST_UTILS_H_
+#define CBLOX_TEST_TSDF_TEST_UTILS_H_
+
+#include <cmath>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <voxblox/core/block.h>
+#include <voxblox/core/layer.h>
+
+#include "cblox/core/common.h"
+
+namespace cblox {
+namespace test {
+
+// Fills a few blocks of the layer with distinct voxels. Every fifth voxel is
+// left unobserved (zero weight), and the last block entirely.
+inline void fillTsdfLayer(Layer<TsdfVoxel>* tsdf_layer_ptr) {
+  CHECK_NOTNULL(tsdf_layer_ptr);
+  const FloatingPoint truncation_distance = 4.0 * tsdf_layer_ptr->voxel_size();
+  const voxblox::BlockIndex block_indices[] = {
+      voxblox::BlockIndex(0, 0, 0), voxblox::BlockIndex(1, 0, 0),
+      voxblox::BlockIndex(-1, 2, 0), voxblox::BlockIndex(0, -3, 1),
+      voxblox::BlockIndex(5, 5, 5)};
+  const size_t num_blocks = sizeof(block_indices) / sizeof(block_indices[0]);
+  for (size_t block_number = 0; block_number < num_blocks; block_number++) {
+    Block<TsdfVoxel>::Ptr block_ptr =
+        tsdf_layer_ptr->allocateBlockPtrByIndex(block_indices[block_number]);
+    if (block_number + 1 == num_blocks) {
+      continue;
+    }
+    for (size_t voxel_index = 0; voxel_index < block_ptr->num_voxels();
+         voxel_index++) {
+      if (voxel_index % 5 == 0) {
+        continue;
+      }
+      TsdfVoxel& voxel = block_ptr->getVoxelByLinearIndex(voxel_index);
+      const FloatingPoint phase =
+          0.1f * static_cast<FloatingPoint>(voxel_index + block_number);
+      voxel.distance = truncation_distance * std::sin(phase);
+      voxel.weight = 1.0f + static_cast<FloatingPoint>(voxel_index % 7);
+      voxel.color.r = static_cast<uint8_t>(voxel_index % 256);
+      voxel.color.g = static_cast<uint8_t>((voxel_index * 3) % 256);
+      voxel.color.b = static_cast<uint8_t>(block_number * 40);
+    }
+    block_ptr->set_has_data(true);
+  }
+}
+
+// Compares the observed voxels of the layers. Blocks without observed voxels
+// may be missing in either (see TsdfBlockEncodingConfig::elide_empty_blocks).
+// The tolerances are those of the compact encoding (zero for exact copies).
+inline void expectTsdfLayersNear(const Layer<TsdfVoxel>& expected_layer,
+                                 const Layer<TsdfVoxel>& actual_layer,
+                                 const FloatingPoint distance_tolerance,
+                                 const FloatingPoint weight_tolerance,
+                                 const bool compare_colors) {
+  ASSERT_EQ(expected_layer.voxels_per_side(), actual_layer.voxels_per_side());
+  voxblox::BlockIndexList block_indices;
+  expected_layer.getAllAllocatedBlocks(&block_indices);
+  for (const voxblox::BlockIndex& block_index : block_indices) {
+    const Block<TsdfVoxel>& expected_block =
+        expected_layer.getBlockByIndex(block_index);
+    const bool has_block = actual_layer.hasBlock(block_index);
+    for (size_t voxel_index = 0; voxel_index < expected_block.num_voxels();
+         voxel_index++) {
+      const TsdfVoxel& expected_voxel =
+          expected_block.getVoxelByLinearIndex(voxel_index);
+      if (expected_voxel.weight <= 0.0f) {
+        if (has_block) {
+          EXPECT_EQ(actual_layer.getBlockByIndex(block_index)
+                        .getVoxelByLinearIndex(voxel_index)
+                        .weight,
+                    0.0f);
+        }
+        continue;
+      }
+      ASSERT_TRUE(has_block) << "Missing block " << block_index.transpose();
+      const TsdfVoxel& actual_voxel = actual_layer.getBlockByIndex(block_index)
+                                          .getVoxelByLinearIndex(voxel_index);
+      EXPECT_NEAR(expected_voxel.distance, actual_voxel.distance,
+                  distance_tolerance);
+      EXPECT_NEAR(expected_voxel.weight, actual_voxel.weight,
+                  weight_tolerance * (1.0f + expected_voxel.weight));
+      EXPECT_GT(actual_voxel.weight, 0.0f);
+      if (compare_colors) {
+        EXPECT_EQ(expected_voxel.color.r, actual_voxel.color.r);
+        EXPECT_EQ(expected_voxel.color.g, actual_voxel.color.g);
+        EXPECT_EQ(expected_voxel.color.b, actual_voxel.color.b);
+      }
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace cblox
+
+#endif  // CBLOX_TEST_TSDF_TEST_UTILS_H_
@@ -1,10 +1,16 @@
 #ifndef CBLOX_ROS_ACTIVE_SUBMAP_VISUALIZER_H_
 #define CBLOX_ROS_ACTIVE_SUBMAP_VISUALIZER_H_
 
+#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <visualization_msgs/Marker.h>
 
+#include <voxblox/core/block_hash.h>
+#include <voxblox_msgs/Mesh.h>
+
 #include <voxblox/mesh/mesh_integrator.h>
 #include <voxblox/mesh/mesh_layer.h>
 #include <voxblox_ros/mesh_vis.h>
@@ -36,11 +42,25 @@ class ActiveSubmapVisualizer {
 
   void switchToActiveSubmap();
 
+  // Drops the meshes of all submaps, e.g. when the collection is replaced by a
+  // loaded one. The blocks already published in G are cleared, so the next
+  // delta message tells the receiver to remove them.
+  // NOTE: Call switchToActiveSubmap() before visualizing again.
+  void reset();
+
   void updateMeshLayer();
 
   void getDisplayMesh(visualization_msgs::Marker* marker_ptr);
   MeshLayer::Ptr getDisplayMeshLayer();
 
+  // Incremental publishing. The meshes of all submaps visualized so far are
+  // kept in G, where only the blocks touched by the mesh blocks of the active
+  // submap which changed since the last call (or all of them, if its pose
+  // changed) are rebuilt. The message holds only the rebuilt blocks, empty
+  // blocks telling the receiver to remove them.
+  // NOTE: Call after updateMeshLayer().
+  void getDeltaMeshMsg(voxblox_msgs::Mesh* mesh_msg_ptr);
+
 private:
   // Functions called when swapping active submaps
   void createMeshLayer();
@@ -52,6 +72,15 @@ private:
   void transformMeshLayerToGlobalFrame(const MeshLayer& mesh_layer_S,
                                        MeshLayer* mesh_layer_G_ptr) const;
   void colorMeshWithCurrentIndex(MeshLayer* mesh_layer_ptr) const;
+  Color getSubmapColor(const SubmapID submap_id) const;
+
+  // A mesh block of a submap, in the submap frame
+  typedef std::pair<SubmapID, voxblox::BlockIndex> SubmapBlock;
+  typedef std::vector<SubmapBlock> SubmapBlockList;
+
+  // Rebuilds the blocks of the mesh in G from the submap blocks contributing
+  // triangles to them.
+  void rebuildMeshBlocks_G(const voxblox::IndexSet& block_indices_G);
 
   // Config
   const MeshIntegratorConfig mesh_config_;
@@ -73,6 +102,17 @@ private:
   // Color stuff
   const int color_cycle_length_;
   int current_color_idx_;
+
+  // The incrementally updated mesh in G, and for each of its blocks, the
+  // submap blocks with triangles (with the first vertex) in it.
+  std::shared_ptr<MeshLayer> mesh_layer_G_ptr_;
+  voxblox::AnyIndexHashMapType<SubmapBlockList>::type block_G_to_contributors_;
+  // For each submap block, the blocks in G it contributes to
+  std::map<SubmapID,
+           voxblox::AnyIndexHashMapType<voxblox::BlockIndexList>::type>
+      contributor_to_blocks_G_;
+  // The pose stamps of the submaps at which they were added to the mesh in G
+  std::map<SubmapID, size_t> contributed_pose_versions_;
 };
 
 }  // namespace cblox
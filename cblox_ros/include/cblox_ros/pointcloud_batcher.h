@@ -0,0 +1,52 @@
+#ifndef CBLOX_ROS_POINTCLOUD_BATCHER_H_
+#define CBLOX_ROS_POINTCLOUD_BATCHER_H_
+
+#include <deque>
+#include <vector>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+namespace cblox {
+
+// Groups the pointclouds of several sensors by time, such that the clouds
+// taken within a short window of each other are integrated together.
+// NOTE: The oldest pending cloud opens a window, and the batch takes the first
+//       cloud of each sensor within it. A batch is released once all sensors
+//       contributed, or once a cloud newer than the window arrived, so a silent
+//       sensor holds up the others by at most the window. Not thread safe
+//       (called from the subscriber callbacks).
+class PointcloudBatcher {
+ public:
+  struct Config {
+    size_t num_sensors = 1;
+    ros::Duration sync_window = ros::Duration(0.05);
+    // Clouds waiting per sensor, above which the oldest are dropped
+    size_t max_queue_size_per_sensor = 10;
+  };
+
+  explicit PointcloudBatcher(const Config& config);
+
+  // Returns the number of clouds of the sensor dropped to make space
+  size_t addMessage(const size_t sensor_index,
+                    const sensor_msgs::PointCloud2::ConstPtr& pointcloud_msg);
+
+  // Moves the next batch out of the queues: the oldest cloud of each sensor
+  // within the sync window of the oldest pending cloud, ordered by sensor
+  // index. Batches are complete unless a newer cloud moved past the window
+  // (a sensor missed it), in which case the sensors without a cloud in it are
+  // skipped, so positions in the batch don't identify the sensors.
+  bool getNextBatch(std::vector<sensor_msgs::PointCloud2::ConstPtr>* batch);
+
+  size_t getNumPendingMessages() const;
+
+ private:
+  const Config config_;
+  std::vector<std::deque<sensor_msgs::PointCloud2::ConstPtr>> queues_;
+  // The stamp of the newest cloud received (from any sensor)
+  ros::Time latest_stamp_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_ROS_POINTCLOUD_BATCHER_H_
@@ -1,17 +1,263 @@
 #ifndef CBLOX_ROS_POINTCLOUD_CONVERSIONS_H_
 #define CBLOX_ROS_POINTCLOUD_CONVERSIONS_H_
 
+#include <cmath>
+#include <cstring>
+#include <string>
+
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
 #include <sensor_msgs/PointCloud2.h>
 
+#include <voxblox/utils/color_maps.h>
+
 #include <cblox/core/common.h>
 
 namespace cblox {
 
-// Convert the PCL pointcloud into our awesome format.
-inline void
-convertPointcloudMsg(const voxblox::ColorMap &color_map,
-                     const sensor_msgs::PointCloud2::Ptr &pointcloud_msg,
-                     Pointcloud *points_C_ptr, Colors *colors_ptr) {
+namespace internal {
+
+// Returns the field with the passed name, or nullptr if it doesn't exist.
+inline const sensor_msgs::PointField* findPointField(
+    const sensor_msgs::PointCloud2& pointcloud_msg, const std::string& name) {
+  for (const sensor_msgs::PointField& field : pointcloud_msg.fields) {
+    if (field.name == name) {
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+// Reads a single scalar of any of the PointField datatypes as a float.
+// NOTE: memcpy because the data is not necessarily aligned.
+template <typename ScalarType>
+inline float readScalar(const uint8_t* data_ptr) {
+  ScalarType value;
+  std::memcpy(&value, data_ptr, sizeof(ScalarType));
+  return static_cast<float>(value);
+}
+
+inline float readFieldAsFloat(const uint8_t* data_ptr, const uint8_t datatype) {
+  switch (datatype) {
+    case sensor_msgs::PointField::INT8:
+      return readScalar<int8_t>(data_ptr);
+    case sensor_msgs::PointField::UINT8:
+      return readScalar<uint8_t>(data_ptr);
+    case sensor_msgs::PointField::INT16:
+      return readScalar<int16_t>(data_ptr);
+    case sensor_msgs::PointField::UINT16:
+      return readScalar<uint16_t>(data_ptr);
+    case sensor_msgs::PointField::INT32:
+      return readScalar<int32_t>(data_ptr);
+    case sensor_msgs::PointField::UINT32:
+      return readScalar<uint32_t>(data_ptr);
+    case sensor_msgs::PointField::FLOAT32:
+      return readScalar<float>(data_ptr);
+    case sensor_msgs::PointField::FLOAT64:
+      return readScalar<double>(data_ptr);
+    default:
+      LOG(FATAL) << "Unknown PointField datatype: "
+                 << static_cast<int>(datatype);
+      return 0.0f;
+  }
+}
+
+// Returns the size in bytes of a PointField datatype, or 0 if it is unknown.
+inline size_t pointFieldDatatypeSize(const uint8_t datatype) {
+  switch (datatype) {
+    case sensor_msgs::PointField::INT8:
+    case sensor_msgs::PointField::UINT8:
+      return 1;
+    case sensor_msgs::PointField::INT16:
+    case sensor_msgs::PointField::UINT16:
+      return 2;
+    case sensor_msgs::PointField::INT32:
+    case sensor_msgs::PointField::UINT32:
+    case sensor_msgs::PointField::FLOAT32:
+      return 4;
+    case sensor_msgs::PointField::FLOAT64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+// Checks that a (scalar) field has a known datatype and lies within a point.
+inline bool isPointFieldValid(const sensor_msgs::PointField& field,
+                              const uint32_t point_step) {
+  const size_t field_size = pointFieldDatatypeSize(field.datatype);
+  if (field_size == 0) {
+    LOG_EVERY_N(WARNING, 100) << "Pointcloud field \"" << field.name
+                              << "\" has unknown datatype "
+                              << static_cast<int>(field.datatype) << ".";
+    return false;
+  }
+  if (static_cast<size_t>(field.offset) + field_size > point_step) {
+    LOG_EVERY_N(WARNING, 100)
+        << "Pointcloud field \"" << field.name << "\" at offset "
+        << field.offset << " doesn't fit in a point of " << point_step
+        << " bytes.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace internal
+
+// Convert the ROS pointcloud message into our awesome format.
+// The points are read straight out of the message data using the field
+// offsets. Non-finite points are removed. The output vectors are resized to
+// fit, so passing the same (reused) vectors in each call avoids reallocation.
+// Returns false, leaving the output vectors empty, if the layout described by
+// the message header doesn't match its data.
+inline bool convertPointcloudMsg(const voxblox::ColorMap& color_map,
+                                 const sensor_msgs::PointCloud2& pointcloud_msg,
+                                 Pointcloud* points_C_ptr, Colors* colors_ptr) {
+  CHECK_NOTNULL(points_C_ptr);
+  CHECK_NOTNULL(colors_ptr);
+  points_C_ptr->clear();
+  colors_ptr->clear();
+  timing::Timer ptcloud_timer("ptcloud_preprocess");
+
+  // Locating the fields
+  const sensor_msgs::PointField* x_field =
+      internal::findPointField(pointcloud_msg, "x");
+  const sensor_msgs::PointField* y_field =
+      internal::findPointField(pointcloud_msg, "y");
+  const sensor_msgs::PointField* z_field =
+      internal::findPointField(pointcloud_msg, "z");
+  if (x_field == nullptr || y_field == nullptr || z_field == nullptr) {
+    LOG_EVERY_N(WARNING, 100)
+        << "Pointcloud message is missing one of the x, y, z fields.";
+    return false;
+  }
+  // Color is either packed as "rgb", without alpha, or as "rgba". Both are
+  // laid out as in PCL: b, g, r, (a) in memory.
+  const sensor_msgs::PointField* rgb_field =
+      internal::findPointField(pointcloud_msg, "rgb");
+  const bool has_alpha = (rgb_field == nullptr);
+  if (has_alpha) {
+    rgb_field = internal::findPointField(pointcloud_msg, "rgba");
+  }
+  const sensor_msgs::PointField* intensity_field =
+      internal::findPointField(pointcloud_msg, "intensity");
+
+  // Checking the message is self consistent
+  const uint32_t point_step = pointcloud_msg.point_step;
+  if (!internal::isPointFieldValid(*x_field, point_step) ||
+      !internal::isPointFieldValid(*y_field, point_step) ||
+      !internal::isPointFieldValid(*z_field, point_step) ||
+      (intensity_field != nullptr &&
+       !internal::isPointFieldValid(*intensity_field, point_step))) {
+    return false;
+  }
+  if (rgb_field != nullptr) {
+    if (!internal::isPointFieldValid(*rgb_field, point_step)) {
+      return false;
+    }
+    if (internal::pointFieldDatatypeSize(rgb_field->datatype) != 4) {
+      LOG_EVERY_N(WARNING, 100) << "Pointcloud field \"" << rgb_field->name
+                                << "\" is not packed into 4 bytes.";
+      return false;
+    }
+  }
+  if (static_cast<size_t>(pointcloud_msg.width) * point_step >
+      pointcloud_msg.row_step) {
+    LOG_EVERY_N(WARNING, 100) << "Pointcloud rows of " << pointcloud_msg.width
+                              << " points of " << point_step
+                              << " bytes don't fit in the row step of "
+                              << pointcloud_msg.row_step << " bytes.";
+    return false;
+  }
+  if (pointcloud_msg.data.size() <
+      static_cast<size_t>(pointcloud_msg.row_step) * pointcloud_msg.height) {
+    LOG_EVERY_N(WARNING, 100)
+        << "Pointcloud data holds " << pointcloud_msg.data.size()
+        << " bytes, less than the " << pointcloud_msg.height << " rows of "
+        << pointcloud_msg.row_step << " bytes in its header.";
+    return false;
+  }
+  const size_t num_points =
+      static_cast<size_t>(pointcloud_msg.width) * pointcloud_msg.height;
+
+  // The common case (float xyz) is read without going through the datatype
+  // switch.
+  const bool xyz_are_float =
+      (x_field->datatype == sensor_msgs::PointField::FLOAT32) &&
+      (y_field->datatype == sensor_msgs::PointField::FLOAT32) &&
+      (z_field->datatype == sensor_msgs::PointField::FLOAT32);
+  // Color in the absence of both rgb and intensity
+  const Color default_color = color_map.colorLookup(0.0f);
+
+  // NOTE: Every point is written and the output index is only advanced for
+  //       finite points. This keeps the loop free of unpredictable branches.
+  points_C_ptr->resize(num_points);
+  colors_ptr->resize(num_points);
+  Point* points_out = points_C_ptr->data();
+  Color* colors_out = colors_ptr->data();
+  size_t num_valid = 0;
+  for (uint32_t row = 0; row < pointcloud_msg.height; ++row) {
+    const uint8_t* row_ptr =
+        pointcloud_msg.data.data() +
+        static_cast<size_t>(row) * pointcloud_msg.row_step;
+    for (uint32_t col = 0; col < pointcloud_msg.width; ++col) {
+      const uint8_t* point_ptr =
+          row_ptr + static_cast<size_t>(col) * pointcloud_msg.point_step;
+      // Position
+      Point& point_C = points_out[num_valid];
+      if (xyz_are_float) {
+        point_C.x() = internal::readScalar<float>(point_ptr + x_field->offset);
+        point_C.y() = internal::readScalar<float>(point_ptr + y_field->offset);
+        point_C.z() = internal::readScalar<float>(point_ptr + z_field->offset);
+      } else {
+        point_C.x() = internal::readFieldAsFloat(point_ptr + x_field->offset,
+                                                 x_field->datatype);
+        point_C.y() = internal::readFieldAsFloat(point_ptr + y_field->offset,
+                                                 y_field->datatype);
+        point_C.z() = internal::readFieldAsFloat(point_ptr + z_field->offset,
+                                                 z_field->datatype);
+      }
+      // Color
+      Color& color = colors_out[num_valid];
+      if (rgb_field != nullptr) {
+        const uint8_t* rgb_ptr = point_ptr + rgb_field->offset;
+        color = Color(rgb_ptr[2], rgb_ptr[1], rgb_ptr[0],
+                      has_alpha ? rgb_ptr[3] : 255u);
+      } else if (intensity_field != nullptr) {
+        color = color_map.colorLookup(internal::readFieldAsFloat(
+            point_ptr + intensity_field->offset, intensity_field->datatype));
+      } else {
+        color = default_color;
+      }
+      // Only keeping finite points
+      const bool is_finite = std::isfinite(point_C.x()) &&
+                             std::isfinite(point_C.y()) &&
+                             std::isfinite(point_C.z());
+      num_valid += static_cast<size_t>(is_finite);
+    }
+  }
+  points_C_ptr->resize(num_valid);
+  colors_ptr->resize(num_valid);
+  ptcloud_timer.Stop();
+  return true;
+}
+
+inline bool convertPointcloudMsg(
+    const voxblox::ColorMap& color_map,
+    const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
+    Pointcloud* points_C_ptr, Colors* colors_ptr) {
+  CHECK(pointcloud_msg);
+  return convertPointcloudMsg(color_map, *pointcloud_msg, points_C_ptr,
+                              colors_ptr);
+}
+
+// Convert the ROS pointcloud message into our awesome format, going through
+// a PCL pointcloud. Kept for comparison with the direct conversion above.
+// NOTE: This modifies the datatype of the rgb field of the passed message.
+inline void convertPointcloudMsgThroughPcl(
+    const voxblox::ColorMap& color_map,
+    const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
+    Pointcloud* points_C_ptr, Colors* colors_ptr) {
   CHECK(pointcloud_msg);
   CHECK_NOTNULL(points_C_ptr);
   CHECK_NOTNULL(colors_ptr);
@@ -25,7 +271,7 @@ convertPointcloudMsg(const voxblox::ColorMap &color_map,
     }
   }
 
-  timing::Timer ptcloud_timer("ptcloud_preprocess");
+  timing::Timer ptcloud_timer("ptcloud_preprocess_pcl");
 
   // Convert differently depending on RGB or I type.
   if (color_pointcloud) {
@@ -69,6 +315,6 @@ convertPointcloudMsg(const voxblox::ColorMap &color_map,
   ptcloud_timer.Stop();
 }
 
-} // namespace cblox
+}  // namespace cblox
 
-#endif // CBLOX_ROS_POINTCLOUD_CONVERSIONS_H_
+#endif  // CBLOX_ROS_POINTCLOUD_CONVERSIONS_H_
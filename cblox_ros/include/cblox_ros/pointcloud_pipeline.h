@@ -0,0 +1,147 @@
+#ifndef CBLOX_ROS_POINTCLOUD_PIPELINE_H_
+#define CBLOX_ROS_POINTCLOUD_PIPELINE_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <cblox/core/common.h>
+
+#include "cblox_ros/spsc_queue.h"
+
+namespace cblox {
+
+// A pointcloud which has been converted and posed, ready for integration.
+struct PointcloudFrame {
+  ros::Time stamp;
+  // T_G_C - Transformation between Camera (C) and Global tracking frame (G).
+  Transformation T_G_C;
+  Pointcloud points_C;
+  Colors colors;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// Counters describing the work done by one pipeline stage.
+// NOTE: Written by the stage thread, read from anywhere.
+class PipelineStageStats {
+ public:
+  PipelineStageStats()
+      : num_processed_(0),
+        num_dropped_(0),
+        total_latency_us_(0),
+        max_latency_us_(0) {}
+
+  void addProcessed(const ros::WallDuration& latency);
+  void addDropped() { num_dropped_++; }
+
+  uint64_t num_processed() const { return num_processed_; }
+  uint64_t num_dropped() const { return num_dropped_; }
+  double mean_latency_sec() const;
+  double max_latency_sec() const { return max_latency_us_ * 1.0e-6; }
+
+ private:
+  std::atomic<uint64_t> num_processed_;
+  std::atomic<uint64_t> num_dropped_;
+  std::atomic<uint64_t> total_latency_us_;
+  std::atomic<uint64_t> max_latency_us_;
+};
+
+// Pipelined ingestion of pointclouds. Work is split over three threads,
+// connected by bounded lock-free queues:
+//  - conversion: TF lookup and message conversion,
+//  - integration: TSDF integration and submap creation,
+//  - visualization: trajectory publishing.
+// Such that a slow stage does not stall the subscriber, and the conversion of
+// frame N+1 overlaps with the integration of frame N.
+class PointcloudPipeline {
+ public:
+  typedef std::shared_ptr<PointcloudPipeline> Ptr;
+  typedef std::shared_ptr<const PointcloudPipeline> ConstPtr;
+
+  struct Config {
+    // Messages waiting for conversion (and their TF).
+    size_t message_queue_size = 10;
+    // Converted frames waiting for integration.
+    size_t frame_queue_size = 2;
+    // Integrated poses waiting for visualization.
+    size_t pose_queue_size = 100;
+  };
+
+  // The outcome of converting a message.
+  // NOTE: kRetryLater is for messages which can't be converted yet, for
+  //       example because the transform is not yet available. The message is
+  //       then retried until newer messages back up behind it. Messages which
+  //       can never be converted (e.g. malformed ones) are kDropped right away.
+  enum class ConversionResult { kConverted, kRetryLater, kDropped };
+
+  // Stage functions.
+  typedef std::function<ConversionResult(const sensor_msgs::PointCloud2::Ptr&,
+                                         PointcloudFrame*)>
+      ConversionFunction;
+  typedef std::function<void(const PointcloudFrame&)> IntegrationFunction;
+  typedef std::function<void(const Transformation&)> VisualizationFunction;
+
+  PointcloudPipeline(const Config& config,
+                     const ConversionFunction& conversion_function,
+                     const IntegrationFunction& integration_function,
+                     const VisualizationFunction& visualization_function);
+  ~PointcloudPipeline() { stop(); }
+
+  // Starting and stopping the stage threads
+  void start();
+  void stop();
+
+  // Adds a message to the pipeline. Called from the subscriber thread only.
+  // Returns false if the message was dropped because the pipeline is full.
+  bool addMessage(const sensor_msgs::PointCloud2::Ptr& pointcloud_msg);
+
+  // Access to the stage statistics
+  const PipelineStageStats& getConversionStats() const {
+    return conversion_stats_;
+  }
+  const PipelineStageStats& getIntegrationStats() const {
+    return integration_stats_;
+  }
+  const PipelineStageStats& getVisualizationStats() const {
+    return visualization_stats_;
+  }
+  size_t getMessageQueueSize() const { return message_queue_.size(); }
+  std::string printStats() const;
+
+ private:
+  // The stage loops
+  void conversionLoop();
+  void integrationLoop();
+  void visualizationLoop();
+
+  // The stage functions
+  const ConversionFunction conversion_function_;
+  const IntegrationFunction integration_function_;
+  const VisualizationFunction visualization_function_;
+
+  // The queues between the stages
+  SpscQueue<sensor_msgs::PointCloud2::Ptr> message_queue_;
+  SpscQueue<PointcloudFrame> frame_queue_;
+  SpscQueue<Transformation> pose_queue_;
+
+  // Stats. Drops of incoming messages are attributed to the conversion stage.
+  PipelineStageStats conversion_stats_;
+  PipelineStageStats integration_stats_;
+  PipelineStageStats visualization_stats_;
+
+  // Threads
+  std::atomic<bool> running_;
+  std::thread conversion_thread_;
+  std::thread integration_thread_;
+  std::thread visualization_thread_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_ROS_POINTCLOUD_PIPELINE_H_
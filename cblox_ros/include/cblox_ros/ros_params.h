@@ -3,8 +3,13 @@
 
 #include <ros/node_handle.h>
 
+#include <algorithm>
+#include <string>
+
 #include <voxblox/integrator/tsdf_integrator.h>
 
+#include <cblox/mesh/submap_mesher.h>
+
 namespace cblox {
 
 inline voxblox::TsdfIntegratorType getTsdfIntegratorTypeFromRosParam(
@@ -32,6 +37,19 @@ inline voxblox::TsdfIntegratorType getTsdfIntegratorTypeFromRosParam(
   return tsdf_integrator_type;
 }
 
+inline MeshLodConfig getMeshLodConfigFromRosParam(
+    const ros::NodeHandle& nh_private) {
+  MeshLodConfig lod_config;
+  nh_private.param("enable_mesh_lod", lod_config.enable, lod_config.enable);
+  nh_private.param("mesh_lod_full_resolution_radius_m",
+                   lod_config.full_resolution_radius_m,
+                   lod_config.full_resolution_radius_m);
+  int max_level = static_cast<int>(lod_config.max_level);
+  nh_private.param("mesh_lod_max_level", max_level, max_level);
+  lod_config.max_level = static_cast<size_t>(std::max(max_level, 0));
+  return lod_config;
+}
+
 }  // namespace cblox
 
 #endif  // CBLOX_ROS_ROS_PARAMS_H_
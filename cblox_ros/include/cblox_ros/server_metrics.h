@@ -0,0 +1,98 @@
+#ifndef CBLOX_ROS_SERVER_METRICS_H_
+#define CBLOX_ROS_SERVER_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+#include <ros/ros.h>
+
+#include <cblox/core/tsdf_submap.h>
+
+namespace cblox {
+
+// A histogram of latencies, with logarithmic buckets (8 per doubling, so
+// percentiles are accurate to ~9%), from 1us to over an hour.
+// NOTE: Recording is lock free. Samples recorded while the histogram is being
+//       reset may be lost.
+class LatencyHistogram {
+ public:
+  struct Summary {
+    uint64_t count = 0;
+    double mean_sec = 0.0;
+    double p50_sec = 0.0;
+    double p99_sec = 0.0;
+    double max_sec = 0.0;
+  };
+
+  LatencyHistogram();
+
+  void record(const ros::WallDuration& latency);
+  Summary summarize() const;
+  void reset();
+
+ private:
+  static constexpr size_t kBucketsPerDoubling = 8;
+  static constexpr size_t kNumBuckets = 32 * kBucketsPerDoubling;
+
+  static size_t getBucketIndex(const uint64_t latency_us);
+  static double getBucketLatencySec(const size_t bucket_index);
+  double getPercentileSec(const double fraction, const uint64_t count) const;
+
+  std::array<std::atomic<uint64_t>, kNumBuckets> bucket_counts_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> total_latency_us_;
+  std::atomic<uint64_t> max_latency_us_;
+};
+
+// Metrics of the hot path of the server (latencies, input queueing and the
+// size of the submaps), published periodically as diagnostics. Recording is
+// skipped while disabled, such that the metrics cost (almost) nothing when
+// off.
+class ServerMetrics {
+ public:
+  ServerMetrics();
+
+  // Toggled at runtime
+  void setEnabled(const bool enabled) { enabled_ = enabled; }
+  bool isEnabled() const { return enabled_; }
+
+  // Recording, from any thread
+  void recordConversion(const ros::WallDuration& latency);
+  void recordIntegration(const ros::WallDuration& latency);
+  void recordMeshing(const ros::WallDuration& latency);
+  void recordQueueDepth(const size_t queue_depth);
+  void recordDroppedMessages(const size_t num_dropped);
+  // The points of a scan before and after downsampling
+  void recordDownsampling(const size_t num_input_points,
+                          const size_t num_output_points);
+
+  // Fills the diagnostics with the metrics since the last call (which are then
+  // reset), and the current (total and largest) size of the given submaps.
+  void getDiagnostics(const std::vector<TsdfSubmap::ConstPtr>& submaps,
+                      diagnostic_msgs::DiagnosticArray* diagnostics_ptr);
+
+ private:
+  std::atomic<bool> enabled_;
+
+  LatencyHistogram conversion_latency_;
+  LatencyHistogram integration_latency_;
+  LatencyHistogram meshing_latency_;
+
+  // Over the current period
+  std::atomic<uint64_t> max_queue_depth_;
+  std::atomic<uint64_t> num_dropped_messages_;
+  std::atomic<uint64_t> num_downsampling_input_points_;
+  std::atomic<uint64_t> num_downsampling_output_points_;
+  // Since the start
+  std::atomic<uint64_t> total_num_frames_;
+  std::atomic<uint64_t> total_num_dropped_messages_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_ROS_SERVER_METRICS_H_
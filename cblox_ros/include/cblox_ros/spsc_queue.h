@@ -0,0 +1,85 @@
+#ifndef CBLOX_ROS_SPSC_QUEUE_H_
+#define CBLOX_ROS_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include <cblox/core/common.h>
+
+namespace cblox {
+
+// A bounded, lock-free, single-producer/single-consumer ring buffer.
+// NOTE: push() must only ever be called from a single thread and pop() from a
+//       single (other) thread. size() is only approximate while the queue is
+//       being used.
+// NOTE: Items are swapped in and out of the queue rather than copied. Whatever
+//       a slot held before is handed back, such that heap buffers held by the
+//       items (for example pointcloud vectors) cycle between producer and
+//       consumer rather than being reallocated for each item.
+template <typename Type>
+class SpscQueue {
+ public:
+  explicit SpscQueue(const size_t capacity)
+      : buffer_(capacity + 1), head_(0), tail_(0) {
+    CHECK_GT(capacity, 0u);
+  }
+
+  // Swaps the item into the queue. On return the item holds the previous
+  // content of the slot. Returns false (and leaves the item untouched) if the
+  // queue is full.
+  bool push(Type* item_ptr) {
+    CHECK_NOTNULL(item_ptr);
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t next_tail = increment(tail);
+    if (next_tail == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    using std::swap;
+    swap(buffer_[tail], *item_ptr);
+    tail_.store(next_tail, std::memory_order_release);
+    return true;
+  }
+  bool push(const Type& item) {
+    Type item_copy(item);
+    return push(&item_copy);
+  }
+
+  // Swaps the front item out of the queue. The previous content of item_ptr
+  // is left in the slot. Returns false if the queue is empty.
+  bool pop(Type* item_ptr) {
+    CHECK_NOTNULL(item_ptr);
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    using std::swap;
+    swap(buffer_[head], *item_ptr);
+    head_.store(increment(head), std::memory_order_release);
+    return true;
+  }
+
+  size_t size() const {
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    return (tail >= head) ? (tail - head) : (buffer_.size() - head + tail);
+  }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return buffer_.size() - 1; }
+
+ private:
+  size_t increment(const size_t index) const {
+    return (index + 1) % buffer_.size();
+  }
+
+  // NOTE: One slot is always left empty to distinguish between the full and the
+  //       empty queue.
+  AlignedVector<Type> buffer_;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_ROS_SPSC_QUEUE_H_
@@ -0,0 +1,77 @@
+#ifndef CBLOX_ROS_SUBMAP_STREAM_CLIENT_H_
+#define CBLOX_ROS_SUBMAP_STREAM_CLIENT_H_
+
+#include <memory>
+#include <string>
+
+#include <ros/ros.h>
+
+#include <voxblox_msgs/FilePath.h>
+
+#include <cblox/core/common.h>
+#include <cblox/core/submap_collection.h>
+#include <cblox/core/tsdf_submap.h>
+#include <cblox/io/submap_stream.h>
+#include <cblox/mesh/submap_mesher.h>
+
+#include <cblox_ros/GetSubmapStreamSnapshot.h>
+#include <cblox_ros/SubmapStreamUpdate.h>
+
+namespace cblox {
+
+// Mirrors the submap collection of a (remote) TsdfSubmapServer from its submap
+// stream, e.g. for a planner on another machine. The deltas are applied as
+// they arrive. A snapshot is requested to catch up, initially and whenever a
+// delta was missed.
+// NOTE: Subscribing before requesting the snapshot ensures that no delta
+//       following the snapshot is missed.
+class SubmapStreamClient {
+ public:
+  SubmapStreamClient(const ros::NodeHandle& nh,
+                     const ros::NodeHandle& nh_private);
+  SubmapStreamClient(const ros::NodeHandle& nh,
+                     const ros::NodeHandle& nh_private,
+                     const TsdfMap::Config& tsdf_map_config,
+                     const voxblox::MeshIntegratorConfig& mesh_config);
+
+  void submapStreamCallback(
+      const cblox_ros::SubmapStreamUpdate::ConstPtr& update_msg);
+  // Requests a snapshot, if one is required
+  void catchUpEvent(const ros::WallTimerEvent& /*event*/);
+
+  // Output of the mirrored map
+  void updateMeshEvent(const ros::WallTimerEvent& /*event*/);
+  bool saveMapCallback(voxblox_msgs::FilePath::Request& request,     // NOLINT
+                       voxblox_msgs::FilePath::Response& response);  // NOLINT
+
+  const std::shared_ptr<SubmapCollection<TsdfSubmap>>& getSubmapCollection()
+      const {
+    return submap_collection_ptr_;
+  }
+
+ private:
+  bool requestSnapshot();
+
+  ros::NodeHandle nh_;
+  ros::NodeHandle nh_private_;
+
+  ros::Subscriber submap_stream_sub_;
+  ros::ServiceClient snapshot_client_;
+  ros::Publisher mesh_pub_;
+  ros::ServiceServer save_map_srv_;
+  ros::WallTimer catch_up_timer_;
+  ros::WallTimer update_mesh_timer_;
+
+  std::string world_frame_;
+
+  // The mirrored collection
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> submap_collection_ptr_;
+  std::unique_ptr<io::SubmapStreamReceiver<TsdfSubmap>> receiver_ptr_;
+
+  // Meshes the mirrored submaps for visualization
+  std::unique_ptr<SubmapMesher> submap_mesher_ptr_;
+};
+
+}  // namespace cblox
+
+#endif  // CBLOX_ROS_SUBMAP_STREAM_CLIENT_H_
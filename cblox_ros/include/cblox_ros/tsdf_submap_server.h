@@ -2,6 +2,7 @@
 #define CBLOX_ROS_TSDF_SUBMAP_SERVER_H_
 
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string>
 #include <vector>
@@ -9,18 +10,28 @@
 #include <ros/ros.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <std_srvs/Empty.h>
+#include <std_srvs/SetBool.h>
 
 #include <voxblox/utils/color_maps.h>
 #include <voxblox_ros/transformer.h>
 #include <voxblox_msgs/FilePath.h>
+#include <voxblox_msgs/Mesh.h>
 
 #include <cblox/core/common.h>
 #include <cblox/core/submap_collection.h>
+#include <cblox/core/submap_creation_policy.h>
 #include <cblox/core/tsdf_submap.h>
 #include <cblox/integrator/tsdf_submap_collection_integrator.h>
+#include <cblox/io/submap_collection_checkpointer.h>
+#include <cblox/io/submap_stream.h>
 #include <cblox/mesh/submap_mesher.h>
 
+#include <cblox_ros/GetSubmapStreamSnapshot.h>
+
 #include "cblox_ros/active_submap_visualizer.h"
+#include "cblox_ros/pointcloud_batcher.h"
+#include "cblox_ros/pointcloud_pipeline.h"
+#include "cblox_ros/server_metrics.h"
 #include "cblox_ros/trajectory_visualizer.h"
 
 namespace cblox {
@@ -32,6 +43,7 @@ constexpr double kDefaultMinTimeBetweenMsgsSec = 0.0;
 
 // Data queue sizes
 constexpr int kDefaultPointcloudQueueSize = 1;
+constexpr int kDefaultMaxPointcloudQueueSize = 10;
 
 // Receives ROS Data and produces a collection of submaps
 class TsdfSubmapServer {
@@ -45,11 +57,15 @@ class TsdfSubmapServer {
       const voxblox::TsdfIntegratorBase::Config& tsdf_integrator_config,
       const voxblox::TsdfIntegratorType& tsdf_integrator_type,
       const voxblox::MeshIntegratorConfig& mesh_config);
-  virtual ~TsdfSubmapServer() {}
+  virtual ~TsdfSubmapServer();
 
   // Pointcloud data subscriber
   virtual void pointcloudCallback(
       const sensor_msgs::PointCloud2::Ptr& pointcloud_msg);
+  // Subscriber of one of several sensors (see pointcloud_topics)
+  void multiSensorPointcloudCallback(
+      const sensor_msgs::PointCloud2::ConstPtr& pointcloud_msg,
+      const size_t sensor_index);
 
   // Saving and Loading callbacks
   bool saveMap(const std::string& file_path);
@@ -61,6 +77,7 @@ class TsdfSubmapServer {
 
   // Update the mesh and publish for visualization
   void updateMeshEvent(const ros::TimerEvent& /*event*/);
+  void updateWholeMapMeshEvent(const ros::TimerEvent& /*event*/);
   void visualizeActiveSubmapMesh();
   void visualizeWholeMap();
 
@@ -68,6 +85,25 @@ class TsdfSubmapServer {
   void visualizeSubMapBaseframes() const;
   void visualizeTrajectory() const;
 
+  // Replaces the policy deciding when to start a new submap (by default set up
+  // from the ROS params)
+  void setSubmapCreationPolicy(
+      const SubmapCreationPolicy::Ptr& submap_creation_policy);
+
+  // Hot path metrics, published periodically as diagnostics while enabled
+  void setMetricsEnabled(const bool enabled);
+  void publishMetricsEvent(const ros::WallTimerEvent& /*event*/);
+  bool setMetricsEnabledCallback(
+      std_srvs::SetBool::Request& request,     // NOLINT
+      std_srvs::SetBool::Response& response);  // NOLINT
+
+  // Streaming the map to remote consumers (see SubmapStreamClient). Deltas are
+  // published periodically, and snapshots served on request.
+  void publishSubmapStreamEvent(const ros::WallTimerEvent& /*event*/);
+  bool getSubmapStreamSnapshotCallback(
+      cblox_ros::GetSubmapStreamSnapshot::Request& request,     // NOLINT
+      cblox_ros::GetSubmapStreamSnapshot::Response& response);  // NOLINT
+
   // Mesh output
   bool generateSeparatedMeshCallback(
       std_srvs::Empty::Request& request,     // NOLINT
@@ -93,22 +129,48 @@ class TsdfSubmapServer {
       std::queue<sensor_msgs::PointCloud2::Ptr>* queue,
       sensor_msgs::PointCloud2::Ptr* pointcloud_msg, Transformation* T_G_C);
 
+  // Returns true if the message passes the input throttling.
+  bool passesMessageThrottle(
+      const sensor_msgs::PointCloud2::Ptr& pointcloud_msg_in);
+
   // Pointcloud integration
   void processPointCloudMessageAndInsert(
       const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
       const Transformation& T_G_C, const bool is_freespace_pointcloud);
+  void insertPointcloud(const Transformation& T_G_C,
+                        const Pointcloud& ptcloud_C, const Colors& colors,
+                        const bool is_freespace_pointcloud);
   void integratePointcloud(const Transformation& T_G_C,
                            const Pointcloud& ptcloud_C, const Colors& colors,
                            const bool is_freespace_pointcloud);
 
+  // Multi sensor integration. The clouds of a batch are posed and converted,
+  // and then integrated together (counting as a single frame).
+  void servicePointcloudBatchQueue();
+  void insertPointcloudBatch(const AlignedVector<PosedScan>& scans);
+
   // Initializes the map
   bool mapIntialized() const { return !tsdf_submap_collection_ptr_->empty(); }
   void intializeMap(const Transformation& T_G_C);
 
   // Submap creation
+  void setupSubmapCreationPolicy();
+  void updateActiveSubmapState(const Transformation& T_G_C,
+                               const Pointcloud& points_C);
+  void updateActiveSubmapState(const AlignedVector<PosedScan>& scans);
+  void extendActiveSubmapExtent(const Transformation& T_G_C,
+                                const Pointcloud& points_C);
+  void updateActiveSubmapSize();
   bool newSubmapRequired() const;
   void createNewSubMap(const Transformation& T_G_C);
 
+  // The stages of pipelined ingestion
+  void setupPointcloudPipeline();
+  PointcloudPipeline::ConversionResult convertPointcloudStage(
+      const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
+      PointcloudFrame* frame_ptr);
+  void integratePointcloudStage(const PointcloudFrame& frame);
+  void visualizePointcloudStage(const Transformation& T_G_C);
 
   // Node handles
   ros::NodeHandle nh_;
@@ -116,20 +178,29 @@ class TsdfSubmapServer {
 
   // Subscribers
   ros::Subscriber pointcloud_sub_;
+  std::vector<ros::Subscriber> multi_sensor_pointcloud_subs_;
 
   // Publishers
   ros::Publisher active_submap_mesh_pub_;
+  ros::Publisher mesh_pub_;
   ros::Publisher submap_poses_pub_;
   ros::Publisher trajectory_pub_;
+  ros::Publisher metrics_pub_;
+  ros::Publisher submap_stream_pub_;
 
   // Services
   ros::ServiceServer generate_separated_mesh_srv_;
   ros::ServiceServer generate_combined_mesh_srv_;
   ros::ServiceServer save_map_srv_;
   ros::ServiceServer load_map_srv_;
+  ros::ServiceServer set_metrics_enabled_srv_;
+  ros::ServiceServer get_submap_stream_snapshot_srv_;
 
   // Timers.
   ros::Timer update_mesh_timer_;
+  ros::Timer update_whole_map_mesh_timer_;
+  ros::WallTimer metrics_timer_;
+  ros::WallTimer submap_stream_timer_;
 
   bool verbose_;
 
@@ -138,6 +209,28 @@ class TsdfSubmapServer {
 
   // The submap collection
   std::shared_ptr<SubmapCollection<TsdfSubmap>> tsdf_submap_collection_ptr_;
+  // Paging of finished submaps to disk
+  SubmapPagingConfig submap_paging_config_;
+  // The number of freed blocks kept for reuse by the collection
+  int max_pooled_blocks_;
+  // Integrating into revisited (previously finished) submaps
+  RevisitIntegrationConfig revisit_integration_config_;
+  // Merging the points of each scan per voxel before integrating
+  PointCloudDownsamplingConfig downsampling_config_;
+
+  // Incremental map saving. When enabled, saving appends a checkpoint of the
+  // changes since the last save to the file, rather than rewriting it.
+  bool use_incremental_map_saves_;
+  double checkpoint_max_file_size_ratio_;
+  std::unique_ptr<io::SubmapCollectionCheckpointer<TsdfSubmap>>
+      map_checkpointer_;
+
+  // Streaming the map. Off unless the period is positive.
+  double submap_stream_period_sec_;
+  io::SubmapStreamConfig submap_stream_config_;
+  std::unique_ptr<io::SubmapStreamPublisher<TsdfSubmap>>
+      submap_stream_publisher_;
+  std::vector<std::string> submap_stream_parts_buffer_;
 
   // The integrator
   std::shared_ptr<TsdfSubmapCollectionIntegrator>
@@ -146,9 +239,14 @@ class TsdfSubmapServer {
   // For meshing the entire collection to file
   std::shared_ptr<SubmapMesher> submap_mesher_ptr_;
   std::string mesh_filename_;
+  // Number of threads over which submaps are meshed for output
+  int num_meshing_threads_;
 
-  // For meshing the active layer
+  // For meshing the active layer. The mesh is published incrementally (as
+  // the changed blocks), and optionally (off by default) as a full marker of
+  // the active submap, rebuilt whenever its mesh changes.
   std::shared_ptr<ActiveSubmapVisualizer> active_submap_visualizer_ptr_;
+  bool publish_active_submap_mesh_marker_;
 
   // For visualizing the trajectory
   std::shared_ptr<TrajectoryVisualizer> trajectory_visualizer_ptr_;
@@ -159,6 +257,38 @@ class TsdfSubmapServer {
 
   // The queue of unprocessed pointclouds
   std::queue<sensor_msgs::PointCloud2::Ptr> pointcloud_queue_;
+  // Queue length above which we start dropping pointclouds
+  int max_pointcloud_queue_size_;
+
+  // Reused conversion buffers for the (non-pipelined) integration path
+  Pointcloud points_C_buffer_;
+  Colors colors_buffer_;
+
+  // Multi sensor ingestion. When pointcloud topics are given, the clouds of
+  // all topics are grouped by time, and each group is integrated as one batch.
+  std::vector<std::string> pointcloud_topics_;
+  PointcloudBatcher::Config pointcloud_batcher_config_;
+  std::unique_ptr<PointcloudBatcher> pointcloud_batcher_;
+  // The batches of unprocessed pointclouds, and reused buffers
+  std::queue<std::vector<sensor_msgs::PointCloud2::ConstPtr>>
+      pointcloud_batch_queue_;
+  std::vector<sensor_msgs::PointCloud2::ConstPtr> pointcloud_batch_buffer_;
+  AlignedVector<PosedScan> scan_batch_buffer_;
+
+  // Pipelined ingestion. When enabled, conversion, integration and
+  // visualization run on their own threads, and the queue above is unused.
+  bool use_pipelined_ingestion_;
+  PointcloudPipeline::Config pipeline_config_;
+  std::unique_ptr<PointcloudPipeline> pointcloud_pipeline_;
+
+  // Guards the submap collection and everything that modifies or reads it
+  // (integrator, visualizers, mesher) against concurrent access from the
+  // pipeline threads and ROS callbacks.
+  std::mutex map_mutex_;
+
+  // Latencies, queueing and submap sizes
+  ServerMetrics metrics_;
+  double metrics_publish_period_sec_;
 
   // Last message times for throttling input.
   ros::Duration min_time_between_msgs_;
@@ -167,10 +297,11 @@ class TsdfSubmapServer {
   /// Colormap to use for intensity pointclouds.
   std::unique_ptr<voxblox::ColorMap> color_map_;
 
-  // Number of frames integrated to the current submap
-  int num_integrated_frames_current_submap_;
   // The number of frames integrated into a submap before requesting a new one.
   int num_integrated_frames_per_submap_;
+  // Decides when to start a new submap, from the state of the active submap
+  SubmapCreationPolicy::Ptr submap_creation_policy_;
+  ActiveSubmapState active_submap_state_;
 };
 
 }  // namespace cblox
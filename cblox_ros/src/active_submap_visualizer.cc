@@ -1,9 +1,15 @@
 #include "cblox_ros/active_submap_visualizer.h"
 
+#include <algorithm>
+
 #include <cblox/mesh/submap_mesher.h>
 
 namespace cblox {
 
+using voxblox::BlockIndex;
+using voxblox::BlockIndexList;
+using voxblox::Mesh;
+
 void ActiveSubmapVisualizer::switchToActiveSubmap() {
   CHECK(tsdf_submap_collection_ptr_);
   // Getting the active submap ID
@@ -19,6 +25,28 @@ void ActiveSubmapVisualizer::switchToActiveSubmap() {
   }
 }
 
+void ActiveSubmapVisualizer::reset() {
+  active_submap_mesh_integrator_ptr_.reset();
+  active_submap_mesh_layer_ptr_.reset();
+  mesh_layers_.clear();
+  mesh_color_indices_.clear();
+  current_color_idx_ = 0;
+  block_G_to_contributors_.clear();
+  contributor_to_blocks_G_.clear();
+  contributed_pose_versions_.clear();
+  // Emptying (rather than dropping) the published blocks
+  if (mesh_layer_G_ptr_) {
+    BlockIndexList block_indices_G;
+    mesh_layer_G_ptr_->getAllAllocatedMeshes(&block_indices_G);
+    for (const BlockIndex& block_index_G : block_indices_G) {
+      Mesh::Ptr mesh_G_ptr =
+          mesh_layer_G_ptr_->getMeshPtrByIndex(block_index_G);
+      mesh_G_ptr->clear();
+      mesh_G_ptr->updated = true;
+    }
+  }
+}
+
 void ActiveSubmapVisualizer::createMeshLayer() {
   // Active layer stuff
   CHECK(tsdf_submap_collection_ptr_);
@@ -106,4 +134,160 @@ void ActiveSubmapVisualizer::getDisplayMesh(
   marker_ptr->id = tsdf_submap_collection_ptr_->getActiveSubMapID();
 }
 
+Color ActiveSubmapVisualizer::getSubmapColor(const SubmapID submap_id) const {
+  const auto color_it = mesh_color_indices_.find(submap_id);
+  const int color_idx =
+      (color_it != mesh_color_indices_.end()) ? color_it->second : 0;
+  return voxblox::rainbowColorMap(static_cast<double>(color_idx) /
+                                  static_cast<double>(color_cycle_length_ - 1));
+}
+
+void ActiveSubmapVisualizer::getDeltaMeshMsg(
+    voxblox_msgs::Mesh* mesh_msg_ptr) {
+  CHECK_NOTNULL(mesh_msg_ptr);
+  CHECK(active_submap_mesh_layer_ptr_) << "MeshLayer not initialized.";
+  if (!mesh_layer_G_ptr_) {
+    mesh_layer_G_ptr_.reset(
+        new MeshLayer(tsdf_submap_collection_ptr_->block_size()));
+  }
+  const SubmapID submap_id = tsdf_submap_collection_ptr_->getActiveSubMapID();
+  const TsdfSubmap::Ptr submap_ptr =
+      tsdf_submap_collection_ptr_->getActiveSubMapPtr();
+  const size_t pose_version = submap_ptr->getPoseVersion();
+  const Transformation T_G_S = submap_ptr->getPose();
+  auto& contributor_to_blocks_G = contributor_to_blocks_G_[submap_id];
+  // The blocks of the active mesh which changed. If the submap moved, all of
+  // its blocks (including the ones it contributed before) are re-added.
+  BlockIndexList changed_block_indices_S;
+  const auto pose_version_it = contributed_pose_versions_.find(submap_id);
+  if (pose_version_it == contributed_pose_versions_.end() ||
+      pose_version_it->second != pose_version) {
+    active_submap_mesh_layer_ptr_->getAllAllocatedMeshes(
+        &changed_block_indices_S);
+    for (const auto& contributor_blocks_pair : contributor_to_blocks_G) {
+      if (!active_submap_mesh_layer_ptr_->hasMesh(
+              contributor_blocks_pair.first)) {
+        changed_block_indices_S.push_back(contributor_blocks_pair.first);
+      }
+    }
+  } else {
+    active_submap_mesh_layer_ptr_->getAllUpdatedMeshes(
+        &changed_block_indices_S);
+  }
+  contributed_pose_versions_[submap_id] = pose_version;
+  // Re-binning the triangles of the changed blocks into the blocks of G
+  voxblox::IndexSet block_indices_to_rebuild_G;
+  for (const BlockIndex& block_index_S : changed_block_indices_S) {
+    const SubmapBlock contributor(submap_id, block_index_S);
+    // Dropping the previous contributions of this block
+    const auto blocks_G_it = contributor_to_blocks_G.find(block_index_S);
+    if (blocks_G_it != contributor_to_blocks_G.end()) {
+      for (const BlockIndex& block_index_G : blocks_G_it->second) {
+        block_indices_to_rebuild_G.insert(block_index_G);
+        SubmapBlockList& contributors =
+            block_G_to_contributors_[block_index_G];
+        contributors.erase(
+            std::remove(contributors.begin(), contributors.end(), contributor),
+            contributors.end());
+      }
+      contributor_to_blocks_G.erase(blocks_G_it);
+    }
+    if (!active_submap_mesh_layer_ptr_->hasMesh(block_index_S)) {
+      continue;
+    }
+    // Adding the new ones
+    Mesh::Ptr mesh_S_ptr =
+        active_submap_mesh_layer_ptr_->getMeshPtrByIndex(block_index_S);
+    mesh_S_ptr->updated = false;
+    voxblox::IndexSet block_indices_G;
+    for (size_t start_index = 0; start_index + 2 < mesh_S_ptr->vertices.size();
+         start_index += 3) {
+      const Point vertex_1_G = T_G_S * mesh_S_ptr->vertices[start_index];
+      block_indices_G.insert(
+          mesh_layer_G_ptr_->computeBlockIndexFromCoordinates(vertex_1_G));
+    }
+    if (block_indices_G.empty()) {
+      continue;
+    }
+    BlockIndexList& blocks_G = contributor_to_blocks_G[block_index_S];
+    for (const BlockIndex& block_index_G : block_indices_G) {
+      blocks_G.push_back(block_index_G);
+      block_G_to_contributors_[block_index_G].push_back(contributor);
+      block_indices_to_rebuild_G.insert(block_index_G);
+    }
+  }
+  rebuildMeshBlocks_G(block_indices_to_rebuild_G);
+  // Sending the rebuilt blocks (which are flagged as updated)
+  voxblox::generateVoxbloxMeshMsg(mesh_layer_G_ptr_, voxblox::ColorMode::kColor,
+                                  mesh_msg_ptr);
+}
+
+void ActiveSubmapVisualizer::rebuildMeshBlocks_G(
+    const voxblox::IndexSet& block_indices_G) {
+  // Clearing the blocks, and gathering the submap blocks contributing to them
+  std::map<SubmapID, voxblox::IndexSet> contributors;
+  for (const BlockIndex& block_index_G : block_indices_G) {
+    Mesh::Ptr mesh_G_ptr =
+        mesh_layer_G_ptr_->allocateMeshPtrByIndex(block_index_G);
+    mesh_G_ptr->clear();
+    mesh_G_ptr->updated = true;
+    const auto contributors_it = block_G_to_contributors_.find(block_index_G);
+    if (contributors_it == block_G_to_contributors_.end()) {
+      continue;
+    }
+    if (contributors_it->second.empty()) {
+      block_G_to_contributors_.erase(contributors_it);
+      continue;
+    }
+    for (const SubmapBlock& contributor : contributors_it->second) {
+      contributors[contributor.first].insert(contributor.second);
+    }
+  }
+  // Adding the triangles of the contributors which fall into the blocks
+  for (const auto& submap_blocks_pair : contributors) {
+    const SubmapID submap_id = submap_blocks_pair.first;
+    const auto mesh_layer_it = mesh_layers_.find(submap_id);
+    Transformation T_G_S;
+    if (mesh_layer_it == mesh_layers_.end() ||
+        !tsdf_submap_collection_ptr_->getSubMapPose(submap_id, &T_G_S)) {
+      continue;
+    }
+    const MeshLayer& mesh_layer_S = *mesh_layer_it->second;
+    const Color color = getSubmapColor(submap_id);
+    for (const BlockIndex& block_index_S : submap_blocks_pair.second) {
+      if (!mesh_layer_S.hasMesh(block_index_S)) {
+        continue;
+      }
+      const Mesh& mesh_S = mesh_layer_S.getMeshByIndex(block_index_S);
+      for (size_t start_index = 0; start_index + 2 < mesh_S.vertices.size();
+           start_index += 3) {
+        const Point vertex_1_G = T_G_S * mesh_S.vertices[start_index];
+        const BlockIndex block_index_G =
+            mesh_layer_G_ptr_->computeBlockIndexFromCoordinates(vertex_1_G);
+        if (block_indices_G.count(block_index_G) == 0) {
+          continue;
+        }
+        Mesh& mesh_G = *mesh_layer_G_ptr_->getMeshPtrByIndex(block_index_G);
+        mesh_G.vertices.push_back(vertex_1_G);
+        mesh_G.vertices.push_back(T_G_S * mesh_S.vertices[start_index + 1]);
+        mesh_G.vertices.push_back(T_G_S * mesh_S.vertices[start_index + 2]);
+        if (mesh_S.hasNormals()) {
+          for (size_t vertex_index = start_index;
+               vertex_index < start_index + 3; vertex_index++) {
+            mesh_G.normals.push_back(
+                T_G_S.getRotation().rotate(mesh_S.normals[vertex_index]));
+          }
+        }
+        mesh_G.colors.insert(mesh_G.colors.end(), 3, color);
+        if (mesh_S.hasTriangles()) {
+          const VertexIndex current_max_index = mesh_G.indices.size();
+          mesh_G.indices.push_back(current_max_index + 0);
+          mesh_G.indices.push_back(current_max_index + 1);
+          mesh_G.indices.push_back(current_max_index + 2);
+        }
+      }
+    }
+  }
+}
+
 }  // namespace cblox
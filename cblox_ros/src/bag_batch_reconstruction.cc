@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <tf2/buffer_core.h>
+#include <tf2/exceptions.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include <minkindr_conversions/kindr_msg.h>
+#include <voxblox/utils/color_maps.h>
+
+#include <cblox/integrator/batch_reconstructor.h>
+
+#include "cblox_ros/pointcloud_conversions.h"
+
+// Reconstructs a submap collection from the pointclouds (and TF) of a bag,
+// as fast as the CPU allows. Unlike playing the bag through the server, this
+// doesn't need a ROS master or clock, and integrates every pointcloud.
+
+DEFINE_string(bag, "", "The input bag.");
+DEFINE_string(pointcloud_topic, "/pointcloud", "The pointcloud topic.");
+DEFINE_string(world_frame, "world", "The frame the clouds are mapped in.");
+DEFINE_string(output_map, "", "The output submap collection file.");
+DEFINE_string(output_mesh, "", "The output (separated) mesh, as PLY.");
+DEFINE_int32(num_integrated_frames_per_submap, 20,
+             "Number of scans per submap.");
+DEFINE_double(voxel_size, 0.2, "TSDF voxel size (m).");
+DEFINE_int32(voxels_per_side, 16, "TSDF voxels per block side.");
+DEFINE_double(truncation_distance_vox, 4.0, "Truncation distance (voxels).");
+DEFINE_double(max_ray_length_m, 25.0, "Maximum integrated ray length (m).");
+DEFINE_string(method, "fast", "TSDF integrator (simple, merged or fast).");
+DEFINE_bool(mesh_in_background, true,
+            "Meshes finished submaps while integrating (with --output_mesh).");
+DEFINE_int32(num_meshing_threads, 2, "Threads for background meshing.");
+DEFINE_double(downsampling_voxel_size_factor, 0.0,
+              "Merges the points of each scan per cell of this size (in "
+              "voxels) before integrating. Disabled if zero.");
+
+namespace cblox {
+namespace {
+
+// Buffers all of the TF of the bag, such that each pointcloud can be looked
+// up at its stamp (also when the TF is recorded after the cloud).
+void bufferTransforms(const rosbag::Bag& bag, tf2::BufferCore* buffer_ptr) {
+  CHECK_NOTNULL(buffer_ptr);
+  const std::vector<std::string> tf_topics = {"/tf", "/tf_static"};
+  rosbag::View view(bag, rosbag::TopicQuery(tf_topics));
+  for (const rosbag::MessageInstance& message : view) {
+    const tf2_msgs::TFMessage::ConstPtr tf_msg =
+        message.instantiate<tf2_msgs::TFMessage>();
+    if (!tf_msg) {
+      continue;
+    }
+    const bool is_static = (message.getTopic() == "/tf_static");
+    for (const geometry_msgs::TransformStamped& transform :
+         tf_msg->transforms) {
+      buffer_ptr->setTransform(transform, "bag", is_static);
+    }
+  }
+}
+
+// Reads the pointclouds of the bag in order, with their poses. Clouds whose
+// pose can't be found are skipped (with a warning), not dropped silently.
+class BagScanSource {
+ public:
+  BagScanSource(const rosbag::Bag& bag, const tf2::BufferCore& tf_buffer)
+      : view_(bag, rosbag::TopicQuery(FLAGS_pointcloud_topic)),
+        it_(view_.begin()),
+        tf_buffer_(tf_buffer),
+        num_skipped_(0) {}
+
+  bool readNextScan(PosedScan* scan_ptr) {
+    CHECK_NOTNULL(scan_ptr);
+    for (; it_ != view_.end(); ++it_) {
+      const sensor_msgs::PointCloud2::ConstPtr pointcloud_msg =
+          it_->instantiate<sensor_msgs::PointCloud2>();
+      if (!pointcloud_msg) {
+        continue;
+      }
+      geometry_msgs::TransformStamped T_G_C_msg;
+      try {
+        T_G_C_msg = tf_buffer_.lookupTransform(FLAGS_world_frame,
+                                               pointcloud_msg->header.frame_id,
+                                               pointcloud_msg->header.stamp);
+      } catch (const tf2::TransformException& exception) {
+        LOG(WARNING) << "Skipping a pointcloud without pose: "
+                     << exception.what();
+        num_skipped_++;
+        continue;
+      }
+      kindr::minimal::QuatTransformationTemplate<double> T_G_C;
+      tf::transformMsgToKindr(T_G_C_msg.transform, &T_G_C);
+      scan_ptr->T_G_C = T_G_C.cast<FloatingPoint>();
+      if (!convertPointcloudMsg(color_map_, *pointcloud_msg,
+                                &scan_ptr->points_C, &scan_ptr->colors)) {
+        LOG(WARNING) << "Skipping a malformed pointcloud.";
+        num_skipped_++;
+        continue;
+      }
+      ++it_;
+      return true;
+    }
+    return false;
+  }
+
+  size_t getNumSkipped() const { return num_skipped_; }
+
+ private:
+  rosbag::View view_;
+  rosbag::View::iterator it_;
+  const tf2::BufferCore& tf_buffer_;
+  const voxblox::GrayscaleColorMap color_map_;
+  size_t num_skipped_;
+};
+
+int runBagBatchReconstruction() {
+  if (FLAGS_bag.empty() ||
+      (FLAGS_output_map.empty() && FLAGS_output_mesh.empty())) {
+    LOG(ERROR) << "Specify --bag and --output_map and/or --output_mesh.";
+    return 1;
+  }
+  rosbag::Bag bag;
+  try {
+    bag.open(FLAGS_bag, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& exception) {
+    LOG(ERROR) << "Could not open " << FLAGS_bag << ": " << exception.what();
+    return 1;
+  }
+  // NOTE: The TF cache covers the whole bag.
+  const rosbag::View full_view(bag);
+  tf2::BufferCore tf_buffer(full_view.getEndTime() - full_view.getBeginTime() +
+                            ros::Duration(1.0));
+  bufferTransforms(bag, &tf_buffer);
+  // The configs
+  TsdfMap::Config tsdf_map_config;
+  tsdf_map_config.tsdf_voxel_size = FLAGS_voxel_size;
+  tsdf_map_config.tsdf_voxels_per_side = FLAGS_voxels_per_side;
+  voxblox::TsdfIntegratorBase::Config tsdf_integrator_config;
+  tsdf_integrator_config.default_truncation_distance =
+      FLAGS_truncation_distance_vox * FLAGS_voxel_size;
+  tsdf_integrator_config.max_ray_length_m = FLAGS_max_ray_length_m;
+  BatchReconstructionConfig config;
+  config.num_integrated_frames_per_submap =
+      static_cast<size_t>(std::max(FLAGS_num_integrated_frames_per_submap, 1));
+  config.mesh_finished_submaps =
+      FLAGS_mesh_in_background && !FLAGS_output_mesh.empty();
+  config.num_meshing_threads =
+      static_cast<size_t>(std::max(FLAGS_num_meshing_threads, 1));
+  config.downsampling_config.enable =
+      (FLAGS_downsampling_voxel_size_factor > 0.0);
+  config.downsampling_config.voxel_size_factor =
+      static_cast<FloatingPoint>(FLAGS_downsampling_voxel_size_factor);
+  // Reconstructing
+  BatchReconstructor reconstructor(
+      tsdf_map_config, tsdf_integrator_config,
+      getTsdfIntegratorTypeFromName(FLAGS_method),
+      voxblox::MeshIntegratorConfig(), config);
+  BagScanSource scan_source(bag, tf_buffer);
+  reconstructor.run([&scan_source](PosedScan* scan_ptr) {
+    return scan_source.readNextScan(scan_ptr);
+  });
+  if (scan_source.getNumSkipped() > 0) {
+    LOG(WARNING) << "Skipped " << scan_source.getNumSkipped()
+                 << " pointclouds without pose.";
+  }
+  // Output
+  if (!FLAGS_output_map.empty() && !reconstructor.saveMap(FLAGS_output_map)) {
+    LOG(ERROR) << "Could not save the map to: " << FLAGS_output_map;
+    return 1;
+  }
+  if (!FLAGS_output_mesh.empty() &&
+      !reconstructor.saveMesh(FLAGS_output_mesh)) {
+    LOG(ERROR) << "Could not save the mesh to: " << FLAGS_output_mesh;
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace cblox
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InstallFailureSignalHandler();
+  // For ros::Time, without a ROS master
+  ros::Time::init();
+  return cblox::runBagBatchReconstruction();
+}
@@ -0,0 +1,77 @@
+#include "cblox_ros/pointcloud_batcher.h"
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+PointcloudBatcher::PointcloudBatcher(const Config& config)
+    : config_(config), queues_(config.num_sensors) {
+  CHECK_GT(config_.num_sensors, 0u);
+  CHECK_GT(config_.max_queue_size_per_sensor, 0u);
+}
+
+size_t PointcloudBatcher::addMessage(
+    const size_t sensor_index,
+    const sensor_msgs::PointCloud2::ConstPtr& pointcloud_msg) {
+  CHECK_LT(sensor_index, queues_.size());
+  CHECK(pointcloud_msg);
+  std::deque<sensor_msgs::PointCloud2::ConstPtr>& queue =
+      queues_[sensor_index];
+  size_t num_dropped = 0;
+  while (queue.size() >= config_.max_queue_size_per_sensor) {
+    queue.pop_front();
+    num_dropped++;
+  }
+  queue.push_back(pointcloud_msg);
+  if (pointcloud_msg->header.stamp > latest_stamp_) {
+    latest_stamp_ = pointcloud_msg->header.stamp;
+  }
+  return num_dropped;
+}
+
+bool PointcloudBatcher::getNextBatch(
+    std::vector<sensor_msgs::PointCloud2::ConstPtr>* batch) {
+  CHECK_NOTNULL(batch);
+  // The oldest pending cloud opens the window
+  bool any_pending = false;
+  ros::Time window_start;
+  for (const auto& queue : queues_) {
+    if (!queue.empty() &&
+        (!any_pending || queue.front()->header.stamp < window_start)) {
+      window_start = queue.front()->header.stamp;
+      any_pending = true;
+    }
+  }
+  if (!any_pending) {
+    return false;
+  }
+  const ros::Time window_end = window_start + config_.sync_window;
+  bool all_sensors_present = true;
+  for (const auto& queue : queues_) {
+    if (queue.empty() || queue.front()->header.stamp > window_end) {
+      all_sensors_present = false;
+      break;
+    }
+  }
+  if (!all_sensors_present && latest_stamp_ <= window_end) {
+    return false;
+  }
+  batch->clear();
+  for (auto& queue : queues_) {
+    if (!queue.empty() && queue.front()->header.stamp <= window_end) {
+      batch->push_back(queue.front());
+      queue.pop_front();
+    }
+  }
+  return true;
+}
+
+size_t PointcloudBatcher::getNumPendingMessages() const {
+  size_t num_pending = 0;
+  for (const auto& queue : queues_) {
+    num_pending += queue.size();
+  }
+  return num_pending;
+}
+
+}  // namespace cblox
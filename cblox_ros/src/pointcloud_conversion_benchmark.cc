@@ -0,0 +1,104 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include <glog/logging.h>
+#include <pcl/point_types.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <ros/ros.h>
+
+#include <voxblox/utils/color_maps.h>
+
+#include "cblox_ros/pointcloud_conversions.h"
+
+// Compares the direct PointCloud2 conversion with the conversion going through
+// PCL, on synthetic KITTI sized (~130k point) scans.
+
+namespace {
+
+constexpr size_t kNumPoints = 130000;
+constexpr int kNumRepetitions = 50;
+// Fraction of points which are NaN (no return).
+constexpr double kNanFraction = 0.05;
+
+template <typename PointType>
+sensor_msgs::PointCloud2::Ptr createPointcloudMsg() {
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<float> position_distribution(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> unit_distribution(0.0f, 1.0f);
+  pcl::PointCloud<PointType> pointcloud_pcl;
+  pointcloud_pcl.points.resize(kNumPoints);
+  for (PointType& point : pointcloud_pcl.points) {
+    if (unit_distribution(generator) < kNanFraction) {
+      point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+    } else {
+      point.x = position_distribution(generator);
+      point.y = position_distribution(generator);
+      point.z = position_distribution(generator);
+    }
+  }
+  pointcloud_pcl.width = pointcloud_pcl.points.size();
+  pointcloud_pcl.height = 1;
+  pointcloud_pcl.is_dense = false;
+  sensor_msgs::PointCloud2::Ptr pointcloud_msg(new sensor_msgs::PointCloud2);
+  pcl::toROSMsg(pointcloud_pcl, *pointcloud_msg);
+  return pointcloud_msg;
+}
+
+// Returns the mean time per conversion in milliseconds.
+template <typename ConversionFunction>
+double timeConversion(const ConversionFunction& conversion_function,
+                      const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
+                      size_t* num_points_out) {
+  const voxblox::GrayscaleColorMap color_map;
+  cblox::Pointcloud points_C;
+  cblox::Colors colors;
+  const ros::WallTime start = ros::WallTime::now();
+  for (int repetition = 0; repetition < kNumRepetitions; repetition++) {
+    points_C.clear();
+    colors.clear();
+    conversion_function(color_map, pointcloud_msg, &points_C, &colors);
+  }
+  const ros::WallTime end = ros::WallTime::now();
+  *num_points_out = points_C.size();
+  return (end - start).toSec() * 1000.0 / kNumRepetitions;
+}
+
+void runBenchmark(const std::string& name,
+                  const sensor_msgs::PointCloud2::Ptr& pointcloud_msg) {
+  size_t num_points_direct = 0;
+  size_t num_points_pcl = 0;
+  const double direct_ms = timeConversion(
+      [](const voxblox::ColorMap& color_map,
+         const sensor_msgs::PointCloud2::Ptr& msg, cblox::Pointcloud* points,
+         cblox::Colors* colors) {
+        CHECK(cblox::convertPointcloudMsg(color_map, *msg, points, colors));
+      },
+      pointcloud_msg, &num_points_direct);
+  const double pcl_ms = timeConversion(
+      [](const voxblox::ColorMap& color_map,
+         const sensor_msgs::PointCloud2::Ptr& msg, cblox::Pointcloud* points,
+         cblox::Colors* colors) {
+        cblox::convertPointcloudMsgThroughPcl(color_map, msg, points, colors);
+      },
+      pointcloud_msg, &num_points_pcl);
+  CHECK_EQ(num_points_direct, num_points_pcl)
+      << "The conversions disagree on the number of valid points.";
+  std::cout << name << ": " << num_points_direct << " valid points. direct: "
+            << direct_ms << " ms, pcl: " << pcl_ms
+            << " ms, speedup: " << pcl_ms / direct_ms << "x" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  // For ros::WallTime
+  ros::WallTime::init();
+
+  runBenchmark("xyzi", createPointcloudMsg<pcl::PointXYZI>());
+  runBenchmark("xyzrgb", createPointcloudMsg<pcl::PointXYZRGB>());
+  return 0;
+}
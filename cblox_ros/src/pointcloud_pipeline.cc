@@ -0,0 +1,172 @@
+#include "cblox_ros/pointcloud_pipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <utility>
+
+namespace cblox {
+
+// How long an idle stage sleeps before checking its input queue again.
+constexpr int kIdleSleepUs = 500;
+
+void PipelineStageStats::addProcessed(const ros::WallDuration& latency) {
+  const uint64_t latency_us = static_cast<uint64_t>(latency.toNSec() / 1000);
+  num_processed_++;
+  total_latency_us_ += latency_us;
+  // Lock-free max update
+  uint64_t current_max = max_latency_us_.load();
+  while (latency_us > current_max &&
+         !max_latency_us_.compare_exchange_weak(current_max, latency_us)) {
+  }
+}
+
+double PipelineStageStats::mean_latency_sec() const {
+  const uint64_t num_processed = num_processed_;
+  if (num_processed == 0) {
+    return 0.0;
+  }
+  return (static_cast<double>(total_latency_us_) * 1.0e-6) /
+         static_cast<double>(num_processed);
+}
+
+PointcloudPipeline::PointcloudPipeline(
+    const Config& config, const ConversionFunction& conversion_function,
+    const IntegrationFunction& integration_function,
+    const VisualizationFunction& visualization_function)
+    : conversion_function_(conversion_function),
+      integration_function_(integration_function),
+      visualization_function_(visualization_function),
+      message_queue_(config.message_queue_size),
+      frame_queue_(config.frame_queue_size),
+      pose_queue_(config.pose_queue_size),
+      running_(false) {
+  CHECK(conversion_function_);
+  CHECK(integration_function_);
+  CHECK(visualization_function_);
+}
+
+void PointcloudPipeline::start() {
+  if (running_) {
+    return;
+  }
+  running_ = true;
+  conversion_thread_ = std::thread(&PointcloudPipeline::conversionLoop, this);
+  integration_thread_ = std::thread(&PointcloudPipeline::integrationLoop, this);
+  visualization_thread_ =
+      std::thread(&PointcloudPipeline::visualizationLoop, this);
+}
+
+void PointcloudPipeline::stop() {
+  running_ = false;
+  if (conversion_thread_.joinable()) {
+    conversion_thread_.join();
+  }
+  if (integration_thread_.joinable()) {
+    integration_thread_.join();
+  }
+  if (visualization_thread_.joinable()) {
+    visualization_thread_.join();
+  }
+}
+
+bool PointcloudPipeline::addMessage(
+    const sensor_msgs::PointCloud2::Ptr& pointcloud_msg) {
+  CHECK(pointcloud_msg);
+  if (!message_queue_.push(pointcloud_msg)) {
+    conversion_stats_.addDropped();
+    ROS_ERROR_THROTTLE(60,
+                       "Pointcloud pipeline input queue full! Dropping "
+                       "pointclouds. Either unable to look up transform "
+                       "timestamps or the processing is taking too long.");
+    return false;
+  }
+  return true;
+}
+
+void PointcloudPipeline::conversionLoop() {
+  sensor_msgs::PointCloud2::Ptr pending_msg;
+  PointcloudFrame frame;
+  while (running_) {
+    // NOTE: pending_msg is always empty when popping, so no stale message is
+    //       left behind in the queue.
+    if (!pending_msg && !message_queue_.pop(&pending_msg)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+      continue;
+    }
+    const ros::WallTime start = ros::WallTime::now();
+    const ConversionResult result = conversion_function_(pending_msg, &frame);
+    if (result == ConversionResult::kDropped) {
+      pending_msg.reset();
+      conversion_stats_.addDropped();
+      continue;
+    }
+    if (result == ConversionResult::kRetryLater) {
+      // The message can't be converted yet. If newer messages are backing up
+      // behind it we give up on it, otherwise we try again later.
+      if (message_queue_.size() >= message_queue_.capacity()) {
+        pending_msg.reset();
+        conversion_stats_.addDropped();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+      }
+      continue;
+    }
+    pending_msg.reset();
+    conversion_stats_.addProcessed(ros::WallTime::now() - start);
+    // Handing over to integration. Waiting here applies back-pressure to the
+    // message queue, such that any dropping happens before conversion.
+    // NOTE: The push hands back an already integrated frame, the buffers of
+    //       which are reused for the next conversion.
+    while (running_ && !frame_queue_.push(&frame)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+    }
+  }
+}
+
+void PointcloudPipeline::integrationLoop() {
+  PointcloudFrame frame;
+  while (running_) {
+    if (!frame_queue_.pop(&frame)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+      continue;
+    }
+    const ros::WallTime start = ros::WallTime::now();
+    integration_function_(frame);
+    integration_stats_.addProcessed(ros::WallTime::now() - start);
+    // Visualization is best effort, we never wait for it.
+    if (!pose_queue_.push(frame.T_G_C)) {
+      visualization_stats_.addDropped();
+    }
+  }
+}
+
+void PointcloudPipeline::visualizationLoop() {
+  Transformation T_G_C;
+  while (running_) {
+    if (!pose_queue_.pop(&T_G_C)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(kIdleSleepUs));
+      continue;
+    }
+    const ros::WallTime start = ros::WallTime::now();
+    visualization_function_(T_G_C);
+    visualization_stats_.addProcessed(ros::WallTime::now() - start);
+  }
+}
+
+std::string PointcloudPipeline::printStats() const {
+  std::stringstream ss;
+  const auto print_stage = [&ss](const std::string& name,
+                                 const PipelineStageStats& stats) {
+    ss << name << ": processed: " << stats.num_processed()
+       << ", dropped: " << stats.num_dropped()
+       << ", mean latency: " << stats.mean_latency_sec()
+       << " s, max latency: " << stats.max_latency_sec() << " s" << std::endl;
+  };
+  print_stage("conversion", conversion_stats_);
+  print_stage("integration", integration_stats_);
+  print_stage("visualization", visualization_stats_);
+  return ss.str();
+}
+
+}  // namespace cblox
@@ -0,0 +1,254 @@
+#include "cblox_ros/server_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+namespace cblox {
+
+namespace {
+
+// Lock-free max update
+void updateMax(const uint64_t value, std::atomic<uint64_t>* max_ptr) {
+  uint64_t current_max = max_ptr->load();
+  while (value > current_max &&
+         !max_ptr->compare_exchange_weak(current_max, value)) {
+  }
+}
+
+diagnostic_msgs::KeyValue makeKeyValue(const std::string& key,
+                                       const double value) {
+  diagnostic_msgs::KeyValue key_value;
+  key_value.key = key;
+  key_value.value = std::to_string(value);
+  return key_value;
+}
+
+void addLatencySummary(const std::string& name,
+                       const LatencyHistogram::Summary& summary,
+                       diagnostic_msgs::DiagnosticStatus* status_ptr) {
+  constexpr double kSecToMs = 1000.0;
+  status_ptr->values.push_back(
+      makeKeyValue(name + "_count", static_cast<double>(summary.count)));
+  status_ptr->values.push_back(
+      makeKeyValue(name + "_mean_ms", kSecToMs * summary.mean_sec));
+  status_ptr->values.push_back(
+      makeKeyValue(name + "_p50_ms", kSecToMs * summary.p50_sec));
+  status_ptr->values.push_back(
+      makeKeyValue(name + "_p99_ms", kSecToMs * summary.p99_sec));
+  status_ptr->values.push_back(
+      makeKeyValue(name + "_max_ms", kSecToMs * summary.max_sec));
+}
+
+}  // namespace
+
+constexpr size_t LatencyHistogram::kBucketsPerDoubling;
+constexpr size_t LatencyHistogram::kNumBuckets;
+
+LatencyHistogram::LatencyHistogram() { reset(); }
+
+void LatencyHistogram::record(const ros::WallDuration& latency) {
+  const uint64_t latency_us =
+      static_cast<uint64_t>(std::max<int64_t>(latency.toNSec() / 1000, 0));
+  bucket_counts_[getBucketIndex(latency_us)]++;
+  count_++;
+  total_latency_us_ += latency_us;
+  updateMax(latency_us, &max_latency_us_);
+}
+
+LatencyHistogram::Summary LatencyHistogram::summarize() const {
+  Summary summary;
+  summary.count = count_;
+  if (summary.count == 0) {
+    return summary;
+  }
+  summary.mean_sec = static_cast<double>(total_latency_us_) * 1.0e-6 /
+                     static_cast<double>(summary.count);
+  summary.max_sec = static_cast<double>(max_latency_us_) * 1.0e-6;
+  // NOTE: The bucket estimates are capped by the exact maximum, which matters
+  //       for the sparse upper buckets.
+  summary.p50_sec =
+      std::min(getPercentileSec(0.5, summary.count), summary.max_sec);
+  summary.p99_sec =
+      std::min(getPercentileSec(0.99, summary.count), summary.max_sec);
+  return summary;
+}
+
+void LatencyHistogram::reset() {
+  for (std::atomic<uint64_t>& bucket_count : bucket_counts_) {
+    bucket_count = 0;
+  }
+  count_ = 0;
+  total_latency_us_ = 0;
+  max_latency_us_ = 0;
+}
+
+size_t LatencyHistogram::getBucketIndex(const uint64_t latency_us) {
+  if (latency_us == 0) {
+    return 0;
+  }
+  const size_t bucket_index = static_cast<size_t>(
+      std::log2(static_cast<double>(latency_us)) * kBucketsPerDoubling);
+  return std::min(bucket_index, kNumBuckets - 1);
+}
+
+double LatencyHistogram::getBucketLatencySec(const size_t bucket_index) {
+  // The (geometric) middle of the bucket
+  return std::exp2((static_cast<double>(bucket_index) + 0.5) /
+                   kBucketsPerDoubling) *
+         1.0e-6;
+}
+
+double LatencyHistogram::getPercentileSec(const double fraction,
+                                          const uint64_t count) const {
+  const uint64_t target_count =
+      std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * count)), 1);
+  uint64_t cumulative_count = 0;
+  for (size_t bucket_index = 0; bucket_index < kNumBuckets; bucket_index++) {
+    cumulative_count += bucket_counts_[bucket_index];
+    if (cumulative_count >= target_count) {
+      return getBucketLatencySec(bucket_index);
+    }
+  }
+  return getBucketLatencySec(kNumBuckets - 1);
+}
+
+ServerMetrics::ServerMetrics()
+    : enabled_(false),
+      max_queue_depth_(0),
+      num_dropped_messages_(0),
+      num_downsampling_input_points_(0),
+      num_downsampling_output_points_(0),
+      total_num_frames_(0),
+      total_num_dropped_messages_(0) {}
+
+void ServerMetrics::recordConversion(const ros::WallDuration& latency) {
+  if (enabled_) {
+    conversion_latency_.record(latency);
+  }
+}
+
+void ServerMetrics::recordIntegration(const ros::WallDuration& latency) {
+  total_num_frames_++;
+  if (enabled_) {
+    integration_latency_.record(latency);
+  }
+}
+
+void ServerMetrics::recordMeshing(const ros::WallDuration& latency) {
+  if (enabled_) {
+    meshing_latency_.record(latency);
+  }
+}
+
+void ServerMetrics::recordQueueDepth(const size_t queue_depth) {
+  if (enabled_) {
+    updateMax(queue_depth, &max_queue_depth_);
+  }
+}
+
+void ServerMetrics::recordDroppedMessages(const size_t num_dropped) {
+  // NOTE: Drops are always counted, as they are rare and the total is of
+  //       interest when enabling the metrics later.
+  num_dropped_messages_ += num_dropped;
+  total_num_dropped_messages_ += num_dropped;
+}
+
+void ServerMetrics::recordDownsampling(const size_t num_input_points,
+                                       const size_t num_output_points) {
+  if (enabled_) {
+    num_downsampling_input_points_ += num_input_points;
+    num_downsampling_output_points_ += num_output_points;
+  }
+}
+
+void ServerMetrics::getDiagnostics(
+    const std::vector<TsdfSubmap::ConstPtr>& submaps,
+    diagnostic_msgs::DiagnosticArray* diagnostics_ptr) {
+  CHECK_NOTNULL(diagnostics_ptr);
+  diagnostics_ptr->header.stamp = ros::Time::now();
+  // Latencies
+  diagnostic_msgs::DiagnosticStatus latency_status;
+  latency_status.name = "cblox: latency";
+  latency_status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  latency_status.message = "Per frame latencies since the last update";
+  addLatencySummary("conversion", conversion_latency_.summarize(),
+                    &latency_status);
+  addLatencySummary("integration", integration_latency_.summarize(),
+                    &latency_status);
+  addLatencySummary("meshing", meshing_latency_.summarize(), &latency_status);
+  conversion_latency_.reset();
+  integration_latency_.reset();
+  meshing_latency_.reset();
+  diagnostics_ptr->status.push_back(latency_status);
+  // Input
+  diagnostic_msgs::DiagnosticStatus input_status;
+  input_status.name = "cblox: input";
+  const uint64_t num_dropped_messages = num_dropped_messages_.exchange(0);
+  if (num_dropped_messages > 0) {
+    input_status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+    input_status.message = "Dropping pointclouds";
+  } else {
+    input_status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    input_status.message = "OK";
+  }
+  input_status.values.push_back(makeKeyValue(
+      "max_queue_depth", static_cast<double>(max_queue_depth_.exchange(0))));
+  input_status.values.push_back(makeKeyValue(
+      "dropped_messages", static_cast<double>(num_dropped_messages)));
+  input_status.values.push_back(makeKeyValue(
+      "total_dropped_messages",
+      static_cast<double>(total_num_dropped_messages_)));
+  input_status.values.push_back(makeKeyValue(
+      "total_integrated_frames", static_cast<double>(total_num_frames_)));
+  const uint64_t num_downsampling_input_points =
+      num_downsampling_input_points_.exchange(0);
+  const uint64_t num_downsampling_output_points =
+      num_downsampling_output_points_.exchange(0);
+  if (num_downsampling_input_points > 0) {
+    input_status.values.push_back(
+        makeKeyValue("downsampling_input_points",
+                     static_cast<double>(num_downsampling_input_points)));
+    input_status.values.push_back(
+        makeKeyValue("downsampling_output_points",
+                     static_cast<double>(num_downsampling_output_points)));
+    input_status.values.push_back(makeKeyValue(
+        "downsampling_reduction_ratio",
+        1.0 - static_cast<double>(num_downsampling_output_points) /
+                  static_cast<double>(num_downsampling_input_points)));
+  }
+  diagnostics_ptr->status.push_back(input_status);
+  // Submaps
+  diagnostic_msgs::DiagnosticStatus submaps_status;
+  submaps_status.name = "cblox: submaps";
+  submaps_status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  submaps_status.message = "Allocated blocks and resident bytes of the submaps";
+  // NOTE: Aggregated, rather than per submap, such that the message size
+  //       doesn't grow with the map.
+  size_t total_num_blocks = 0;
+  size_t total_num_bytes = 0;
+  size_t max_num_blocks = 0;
+  size_t max_num_bytes = 0;
+  for (const TsdfSubmap::ConstPtr& submap_ptr : submaps) {
+    const size_t num_blocks = submap_ptr->getNumberAllocatedBlocks();
+    const size_t num_bytes = submap_ptr->getResidentMemoryBytes();
+    total_num_blocks += num_blocks;
+    total_num_bytes += num_bytes;
+    max_num_blocks = std::max(max_num_blocks, num_blocks);
+    max_num_bytes = std::max(max_num_bytes, num_bytes);
+  }
+  submaps_status.values.push_back(
+      makeKeyValue("num_submaps", static_cast<double>(submaps.size())));
+  submaps_status.values.push_back(
+      makeKeyValue("total_blocks", static_cast<double>(total_num_blocks)));
+  submaps_status.values.push_back(
+      makeKeyValue("total_bytes", static_cast<double>(total_num_bytes)));
+  submaps_status.values.push_back(
+      makeKeyValue("max_submap_blocks", static_cast<double>(max_num_blocks)));
+  submaps_status.values.push_back(
+      makeKeyValue("max_submap_bytes", static_cast<double>(max_num_bytes)));
+  diagnostics_ptr->status.push_back(submaps_status);
+}
+
+}  // namespace cblox
@@ -0,0 +1,137 @@
+#include "cblox_ros/submap_stream_client.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <visualization_msgs/Marker.h>
+
+#include <voxblox_ros/mesh_vis.h>
+#include <voxblox_ros/ros_params.h>
+
+#include "cblox_ros/ros_params.h"
+
+namespace cblox {
+
+SubmapStreamClient::SubmapStreamClient(const ros::NodeHandle& nh,
+                                       const ros::NodeHandle& nh_private)
+    : SubmapStreamClient(
+          nh, nh_private, voxblox::getTsdfMapConfigFromRosParam(nh_private),
+          voxblox::getMeshIntegratorConfigFromRosParam(nh_private)) {}
+
+SubmapStreamClient::SubmapStreamClient(
+    const ros::NodeHandle& nh, const ros::NodeHandle& nh_private,
+    const TsdfMap::Config& tsdf_map_config,
+    const voxblox::MeshIntegratorConfig& mesh_config)
+    : nh_(nh), nh_private_(nh_private), world_frame_("world") {
+  nh_private_.param("world_frame", world_frame_, world_frame_);
+  int num_threads = static_cast<int>(getDefaultNumThreads());
+  nh_private_.param("num_threads", num_threads, num_threads);
+  double snapshot_retry_period_sec = 1.0;
+  nh_private_.param("snapshot_retry_period_sec", snapshot_retry_period_sec,
+                    snapshot_retry_period_sec);
+  double update_mesh_every_n_sec = 1.0;
+  nh_private_.param("update_mesh_every_n_sec", update_mesh_every_n_sec,
+                    update_mesh_every_n_sec);
+
+  // The mirrored collection
+  // NOTE: The voxel size has to match that of the server.
+  submap_collection_ptr_.reset(
+      new SubmapCollection<TsdfSubmap>(tsdf_map_config));
+  receiver_ptr_.reset(new io::SubmapStreamReceiver<TsdfSubmap>(
+      submap_collection_ptr_, 1000,
+      static_cast<size_t>(std::max(num_threads, 1))));
+  submap_mesher_ptr_.reset(
+      new SubmapMesher(tsdf_map_config, mesh_config,
+                       static_cast<size_t>(std::max(num_threads, 1))));
+  submap_mesher_ptr_->setLodConfig(getMeshLodConfigFromRosParam(nh_private_));
+
+  // Subscribing first, such that the deltas after the snapshot are received
+  submap_stream_sub_ =
+      nh_.subscribe("submap_stream", 100,
+                    &SubmapStreamClient::submapStreamCallback, this);
+  snapshot_client_ = nh_.serviceClient<cblox_ros::GetSubmapStreamSnapshot>(
+      "get_submap_stream_snapshot");
+  mesh_pub_ =
+      nh_private_.advertise<visualization_msgs::Marker>("separated_mesh", 1);
+  save_map_srv_ = nh_private_.advertiseService(
+      "save_map", &SubmapStreamClient::saveMapCallback, this);
+
+  catch_up_timer_ = nh_private_.createWallTimer(
+      ros::WallDuration(std::max(snapshot_retry_period_sec, 0.01)),
+      &SubmapStreamClient::catchUpEvent, this);
+  if (update_mesh_every_n_sec > 0.0) {
+    update_mesh_timer_ = nh_private_.createWallTimer(
+        ros::WallDuration(update_mesh_every_n_sec),
+        &SubmapStreamClient::updateMeshEvent, this);
+  }
+}
+
+void SubmapStreamClient::submapStreamCallback(
+    const cblox_ros::SubmapStreamUpdate::ConstPtr& update_msg) {
+  const std::string bytes(update_msg->data.begin(), update_msg->data.end());
+  if (!receiver_ptr_->addUpdatePart(bytes)) {
+    ROS_WARN("Could not apply a part of the submap stream.");
+  }
+}
+
+void SubmapStreamClient::catchUpEvent(const ros::WallTimerEvent& /*event*/) {
+  if (receiver_ptr_->requiresSnapshot()) {
+    requestSnapshot();
+  }
+}
+
+bool SubmapStreamClient::requestSnapshot() {
+  cblox_ros::GetSubmapStreamSnapshot snapshot_srv;
+  if (!snapshot_client_.call(snapshot_srv)) {
+    ROS_WARN_THROTTLE(10.0, "Could not get a submap stream snapshot from: %s",
+                      snapshot_client_.getService().c_str());
+    return false;
+  }
+  for (const cblox_ros::SubmapStreamUpdate& part :
+       snapshot_srv.response.parts) {
+    const std::string bytes(part.data.begin(), part.data.end());
+    if (!receiver_ptr_->addUpdatePart(bytes)) {
+      ROS_WARN("Could not apply the submap stream snapshot.");
+      return false;
+    }
+  }
+  ROS_INFO_STREAM("Caught up with the submap stream at delta "
+                  << receiver_ptr_->getSequenceNumber() << ", "
+                  << submap_collection_ptr_->size() << " submaps.");
+  return true;
+}
+
+void SubmapStreamClient::updateMeshEvent(
+    const ros::WallTimerEvent& /*event*/) {
+  if (mesh_pub_.getNumSubscribers() == 0) {
+    return;
+  }
+  // With level of detail, submaps far from the active one are meshed coarser
+  Transformation T_G_S_active;
+  if (submap_collection_ptr_->getSubMapPose(receiver_ptr_->getActiveSubmapID(),
+                                            &T_G_S_active)) {
+    submap_mesher_ptr_->setLodViewpoint(T_G_S_active.getPosition());
+  }
+  // Only submaps which changed since the last update are re-meshed
+  submap_mesher_ptr_->updateMeshCache(*submap_collection_ptr_);
+  std::vector<SubmapID> submap_ids;
+  std::vector<MeshLayer::ConstPtr> mesh_layers_G;
+  submap_mesher_ptr_->getCachedMeshLayers(&submap_ids, &mesh_layers_G);
+  for (size_t submap_index = 0; submap_index < submap_ids.size();
+       submap_index++) {
+    visualization_msgs::Marker marker;
+    voxblox::fillMarkerWithMesh(mesh_layers_G[submap_index],
+                                voxblox::ColorMode::kLambertColor, &marker);
+    marker.id = submap_ids[submap_index];
+    marker.header.frame_id = world_frame_;
+    mesh_pub_.publish(marker);
+  }
+}
+
+bool SubmapStreamClient::saveMapCallback(
+    voxblox_msgs::FilePath::Request& request,
+    voxblox_msgs::FilePath::Response& /*response*/) {  // NOLINT
+  return submap_collection_ptr_->saveToFile(request.file_path);
+}
+
+}  // namespace cblox
@@ -0,0 +1,18 @@
+#include <glog/logging.h>
+#include <ros/ros.h>
+
+#include "cblox_ros/submap_stream_client.h"
+
+int main(int argc, char** argv) {
+  ros::init(argc, argv, "submap_stream_client");
+  google::InitGoogleLogging(argv[0]);
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InstallFailureSignalHandler();
+  ros::NodeHandle nh;
+  ros::NodeHandle nh_private("~");
+
+  cblox::SubmapStreamClient node(nh, nh_private);
+
+  ros::spin();
+  return 0;
+}
@@ -1,5 +1,9 @@
 #include "cblox_ros/tsdf_submap_server.h"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
 #include <geometry_msgs/PoseArray.h>
 #include <nav_msgs/Path.h>
 #include <visualization_msgs/Marker.h>
@@ -9,6 +13,7 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl_ros/point_cloud.h>
 
+#include <boost/bind.hpp>
 #include <minkindr_conversions/kindr_msg.h>
 
 #include <voxblox/utils/timing.h>
@@ -39,10 +44,18 @@ TsdfSubmapServer::TsdfSubmapServer(
       nh_private_(nh_private),
       verbose_(true),
       world_frame_("world"),
-      num_integrated_frames_current_submap_(0),
-      num_integrated_frames_per_submap_(kDefaultNumFramesPerSubmap),
+      max_pooled_blocks_(0),
+      use_incremental_map_saves_(false),
+      checkpoint_max_file_size_ratio_(2.0),
+      submap_stream_period_sec_(0.0),
+      num_meshing_threads_(static_cast<int>(getDefaultNumThreads())),
+      publish_active_submap_mesh_marker_(false),
+      transformer_(nh, nh_private),
+      max_pointcloud_queue_size_(kDefaultMaxPointcloudQueueSize),
+      use_pipelined_ingestion_(false),
+      metrics_publish_period_sec_(1.0),
       color_map_(new voxblox::GrayscaleColorMap()),
-      transformer_(nh, nh_private) {
+      num_integrated_frames_per_submap_(kDefaultNumFramesPerSubmap) {
   ROS_DEBUG("Creating a TSDF Server");
 
   // Initial interaction with ROS
@@ -53,20 +66,53 @@ TsdfSubmapServer::TsdfSubmapServer(
   // Creating the submap collection
   tsdf_submap_collection_ptr_.reset(
       new SubmapCollection<TsdfSubmap>(tsdf_map_config));
+  tsdf_submap_collection_ptr_->setPagingConfig(submap_paging_config_);
+  tsdf_submap_collection_ptr_->setBlockPoolCapacity(
+      static_cast<size_t>(std::max(max_pooled_blocks_, 0)));
 
   // Creating an integrator and targetting the collection
   tsdf_submap_collection_integrator_ptr_.reset(
       new TsdfSubmapCollectionIntegrator(tsdf_integrator_config,
                                          tsdf_integrator_type,
                                          tsdf_submap_collection_ptr_));
+  tsdf_submap_collection_integrator_ptr_->setRevisitConfig(
+      revisit_integration_config_);
+  tsdf_submap_collection_integrator_ptr_->setDownsamplingConfig(
+      downsampling_config_);
 
   // An object to visualize the submaps
-  submap_mesher_ptr_.reset(new SubmapMesher(tsdf_map_config, mesh_config));
+  submap_mesher_ptr_.reset(new SubmapMesher(
+      tsdf_map_config, mesh_config,
+      static_cast<size_t>(std::max(num_meshing_threads_, 1))));
+  submap_mesher_ptr_->setLodConfig(getMeshLodConfigFromRosParam(nh_private_));
   active_submap_visualizer_ptr_.reset(
       new ActiveSubmapVisualizer(mesh_config, tsdf_submap_collection_ptr_));
 
   // An object to visualize the trajectory
   trajectory_visualizer_ptr_.reset(new TrajectoryVisualizer);
+
+  // Starting the ingestion threads (if requested)
+  if (use_pipelined_ingestion_) {
+    setupPointcloudPipeline();
+  }
+}
+
+TsdfSubmapServer::~TsdfSubmapServer() {
+  // NOTE: The pipeline threads call into this object, so they have to be
+  //       stopped before any of the members go away.
+  pointcloud_pipeline_.reset();
+}
+
+void TsdfSubmapServer::setupPointcloudPipeline() {
+  using std::placeholders::_1;
+  using std::placeholders::_2;
+  pointcloud_pipeline_.reset(new PointcloudPipeline(
+      pipeline_config_,
+      std::bind(&TsdfSubmapServer::convertPointcloudStage, this, _1, _2),
+      std::bind(&TsdfSubmapServer::integratePointcloudStage, this, _1),
+      std::bind(&TsdfSubmapServer::visualizePointcloudStage, this, _1)));
+  pointcloud_pipeline_->start();
+  ROS_INFO("Started pipelined pointcloud ingestion.");
 }
 
 void TsdfSubmapServer::subscribeToTopics() {
@@ -74,8 +120,23 @@ void TsdfSubmapServer::subscribeToTopics() {
   int pointcloud_queue_size = kDefaultPointcloudQueueSize;
   nh_private_.param("pointcloud_queue_size", pointcloud_queue_size,
                     pointcloud_queue_size);
-  pointcloud_sub_ = nh_.subscribe("pointcloud", pointcloud_queue_size,
-                                  &TsdfSubmapServer::pointcloudCallback, this);
+  if (pointcloud_topics_.empty()) {
+    pointcloud_sub_ =
+        nh_.subscribe("pointcloud", pointcloud_queue_size,
+                      &TsdfSubmapServer::pointcloudCallback, this);
+    return;
+  }
+  // Or to the pointclouds of several sensors
+  pointcloud_batcher_config_.num_sensors = pointcloud_topics_.size();
+  pointcloud_batcher_.reset(new PointcloudBatcher(pointcloud_batcher_config_));
+  for (size_t sensor_index = 0; sensor_index < pointcloud_topics_.size();
+       sensor_index++) {
+    multi_sensor_pointcloud_subs_.push_back(
+        nh_.subscribe<sensor_msgs::PointCloud2>(
+            pointcloud_topics_[sensor_index], pointcloud_queue_size,
+            boost::bind(&TsdfSubmapServer::multiSensorPointcloudCallback, this,
+                        _1, sensor_index)));
+  }
 }
 
 void TsdfSubmapServer::advertiseTopics() {
@@ -91,12 +152,31 @@ void TsdfSubmapServer::advertiseTopics() {
       "save_map", &TsdfSubmapServer::saveMapCallback, this);
   load_map_srv_ = nh_private_.advertiseService(
       "load_map", &TsdfSubmapServer::loadMapCallback, this);
+  // Service for toggling the metrics
+  set_metrics_enabled_srv_ = nh_private_.advertiseService(
+      "set_metrics_enabled", &TsdfSubmapServer::setMetricsEnabledCallback,
+      this);
+  // Streaming the map
+  // NOTE: The parts of each delta are published back to back, so the queue
+  //       holds many of them. Receivers which miss a part catch up with the
+  //       snapshot service.
+  if (submap_stream_publisher_) {
+    submap_stream_pub_ = nh_private_.advertise<cblox_ros::SubmapStreamUpdate>(
+        "submap_stream", 100);
+    get_submap_stream_snapshot_srv_ = nh_private_.advertiseService(
+        "get_submap_stream_snapshot",
+        &TsdfSubmapServer::getSubmapStreamSnapshotCallback, this);
+  }
   // Real-time publishing for rviz
   active_submap_mesh_pub_ =
       nh_private_.advertise<visualization_msgs::Marker>("separated_mesh", 1);
+  mesh_pub_ = nh_private_.advertise<voxblox_msgs::Mesh>("mesh", 1);
   submap_poses_pub_ =
       nh_private_.advertise<geometry_msgs::PoseArray>("submap_baseframes", 1);
   trajectory_pub_ = nh_private_.advertise<nav_msgs::Path>("trajectory", 1);
+  // Metrics, on the (global) diagnostics topic by default
+  metrics_pub_ =
+      nh_.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
 }
 
 void TsdfSubmapServer::getParametersFromRos() {
@@ -109,6 +189,11 @@ void TsdfSubmapServer::getParametersFromRos() {
                     min_time_between_msgs_sec);
   min_time_between_msgs_.fromSec(min_time_between_msgs_sec);
   nh_private_.param("mesh_filename", mesh_filename_, mesh_filename_);
+  nh_private_.param("num_meshing_threads", num_meshing_threads_,
+                    num_meshing_threads_);
+  nh_private_.param("publish_active_submap_mesh_marker",
+                    publish_active_submap_mesh_marker_,
+                    publish_active_submap_mesh_marker_);
   // Timed updates for submap mesh publishing.
   double update_mesh_every_n_sec = 0.0;
   nh_private_.param("update_mesh_every_n_sec", update_mesh_every_n_sec,
@@ -118,26 +203,329 @@ void TsdfSubmapServer::getParametersFromRos() {
         nh_private_.createTimer(ros::Duration(update_mesh_every_n_sec),
                                 &TsdfSubmapServer::updateMeshEvent, this);
   }
+  // Timed updates of the whole map mesh (off by default)
+  double update_whole_map_mesh_every_n_sec = 0.0;
+  nh_private_.param("update_whole_map_mesh_every_n_sec",
+                    update_whole_map_mesh_every_n_sec,
+                    update_whole_map_mesh_every_n_sec);
+  if (update_whole_map_mesh_every_n_sec > 0.0) {
+    update_whole_map_mesh_timer_ = nh_private_.createTimer(
+        ros::Duration(update_whole_map_mesh_every_n_sec),
+        &TsdfSubmapServer::updateWholeMapMeshEvent, this);
+  }
   // Frequency of submap creation
   nh_private_.param("num_integrated_frames_per_submap",
                     num_integrated_frames_per_submap_,
                     num_integrated_frames_per_submap_);
+  setupSubmapCreationPolicy();
+  // Input queueing
+  nh_private_.param("max_pointcloud_queue_size", max_pointcloud_queue_size_,
+                    max_pointcloud_queue_size_);
+  // Pipelined ingestion
+  nh_private_.param("use_pipelined_ingestion", use_pipelined_ingestion_,
+                    use_pipelined_ingestion_);
+  pipeline_config_.message_queue_size =
+      static_cast<size_t>(std::max(max_pointcloud_queue_size_, 1));
+  int pipeline_frame_queue_size =
+      static_cast<int>(pipeline_config_.frame_queue_size);
+  nh_private_.param("pipeline_frame_queue_size", pipeline_frame_queue_size,
+                    pipeline_frame_queue_size);
+  pipeline_config_.frame_queue_size =
+      static_cast<size_t>(std::max(pipeline_frame_queue_size, 1));
+  // Integrating the pointclouds of several sensors together
+  nh_private_.param("pointcloud_topics", pointcloud_topics_,
+                    pointcloud_topics_);
+  double sensor_sync_window_sec =
+      pointcloud_batcher_config_.sync_window.toSec();
+  nh_private_.param("sensor_sync_window_sec", sensor_sync_window_sec,
+                    sensor_sync_window_sec);
+  pointcloud_batcher_config_.sync_window =
+      ros::Duration(std::max(sensor_sync_window_sec, 0.0));
+  pointcloud_batcher_config_.max_queue_size_per_sensor =
+      static_cast<size_t>(std::max(max_pointcloud_queue_size_, 1));
+  if (!pointcloud_topics_.empty() && use_pipelined_ingestion_) {
+    ROS_WARN(
+        "Pipelined ingestion is not supported with multiple pointcloud "
+        "topics. Disabling it.");
+    use_pipelined_ingestion_ = false;
+  }
+  // Paging finished submaps to disk
+  nh_private_.param("enable_submap_paging", submap_paging_config_.enable_paging,
+                    submap_paging_config_.enable_paging);
+  nh_private_.param("max_resident_memory_mb",
+                    submap_paging_config_.max_resident_memory_mb,
+                    submap_paging_config_.max_resident_memory_mb);
+  nh_private_.param("submap_page_directory",
+                    submap_paging_config_.page_directory,
+                    submap_paging_config_.page_directory);
+  // Compressing finished submaps in memory
+  nh_private_.param("compress_finished_submaps",
+                    submap_paging_config_.compress_finished_submaps,
+                    submap_paging_config_.compress_finished_submaps);
+  nh_private_.param("compressed_submaps_keep_colors",
+                    submap_paging_config_.encoding_config.keep_colors,
+                    submap_paging_config_.encoding_config.keep_colors);
+  // Recycling the blocks of freed submaps
+  nh_private_.param("max_pooled_blocks", max_pooled_blocks_,
+                    max_pooled_blocks_);
+  // Integrating into revisited submaps
+  nh_private_.param("enable_revisit_integration",
+                    revisit_integration_config_.enable,
+                    revisit_integration_config_.enable);
+  int max_revisit_submaps =
+      static_cast<int>(revisit_integration_config_.max_revisit_submaps);
+  nh_private_.param("max_revisit_submaps", max_revisit_submaps,
+                    max_revisit_submaps);
+  revisit_integration_config_.max_revisit_submaps =
+      static_cast<size_t>(std::max(max_revisit_submaps, 1));
+  nh_private_.param("revisit_min_point_fraction",
+                    revisit_integration_config_.min_point_fraction,
+                    revisit_integration_config_.min_point_fraction);
+  // Downsampling the scans
+  nh_private_.param("enable_downsampling", downsampling_config_.enable,
+                    downsampling_config_.enable);
+  nh_private_.param("downsampling_voxel_size_factor",
+                    downsampling_config_.voxel_size_factor,
+                    downsampling_config_.voxel_size_factor);
+  if (downsampling_config_.voxel_size_factor <= 0.0f) {
+    ROS_WARN("downsampling_voxel_size_factor must be positive. Using 1.0.");
+    downsampling_config_.voxel_size_factor = 1.0f;
+  }
+  // Incremental map saving
+  nh_private_.param("use_incremental_map_saves", use_incremental_map_saves_,
+                    use_incremental_map_saves_);
+  nh_private_.param("checkpoint_max_file_size_ratio",
+                    checkpoint_max_file_size_ratio_,
+                    checkpoint_max_file_size_ratio_);
+  // Metrics
+  bool enable_metrics = false;
+  nh_private_.param("enable_metrics", enable_metrics, enable_metrics);
+  metrics_.setEnabled(enable_metrics);
+  nh_private_.param("metrics_publish_period_sec", metrics_publish_period_sec_,
+                    metrics_publish_period_sec_);
+  if (metrics_publish_period_sec_ > 0.0) {
+    // NOTE: A wall timer, as the latencies are in wall time (also when playing
+    //       back bags in sim time).
+    metrics_timer_ = nh_private_.createWallTimer(
+        ros::WallDuration(metrics_publish_period_sec_),
+        &TsdfSubmapServer::publishMetricsEvent, this);
+  }
+  // Streaming the map
+  nh_private_.param("submap_stream_period_sec", submap_stream_period_sec_,
+                    submap_stream_period_sec_);
+  nh_private_.param("compress_submap_stream",
+                    submap_stream_config_.compress_submaps,
+                    submap_stream_config_.compress_submaps);
+  double submap_stream_max_part_mb =
+      static_cast<double>(submap_stream_config_.max_part_num_bytes) /
+      (1024.0 * 1024.0);
+  nh_private_.param("submap_stream_max_part_mb", submap_stream_max_part_mb,
+                    submap_stream_max_part_mb);
+  submap_stream_config_.max_part_num_bytes = static_cast<size_t>(
+      std::max(submap_stream_max_part_mb, 0.001) * 1024.0 * 1024.0);
+  if (submap_stream_period_sec_ > 0.0) {
+    submap_stream_publisher_.reset(
+        new io::SubmapStreamPublisher<TsdfSubmap>(submap_stream_config_));
+    submap_stream_timer_ = nh_private_.createWallTimer(
+        ros::WallDuration(submap_stream_period_sec_),
+        &TsdfSubmapServer::publishSubmapStreamEvent, this);
+  }
+}
+
+void TsdfSubmapServer::setupSubmapCreationPolicy() {
+  // NOTE: By default submaps are created by frame count only. The other limits
+  //       are off (zero) unless set.
+  double max_distance_m = 0.0;
+  double max_rotation_deg = 0.0;
+  int max_num_blocks = 0;
+  double max_memory_mb = 0.0;
+  double max_overlap_with_previous = 1.0;
+  nh_private_.param("submap_max_distance_m", max_distance_m, max_distance_m);
+  nh_private_.param("submap_max_rotation_deg", max_rotation_deg,
+                    max_rotation_deg);
+  nh_private_.param("submap_max_num_blocks", max_num_blocks, max_num_blocks);
+  nh_private_.param("submap_max_memory_mb", max_memory_mb, max_memory_mb);
+  nh_private_.param("submap_max_overlap_with_previous",
+                    max_overlap_with_previous, max_overlap_with_previous);
+  std::shared_ptr<CompositeSubmapPolicy> policy(new CompositeSubmapPolicy);
+  if (num_integrated_frames_per_submap_ > 0) {
+    policy->addTrigger(std::make_shared<FrameCountSubmapPolicy>(
+        static_cast<size_t>(num_integrated_frames_per_submap_)));
+  }
+  if (max_distance_m > 0.0 || max_rotation_deg > 0.0) {
+    policy->addTrigger(std::make_shared<MotionSubmapPolicy>(
+        max_distance_m, max_rotation_deg * M_PI / 180.0));
+  }
+  if (max_num_blocks > 0 || max_memory_mb > 0.0) {
+    policy->addTrigger(std::make_shared<SubmapSizePolicy>(
+        static_cast<size_t>(std::max(max_num_blocks, 0)),
+        static_cast<size_t>(std::max(max_memory_mb, 0.0) * 1024 * 1024)));
+  }
+  if (max_overlap_with_previous < 1.0) {
+    policy->addRequirement(
+        std::make_shared<OverlapSubmapPolicy>(max_overlap_with_previous));
+  }
+  submap_creation_policy_ = policy;
+}
+
+void TsdfSubmapServer::setSubmapCreationPolicy(
+    const SubmapCreationPolicy::Ptr& submap_creation_policy) {
+  CHECK(submap_creation_policy);
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  submap_creation_policy_ = submap_creation_policy;
 }
 
 void TsdfSubmapServer::pointcloudCallback(
     const sensor_msgs::PointCloud2::Ptr& pointcloud_msg_in) {
+  // In pipelined mode the subscriber thread only hands the message over
+  if (pointcloud_pipeline_) {
+    if (passesMessageThrottle(pointcloud_msg_in)) {
+      if (!pointcloud_pipeline_->addMessage(pointcloud_msg_in)) {
+        metrics_.recordDroppedMessages(1);
+      }
+      metrics_.recordQueueDepth(pointcloud_pipeline_->getMessageQueueSize());
+    }
+    return;
+  }
   // Pushing this message onto the queue for processing
   addMesageToPointcloudQueue(pointcloud_msg_in);
   // Processing messages in the queue
   servicePointcloudQueue();
 }
 
-void TsdfSubmapServer::addMesageToPointcloudQueue(
+void TsdfSubmapServer::multiSensorPointcloudCallback(
+    const sensor_msgs::PointCloud2::ConstPtr& pointcloud_msg,
+    const size_t sensor_index) {
+  // NOTE: The message throttle doesn't apply, as it would drop the clouds of
+  //       all but one sensor.
+  const size_t num_dropped =
+      pointcloud_batcher_->addMessage(sensor_index, pointcloud_msg);
+  if (num_dropped > 0) {
+    ROS_WARN_THROTTLE(60,
+                      "Dropping pointclouds of sensor %lu, which can't be "
+                      "matched with the other sensors.",
+                      sensor_index);
+    metrics_.recordDroppedMessages(num_dropped);
+  }
+  while (pointcloud_batcher_->getNextBatch(&pointcloud_batch_buffer_)) {
+    pointcloud_batch_queue_.push(pointcloud_batch_buffer_);
+  }
+  metrics_.recordQueueDepth(pointcloud_batcher_->getNumPendingMessages() +
+                            pointcloud_batch_queue_.size());
+  servicePointcloudBatchQueue();
+}
+
+void TsdfSubmapServer::servicePointcloudBatchQueue() {
+  const size_t kMaxQueueSize = static_cast<size_t>(max_pointcloud_queue_size_);
+  while (!pointcloud_batch_queue_.empty()) {
+    const std::vector<sensor_msgs::PointCloud2::ConstPtr>& batch =
+        pointcloud_batch_queue_.front();
+    // Looking up the poses of all clouds of the batch
+    scan_batch_buffer_.resize(batch.size());
+    bool all_transforms_found = true;
+    for (size_t scan_idx = 0; scan_idx < batch.size(); scan_idx++) {
+      if (!transformer_.lookupTransform(batch[scan_idx]->header.frame_id,
+                                        world_frame_,
+                                        batch[scan_idx]->header.stamp,
+                                        &scan_batch_buffer_[scan_idx].T_G_C)) {
+        all_transforms_found = false;
+        break;
+      }
+    }
+    if (!all_transforms_found) {
+      if (pointcloud_batch_queue_.size() >= kMaxQueueSize) {
+        ROS_ERROR_THROTTLE(60,
+                           "Input pointcloud batch queue getting too long! "
+                           "Dropping some batches. Either unable to look up "
+                           "transform timestamps or the processing is taking "
+                           "too long.");
+        size_t num_dropped = 0;
+        while (pointcloud_batch_queue_.size() >= kMaxQueueSize) {
+          num_dropped += pointcloud_batch_queue_.front().size();
+          pointcloud_batch_queue_.pop();
+        }
+        metrics_.recordDroppedMessages(num_dropped);
+      }
+      return;
+    }
+    // Converting (into buffers reused between batches)
+    const ros::WallTime conversion_start = ros::WallTime::now();
+    // NOTE: A malformed message leaves its scan empty, so it integrates
+    //       nothing but keeps its place in the batch.
+    for (size_t scan_idx = 0; scan_idx < batch.size(); scan_idx++) {
+      if (!convertPointcloudMsg(*color_map_, *batch[scan_idx],
+                                &scan_batch_buffer_[scan_idx].points_C,
+                                &scan_batch_buffer_[scan_idx].colors)) {
+        ROS_WARN_THROTTLE(10, "Skipping a malformed pointcloud message.");
+      }
+    }
+    metrics_.recordConversion(ros::WallTime::now() - conversion_start);
+    pointcloud_batch_queue_.pop();
+    // Integrating. New submaps start at the first sensor of the batch.
+    const Transformation T_G_C = scan_batch_buffer_.front().T_G_C;
+    {
+      std::lock_guard<std::mutex> map_lock(map_mutex_);
+      insertPointcloudBatch(scan_batch_buffer_);
+      if (newSubmapRequired()) {
+        createNewSubMap(T_G_C);
+      }
+    }
+    trajectory_visualizer_ptr_->addPose(T_G_C);
+    visualizeTrajectory();
+  }
+}
+
+void TsdfSubmapServer::insertPointcloudBatch(
+    const AlignedVector<PosedScan>& scans) {
+  CHECK(!scans.empty());
+  if (verbose_) {
+    ROS_INFO("Integrating a batch of %lu pointclouds.", scans.size());
+  }
+
+  if (!mapIntialized()) {
+    ROS_INFO("Intializing map.");
+    intializeMap(scans.front().T_G_C);
+  }
+
+  const PointCloudDownsamplingStats downsampling_stats_start =
+      tsdf_submap_collection_integrator_ptr_->getDownsamplingStats();
+  ros::WallTime start = ros::WallTime::now();
+  tsdf_submap_collection_integrator_ptr_->integratePointClouds(scans);
+  ros::WallTime end = ros::WallTime::now();
+  metrics_.recordIntegration(end - start);
+  if (downsampling_config_.enable) {
+    const PointCloudDownsamplingStats downsampling_stats =
+        tsdf_submap_collection_integrator_ptr_->getDownsamplingStats();
+    metrics_.recordDownsampling(
+        downsampling_stats.num_input_points -
+            downsampling_stats_start.num_input_points,
+        downsampling_stats.num_output_points -
+            downsampling_stats_start.num_output_points);
+  }
+  updateActiveSubmapState(scans);
+  if (verbose_) {
+    ROS_INFO(
+        "Finished integrating in %f seconds, have %lu blocks. %lu frames "
+        "integrated to current submap.",
+        (end - start).toSec(), active_submap_state_.num_allocated_blocks,
+        active_submap_state_.num_integrated_frames);
+  }
+}
+
+bool TsdfSubmapServer::passesMessageThrottle(
     const sensor_msgs::PointCloud2::Ptr& pointcloud_msg_in) {
-  // Pushing this message onto the queue for processing
   if (pointcloud_msg_in->header.stamp - last_msg_time_ptcloud_ >
       min_time_between_msgs_) {
     last_msg_time_ptcloud_ = pointcloud_msg_in->header.stamp;
+    return true;
+  }
+  return false;
+}
+
+void TsdfSubmapServer::addMesageToPointcloudQueue(
+    const sensor_msgs::PointCloud2::Ptr& pointcloud_msg_in) {
+  // Pushing this message onto the queue for processing
+  if (passesMessageThrottle(pointcloud_msg_in)) {
     pointcloud_queue_.push(pointcloud_msg_in);
   }
 }
@@ -152,11 +540,13 @@ void TsdfSubmapServer::servicePointcloudQueue() {
       getNextPointcloudFromQueue(&pointcloud_queue_, &pointcloud_msg, &T_G_C)) {
     constexpr bool is_freespace_pointcloud = false;
 
-    processPointCloudMessageAndInsert(pointcloud_msg, T_G_C,
-                                      is_freespace_pointcloud);
-
-    if (newSubmapRequired()) {
-      createNewSubMap(T_G_C);
+    {
+      std::lock_guard<std::mutex> map_lock(map_mutex_);
+      processPointCloudMessageAndInsert(pointcloud_msg, T_G_C,
+                                        is_freespace_pointcloud);
+      if (newSubmapRequired()) {
+        createNewSubMap(T_G_C);
+      }
     }
 
     trajectory_visualizer_ptr_->addPose(T_G_C);
@@ -178,10 +568,11 @@ void TsdfSubmapServer::servicePointcloudQueue() {
 bool TsdfSubmapServer::getNextPointcloudFromQueue(
     std::queue<sensor_msgs::PointCloud2::Ptr>* queue,
     sensor_msgs::PointCloud2::Ptr* pointcloud_msg, Transformation* T_G_C) {
-  const size_t kMaxQueueSize = 10;
+  const size_t kMaxQueueSize = static_cast<size_t>(max_pointcloud_queue_size_);
   if (queue->empty()) {
     return false;
   }
+  metrics_.recordQueueDepth(queue->size());
   *pointcloud_msg = queue->front();
   if (transformer_.lookupTransform((*pointcloud_msg)->header.frame_id,
                                    world_frame_,
@@ -194,9 +585,12 @@ bool TsdfSubmapServer::getNextPointcloudFromQueue(
                          "Input pointcloud queue getting too long! Dropping "
                          "some pointclouds. Either unable to look up transform "
                          "timestamps or the processing is taking too long.");
+      size_t num_dropped = 0;
       while (queue->size() >= kMaxQueueSize) {
         queue->pop();
+        num_dropped++;
       }
+      metrics_.recordDroppedMessages(num_dropped);
     }
   }
   return false;
@@ -205,11 +599,24 @@ bool TsdfSubmapServer::getNextPointcloudFromQueue(
 void TsdfSubmapServer::processPointCloudMessageAndInsert(
     const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
     const Transformation& T_G_C, const bool is_freespace_pointcloud) {
-  // Convert the PCL pointcloud into our awesome format.
-  Pointcloud points_C;
-  Colors colors;
-  convertPointcloudMsg(*color_map_, pointcloud_msg, &points_C, &colors);
+  // Convert the ROS pointcloud into our awesome format.
+  // NOTE: The conversion buffers are reused between frames.
+  const ros::WallTime conversion_start = ros::WallTime::now();
+  if (!convertPointcloudMsg(*color_map_, *pointcloud_msg, &points_C_buffer_,
+                            &colors_buffer_)) {
+    ROS_WARN_THROTTLE(10, "Skipping a malformed pointcloud message.");
+    return;
+  }
+  metrics_.recordConversion(ros::WallTime::now() - conversion_start);
+  // Integrating
+  insertPointcloud(T_G_C, points_C_buffer_, colors_buffer_,
+                   is_freespace_pointcloud);
+}
 
+void TsdfSubmapServer::insertPointcloud(const Transformation& T_G_C,
+                                        const Pointcloud& points_C,
+                                        const Colors& colors,
+                                        const bool is_freespace_pointcloud) {
   if (verbose_) {
     ROS_INFO("Integrating a pointcloud with %lu points.", points_C.size());
   }
@@ -222,16 +629,64 @@ void TsdfSubmapServer::processPointCloudMessageAndInsert(
   ros::WallTime start = ros::WallTime::now();
   integratePointcloud(T_G_C, points_C, colors, is_freespace_pointcloud);
   ros::WallTime end = ros::WallTime::now();
-  num_integrated_frames_current_submap_++;
+  metrics_.recordIntegration(end - start);
+  if (downsampling_config_.enable) {
+    const PointCloudDownsamplingStats downsampling_stats =
+        tsdf_submap_collection_integrator_ptr_->getDownsamplingStats();
+    metrics_.recordDownsampling(downsampling_stats.last_num_input_points,
+                                downsampling_stats.last_num_output_points);
+    if (verbose_) {
+      ROS_INFO("Downsampled the pointcloud to %lu points (%.1f%% removed).",
+               downsampling_stats.last_num_output_points,
+               100.0 * downsampling_stats.getLastReductionRatio());
+    }
+  }
+  updateActiveSubmapState(T_G_C, points_C);
   if (verbose_) {
     ROS_INFO(
-        "Finished integrating in %f seconds, have %lu blocks. %u frames "
+        "Finished integrating in %f seconds, have %lu blocks. %lu frames "
         "integrated to current submap.",
-        (end - start).toSec(), tsdf_submap_collection_ptr_->getActiveTsdfMap()
-                                   .getTsdfLayer()
-                                   .getNumberOfAllocatedBlocks(),
-        num_integrated_frames_current_submap_);
+        (end - start).toSec(), active_submap_state_.num_allocated_blocks,
+        active_submap_state_.num_integrated_frames);
+  }
+}
+
+void TsdfSubmapServer::updateActiveSubmapState(const Transformation& T_G_C,
+                                               const Pointcloud& points_C) {
+  active_submap_state_.num_integrated_frames++;
+  active_submap_state_.T_G_C = T_G_C;
+  extendActiveSubmapExtent(T_G_C, points_C);
+  updateActiveSubmapSize();
+}
+
+void TsdfSubmapServer::updateActiveSubmapState(
+    const AlignedVector<PosedScan>& scans) {
+  CHECK(!scans.empty());
+  active_submap_state_.num_integrated_frames++;
+  active_submap_state_.T_G_C = scans.front().T_G_C;
+  for (const PosedScan& scan : scans) {
+    extendActiveSubmapExtent(scan.T_G_C, scan.points_C);
+  }
+  updateActiveSubmapSize();
+}
+
+void TsdfSubmapServer::extendActiveSubmapExtent(const Transformation& T_G_C,
+                                                const Pointcloud& points_C) {
+  // NOTE: The box of the scan is found in the sensor frame and then
+  //       transformed, which is cheaper than transforming the points.
+  BoundingBox scan_box_C;
+  for (const Point& point_C : points_C) {
+    scan_box_C.extend(point_C);
   }
+  active_submap_state_.extent_G.extend(scan_box_C.transformed(T_G_C));
+}
+
+void TsdfSubmapServer::updateActiveSubmapSize() {
+  const TsdfSubmap& active_submap =
+      tsdf_submap_collection_ptr_->getActiveSubMap();
+  active_submap_state_.num_allocated_blocks =
+      active_submap.getNumberAllocatedBlocks();
+  active_submap_state_.memory_bytes = active_submap.getResidentMemoryBytes();
 }
 
 void TsdfSubmapServer::integratePointcloud(const Transformation& T_G_C,
@@ -250,8 +705,7 @@ void TsdfSubmapServer::intializeMap(const Transformation& T_G_C) {
 }
 
 bool TsdfSubmapServer::newSubmapRequired() const {
-  return (num_integrated_frames_current_submap_ >
-          num_integrated_frames_per_submap_);
+  return submap_creation_policy_->newSubmapRequired(active_submap_state_);
 }
 
 void TsdfSubmapServer::createNewSubMap(const Transformation& T_G_C) {
@@ -261,7 +715,7 @@ void TsdfSubmapServer::createNewSubMap(const Transformation& T_G_C) {
   // Activating the submap in the frame integrator
   tsdf_submap_collection_integrator_ptr_->switchToActiveSubmap();
   // Resetting current submap counters
-  num_integrated_frames_current_submap_ = 0;
+  active_submap_state_.startNewSubmap(T_G_C);
 
   // Updating the active submap mesher
   active_submap_visualizer_ptr_->switchToActiveSubmap();
@@ -273,6 +727,80 @@ void TsdfSubmapServer::createNewSubMap(const Transformation& T_G_C) {
     ROS_INFO_STREAM("Created a new submap with id: "
                     << submap_id << ". Total submap number: "
                     << tsdf_submap_collection_ptr_->size());
+    if (submap_paging_config_.enable_paging ||
+        submap_paging_config_.compress_finished_submaps) {
+      const SubmapPagingStats paging_stats =
+          tsdf_submap_collection_ptr_->getPagingStats();
+      ROS_INFO_STREAM("Submap paging: "
+                      << paging_stats.num_resident_submaps << " resident ("
+                      << paging_stats.resident_memory_bytes / (1024 * 1024)
+                      << "MB, " << paging_stats.num_compressed_submaps
+                      << " compressed), " << paging_stats.num_paged_out_submaps
+                      << " paged out. hits: " << paging_stats.num_hits
+                      << ", misses: " << paging_stats.num_page_ins
+                      << ", evictions: " << paging_stats.num_page_outs
+                      << ", decompressions: "
+                      << paging_stats.num_decompressions);
+    }
+    if (max_pooled_blocks_ > 0) {
+      const TsdfBlockPoolStats pool_stats =
+          tsdf_submap_collection_ptr_->getBlockPoolStats();
+      ROS_INFO_STREAM("Block pool: "
+                      << pool_stats.num_pooled_blocks << " of "
+                      << pool_stats.max_pooled_blocks << " blocks ("
+                      << pool_stats.pooled_memory_bytes / (1024 * 1024)
+                      << "MB). reused: " << pool_stats.num_reused_blocks
+                      << ", allocated: " << pool_stats.num_allocated_blocks
+                      << ", recycled: " << pool_stats.num_recycled_blocks
+                      << ", freed: " << pool_stats.num_freed_blocks);
+    }
+  }
+}
+
+PointcloudPipeline::ConversionResult TsdfSubmapServer::convertPointcloudStage(
+    const sensor_msgs::PointCloud2::Ptr& pointcloud_msg,
+    PointcloudFrame* frame_ptr) {
+  CHECK_NOTNULL(frame_ptr);
+  // Looking up the pose first. Without it the message can't be used yet.
+  if (!transformer_.lookupTransform(pointcloud_msg->header.frame_id,
+                                    world_frame_, pointcloud_msg->header.stamp,
+                                    &frame_ptr->T_G_C)) {
+    return PointcloudPipeline::ConversionResult::kRetryLater;
+  }
+  frame_ptr->stamp = pointcloud_msg->header.stamp;
+  const ros::WallTime conversion_start = ros::WallTime::now();
+  if (!convertPointcloudMsg(*color_map_, *pointcloud_msg, &frame_ptr->points_C,
+                            &frame_ptr->colors)) {
+    ROS_WARN_THROTTLE(10, "Skipping a malformed pointcloud message.");
+    return PointcloudPipeline::ConversionResult::kDropped;
+  }
+  metrics_.recordConversion(ros::WallTime::now() - conversion_start);
+  return PointcloudPipeline::ConversionResult::kConverted;
+}
+
+void TsdfSubmapServer::integratePointcloudStage(const PointcloudFrame& frame) {
+  constexpr bool is_freespace_pointcloud = false;
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  insertPointcloud(frame.T_G_C, frame.points_C, frame.colors,
+                   is_freespace_pointcloud);
+  if (newSubmapRequired()) {
+    createNewSubMap(frame.T_G_C);
+  }
+}
+
+void TsdfSubmapServer::visualizePointcloudStage(const Transformation& T_G_C) {
+  {
+    // NOTE: This stage runs on its own pipeline thread, concurrently with the
+    //       integration stage and the service callbacks, which share the
+    //       trajectory under the same lock.
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    trajectory_visualizer_ptr_->addPose(T_G_C);
+    visualizeTrajectory();
+  }
+  if (verbose_) {
+    ROS_INFO_STREAM_THROTTLE(
+        10, "Pointcloud pipeline: " << std::endl
+                                    << pointcloud_pipeline_->printStats());
   }
 }
 
@@ -280,7 +808,22 @@ void TsdfSubmapServer::visualizeActiveSubmapMesh() {
   // NOTE(alexmillane): For the time being only the mesh from the currently
   // active submap is updated. This breaks down when the pose of past submaps is
   // changed. We will need to handle this separately later.
+  const ros::WallTime meshing_start = ros::WallTime::now();
   active_submap_visualizer_ptr_->updateMeshLayer();
+  metrics_.recordMeshing(ros::WallTime::now() - meshing_start);
+  // Publishing the mesh blocks which changed
+  voxblox_msgs::Mesh mesh_msg;
+  active_submap_visualizer_ptr_->getDeltaMeshMsg(&mesh_msg);
+  if (mesh_msg.mesh_blocks.empty()) {
+    return;
+  }
+  mesh_msg.header.frame_id = world_frame_;
+  mesh_pub_.publish(mesh_msg);
+  // NOTE: The marker holds the whole mesh of the active submap, so is only
+  //       rebuilt when it changed, and only if asked for (off by default).
+  if (!publish_active_submap_mesh_marker_) {
+    return;
+  }
   // Getting the display mesh
   visualization_msgs::Marker marker;
   active_submap_visualizer_ptr_->getDisplayMesh(&marker);
@@ -290,17 +833,31 @@ void TsdfSubmapServer::visualizeActiveSubmapMesh() {
 }
 
 void TsdfSubmapServer::visualizeWholeMap() {
-  // Looping through the whole map, meshing and publishing.
-  for (const SubmapID submap_id : tsdf_submap_collection_ptr_->getIDs()) {
-    tsdf_submap_collection_ptr_->activateSubMap(submap_id);
-    active_submap_visualizer_ptr_->switchToActiveSubmap();
-    visualizeActiveSubmapMesh();
+  // Bringing the mesh cache up to date. Only submaps which changed since they
+  // were last published are re-meshed (or just re-transformed if only their
+  // pose changed). With level of detail, distant submaps are meshed coarser.
+  submap_mesher_ptr_->setLodViewpoint(active_submap_state_.T_G_C.getPosition());
+  submap_mesher_ptr_->updateMeshCache(*tsdf_submap_collection_ptr_);
+  std::vector<SubmapID> submap_ids;
+  std::vector<MeshLayer::ConstPtr> mesh_layers_G;
+  submap_mesher_ptr_->getCachedMeshLayers(&submap_ids, &mesh_layers_G);
+  // Publishing the submap meshes
+  for (size_t submap_index = 0; submap_index < submap_ids.size();
+       submap_index++) {
+    visualization_msgs::Marker marker;
+    const voxblox::ColorMode color_mode = voxblox::ColorMode::kLambertColor;
+    voxblox::fillMarkerWithMesh(mesh_layers_G[submap_index], color_mode,
+                                &marker);
+    marker.id = submap_ids[submap_index];
+    marker.header.frame_id = world_frame_;
+    active_submap_mesh_pub_.publish(marker);
   }
 }
 
 bool TsdfSubmapServer::generateSeparatedMeshCallback(
     std_srvs::Empty::Request& request,
     std_srvs::Empty::Response& /*response*/) {  // NO LINT
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
   // Saving mesh to file if required
   if (!mesh_filename_.empty()) {
     // Getting the requested mesh type from the mesher
@@ -324,6 +881,7 @@ bool TsdfSubmapServer::generateSeparatedMeshCallback(
 bool TsdfSubmapServer::generateCombinedMeshCallback(
     std_srvs::Empty::Request& request,
     std_srvs::Empty::Response& /*response*/) {  // NO LINT
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
   // Saving mesh to file if required
   if (!mesh_filename_.empty()) {
     // Getting the requested mesh type from the mesher
@@ -345,11 +903,107 @@ bool TsdfSubmapServer::generateCombinedMeshCallback(
 }
 
 void TsdfSubmapServer::updateMeshEvent(const ros::TimerEvent& /*event*/) {
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
   if (mapIntialized()) {
     visualizeActiveSubmapMesh();
   }
 }
 
+void TsdfSubmapServer::updateWholeMapMeshEvent(
+    const ros::TimerEvent& /*event*/) {
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  if (mapIntialized()) {
+    visualizeWholeMap();
+  }
+}
+
+void TsdfSubmapServer::setMetricsEnabled(const bool enabled) {
+  metrics_.setEnabled(enabled);
+  ROS_INFO("Metrics %s.", enabled ? "enabled" : "disabled");
+}
+
+bool TsdfSubmapServer::setMetricsEnabledCallback(
+    std_srvs::SetBool::Request& request,
+    std_srvs::SetBool::Response& response) {  // NOLINT
+  setMetricsEnabled(request.data);
+  response.success = true;
+  response.message = request.data ? "Metrics enabled" : "Metrics disabled";
+  return true;
+}
+
+void TsdfSubmapServer::publishMetricsEvent(
+    const ros::WallTimerEvent& /*event*/) {
+  if (!metrics_.isEnabled()) {
+    return;
+  }
+  // NOTE: The map lock is only held to get the collection (which is replaced
+  //       on loading). The submap sizes are read under the submaps' own
+  //       locks, without holding up integration.
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> submap_collection_ptr;
+  {
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    submap_collection_ptr = tsdf_submap_collection_ptr_;
+  }
+  diagnostic_msgs::DiagnosticArray diagnostics_msg;
+  metrics_.getDiagnostics(submap_collection_ptr->getSubMapConstPtrs(),
+                          &diagnostics_msg);
+  metrics_pub_.publish(diagnostics_msg);
+}
+
+void TsdfSubmapServer::publishSubmapStreamEvent(
+    const ros::WallTimerEvent& /*event*/) {
+  // NOTE: The map lock is only held to get the collection (which is replaced on
+  //       loading). The submaps are serialized under their own locks, without
+  //       holding up integration.
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> submap_collection_ptr;
+  {
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    submap_collection_ptr = tsdf_submap_collection_ptr_;
+  }
+  // Deltas no one receives are numbered, but not serialized
+  if (submap_stream_pub_.getNumSubscribers() == 0) {
+    submap_stream_publisher_->skipDelta(*submap_collection_ptr);
+    return;
+  }
+  submap_stream_publisher_->getDelta(*submap_collection_ptr,
+                                     &submap_stream_parts_buffer_);
+  const uint64_t sequence_number =
+      submap_stream_publisher_->getSequenceNumber();
+  for (const std::string& part : submap_stream_parts_buffer_) {
+    cblox_ros::SubmapStreamUpdate::Ptr update_msg(
+        new cblox_ros::SubmapStreamUpdate);
+    update_msg->sequence_number = sequence_number;
+    update_msg->is_snapshot = false;
+    update_msg->data.assign(part.begin(), part.end());
+    submap_stream_pub_.publish(update_msg);
+  }
+}
+
+bool TsdfSubmapServer::getSubmapStreamSnapshotCallback(
+    cblox_ros::GetSubmapStreamSnapshot::Request& /*request*/,
+    cblox_ros::GetSubmapStreamSnapshot::Response& response) {  // NOLINT
+  std::shared_ptr<SubmapCollection<TsdfSubmap>> submap_collection_ptr;
+  {
+    std::lock_guard<std::mutex> map_lock(map_mutex_);
+    submap_collection_ptr = tsdf_submap_collection_ptr_;
+  }
+  std::vector<std::string> parts;
+  submap_stream_publisher_->getSnapshot(*submap_collection_ptr, &parts);
+  const uint64_t sequence_number =
+      submap_stream_publisher_->getSequenceNumber();
+  response.parts.resize(parts.size());
+  for (size_t part_index = 0; part_index < parts.size(); part_index++) {
+    response.parts[part_index].sequence_number = sequence_number;
+    response.parts[part_index].is_snapshot = true;
+    response.parts[part_index].data.assign(parts[part_index].begin(),
+                                           parts[part_index].end());
+  }
+  ROS_INFO_STREAM("Served a submap stream snapshot of "
+                  << submap_collection_ptr->size() << " submaps at delta "
+                  << sequence_number << ".");
+  return true;
+}
+
 void TsdfSubmapServer::visualizeSubMapBaseframes() const {
   // Get poses
   TransformationVector submap_poses;
@@ -370,11 +1024,31 @@ void TsdfSubmapServer::visualizeTrajectory() const {
 }
 
 bool TsdfSubmapServer::saveMap(const std::string& file_path) {
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  if (use_incremental_map_saves_) {
+    // Checkpoints are relative to the previous save to the same file
+    if (!map_checkpointer_ || map_checkpointer_->getFilePath() != file_path) {
+      map_checkpointer_.reset(new io::SubmapCollectionCheckpointer<TsdfSubmap>(
+          file_path, std::max(checkpoint_max_file_size_ratio_, 1.0)));
+    }
+    return map_checkpointer_->checkpoint(*tsdf_submap_collection_ptr_);
+  }
   return cblox::io::SaveTsdfSubmapCollection(*tsdf_submap_collection_ptr_,
                                              file_path);
 }
 bool TsdfSubmapServer::loadMap(const std::string& file_path) {
-  bool success = io::LoadSubmapCollection<TsdfSubmap>(
+  std::lock_guard<std::mutex> map_lock(map_mutex_);
+  // The loaded map replaces the current one. Its submap IDs (and stamps) may
+  // repeat those of the current map, so the cached meshes and the revisited
+  // submaps are dropped along with it.
+  map_checkpointer_.reset();
+  tsdf_submap_collection_ptr_->clear();
+  tsdf_submap_collection_integrator_ptr_->releaseRevisitSubmaps();
+  submap_mesher_ptr_->clearMeshCache();
+  active_submap_visualizer_ptr_->reset();
+  // NOTE: Only the index is read here, the submaps are read from the file as
+  //       they are accessed. Checkpoint files are replayed.
+  bool success = io::LoadSubmapCollectionLazily<TsdfSubmap>(
       file_path, &tsdf_submap_collection_ptr_);
   if (success) {
     ROS_INFO("Successfully loaded TSDFSubmapCollection.");
@@ -383,6 +1057,14 @@ bool TsdfSubmapServer::loadMap(const std::string& file_path) {
       ROS_INFO("Publishing loaded map's mesh.");
       visualizeWholeMap();
     }
+  } else {
+    ROS_ERROR_STREAM("Could not load the map from: " << file_path);
+  }
+  // Targeting the integrator and the active submap mesher at the (last
+  // loaded) active submap. Without one, the next pointcloud starts a new map.
+  if (mapIntialized()) {
+    tsdf_submap_collection_integrator_ptr_->switchToActiveSubmap();
+    active_submap_visualizer_ptr_->switchToActiveSubmap();
   }
   return success;
 }